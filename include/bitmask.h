@@ -0,0 +1,57 @@
+#ifndef bitmask_h_
+#define bitmask_h_
+
+/*	bitmask.h
+ * Compare and merge Bytes under a mask covering all of them,
+ * for fields with a 'bitmask' (see field.h) matched against or written
+ * with a value (see op_new()).
+ *
+ * The value is always stored already masked, so that:
+ * - a field matches when ((field & mask) ^ value) is all zero;
+ * - a write is (field & ~mask) | value.
+ *
+ * Both are done 16 or 32 Bytes at a time with SSE2/AVX2 compares
+ * (whichever the CPU supports, like ones_sum() in checksums.c),
+ * and 8 Bytes at a time below that.
+ *
+ * (c) 2019 Sirio Balmelli
+ */
+
+#include <xdpacket.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <nonlibc.h>
+
+
+bool		bitmask_differ	(const uint8_t *p,
+				const uint8_t *value,
+				const uint8_t *mask,
+				size_t len);
+
+void		bitmask_merge	(uint8_t *p,
+				const uint8_t *value,
+				const uint8_t *mask,
+				size_t len);
+
+
+/* Implementations, all giving the same result.
+ * Exposed for testing: the functions above use the widest the CPU supports.
+ */
+bool		bitmask_differ_scalar(const uint8_t *p, const uint8_t *value,
+				const uint8_t *mask, size_t len);
+void		bitmask_merge_scalar(uint8_t *p, const uint8_t *value,
+				const uint8_t *mask, size_t len);
+#if defined(__x86_64__) || defined(__i386__)
+bool		bitmask_differ_sse2(const uint8_t *p, const uint8_t *value,
+				const uint8_t *mask, size_t len);
+void		bitmask_merge_sse2(uint8_t *p, const uint8_t *value,
+				const uint8_t *mask, size_t len);
+bool		bitmask_differ_avx2(const uint8_t *p, const uint8_t *value,
+				const uint8_t *mask, size_t len);
+void		bitmask_merge_avx2(uint8_t *p, const uint8_t *value,
+				const uint8_t *mask, size_t len);
+#endif
+
+
+#endif /* bitmask_h_ */
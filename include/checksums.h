@@ -13,6 +13,8 @@
 
 #include <ndebug.h>
 #include <nonlibc.h>
+#include <stdint.h>
+#include <stddef.h>
 
 
 enum checksum_err {
@@ -25,6 +27,61 @@ enum checksum_err {
 const char *checksum_strerr(enum checksum_err error);
 
 enum checksum_err checksum(void *frame, size_t len);
+enum checksum_err checksum_update(void *frame, size_t len);
+
+
+/* Ones-complement sum implementations, all giving the same ones_final().
+ * Exposed for testing: checksum() uses the widest the CPU supports.
+ */
+uint32_t	ones_sum_scalar	(const void *blocks, size_t byte_count, uint32_t sum);
+uint32_t	ones_sum_u64	(const void *blocks, size_t byte_count, uint32_t sum);
+#if defined(__x86_64__) || defined(__i386__)
+uint32_t	ones_sum_sse2	(const void *blocks, size_t byte_count, uint32_t sum);
+uint32_t	ones_sum_avx2	(const void *blocks, size_t byte_count, uint32_t sum);
+#endif
+uint16_t	ones_final	(uint32_t sum);
+
+
+/*	checksum_log
+ * Per-thread journal of the 16-bit words of a frame changed by op_write(),
+ * so that checksum_update() can patch checksums incrementally (RFC 1624)
+ * instead of recomputing them over the whole frame.
+ * Reset by process_exec() before writing to each packet.
+ * @cnt		: entries used in 'words';
+ *		  > CHECKSUM_LOG_MAX means too many changes were made to journal.
+ * @partial	: the frame was received with its L4 checksum not yet computed
+ *		  (CHECKSUM_PARTIAL, as on veth): it must be computed in full.
+ *		  Set by the receive path for each frame, see checksum_log_rx().
+ * @words	: frame offset (always even) of a word, its old and new value
+ */
+#define CHECKSUM_LOG_MAX 32
+
+struct checksum_word {
+	uint16_t	offt;
+	uint16_t	old;
+	uint16_t	new;
+};
+
+struct checksum_log {
+	size_t			cnt;
+	bool			partial;
+	struct checksum_word	words[CHECKSUM_LOG_MAX];
+};
+
+extern __thread struct checksum_log checksum_log;
+
+NLC_INLINE void checksum_log_reset()
+{
+	checksum_log.cnt = 0;
+}
+
+NLC_INLINE void checksum_log_rx(bool partial)
+{
+	checksum_log.partial = partial;
+}
+
+size_t	checksum_log_old	(const void *frame, size_t len, size_t offt, size_t n);
+void	checksum_log_new	(const void *frame, size_t len, size_t first);
 
 
 #endif /* checksums_h_ */
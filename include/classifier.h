@@ -0,0 +1,144 @@
+#ifndef classifier_h_
+#define classifier_h_
+
+/*	classifier.h
+ * Tuple-space search classifier over the rules of a process.
+ *
+ * Rules are grouped into "tuples" by the set of packet fields they compare
+ * against constant values (their exact-match 'field_set's).
+ * Each tuple is a hash table keyed on the combined FNV hash of those fields
+ * (see field_hash()), so that classifying a packet costs one hash and one
+ * lookup per tuple instead of one op_match() per op per rule.
+ * Candidates found in a table are always verified by running all their
+ * match ops, which both resolves hash collisions and checks any ops
+ * which could not be hashed (state memrefs, field-to-field comparisons).
+ *
+ * Rules whose match ops include a range comparison (see op_range_new())
+ * are further grouped by the field of their first one: within each bucket
+ * of such a tuple, an interval index (sorted disjoint segments of packet
+ * values, each listing the candidates whose range covers it) yields only
+ * the candidates whose range contains the packet's value, in one binary search.
+ * Nested or overlapping ranges repeat candidates over many segments
+ * (quadratically in the worst case): an index holds at most
+ * CLASSIFIER_SEG_FACTOR entries per candidate of its bucket, past which
+ * the bucket is instead one segment holding all its candidates,
+ * each verified in turn as in a bucket without an index.
+ * Building an index costs O(n log n) plus the entries it holds.
+ *
+ * Rule priority (order in the process) is preserved:
+ * the highest-priority matching rule is always the one returned.
+ *
+ * (c) 2018 Sirio Balmelli
+ */
+
+#include <judyutils.h>
+#include <field.h>
+#include <rout.h>
+
+
+/*	classifier_slot
+ * A bucket in the (open-addressing) hash table of a tuple.
+ * @hash	: combined hash of the values of all rules in bucket
+ * @first	: index in 'cands' of the first (highest-priority) rule in bucket
+ * @cnt		: number of rules in bucket, in priority order; 0 == empty slot
+ */
+struct classifier_slot {
+	uint64_t		hash;
+	uint32_t		first;
+	uint32_t		cnt;
+};
+
+
+/*	classifier_seg
+ * A segment of an interval index: packet values from 'lo' up to
+ * the 'lo' of the next segment are in the ranges of 'cnt' candidates
+ * starting at index 'first' in 'cands', in priority order.
+ */
+struct classifier_seg {
+	uint64_t		lo;
+	uint32_t		first;
+	uint32_t		cnt;
+};
+
+
+/*	classifier_cand
+ * A candidate rule, as found in a bucket.
+ * @fields	: packet fields its match ops read (bitmap of 'classifier.fields')
+ */
+struct classifier_cand {
+	uint64_t		prio;
+	struct rout_set		*rst;
+	uint32_t		fields;
+};
+
+
+/*	classifier_tuple
+ * All rules matching the same packet fields against constant values.
+ * @prio	: priority of the highest-priority (first) rule in tuple
+ * @set_first	: index in 'sets' of the first hashed field
+ * @set_cnt	: number of hashed fields
+ * @slot_first	: index in 'slots' of the tuple's hash table
+ * @slot_mask	: hash table size - 1 (size is a power of 2)
+ * @fields	: hashed fields (bitmap of 'classifier.fields')
+ * @range	: field of the interval index; 0 'len' == no index,
+ *		  otherwise the 'first' and 'cnt' of a slot are those of
+ *		  its segments in 'segs'
+ */
+struct classifier_tuple {
+	uint64_t		prio;
+	uint32_t		set_first;
+	uint32_t		set_cnt;
+	uint32_t		slot_first;
+	uint32_t		slot_mask;
+	uint32_t		fields;
+	struct field_set	range;
+};
+
+
+/* Max distinct packet fields which can be tracked in a bitmap.
+ */
+#define CLASSIFIER_FIELD_MAX 32
+
+/* Max interval index entries (see above) per candidate in a bucket.
+ */
+#define CLASSIFIER_SEG_FACTOR 16
+
+
+/*	classifier
+ * Built from Judy arrays (see classifier.c), then flattened into
+ * contiguous arrays so the hot path does no pointer chasing.
+ * @tuples	: sorted by priority of the first rule in each tuple
+ * @sets	: hashed fields of all tuples
+ * @slots	: hash tables of all tuples
+ * @cands	: bucket (or segment) contents of all tuples
+ * @segs	: interval index segments of all tuples
+ * @pure	: the result of a lookup depends only on the bytes of 'fields'
+ *		  in the packet (no state is matched, no field is over-read),
+ *		  so that it may be cached (see flow.h)
+ * @field_cnt	: number of 'fields'
+ * @fields	: every distinct packet field read by any match op
+ */
+struct classifier {
+	size_t			tuple_cnt;
+	struct classifier_tuple	*tuples;
+	struct field_set	*sets;
+	struct classifier_slot	*slots;
+	struct classifier_cand	*cands;
+	struct classifier_seg	*segs;
+
+	bool			pure;
+	uint32_t		field_cnt;
+	struct field_set	fields[CLASSIFIER_FIELD_MAX];
+};
+
+
+void			classifier_free		(struct classifier *cls);
+struct classifier	*classifier_new		(Pvoid_t rout_set_JQ);
+
+struct rout_set		*classifier_lookup	(struct classifier *cls,
+						const void *pkt,
+						size_t plen,
+						uint32_t *fields);
+
+
+#endif /* classifier_h_ */
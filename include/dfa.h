@@ -0,0 +1,118 @@
+#ifndef dfa_h_
+#define dfa_h_
+
+/*	dfa.h
+ * A "dfa" is a regular expression compiled for matching anywhere inside
+ * a window of a packet (see op_regex_new()), in a single pass over
+ * its Bytes and without ever backtracking.
+ *
+ * The expression is parsed into a Thompson NFA, which is then turned into
+ * a DFA by subset construction: each DFA state is a set of NFA states
+ * and has one transition per Byte class (Bytes no part of the expression
+ * tells apart share a class), so scanning costs one table load per Byte.
+ *
+ * Subset construction may blow up: DFA states are built breadth first
+ * up to DFA_STATES_MAX, after which transitions to states not built
+ * are marked DFA_STATE_SPILL.
+ * A scan taking such a transition carries on from the NFA states of
+ * the DFA state it was in, computing each next set of NFA states on the
+ * fly (a lazy DFA without a cache: tables are shared read-only by all
+ * workers). This is slower, but still one pass with no backtracking.
+ *
+ * Supported syntax (POSIX ERE-like, on Bytes):
+ * - literals; '.' (any Byte); '[...]' and '[^...]' with ranges
+ * - escapes: '\xHH', '\n', '\r', '\t', '\d', '\w', '\s' (and negations
+ *   '\D', '\W', '\S'), '\' before any other character makes it literal
+ * - grouping '( )', alternation '|'
+ * - repetition '*', '+', '?', '{m}', '{m,}', '{m,n}'
+ * - '^' as the first and '$' as the last character anchor the expression
+ *   to the start and end of the window; elsewhere they are errors.
+ *
+ * (c) 2018 Sirio Balmelli
+ */
+
+#include <xdpacket.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <nonlibc.h>
+
+
+#define DFA_NFA_MAX		2048	/* NFA states */
+#define DFA_NFA_WORDS		(DFA_NFA_MAX / 64)
+#define DFA_STATES_MAX		4096	/* DFA states */
+#define DFA_REPEAT_MAX		255	/* largest 'm' or 'n' in '{m,n}' */
+
+#define DFA_STATE_DEAD		0	/* no match possible */
+#define DFA_STATE_START		1
+#define DFA_STATE_SPILL		(UINT16_MAX - 1) /* state not built */
+#define DFA_STATE_HIT		UINT16_MAX	/* match: stop scanning */
+
+NLC_ASSERT(dfa_states_check, DFA_STATES_MAX < DFA_STATE_SPILL);
+
+
+/*	dfa_nfa
+ * NFA state: @set is only used by DFA_NFA_BYTE states.
+ */
+enum dfa_nfa_type {
+	DFA_NFA_EPS = 0,	/* -> out */
+	DFA_NFA_SPLIT,		/* -> out, out1 */
+	DFA_NFA_BYTE,		/* -> out, if Byte is in 'set' */
+	DFA_NFA_MATCH
+};
+
+struct dfa_nfa {
+	uint8_t			type;
+	uint32_t		out;
+	uint32_t		out1;
+	uint64_t		set[4];
+};
+
+
+/*	dfa
+ * @pattern	: expression as given by the user, to emit it back
+ * @anchor_start: '^': the NFA isn't restarted at every Byte
+ * @anchor_end	: '$': only the state at the end of the window decides
+ * @always	: the expression matches an empty string anywhere
+ * @nfa_cnt	: number of NFA states
+ * @nfa		: NFA states; 'start' and 'match' are indices of the first and last
+ * @words	: uint64_t per set of NFA states
+ * @closure	: for each NFA state, the set of BYTE/MATCH states reached
+ *		  from it through EPS/SPLIT states
+ * @class_cnt	: number of Byte classes
+ * @classes	: class of each Byte
+ * @state_cnt	: number of DFA states built
+ * @delta	: 'state_cnt' rows of 'class_cnt' next states
+ * @accept	: DFA state holds 'match' (only with 'anchor_end')
+ * @sets	: set of NFA states of each DFA state
+ */
+struct dfa {
+	char			*pattern;
+	bool			anchor_start;
+	bool			anchor_end;
+	bool			always;
+
+	uint32_t		nfa_cnt;
+	struct dfa_nfa		*nfa;
+	uint32_t		start;
+	uint32_t		match;
+	uint32_t		words;
+	uint64_t		*closure;
+
+	uint32_t		class_cnt;
+	uint8_t			classes[256];
+	uint32_t		state_cnt;
+	uint16_t		*delta;
+	uint8_t			*accept;
+	uint64_t		*sets;
+};
+
+
+void		dfa_free	(struct dfa *dfa);
+struct dfa	*dfa_new	(const char *pattern);
+
+bool		dfa_match	(const struct dfa *dfa,
+				const uint8_t *p,
+				size_t len);
+
+
+#endif /* dfa_h_ */
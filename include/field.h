@@ -20,11 +20,45 @@
 #include <regex.h>
 
 
+/*	field_anchor
+ * What the 'offt' of a field counts from: the start of the packet,
+ * a header located in each packet by field_anchors_parse(),
+ * or an offset computed from the value of another field ('offt_from').
+ */
+#define FIELD_OFFT_BITS		26
+#define FIELD_OFFT_MAX		((1L << (FIELD_OFFT_BITS - 1)) - 1)
+#define FIELD_OFFT_MIN		(-(1L << (FIELD_OFFT_BITS - 1)))
+
+enum field_anchor {
+	FIELD_ANCHOR_PACKET = 0,
+	FIELD_ANCHOR_L3,	/* network header, past Ethernet and VLAN tags */
+	FIELD_ANCHOR_L4,	/* transport header, past IP options/extensions */
+	FIELD_ANCHOR_PAYLOAD,	/* past the TCP, UDP or ICMP header */
+	FIELD_ANCHOR_COMPUTED,	/* first of FIELD_COMPUTED_MAX computed anchors */
+	FIELD_ANCHOR_CNT = 1 << (32 - FIELD_OFFT_BITS)
+};
+
+#define FIELD_COMPUTED_MAX	(FIELD_ANCHOR_CNT - FIELD_ANCHOR_COMPUTED)
+
+extern const char *field_anchor_names[];
+
+NLC_INLINE const char *field_anchor_prn(enum field_anchor anchor)
+{
+	if (anchor > FIELD_ANCHOR_COMPUTED)
+		anchor = FIELD_ANCHOR_COMPUTED;
+	return field_anchor_names[anchor];
+}
+
+
 /*	field_set
  * The set of parameters defining the extent of a field.
  * NOTE: this is expressly a uint64_t/uintptr_t size and meant to be passed
  * by _value_ (copied, not referenced) see e.g. fval.h which uses this.
- * @offt	: offset into the packet where field matching should begin.
+ * @offt	: offset into the packet where field matching should begin,
+ *		  counted from 'anchor'.
+ *		  Negative offsets count from the end of the packet and are
+ *		  only valid for FIELD_ANCHOR_PACKET.
+ * @anchor	: enum field_anchor
  * @len		: how many bytes to match.
  * @mask	: mask to apply to last byte of match (0xff == entire last byte).
  * @flags	: opaque byte that can be used by others when handling copies
@@ -35,7 +69,8 @@
 struct field_set {
 union {
 struct {
-	int32_t			offt;
+	int32_t			offt:FIELD_OFFT_BITS;
+	uint32_t		anchor:(32 - FIELD_OFFT_BITS);
 	uint16_t		len;
 	uint8_t			mask;
 	uint8_t			flags; /* deprecate flags, turn this into leading and trailing masks */
@@ -45,30 +80,94 @@ struct {
 };
 
 NLC_ASSERT(field_set_size, sizeof(struct field_set) == sizeof(uint64_t));
+NLC_ASSERT(field_computed_max, FIELD_COMPUTED_MAX <= UINT8_MAX);
 
 NLC_INLINE void field_set_prn(struct field_set set)
 {
-	NB_inf("offt %d, len %u, mask 0x%x, flags 0x%x",
-		set.offt, set.len, set.mask, set.flags);
+	NB_inf("%s offt %d, len %u, mask 0x%x, flags 0x%x",
+		field_anchor_prn(set.anchor), set.offt, set.len, set.mask, set.flags);
 }
 
 
+/*	field_anchors
+ * Per-thread offsets of the headers of the packet being processed,
+ * and of the anchors computed from its Bytes ('offt_from'),
+ * found once per packet by field_anchors_parse() (see process_exec())
+ * so that anchored fields resolve with a single add.
+ * Headers a packet doesn't have are at FIELD_ANCHOR_ABSENT, as is every
+ * anchor before a thread's first packet (see field_anchors_reset()),
+ * which no bounds check lets through.
+ * NOTE: offsets are those of the packet as received: writes which move
+ * headers (e.g. to the IPv4 header length) don't move anchors.
+ */
+#define FIELD_ANCHOR_ABSENT	(UINT32_MAX >> 1)
+
+NLC_ASSERT(field_anchor_absent, FIELD_ANCHOR_ABSENT > UINT16_MAX + FIELD_OFFT_MAX);
+
+struct field_anchors {
+	uint32_t		offt[FIELD_ANCHOR_CNT];
+};
+
+extern __thread struct field_anchors field_anchors;
+
+void		field_anchors_reset	();
+void		field_anchors_parse	(const void *pkt, size_t plen);
+
+
+/*	field_offt()
+ * Offset of 'set' from the start of a packet of 'plen' Bytes.
+ * Negative offsets past the start of the packet, and anchors missing
+ * from the packet, yield a huge value which any bounds check will reject.
+ */
+NLC_INLINE size_t field_offt(struct field_set set, size_t plen)
+{
+	if (set.offt < 0)
+		return plen + set.offt;
+	return (size_t)field_anchors.offt[set.anchor] + (size_t)set.offt;
+}
+
+
+/*	field_from
+ * User-supplied 'offt_from': the anchor of a field is computed in each
+ * packet as ((value of 'field' >> shift) * mult) + add,
+ * counted from the anchor of 'field' itself.
+ * E.g. the IPv4 header length in 32-bit words, times 4, plus 14
+ * (Ethernet header) is the start of L4.
+ * @field	: name of a field of 1 to 4 Bytes, read as a big-endian integer
+ *		  (with its mask applied)
+ */
+struct field_from {
+	const char		*field;
+	long			shift;
+	long			mult;
+	long			add;
+};
+
+
 /*	field
  * User-supplied parameters describing a field.
+ * @from	: field whose value gives the (computed) 'set.anchor'
+ * @bitmask	: mask over all 'set.len' Bytes (see bitmask.h),
+ *		  NULL if only the last Byte is masked (by 'set.mask')
  */
 struct field {
 	char			*name;
 	struct field_set	set;
 	uint32_t		refcnt;
+	struct field		*from;
+	uint8_t			*bitmask;
 };
 
 
 void		field_free	(void *arg);
 void		field_free_all	();
 struct field	*field_new	(const char *name,
+				enum field_anchor anchor,
 				long offt,
 				long len,
-				long mask);
+				long mask,
+				const char *bitmask,
+				const struct field_from *from);
 
 void		field_release	(struct field *field);
 struct field	*field_get	(const char *field_name);
@@ -106,20 +205,12 @@ int		field_emit_all	(yaml_document_t *outdoc,
 	if NLC_UNLIKELY(!pkt || !plen)						\
 		return 1;							\
 										\
-	/* Offset sanity.							\
-	 * 'offt' may be negative, in which case it denotes offset from		\
-	 * the end of the packet.						\
-	 */									\
-	__typeof__(pkt) start = pkt + set.offt;					\
-	if (set.offt < 0)							\
-		start += plen;							\
-	if (start < pkt)							\
-		return 1;							\
-										\
-	/* Size sanity. */							\
+	/* Offset and size sanity: see field_offt() */				\
 	size_t flen = set.len;							\
-	if ((start + flen) > (pkt + plen))					\
-		return 1;
+	size_t offt__ = field_offt(set, plen);					\
+	if (offt__ > plen || flen > plen - offt__)				\
+		return 1;							\
+	__typeof__(pkt) start = pkt + offt__;
 
 /* Common code for calculating a packet hash given a field_set and some memory.
  * Expects to see the following variables:
@@ -0,0 +1,88 @@
+#ifndef flow_h_
+#define flow_h_
+
+/*	flow.h
+ * Per-thread flow cache in front of the classifier of a process.
+ *
+ * Two tiers, both direct-mapped tables of "packet key -> rout_set":
+ * - microflow: keyed on every packet field any match op of the process reads,
+ *   so a hit costs building and comparing one key.
+ * - megaflow: keyed only on the fields the classifier actually read to
+ *   decide a packet (see classifier_lookup()), so a single entry covers
+ *   all packets which differ in fields irrelevant to the result.
+ *   The distinct field bitmaps seen ("masks") are tried in turn.
+ * Negative results (no rule matched) are cached as well.
+ *
+ * A key holds, for each field in its bitmap, one byte telling whether
+ * the field is inside the packet, followed by the field bytes
+ * (last byte masked) if it is.
+ *
+ * Caching is only valid if the classifier is pure (see classifier.h).
+ * A cache belongs to a single classifier, and is freed along with
+ * the process which owns both.
+ * The only thing a pure classifier reads besides the packet are sets,
+ * whose values may change (see set.h): a cache is emptied whenever
+ * 'set_generation' differs from the one it was filled under.
+ *
+ * (c) 2018 Sirio Balmelli
+ */
+
+#include <classifier.h>
+#include <set.h>
+
+
+#define FLOW_KEY_MAX	64	/* largest key (all fields of a process) cached */
+#define FLOW_MICRO_CNT	512	/* power of 2 */
+#define FLOW_MEGA_CNT	512	/* power of 2 */
+#define FLOW_MASK_MAX	8
+
+
+/*	flow_entry
+ * @hash	: hash of 'fields' and 'key'; 0 == empty entry
+ * @rst		: result of lookup; NULL == no rule matched
+ * @fields	: field bitmap 'key' is made of
+ * @len		: length of 'key'
+ */
+struct flow_entry {
+	uint64_t		hash;
+	struct rout_set		*rst;
+	uint32_t		fields;
+	uint32_t		len;
+	uint8_t			key[FLOW_KEY_MAX];
+};
+
+
+/*	flow_cache
+ * @cls		: classifier being cached
+ * @all		: bitmap of all fields in 'cls'
+ * @masks	: distinct megaflow field bitmaps, replaced round-robin
+ * @set_gen	: 'set_generation' entries were cached under
+ */
+struct flow_cache {
+	struct classifier	*cls;
+	uint32_t		all;
+	uint32_t		set_gen;
+	uint32_t		mask_cnt;
+	uint32_t		mask_next;
+	uint32_t		masks[FLOW_MASK_MAX];
+
+	size_t			hit_micro;
+	size_t			hit_mega;
+	size_t			miss;
+
+	struct flow_entry	micro[FLOW_MICRO_CNT];
+	struct flow_entry	mega[FLOW_MEGA_CNT];
+};
+
+
+bool			flow_cacheable		(const struct classifier *cls);
+
+void			flow_cache_free		(struct flow_cache *fc);
+struct flow_cache	*flow_cache_new		(struct classifier *cls);
+
+struct rout_set		*flow_lookup		(struct flow_cache *fc,
+						const void *pkt,
+						size_t plen);
+
+
+#endif /* flow_h_ */
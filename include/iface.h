@@ -12,9 +12,11 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <netinet/in.h> /* sockaddr_in */
+#include <pthread.h>
 #include <epoll_track.h>
 #include <parse2.h>
 #include <rule.h>
+#include <xsk.h>
 
 
 /*	iface_handler_t
@@ -29,12 +31,137 @@
 typedef void (*iface_handler_t)(void *context, void *pkt, size_t len);
 
 
+/*	iface_io
+ * How packets are moved between the kernel and xdpacket.
+ * @IFACE_IO_SOCKET	: one syscall (and one copy) per packet
+ * @IFACE_IO_RING	: PACKET_MMAP ring shared with the kernel, no copies
+ * @IFACE_IO_MMSG	: one recvmmsg()/sendmmsg() per batch of packets,
+ *			  for when rings are not usable
+ * @IFACE_IO_XDP	: AF_XDP socket, packets used in-place in a UMEM
+ *			  shared by all XDP ifaces
+ */
+enum iface_io {
+	IFACE_IO_SOCKET = 0,
+	IFACE_IO_RING,
+	IFACE_IO_MMSG,
+	IFACE_IO_XDP,
+	IFACE_IO_INVALID
+};
+
+extern const char *iface_ios[];
+
+NLC_INLINE const char *iface_io_prn(enum iface_io io)
+{
+	return iface_ios[io];
+}
+
+enum iface_io	iface_io_parse	(const char *txt);
+
+
+/* TPACKET_V3 ring geometry.
+ * A block must hold at least one full-MTU frame (including jumbo frames).
+ * The kernel hands an rx block to userland when it is full or when
+ * IFACE_RING_TIMEOUT_MS expire, whichever comes first: this bounds latency
+ * when traffic is sparse.
+ * tx frames are fixed-size slots, sized up from IFACE_RING_FRAME_SZ
+ * to fit the interface MTU.
+ */
+#define IFACE_RING_BLOCK_SZ	((unsigned int)1 << 18)
+#define IFACE_RING_BLOCK_CNT	64
+#define IFACE_RING_TX_BLOCK_CNT	16
+#define IFACE_RING_FRAME_SZ	((unsigned int)1 << 11)
+#define IFACE_RING_TIMEOUT_MS	2
+
+/* Max packets per recvmmsg()/sendmmsg() call.
+ * Each slot is a buffer big enough for a full-MTU Ethernet frame.
+ */
+#define IFACE_MMSG_BATCH	64
+
+/*	iface_fanout
+ * How packets are spread across the worker sockets of an iface
+ * (see PACKET_FANOUT in packet(7)).
+ * @IFACE_FANOUT_HASH	: by flow hash: packets of a flow stay on one worker
+ * @IFACE_FANOUT_CPU	: by the CPU the packet arrived on
+ * @IFACE_FANOUT_QM	: by the NIC queue the packet arrived on
+ */
+enum iface_fanout {
+	IFACE_FANOUT_HASH = 0,
+	IFACE_FANOUT_CPU,
+	IFACE_FANOUT_QM,
+	IFACE_FANOUT_INVALID
+};
+
+extern const char *iface_fanouts[];
+
+NLC_INLINE const char *iface_fanout_prn(enum iface_fanout fanout)
+{
+	return iface_fanouts[fanout];
+}
+
+enum iface_fanout	iface_fanout_parse	(const char *txt);
+
+
+/* Max worker threads in the whole program.
+ * An idle or fenced worker checks every IFACE_WORKER_POLL_MS whether it should exit.
+ */
+#define IFACE_WORKER_MAX	64
+#define IFACE_WORKER_SLOTS	(IFACE_WORKER_MAX + 1) /* see iface_worker_slot() */
+#define IFACE_WORKER_POLL_MS	100
+
+
+/* Default max packets handled per epoll wakeup of an iface,
+ * before yielding to other ifaces and the control parser.
+ */
+#define IFACE_BUDGET_DEFAULT	64
+
+
+/* Epoll timeout while frames staged on a tx ring wait for the kernel
+ * to accept a kick (see iface_tx_retry()).
+ */
+#define IFACE_TX_RETRY_MS	1
+
+
+/*	iface_wcount
+ * Counters written by a single worker thread,
+ * on a cache line of their own so workers never contend.
+ */
+struct iface_wcount {
+	size_t		out;
+	size_t		drop;
+	size_t		checkfail;
+} __attribute__((aligned(NLC_CACHE_LINE)));
+
+
 /*	iface
  * all parameters for an 'if' or 'iface' element in the grammar
  *
- * @pkin	: queue of packets to be output
- * @msg		: pipe containing control messages
  * @fd		: raw socket
+ * @budget	: max packets received per epoll wakeup
+ * @count_exhausted	: wakeups which ended with 'budget' exhausted
+ * @count_empty	: wakeups which ended with the receive queue empty
+ * @rx_io	: how packets are received
+ * @tx_io	: how packets are sent
+ * @ring	: single mmap() of the rx ring followed by the tx ring
+ * @rx_block	: index of next block in 'rx_ring' to be handed to us
+ * @rx_pkt	: index of next packet in 'rx_block'
+ * @rx_offt	: offset of next packet from start of 'rx_block'
+ * @tx_frame	: index of next slot in 'tx_ring' to be filled
+ * @tx_pending	: frames staged in 'tx_ring', 'tx_msgs' or 'xsk' since the last kick
+ * @tx_next	: next iface in the list of ifaces needing a kick
+ * @mmsg_slot_sz	: size of each buffer in 'rx_bufs' and 'tx_bufs'
+ * @xsk		: AF_XDP socket; with 'rx: xdp' packets are received here, not on 'fd'
+ * @fanout	: how packets are spread across 'workers'
+ * @fanout_id	: PACKET_FANOUT group id, assigned by the kernel
+ * @worker_cnt	: number of worker threads; 0 means 'fd' is serviced by main()
+ * @workers	: worker sockets, each in the PACKET_FANOUT group of this iface
+ * @wcount	: per-worker-thread counts of packets output on this iface
+ *		  by workers of other ifaces
+ * @parent	: (worker socket only) iface this is a worker of
+ * @worker_id	: (worker socket only) program-wide index of the worker thread
+ * @cpu		: (worker socket only) CPU the worker thread is pinned to
+ * @xfd		: (worker socket only) socket for output to other ifaces
+ * @stop	: (worker socket only) set to make the worker thread exit
+ * @wtk		: (worker socket only) epoll loop of the worker thread
  * @ip_prn	: IP address as a string
  * @JS_mch_out	: output matchers in alphabetical order
  * @JS_mch_in	: input matchers in alphabetical order
@@ -42,7 +169,7 @@ typedef void (*iface_handler_t)(void *context, void *pkt, size_t len);
 struct iface {
 	/* first cache line: runtime (packet-handling-time) parameters */
 	int		fd;
-	int		pad;
+	unsigned int	budget;
 
 	int		ifindex;
 	int		mtu;
@@ -54,20 +181,85 @@ struct iface {
 	size_t		count_out;
 	size_t		count_checkfail;
 	size_t		count_sockdrop;
+	size_t		count_exhausted;
+	size_t		count_empty;
 
 	struct sockaddr		*hwaddr;
 	struct sockaddr_in	*addr;
 
+	/* rings: only touched when (rx_io or tx_io == IFACE_IO_RING) */
+	enum iface_io	rx_io;
+	enum iface_io	tx_io;
+	uint8_t		*ring;
+	size_t		ring_len;
+
+	uint8_t		*rx_ring;
+	unsigned int	rx_block;
+	uint32_t	rx_pkt;
+	uint32_t	rx_offt;
+
+	unsigned int	tx_frame;
+	uint8_t		*tx_ring;
+	unsigned int	tx_frame_sz;
+	unsigned int	tx_frame_cnt;
+	unsigned int	tx_pending;
+	struct iface	*tx_next;
+
+	/* batched syscalls: only touched when (rx_io or tx_io == IFACE_IO_MMSG) */
+	unsigned int		mmsg_slot_sz;
+	struct mmsghdr		*rx_msgs;
+	struct iovec		*rx_iovs;
+	struct sockaddr_ll	*rx_addrs;
+	uint8_t			*rx_ctrls;
+	uint8_t			*rx_bufs;
+	struct mmsghdr		*tx_msgs;
+	struct iovec		*tx_iovs;
+	uint8_t			*tx_bufs;
+
+	/* AF_XDP: only when (rx_io or tx_io == IFACE_IO_XDP) */
+	struct xsk	*xsk;
+
+	/* worker threads: only when (worker_cnt > 0) */
+	enum iface_fanout	fanout;
+	unsigned int		fanout_id;
+	unsigned int		worker_cnt;
+	struct iface		**workers;
+	struct iface_wcount	*wcount;
+
+	struct iface		*parent;
+	unsigned int		worker_id;
+	int			cpu;
+	int			xfd;
+	bool			stop;
+	pthread_t		thread;
+	struct epoll_track	*wtk;
+
 	/* second cache line: metadata nonessentials */
 	char		*name;
 	char		*ip_prn;
 	uint32_t	refcnt;
 };
 
+/*	iface_rx_fd()
+ * The fd which becomes readable when packets arrive.
+ */
+NLC_INLINE int iface_rx_fd(struct iface *iface)
+{
+	if (iface->rx_io == IFACE_IO_XDP)
+		return iface->xsk->fd;
+	return iface->fd;
+}
+
 
 void		iface_free	(void *arg);
 void		iface_free_all	();
-struct iface	*iface_new	(const char *name);
+struct iface	*iface_new	(const char *name,
+				enum iface_io rx_io,
+				enum iface_io tx_io,
+				long budget,
+				enum iface_fanout fanout,
+				const int *cpus,
+				unsigned int worker_cnt);
 
 void		iface_release	(struct iface *iface);
 struct iface	*iface_get	(const char *name);
@@ -75,6 +267,7 @@ struct iface	*iface_get	(const char *name);
 int		iface_callback	(int fd,
 				uint32_t events,
 				void *context);
+int		iface_tx_retry	(int timeout);
 
 int	iface_handler_register	(struct iface *iface,
 				iface_handler_t handler,
@@ -86,7 +279,13 @@ int	iface_handler_clear	(struct iface *iface,
 
 int	iface_output		(struct iface *iface,
 				void *pkt,
-				size_t plen);
+				size_t plen,
+				bool checksum);
+
+unsigned int	iface_worker_slot	();
+
+void	iface_fence		();
+void	iface_unfence		();
 
 
 /* integrate into parse2.h
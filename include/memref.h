@@ -6,6 +6,10 @@
  * A chunk of allocated memory with relevant metadata.
  * This may be mutable globaly referenced memory (aka "state")
  * or may be a literal value for use in comparing or writing into packets.
+ *
+ * A "scratch" memref has no memory of its own: it names a register
+ * in the per-packet register file (see rout_set_exec()),
+ * at offset 'set.offt', which exists only while a rule's writes execute.
  */
 
 #include <stdint.h>
@@ -14,11 +18,15 @@
 
 
 #define MEMREF_FLAG_STATIC	0x1  /* use memory->set.flags to track memory type */
+#define MEMREF_FLAG_SCRATCH	0x2
+
+#define MEMREF_SCRATCH_LEN	256  /* size of the per-packet register file */
+#define MEMREF_SCRATCH_ALIGN	8    /* each register starts on a multiple */
 
 
 struct memref {
 union {
-struct {	/* variable global state */
+struct {	/* variable global state; scratch register */
 	char			*name;
 	uint32_t		refcnt;
 };
@@ -41,10 +49,16 @@ NLC_INLINE bool memref_is_value(struct memref *ref)
 	return (ref->set.flags & MEMREF_FLAG_STATIC);
 }
 
+NLC_INLINE bool memref_is_scratch(struct memref *ref)
+{
+	return (ref->set.flags & MEMREF_FLAG_SCRATCH);
+}
+
 void memref_release(void *arg);
 
 struct memref *memref_value_new(const struct field *field, const char *value);
 struct memref *memref_state_get(const struct field *field, const char *state_name);
+struct memref *memref_scratch_get(const struct field *field, const char *scratch_name);
 
 int memref_emit (struct memref *ref, yaml_document_t *outdoc, int outmapping);
 
@@ -9,8 +9,65 @@
  */
 
 #include <field.h>
+#include <string.h>
 #include <yamlutils.h>
 #include <memref.h>
+#include <table.h>
+#include <set.h>
+#include <search.h>
+#include <dfa.h>
+#include <bitmask.h>
+
+
+/*	op_kernel
+ * Which specialized match/write kernel handles an op_set, chosen by op_new().
+ * Common field widths are matched and written with single unaligned
+ * loads/stores instead of memcmp()/memcpy();
+ * OP_KERNEL_MASKED is set when either last-byte mask is not 0xff.
+ * OP_KERNEL_TABLE and OP_KERNEL_SET mark a lookup of 'set_to' in the
+ * table or set 'from' points to (see op_table_new(), op_member_new()).
+ * OP_KERNEL_RANGE marks a comparison of 'set_to' against the bounds
+ * held in 'to' and 'from' (see op_range_new()).
+ * OP_KERNEL_CONTAINS marks a search of the window 'set_to' for the patterns
+ * of the search 'from' points to (see op_search_new());
+ * OP_KERNEL_REGEX for the expression of the dfa 'from' points to
+ * (see op_regex_new()).
+ * OP_KERNEL_BITMASK marks a field with a 'bitmask' matched against or
+ * written with the value 'from' points to, which the bitmask follows
+ * (see memref_value_new()).
+ * Stored in 'set_to.flags' of an op_set, so as not to grow 'struct op'.
+ */
+enum op_kernel {
+	OP_KERNEL_GENERIC = 0,
+	OP_KERNEL_1,
+	OP_KERNEL_2,
+	OP_KERNEL_4,
+	OP_KERNEL_6,
+	OP_KERNEL_8,
+	OP_KERNEL_16,
+	OP_KERNEL_TABLE = 0x40,
+	OP_KERNEL_SET,
+	OP_KERNEL_RANGE,
+	OP_KERNEL_CONTAINS,
+	OP_KERNEL_REGEX,
+	OP_KERNEL_BITMASK,
+	OP_KERNEL_MASKED = 0x80
+};
+
+
+/*	op_flag
+ * Stored in 'set_from.flags' of an op_set.
+ * OP_SCRATCH_*: that side is a scratch register (see memref.h),
+ *		 'to' or 'from' then hold an offset into the register file
+ *		 instead of a pointer.
+ * OP_SWAP	: exchange the two packet fields 'set_to' and 'set_from'
+ *		  (see op_swap_new()).
+ */
+enum op_flag {
+	OP_SCRATCH_TO	= 0x1,
+	OP_SCRATCH_FROM	= 0x2,
+	OP_SWAP		= 0x4
+};
 
 
 /*	struct op_set
@@ -29,8 +86,67 @@ struct op_set {
 int op_match(struct op_set *op, const void *pkt, size_t plen);
 /**
  * return 0 if 'op' could be applied (written) to 'pkt'
+ * 'scratch' is the register file, MEMREF_SCRATCH_LEN Bytes
+ */
+int op_write(struct op_set *op, void *pkt, size_t plen, uint8_t *scratch);
+
+/**
+ * As op_match() and op_write(), skipping packet bounds checks where they can:
+ * only valid when op_bound() gave '*checked' false and 'plen' is at least
+ * its '*min_plen'.
  */
-int op_write(struct op_set *op, void *pkt, size_t plen);
+int op_match_unchecked(struct op_set *op, const void *pkt, size_t plen);
+int op_write_unchecked(struct op_set *op, void *pkt, size_t plen, uint8_t *scratch);
+
+void op_bound(const struct op_set *op, size_t *min_plen, bool *checked);
+void op_kernel_select(struct op_set *set);
+
+
+/* Width-specialized kernels.
+ * A field of width 'w' is handled as an unmasked 'head' followed by a 'tail'
+ * whose last byte is masked, each being a single 1, 2, 4 or 8 Byte load/store:
+ *
+ *	w	head	tail
+ *	1	0	1
+ *	2	0	2
+ *	4	0	4
+ *	6	4	2
+ *	8	0	8
+ *	16	8	8
+ *
+ * 'w' and 'masked' are always constants, so the compiler reduces each
+ * kernel (see operations.c and program.c) to a handful of instructions.
+ */
+#define OP_TAIL(w) ((w) > 8 ? 8 : (w) == 6 ? 2 : (w))
+
+/*	op_ld()
+ * Unaligned load of 'n' (1, 2, 4 or 8) Bytes.
+ */
+NLC_INLINE uint64_t op_ld(const uint8_t *p, size_t n)
+{
+	uint64_t v = 0;
+	memcpy(&v, p, n);
+	return v;
+}
+
+/*	op_st()
+ * Unaligned store of 'n' (1, 2, 4 or 8) Bytes.
+ */
+NLC_INLINE void op_st(uint8_t *p, uint64_t v, size_t n)
+{
+	memcpy(p, &v, n);
+}
+
+/*	op_tail_mask()
+ * Mask for a value loaded by op_ld() of 'n' Bytes, where the last Byte
+ * in memory is masked by 'mask': independent of endianness.
+ */
+NLC_INLINE uint64_t op_tail_mask(uint8_t mask, size_t n)
+{
+	uint64_t m = -1;
+	((uint8_t *)&m)[n-1] = mask;
+	return m;
+}
 
 
 /*	struct op
@@ -49,12 +165,100 @@ NLC_ASSERT(struct_op_size, sizeof(struct op) <= NLC_CACHE_LINE);
 
 void		op_free		(void *arg);
 
+NLC_INLINE struct table *op_table(const struct op *op)
+{
+	return op->set.set_to.flags == OP_KERNEL_TABLE ? op->set.from : NULL;
+}
+
+NLC_INLINE struct set *op_member(const struct op *op)
+{
+	return op->set.set_to.flags == OP_KERNEL_SET ? op->set.from : NULL;
+}
+
+NLC_INLINE struct search *op_search(const struct op *op)
+{
+	return op->set.set_to.flags == OP_KERNEL_CONTAINS ? op->set.from : NULL;
+}
+
+NLC_INLINE struct dfa *op_regex(const struct op *op)
+{
+	return op->set.set_to.flags == OP_KERNEL_REGEX ? op->set.from : NULL;
+}
+
+/*	op_is_window()
+ * Contains and regex ops scan a window of the packet,
+ * which the end of the packet may cut short (see op_pkt_window()).
+ */
+NLC_INLINE bool op_is_window(const struct op *op)
+{
+	return op->set.set_to.flags == OP_KERNEL_CONTAINS
+		|| op->set.set_to.flags == OP_KERNEL_REGEX;
+}
+
+/*	op_is_lookup()
+ * Table, set, range, contains and regex ops only read their packet
+ * field 'set_to': 'to' and 'from' are not memory to compare against.
+ */
+NLC_INLINE bool op_is_lookup(const struct op *op)
+{
+	return op->set.set_to.flags == OP_KERNEL_TABLE
+		|| op->set.set_to.flags == OP_KERNEL_SET
+		|| op->set.set_to.flags == OP_KERNEL_RANGE
+		|| op_is_window(op);
+}
+
+/*	op_range()
+ * If 'op' is a range comparison, get its inclusive bounds and return true.
+ */
+NLC_INLINE bool op_range(const struct op *op, uint64_t *lo, uint64_t *hi)
+{
+	if (op->set.set_to.flags != OP_KERNEL_RANGE)
+		return false;
+	*lo = (uintptr_t)op->set.to;
+	*hi = (uintptr_t)op->set.from;
+	return true;
+}
+
+/*	op_range_value()
+ * The big-endian unsigned integer of 'len' (at most 8) Bytes at 'p',
+ * last Byte masked by 'mask'.
+ */
+NLC_INLINE uint64_t op_range_value(const uint8_t *p, size_t len, uint8_t mask)
+{
+	uint64_t v = 0;
+	for (size_t i = 0; i < len - 1; i++)
+		v = v << 8 | p[i];
+	return v << 8 | (p[len - 1] & mask);
+}
+
 struct op	*op_new		(const char	*dst_field_name,
 				const char	*dst_state_name,
+				const char	*dst_scratch_name,
 				const char	*src_field_name,
 				const char	*src_state_name,
+				const char	*src_scratch_name,
 				const char	*src_value);
 
+struct op	*op_swap_new	(const char	*a_field_name,
+				const char	*b_field_name);
+
+struct op	*op_table_new	(const char	*field_name,
+				const char	*table_name);
+
+struct op	*op_member_new	(const char	*field_name,
+				const char	*set_name);
+
+struct op	*op_range_new	(const char	*field_name,
+				const char	*cmp,
+				const char	*value,
+				const char	*value_hi);
+
+struct op	*op_search_new	(const char	*field_name,
+				Pvoid_t		pattern_JQ);
+
+struct op	*op_regex_new	(const char	*field_name,
+				const char	*pattern);
+
 struct op	*op_parse_new	(yaml_document_t *doc,
 				yaml_node_t *mapping);
 
@@ -12,14 +12,25 @@
 #include <iface.h>
 #include <rule.h>
 #include <rout.h>
+#include <classifier.h>
+#include <flow.h>
 
 
 /*	process
+ * @cls	: classifier built from 'rout_set_JQ', used on the hot path
+ * @cacheable	: 'cls' lookups can go through flow caches
+ * @anchored	: some rule uses anchored fields: packets are parsed for anchors
+ * @flows	: flow cache of each thread (see iface_worker_slot()),
+ *		  allocated by that thread on its first packet
  */
 struct process {
-	struct iface	*in_iface;
-	Pvoid_t		rout_JQ;	/* (uint64_t seq) -> (struct rout *rout) */
-	Pvoid_t		rout_set_JQ;	/* (uint64_t seq) -> (struct rout_set *rst) */
+	struct iface		*in_iface;
+	Pvoid_t			rout_JQ;	/* (uint64_t seq) -> (struct rout *rout) */
+	Pvoid_t			rout_set_JQ;	/* (uint64_t seq) -> (struct rout_set *rst) */
+	struct classifier	*cls;
+	bool			cacheable;
+	bool			anchored;
+	struct flow_cache	*flows[IFACE_WORKER_SLOTS];
 };
 
 
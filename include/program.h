@@ -0,0 +1,114 @@
+#ifndef program_h_
+#define program_h_
+
+/*	program.h
+ * A "program" is a rule compiled for the hot path (see rout_set_new()).
+ *
+ * The ops of a rule are lowered to an IR (a copy of the op_set of each,
+ * owning its value operand) which these passes rewrite, in order:
+ * - nop elimination: zero-length ops (e.g. 'field: any') never look
+ *   at the packet;
+ * - constant folding: comparing or copying a packet field with itself;
+ *   a value written to a scratch register is read straight from the value;
+ * - dead-write elimination: scratch registers never read afterwards,
+ *   packet writes entirely overwritten by a later write;
+ * - adjacent-field merging: matches of values against contiguous fields,
+ *   or consecutive writes of values into them, become one wider op.
+ *
+ * The result is emitted as bytecode: a stream of instructions, each an
+ * 8 Byte 'prog_insn' followed by its operand, padded to 8 Bytes.
+ * Values matched against or written into fields at a fixed offset from
+ * the start of the packet are instructions of their own, with the value
+ * inline; any other op is embedded whole and run by op_match()/op_write().
+ *
+ * Packet length is checked once against the shortest packet all ops of
+ * the rule fit in (see op_bound()): only ops on anchored fields or fields
+ * counting from the end of the packet then check their own bounds.
+ *
+ * (c) 2019 Sirio Balmelli
+ */
+
+#include <xdpacket.h>
+#include <rule.h>
+#include <operations.h>
+
+
+#define PROG_ALIGN(len) (((len) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1))
+
+
+/*	prog_code
+ * PROG_MATCH_* and PROG_WRITE_*: the value follows the instruction,
+ * width-specialized like op kernels (see OP_TAIL()), *_N for any other width.
+ * PROG_OP: an op_set follows the instruction, then its value (if any);
+ * PROG_OP_CHECKED: the same, for an op which must check its own bounds.
+ */
+enum prog_code {
+	PROG_OP = 0,
+	PROG_OP_CHECKED,
+	PROG_MATCH_1,
+	PROG_MATCH_2,
+	PROG_MATCH_4,
+	PROG_MATCH_6,
+	PROG_MATCH_8,
+	PROG_MATCH_16,
+	PROG_MATCH_N,
+	PROG_WRITE_1,
+	PROG_WRITE_2,
+	PROG_WRITE_4,
+	PROG_WRITE_6,
+	PROG_WRITE_8,
+	PROG_WRITE_16,
+	PROG_WRITE_N
+};
+
+
+/*	prog_insn
+ * @code	: enum prog_code
+ * @mask	: mask of the last Byte of the field;
+ *		  the last Byte of the value is stored already masked
+ * @len		: length of the field
+ * @offt	: offset of the field from the start of the packet,
+ *		  or for PROG_OP*: size of the instruction and its operands
+ */
+struct prog_insn {
+	uint8_t			code;
+	uint8_t			mask;
+	uint16_t		len;
+	uint32_t		offt;
+};
+NLC_ASSERT(prog_insn_size, sizeof(struct prog_insn) == sizeof(uint64_t));
+
+
+/*	program
+ * @match_plen	: shortest packet all match ops fit in
+ * @write_plen	: shortest packet all write ops fit in
+ * @match_cnt	: number of match instructions
+ * @write_cnt	: number of write instructions
+ * @match_size	: Bytes of match instructions at the start of 'code'
+ * @write_size	: Bytes of write instructions following them
+ * @code	: instructions
+ */
+struct program {
+	uint32_t		match_plen;
+	uint32_t		write_plen;
+	uint32_t		match_cnt;
+	uint32_t		write_cnt;
+	uint32_t		match_size;
+	uint32_t		write_size;
+	uint8_t			code[] __attribute__((aligned(sizeof(uint64_t))));
+};
+
+
+void		program_free	(struct program *prog);
+struct program	*program_new	(struct rule *rule);
+
+bool		program_match	(struct program *prog,
+				const void *pkt,
+				size_t plen);
+
+bool		program_exec	(struct program *prog,
+				void *pkt,
+				size_t plen);
+
+
+#endif /* program_h_ */
@@ -10,15 +10,38 @@
 #include <judyutils.h>
 #include <yaml.h>
 #include <iface.h>
+#include <operations.h>
+#include <program.h>
+
+
+/* Ethernet destination and source addresses: not covered by any checksum.
+ */
+#define ROUT_L2_ADDR_LEN 12
+
+
+/*	rout_wcount
+ * Counters written by a single thread (see iface_worker_slot()),
+ * on a cache line of their own so workers never contend.
+ */
+struct rout_wcount {
+	size_t		match;
+} __attribute__((aligned(NLC_CACHE_LINE)));
 
 
 /*	rout_set
- * Packed representation of a rule (match -> write -> output) sequence.
+ * A rule (match -> write -> output) sequence, as used on the hot path:
+ * its ops are compiled into 'prog' (see program.h).
  *
  * @if_out	: interface where packets should be output after writing/mangling.
- * @match_JQ	: queue (sequence) of match operatioons to be applied to packet.
- * @write_JQ	: write operations to be applied if all match operations pass.
- * @count_match	: number of packets matched and processed
+ * @match_JQ	: queue (sequence) of match operatioons (control plane only).
+ * @write_JQ	: write operations (control plane only).
+ * @wcount	: per-thread counts of packets matched and processed,
+ *		  summed by rout_set_count()
+ * @checksum	: writes may touch bytes covered by IP/L4 checksums,
+ *		  which must then be updated on output.
+ * @anchored	: some op uses a field anchored to a header or computed
+ *		  (see field_anchors_parse()).
+ * @prog	: match and write ops, compiled
  */
 struct rout_set {
 	struct iface		*if_out;
@@ -26,7 +49,11 @@ struct rout_set {
 	Pvoid_t			match_JQ; /* (uint64_t seq) -> (struct op *match) */
 	Pvoid_t			write_JQ; /* (uint64_t seq) -> (struct op *write) */
 
-	uint32_t		count_match;
+	struct rout_wcount	*wcount;
+	bool			checksum;
+	bool			anchored;
+
+	struct program		*prog;
 };
 
 
@@ -43,6 +70,8 @@ bool		rout_set_exec	(struct rout_set *set,
 				void *pkt,
 				size_t plen);
 
+size_t		rout_set_count	(struct rout_set *set);
+
 
 /*	rout
  * Representation of user-supplied (rule, output) tuple, given to us as strings.
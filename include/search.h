@@ -0,0 +1,87 @@
+#ifndef search_h_
+#define search_h_
+
+/*	search.h
+ * A "search" looks for any of a set of literal byte patterns anywhere
+ * inside a window of a packet (see op_search_new()).
+ *
+ * Patterns are compiled into an Aho-Corasick automaton with a full
+ * transition table (one row of 256 next states per state), so that
+ * scanning costs one table load per Byte whatever the number of patterns,
+ * and never backtracks.
+ *
+ * In front of the automaton sits a prefilter: every pattern starts with
+ * one of a few Byte pairs (or single Bytes, for 1-Byte patterns),
+ * which are looked for 16 or 32 Bytes at a time with SSE2/AVX2 compares
+ * (whichever the CPU supports, like ones_sum() in checksums.c).
+ * Whenever the automaton is back in its root state, scanning skips
+ * straight to the next position holding a candidate pair,
+ * so windows without candidates are rejected at memory bandwidth.
+ * With more than SEARCH_PAIRS_MAX distinct pairs the prefilter is a
+ * (scalar) lookup of the first Byte instead.
+ *
+ * (c) 2018 Sirio Balmelli
+ */
+
+#include <xdpacket.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <nonlibc.h>
+#include <judyutils.h>
+
+
+#define SEARCH_BYTES_MAX	4096	/* total length of all patterns */
+#define SEARCH_PAIRS_MAX	8	/* vector prefilter compares per block */
+#define SEARCH_STATE_HIT	UINT16_MAX /* transition into a matching state */
+
+NLC_ASSERT(search_states_check, SEARCH_BYTES_MAX + 1 < SEARCH_STATE_HIT);
+
+
+/*	search
+ * @pattern_JQ	: patterns as given by the user, to emit them back
+ * @state_cnt	: number of automaton states; 0 is the root
+ * @delta	: 'state_cnt' rows of 256 next states, or SEARCH_STATE_HIT
+ * @first	: bitmap of the first Byte of all patterns
+ * @pair_cnt	: number of prefilter pairs, 0 if there are too many
+ * @pair_a	: first Byte of each pair
+ * @pair_b	: second Byte of each pair
+ * @pair_any	: pair is a 1-Byte pattern: any second Byte will do
+ */
+struct search {
+	Pvoid_t			pattern_JQ; /* (uint64_t seq) -> (char *pattern) */
+	uint32_t		state_cnt;
+	uint16_t		*delta;
+	uint64_t		first[4];
+
+	uint8_t			pair_cnt;
+	uint8_t			pair_a[SEARCH_PAIRS_MAX];
+	uint8_t			pair_b[SEARCH_PAIRS_MAX];
+	uint8_t			pair_any[SEARCH_PAIRS_MAX];
+};
+
+
+void		search_free	(struct search *search);
+struct search	*search_new	(Pvoid_t pattern_JQ);
+
+bool		search_match	(const struct search *search,
+				const uint8_t *p,
+				size_t len);
+
+/* Prefilter implementations, all giving the same result.
+ * Return the offset of the first candidate in 'p', or 'len' if none.
+ * Exposed for testing: search_match() uses the widest the CPU supports.
+ */
+size_t		search_skip_scalar(const struct search *search,
+				const uint8_t *p,
+				size_t len);
+#if defined(__x86_64__) || defined(__i386__)
+size_t		search_skip_sse2(const struct search *search,
+				const uint8_t *p,
+				size_t len);
+size_t		search_skip_avx2(const struct search *search,
+				const uint8_t *p,
+				size_t len);
+#endif
+
+
+#endif /* search_h_ */
@@ -0,0 +1,150 @@
+#ifndef set_h_
+#define set_h_
+
+/*	set.h
+ * A "set" is a named collection of values of the same length,
+ * which a match op can test a packet field for membership in
+ * (see op_member_new()).
+ *
+ * Values are kept in an open-addressing (linear probing) hash table,
+ * at most half full, so a lookup costs one hash and a probe or two
+ * whatever the number of values.
+ * A Bloom filter of 16 bits per value (2 bits set per value) sits in front
+ * of the table, so that most misses cost two bit tests and no probing.
+ *
+ * Unlike tables (see table.h), values may be added and deleted while
+ * rules use a set: every change bumps 'set_generation',
+ * which tells flow caches their results may be stale (see flow.h).
+ * Deletions leave the Bloom filter untouched (it may only yield more
+ * false positives) until set_bloom_rebuild().
+ *
+ * (c) 2018 Sirio Balmelli
+ */
+
+#include <xdpacket.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <nonlibc.h>
+#include <judyutils.h>
+#include <yaml.h>
+#include <parse2.h>
+#include <fnv.h>
+
+
+#define SET_LEN_MAX	64
+#define SET_SLOTS_MIN	16	/* power of 2 */
+#define SET_BLOOM_BITS	16	/* per slot: at most half of slots are used */
+
+
+/*	set
+ * @len		: length of values (and of fields which may be looked up)
+ * @cnt		: number of values
+ * @slot_mask	: number of slots - 1 (a power of 2)
+ * @hashes	: set_hash() of value in each slot; 0 == empty slot
+ * @values	: 'len' Bytes per slot
+ * @texts	: value of each slot as given by the user, to emit it back
+ * @bloom	: 'slot_mask + 1' * SET_BLOOM_BITS bits
+ */
+struct set {
+	char			*name;
+	uint32_t		refcnt;
+	uint16_t		len;
+	uint32_t		cnt;
+	uint32_t		slot_mask;
+
+	uint64_t		*hashes;
+	uint8_t			*values;
+	char			**texts;
+	uint64_t		*bloom;
+};
+
+
+/* Bumped whenever the values of any set change.
+ */
+extern uint32_t set_generation;
+
+
+void		set_free	(void *arg);
+void		set_free_all	();
+struct set	*set_new	(const char *name,
+				long len);
+
+void		set_release	(struct set *set);
+struct set	*set_get	(const char *name);
+
+int		set_add		(struct set *set,
+				const char *value);
+int		set_del		(struct set *set,
+				const char *value);
+void		set_bloom_rebuild(struct set *set);
+
+/* integrates into parse2.h
+ */
+int		set_parse	(enum parse_mode mode,
+				yaml_document_t *doc,
+				yaml_node_t *mapping,
+				yaml_document_t *outdoc,
+				int outlist);
+
+int		set_emit	(struct set *set,
+				yaml_document_t *outdoc,
+				int outlist);
+
+int		set_emit_all	(yaml_document_t *outdoc,
+				int outlist);
+
+
+/*	set_hash()
+ * Never 0, which marks an empty slot.
+ */
+NLC_INLINE uint64_t set_hash(const uint8_t *value, size_t len)
+{
+	uint64_t hash = fnv_hash64(NULL, NULL, 0);
+	return fnv_hash64(&hash, value, len) | 0x1;
+}
+
+/*	set_slot()
+ * Home slot of 'hash': bit 0 is always set, don't use it.
+ */
+NLC_INLINE uint32_t set_slot(const struct set *set, uint64_t hash)
+{
+	return (hash >> 1) & set->slot_mask;
+}
+
+/*	set_bloom_bits()
+ * The 2 Bloom filter bits of 'hash', from bits independent of set_slot().
+ */
+NLC_INLINE void set_bloom_bits(const struct set *set, uint64_t hash, uint64_t out[2])
+{
+	uint64_t mask = (uint64_t)(set->slot_mask + 1) * SET_BLOOM_BITS - 1;
+	out[0] = (hash >> 32) & mask;
+	out[1] = ((hash * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+}
+
+/*	set_lookup()
+ * Returns true if 'key', which is 'set->len' Bytes and is read with
+ * its last Byte masked by 'mask', is in 'set'.
+ */
+NLC_INLINE bool set_lookup(const struct set *set, const uint8_t *key, uint8_t mask)
+{
+	uint8_t buf[SET_LEN_MAX];
+	size_t len = set->len;
+	memcpy(buf, key, len);
+	buf[len - 1] &= mask;
+	uint64_t hash = set_hash(buf, len);
+
+	uint64_t bits[2];
+	set_bloom_bits(set, hash, bits);
+	if (!(set->bloom[bits[0] >> 6] & 1ULL << (bits[0] & 63))
+			|| !(set->bloom[bits[1] >> 6] & 1ULL << (bits[1] & 63)))
+		return false;
+
+	for (uint32_t i = set_slot(set, hash); set->hashes[i]; i = (i + 1) & set->slot_mask) {
+		if (set->hashes[i] == hash && !memcmp(&set->values[(size_t)i * len], buf, len))
+			return true;
+	}
+	return false;
+}
+
+
+#endif /* set_h_ */
@@ -0,0 +1,125 @@
+#ifndef table_h_
+#define table_h_
+
+/*	table.h
+ * A "table" is a named set of address prefixes (e.g. '10.0.0.0/8'),
+ * which a match op can test a packet field against (see op_table_new()):
+ * a field matches if any prefix in the table covers it.
+ *
+ * Lookup cost does not depend on the number of prefixes:
+ * - 4 Byte (IPv4) tables are DIR-24-8: one 2^24 entry array indexed
+ *   by the first 3 Bytes, whose entries are either a result or the index
+ *   of a 256 entry group indexed by the last Byte.
+ *   At most 2 memory accesses.
+ *   The first array is allocated but never written for ranges
+ *   no prefix touches, so those pages are never backed by memory.
+ * - all other widths (e.g. IPv6) use a multibit trie with a stride of 1 Byte,
+ *   where a prefix ending inside a Byte is expanded to all the children
+ *   it covers, and a node entirely covered by a prefix is collapsed
+ *   into a single "hit" entry.
+ *   At most 1 memory access per Byte of key.
+ *
+ * Since only hit/miss is needed, prefixes are the union of all covered
+ * addresses: a longer prefix inside a shorter one changes nothing.
+ *
+ * Tables cannot be changed while referenced by a rule:
+ * a lookup depends only on the packet, which allows caching (see flow.h).
+ *
+ * (c) 2018 Sirio Balmelli
+ */
+
+#include <xdpacket.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <nonlibc.h>
+#include <judyutils.h>
+#include <yaml.h>
+#include <parse2.h>
+
+
+#define TABLE_LEN_MAX		16	/* longest key: IPv6 */
+#define TABLE_DIR_BITS		24
+#define TABLE_DIR_MISS		0
+#define TABLE_DIR_HIT		1	/* otherwise: 'group + 2' */
+#define TABLE_DIR_GROUP_MAX	(UINT16_MAX - 2)
+
+
+/*	table_node
+ * Trie node: one child per value of the next Byte of key.
+ * A child of TABLE_NODE_HIT means all keys below it are covered;
+ * a NULL child means none are.
+ */
+struct table_node {
+	struct table_node	*child[256];
+};
+#define TABLE_NODE_HIT ((struct table_node *)0x1)
+
+
+/*	table
+ * @len		: length of keys (and of fields which may be looked up)
+ * @prefix_JQ	: prefixes as given by the user, to emit them back
+ * @dir		: DIR-24-8 first level (len == 4)
+ * @groups	: DIR-24-8 second level, 'group_cnt' groups of 256 entries
+ * @root	: trie (len != 4)
+ */
+struct table {
+	char			*name;
+	uint32_t		refcnt;
+	uint16_t		len;
+	uint16_t		group_cnt;
+	Pvoid_t			prefix_JQ; /* (uint64_t seq) -> (char *prefix) */
+
+	uint16_t		*dir;
+	uint8_t			*groups;
+	struct table_node	*root;
+};
+
+
+void		table_free	(void *arg);
+void		table_free_all	();
+struct table	*table_new	(const char *name,
+				long len,
+				Pvoid_t prefix_JQ);
+
+void		table_release	(struct table *table);
+struct table	*table_get	(const char *name);
+
+/* integrates into parse2.h
+ */
+int		table_parse	(enum parse_mode mode,
+				yaml_document_t *doc,
+				yaml_node_t *mapping,
+				yaml_document_t *outdoc,
+				int outlist);
+
+int		table_emit	(struct table *table,
+				yaml_document_t *outdoc,
+				int outlist);
+
+int		table_emit_all	(yaml_document_t *outdoc,
+				int outlist);
+
+
+/*	table_lookup()
+ * Returns true if any prefix in 'table' covers 'key',
+ * which is 'table->len' Bytes and is read with its last Byte masked by 'mask'.
+ */
+NLC_INLINE bool table_lookup(const struct table *table, const uint8_t *key, uint8_t mask)
+{
+	if (table->dir) {
+		uint32_t hi = (uint32_t)key[0] << 16 | (uint32_t)key[1] << 8 | key[2];
+		uint16_t ent = table->dir[hi];
+		if (ent < 2)
+			return ent;
+		return table->groups[(size_t)(ent - 2) << 8 | (key[3] & mask)];
+	}
+
+	const struct table_node *node = table->root;
+	size_t last = table->len - 1;
+	for (size_t i = 0; node > TABLE_NODE_HIT; i++)
+		node = node->child[i < last ? key[i] : key[i] & mask];
+	return node == TABLE_NODE_HIT;
+}
+
+
+#endif /* table_h_ */
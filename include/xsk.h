@@ -0,0 +1,99 @@
+#ifndef xsk_h_
+#define xsk_h_
+
+/*	xsk.h
+ * AF_XDP (XSK) sockets for ifaces with 'rx: xdp' and/or 'tx: xdp'.
+ *
+ * All XSKs share a single UMEM (one area of packet frames registered
+ * with the kernel), so that a packet received on one XSK can be sent
+ * on another by moving its descriptor: no copy.
+ * Packets are steered into an XSK by a minimal built-in XDP program
+ * which redirects every packet on queue 0 of the interface.
+ *
+ * Zero-copy is used when the driver supports it, copy mode otherwise;
+ * the program is attached in native (driver) mode when possible,
+ * generic (skb) mode otherwise.
+ *
+ * (c) 2018 Sirio Balmelli
+ */
+
+#include <nonlibc.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/if_xdp.h>
+
+
+/* UMEM geometry.
+ * A frame must hold a full-MTU Ethernet frame after the XDP headroom:
+ * jumbo frames are not supported.
+ */
+#define XSK_FRAME_SZ	2048
+#define XSK_FRAME_CNT	8192
+#define XSK_RING_SZ	2048
+
+
+/*	xsk_ring
+ * One of the 4 rings shared with the kernel (rx, tx, fill, completion).
+ * @producer	: written by the producer side only
+ * @consumer	: written by the consumer side only
+ * @ring	: 'size' entries of 'struct xdp_desc' (rx, tx) or 'uint64_t' (fill, comp)
+ */
+struct xsk_ring {
+	uint32_t	*producer;
+	uint32_t	*consumer;
+	void		*ring;
+	uint32_t	mask;
+	uint32_t	size;
+	void		*map;
+	size_t		map_len;
+};
+
+
+/*	xsk
+ * @fd		: AF_XDP socket, bound to queue 0 of 'ifindex'
+ * @zerocopy	: bound in zero-copy mode
+ * @native	: XDP program attached in native (driver) mode
+ * @map_fd	: XSKMAP the XDP program redirects into
+ * @prog_fd	: the XDP program
+ * @link_fd	: attachment of the program to the interface (detached on close)
+ * @next	: next XSK sharing the UMEM
+ */
+struct xsk {
+	int		fd;
+	int		ifindex;
+	bool		zerocopy;
+	bool		native;
+	int		map_fd;
+	int		prog_fd;
+	int		link_fd;
+
+	struct xsk_ring	rx;
+	struct xsk_ring	tx;
+	struct xsk_ring	fill;
+	struct xsk_ring	comp;
+
+	struct xsk	*next;
+};
+
+
+void		xsk_free	(struct xsk *xsk);
+struct xsk	*xsk_new	(int ifindex, int mtu, bool rx, bool tx);
+
+unsigned int	xsk_rx_burst	(struct xsk *xsk, unsigned int max,
+				void (*handler)(void *context, void *pkt, size_t len),
+				void *context);
+
+int		xsk_tx_stage	(struct xsk *xsk, void *pkt, size_t len);
+int		xsk_tx_kick	(struct xsk *xsk);
+
+NLC_INLINE const char *xsk_mode_prn(struct xsk *xsk)
+{
+	if (xsk->zerocopy)
+		return "zerocopy";
+	if (xsk->link_fd == -1)
+		return "copy";
+	return xsk->native ? "native copy" : "generic copy";
+}
+
+
+#endif /* xsk_h_ */
@@ -0,0 +1,171 @@
+/*	bitmask.c
+ * (c) 2019 Sirio Balmelli
+ */
+
+#include <bitmask.h>
+#include <string.h>
+
+
+/*	bitmask_ld()
+ * Unaligned load of 8 Bytes.
+ */
+NLC_INLINE uint64_t bitmask_ld(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+
+/*	bitmask_differ_scalar()
+ * Returns true if the 'len' Bytes at 'p', masked by 'mask', differ from 'value'.
+ * 8 Bytes at a time, then one at a time.
+ */
+bool bitmask_differ_scalar(const uint8_t *p, const uint8_t *value,
+			const uint8_t *mask, size_t len)
+{
+	size_t i = 0;
+	uint64_t x = 0;
+	for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+		x |= (bitmask_ld(&p[i]) & bitmask_ld(&mask[i])) ^ bitmask_ld(&value[i]);
+	for (; i < len; i++)
+		x |= (p[i] & mask[i]) ^ value[i];
+	return x != 0;
+}
+
+/*	bitmask_merge_scalar()
+ * Write 'value' into the bits of the 'len' Bytes at 'p' which 'mask' covers.
+ */
+void bitmask_merge_scalar(uint8_t *p, const uint8_t *value,
+			const uint8_t *mask, size_t len)
+{
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+		uint64_t v = (bitmask_ld(&p[i]) & ~bitmask_ld(&mask[i])) | bitmask_ld(&value[i]);
+		memcpy(&p[i], &v, sizeof(v));
+	}
+	for (; i < len; i++)
+		p[i] = (p[i] & ~mask[i]) | value[i];
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/*	bitmask_differ_sse2()
+ */
+bool __attribute__((target("sse2"))) bitmask_differ_sse2(const uint8_t *p,
+			const uint8_t *value, const uint8_t *mask, size_t len)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + sizeof(__m128i) <= len; i += sizeof(__m128i)) {
+		__m128i x = _mm_xor_si128(
+			_mm_and_si128(_mm_loadu_si128((const __m128i *)&p[i]),
+				_mm_loadu_si128((const __m128i *)&mask[i])),
+			_mm_loadu_si128((const __m128i *)&value[i]));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) != 0xffff)
+			return true;
+	}
+	return bitmask_differ_scalar(&p[i], &value[i], &mask[i], len - i);
+}
+
+/*	bitmask_merge_sse2()
+ */
+void __attribute__((target("sse2"))) bitmask_merge_sse2(uint8_t *p,
+			const uint8_t *value, const uint8_t *mask, size_t len)
+{
+	size_t i = 0;
+	for (; i + sizeof(__m128i) <= len; i += sizeof(__m128i)) {
+		__m128i v = _mm_or_si128(
+			_mm_andnot_si128(_mm_loadu_si128((const __m128i *)&mask[i]),
+				_mm_loadu_si128((const __m128i *)&p[i])),
+			_mm_loadu_si128((const __m128i *)&value[i]));
+		_mm_storeu_si128((__m128i *)&p[i], v);
+	}
+	bitmask_merge_scalar(&p[i], &value[i], &mask[i], len - i);
+}
+
+/*	bitmask_differ_avx2()
+ * As bitmask_differ_sse2(), 32 Bytes at a time.
+ */
+bool __attribute__((target("avx2"))) bitmask_differ_avx2(const uint8_t *p,
+			const uint8_t *value, const uint8_t *mask, size_t len)
+{
+	size_t i = 0;
+	for (; i + sizeof(__m256i) <= len; i += sizeof(__m256i)) {
+		__m256i x = _mm256_xor_si256(
+			_mm256_and_si256(_mm256_loadu_si256((const __m256i *)&p[i]),
+				_mm256_loadu_si256((const __m256i *)&mask[i])),
+			_mm256_loadu_si256((const __m256i *)&value[i]));
+		if (!_mm256_testz_si256(x, x))
+			return true;
+	}
+	return bitmask_differ_sse2(&p[i], &value[i], &mask[i], len - i);
+}
+
+/*	bitmask_merge_avx2()
+ * As bitmask_merge_sse2(), 32 Bytes at a time.
+ */
+void __attribute__((target("avx2"))) bitmask_merge_avx2(uint8_t *p,
+			const uint8_t *value, const uint8_t *mask, size_t len)
+{
+	size_t i = 0;
+	for (; i + sizeof(__m256i) <= len; i += sizeof(__m256i)) {
+		__m256i v = _mm256_or_si256(
+			_mm256_andnot_si256(_mm256_loadu_si256((const __m256i *)&mask[i]),
+				_mm256_loadu_si256((const __m256i *)&p[i])),
+			_mm256_loadu_si256((const __m256i *)&value[i]));
+		_mm256_storeu_si256((__m256i *)&p[i], v);
+	}
+	bitmask_merge_sse2(&p[i], &value[i], &mask[i], len - i);
+}
+#endif
+
+
+/*	bitmask_differ_best, bitmask_merge_best
+ * Widest implementations supported by this CPU, chosen at startup.
+ */
+static bool (*bitmask_differ_best)(const uint8_t *p, const uint8_t *value,
+				const uint8_t *mask, size_t len) = bitmask_differ_scalar;
+static void (*bitmask_merge_best)(uint8_t *p, const uint8_t *value,
+				const uint8_t *mask, size_t len) = bitmask_merge_scalar;
+
+static void __attribute__((constructor)) bitmask_select()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		bitmask_differ_best = bitmask_differ_avx2;
+		bitmask_merge_best = bitmask_merge_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		bitmask_differ_best = bitmask_differ_sse2;
+		bitmask_merge_best = bitmask_merge_sse2;
+	}
+#endif
+}
+
+
+/*	bitmask_differ()
+ * Returns true if the 'len' Bytes at 'p', masked by 'mask', differ from 'value'.
+ * Fields shorter than a vector are not worth a vector unit.
+ */
+bool __attribute__((hot)) bitmask_differ(const uint8_t *p, const uint8_t *value,
+					const uint8_t *mask, size_t len)
+{
+	if (len < 16)
+		return bitmask_differ_scalar(p, value, mask, len);
+	return bitmask_differ_best(p, value, mask, len);
+}
+
+/*	bitmask_merge()
+ * Write 'value' into the bits of the 'len' Bytes at 'p' which 'mask' covers.
+ */
+void __attribute__((hot)) bitmask_merge(uint8_t *p, const uint8_t *value,
+					const uint8_t *mask, size_t len)
+{
+	if (len < 16)
+		bitmask_merge_scalar(p, value, mask, len);
+	else
+		bitmask_merge_best(p, value, mask, len);
+}
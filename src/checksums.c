@@ -56,16 +56,13 @@ NLC_ASSERT(pseudo_ip6_size, sizeof(struct pseudo_ip6) == 40);
 #define NO_PSEUDO_HEADER_ON_STACK
 
 
-static uint32_t ones_sum(const void *blocks, size_t byte_count, uint32_t sum);
-static uint16_t ones_final(uint32_t sum);
-
-
-/*	ones_sum()
+/*	ones_sum_scalar()
  * Add 'byte_count' bytes to 'sum'.
  * 'sum' must be 0 if this is the first block being summed, otherwise it should
  * be the previous output of a call to ones_sum().
+ * Reference implementation, one 16-bit word at a time.
  */
-static uint32_t ones_sum(const void *blocks, size_t byte_count, uint32_t sum)
+uint32_t ones_sum_scalar(const void *blocks, size_t byte_count, uint32_t sum)
 {
 	size_t block_cnt = byte_count >> 1;
 	for (unsigned int i=0; i < block_cnt; i++)
@@ -83,11 +80,139 @@ static uint32_t ones_sum(const void *blocks, size_t byte_count, uint32_t sum)
 	return sum;
 }
 
+
+/*	ones_fold()
+ * Fold a wide accumulator down to 16 bits (plus carry) without changing
+ * its ones-complement value: 2^16 == 1 in ones-complement arithmetic.
+ * A non-zero input never folds to zero.
+ */
+NLC_INLINE uint32_t ones_fold(uint64_t acc)
+{
+	while (acc >> 16)
+		acc = (acc & 0xffff) + (acc >> 16);
+	return acc;
+}
+
+
+/*	ones_sum_u64()
+ * Generic wide implementation: sum 64 bits at a time as two 32-bit halves
+ * into a 64-bit accumulator, which cannot carry out before 2^32 words.
+ */
+uint32_t ones_sum_u64(const void *blocks, size_t byte_count, uint32_t sum)
+{
+	const uint8_t *p = blocks;
+	uint64_t acc = sum;
+	for (; byte_count >= sizeof(uint64_t); p += sizeof(uint64_t), byte_count -= sizeof(uint64_t)) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		acc += (v & 0xffffffff) + (v >> 32);
+	}
+	/* at most 3 words and a trailing byte left */
+	return ones_sum_scalar(p, byte_count, ones_fold(acc));
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/* Lanes are 32-bit and gain at most 2 * 0xffff per vector summed:
+ * flush them into the 64-bit accumulator well before they could overflow.
+ */
+#define ONES_LANE_FLUSH 0x7fff
+
+/*	ones_sum_sse2()
+ * Zero-extend each 16-bit word into a 32-bit lane and add vertically.
+ */
+uint32_t __attribute__((target("sse2"))) ones_sum_sse2(const void *blocks, size_t byte_count, uint32_t sum)
+{
+	const uint8_t *p = blocks;
+	uint64_t acc = sum;
+	const __m128i zero = _mm_setzero_si128();
+
+	while (byte_count >= sizeof(__m128i)) {
+		size_t n = byte_count / sizeof(__m128i);
+		if (n > ONES_LANE_FLUSH)
+			n = ONES_LANE_FLUSH;
+		byte_count -= n * sizeof(__m128i);
+
+		__m128i lanes = zero;
+		for (; n; n--, p += sizeof(__m128i)) {
+			__m128i v = _mm_loadu_si128((const __m128i *)p);
+			lanes = _mm_add_epi32(lanes, _mm_unpacklo_epi16(v, zero));
+			lanes = _mm_add_epi32(lanes, _mm_unpackhi_epi16(v, zero));
+		}
+		uint32_t out[4];
+		_mm_storeu_si128((__m128i *)out, lanes);
+		acc += (uint64_t)out[0] + out[1] + out[2] + out[3];
+	}
+	return ones_sum_u64(p, byte_count, ones_fold(acc));
+}
+
+/*	ones_sum_avx2()
+ * As ones_sum_sse2(), 32 bytes at a time.
+ */
+uint32_t __attribute__((target("avx2"))) ones_sum_avx2(const void *blocks, size_t byte_count, uint32_t sum)
+{
+	const uint8_t *p = blocks;
+	uint64_t acc = sum;
+	const __m256i zero = _mm256_setzero_si256();
+
+	while (byte_count >= sizeof(__m256i)) {
+		size_t n = byte_count / sizeof(__m256i);
+		if (n > ONES_LANE_FLUSH)
+			n = ONES_LANE_FLUSH;
+		byte_count -= n * sizeof(__m256i);
+
+		__m256i lanes = zero;
+		for (; n; n--, p += sizeof(__m256i)) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)p);
+			lanes = _mm256_add_epi32(lanes, _mm256_unpacklo_epi16(v, zero));
+			lanes = _mm256_add_epi32(lanes, _mm256_unpackhi_epi16(v, zero));
+		}
+		uint32_t out[8];
+		_mm256_storeu_si256((__m256i *)out, lanes);
+		for (unsigned int i = 0; i < NLC_ARRAY_LEN(out); i++)
+			acc += out[i];
+	}
+	return ones_sum_sse2(p, byte_count, ones_fold(acc));
+}
+#endif
+
+
+/*	ones_sum_best
+ * Widest implementation supported by this CPU, chosen at startup.
+ */
+static uint32_t (*ones_sum_best)(const void *blocks, size_t byte_count, uint32_t sum) = ones_sum_u64;
+
+static void __attribute__((constructor)) ones_sum_select()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		ones_sum_best = ones_sum_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		ones_sum_best = ones_sum_sse2;
+#endif
+}
+
+
+/*	ones_sum()
+ * Add 'byte_count' bytes to 'sum', see ones_sum_scalar().
+ * Short blocks (addresses, pseudo-header fields) are not worth a vector unit.
+ */
+NLC_INLINE uint32_t ones_sum(const void *blocks, size_t byte_count, uint32_t sum)
+{
+	if (byte_count < 64)
+		return ones_sum_u64(blocks, byte_count, sum);
+	return ones_sum_best(blocks, byte_count, sum);
+}
+
+
 /*	ones_final()
  * Produce the ones-complement of the ones-complement sum.
  * See RFC1071 for full implementation details;
  */
-static uint16_t ones_final(uint32_t sum)
+uint16_t ones_final(uint32_t sum)
 {
 	/* Speed up ones-complement sum by adding all into 32-bit and then
 	 * "carrying" overflow twice.
@@ -98,46 +223,102 @@ static uint16_t ones_final(uint32_t sum)
 }
 
 
-/*	checksum()
- * Calculate IP and protocol (tcp/udp) checksums on an ethernet frame.
- * Returns 0 on success (was able to calculate all checksums).
- * NOTE: all words are network (big-endian) byte order.
+/*	checksum_word()
+ * 16-bit word of 'frame' at (even) 'offt', zero-padded past 'len'
+ * exactly as ones_sum() pads a trailing byte.
  */
-enum checksum_err __attribute__((hot)) checksum(void *frame, size_t len)
+NLC_INLINE uint16_t checksum_word(const uint8_t *frame, size_t len, size_t offt)
 {
-	struct ethhdr *l2 = frame;
+	uint8_t padded[2] = { frame[offt], offt + 1 < len ? frame[offt + 1] : 0x0 };
+	uint16_t word;
+	memcpy(&word, padded, sizeof(word));
+	return word;
+}
 
-	struct iphdr *l3 = frame + sizeof(*l2);
-	uint16_t head_len; /* length of ip(4|6) header */
-	uint8_t *l3_proto; /* location of protocol/next_header */
 
-#ifndef NO_PSEUDO_HEADER_ON_STACK
-	/* build pseudo-header on the stack */
-	union pseudo {
-		struct pseudo_ip4	v4;
-		struct pseudo_ip6	v6;
-	};
-	union pseudo pseudo = { { 0 } };
-#else
-	/* use for padded values in checksum computes */
-	uint16_t stack = 0;
-#endif
+/*	checksum_log
+ */
+__thread struct checksum_log checksum_log = { 0 };
 
-	union l4 {
-		void		*ptr;
-		struct tcphdr	*tcp;
-		struct udphdr	*udp;
-		struct icmphdr	*icmp;
-		struct icmp6hdr	*icmp6;
-	};
-	union l4 l4 = { 0 };
-	uint16_t l4_len; /* length of tcp/udp header plus payload */
-	uint32_t l4_sum; /* accumulator for 1s complement sum of:
-			  * - pseudo-header
-			  * - l4 header
-			  * - payload
-			  */
 
+/*	checksum_log_old()
+ * Journal the current value of all words covering 'n' bytes at 'offt' in 'frame',
+ * which are about to be written.
+ * Returns the index of the first journal entry, to be given to checksum_log_new()
+ * once the write is done.
+ */
+size_t checksum_log_old(const void *frame, size_t len, size_t offt, size_t n)
+{
+	size_t first = checksum_log.cnt;
+	/* nothing written, or write will fail: nothing to journal */
+	if (!n || offt >= len || n > len - offt || first > CHECKSUM_LOG_MAX)
+		return first;
+
+	size_t end = offt + n;
+	offt &= ~(size_t)1;
+	if ((end - offt + 1) >> 1 > CHECKSUM_LOG_MAX - first) {
+		checksum_log.cnt = CHECKSUM_LOG_MAX + 1;
+		return checksum_log.cnt;
+	}
+	for (; offt < end; offt += 2) {
+		struct checksum_word *w = &checksum_log.words[checksum_log.cnt++];
+		w->offt = offt;
+		w->old = checksum_word(frame, len, offt);
+	}
+	return first;
+}
+
+
+/*	checksum_log_new()
+ * Journal the new value of all words logged from index 'first' onwards.
+ */
+void checksum_log_new(const void *frame, size_t len, size_t first)
+{
+	for (size_t i = first; i < checksum_log.cnt && i < CHECKSUM_LOG_MAX; i++) {
+		struct checksum_word *w = &checksum_log.words[i];
+		w->new = checksum_word(frame, len, w->offt);
+	}
+}
+
+
+/* L4 header, by protocol
+ */
+union l4 {
+	void		*ptr;
+	struct tcphdr	*tcp;
+	struct udphdr	*udp;
+	struct icmphdr	*icmp;
+	struct icmp6hdr	*icmp6;
+};
+
+/*	checksum_frame
+ * Location of checksummed headers in a frame, as found by checksum_parse().
+ * @l3		: IPv4 header (or IPv6: see 'version')
+ * @head_len	: length of ip(4|6) header
+ * @l3_proto	: location of protocol/next_header
+ * @l4		: L4 header
+ * @l4_len	: length of tcp/udp header plus payload
+ * @l4_check	: L4 checksum field
+ */
+struct checksum_frame {
+	struct iphdr	*l3;
+	uint16_t	head_len;
+	uint8_t		*l3_proto;
+	union l4	l4;
+	uint16_t	l4_len;
+	uint16_t	*l4_check;
+};
+
+
+/*	checksum_parse()
+ * Locate IP and protocol (tcp/udp/icmp) headers in an ethernet frame
+ * and verify their lengths.
+ * Returns 0 if all checksums in 'frame' can be calculated.
+ */
+static enum checksum_err checksum_parse(void *frame, size_t len, struct checksum_frame *cf)
+{
+	struct ethhdr *l2 = frame;
+	struct iphdr *l3 = frame + sizeof(*l2);
 
 	/* sanity check provided pointer and length values */
 	if (!l2 || len <= (sizeof(*l2) + sizeof(*l3)) || len > UINT16_MAX)
@@ -148,6 +329,7 @@ enum checksum_err __attribute__((hot)) checksum(void *frame, size_t len)
 		NB_inf("protocol 0x%04x not IP", be16toh(l2->h_proto));
 		return CHK_UNSUPPORTED;
 	}
+	cf->l3 = l3;
 
 
 	/* l3 == ipv4
@@ -157,19 +339,98 @@ enum checksum_err __attribute__((hot)) checksum(void *frame, size_t len)
 		 * NOTE: ihl is header length is in 32-bit words,
 		 * multiply by 4 to get header size in bytes.
 		 */
-		head_len = (uint16_t)l3->ihl << 2;
-		if (head_len < 20 || head_len > 60)
+		cf->head_len = (uint16_t)l3->ihl << 2;
+		if (cf->head_len < 20 || cf->head_len > 60)
 			return CHK_MALFORMED;
-		l4.ptr = (void *)l3 + head_len;
-		l4_len = be16toh(l3->tot_len) - head_len;
-		if (l4_len > (len - sizeof(*l2) - head_len))
+		cf->l4.ptr = (void *)l3 + cf->head_len;
+		cf->l4_len = be16toh(l3->tot_len) - cf->head_len;
+		if (cf->l4_len > (len - sizeof(*l2) - cf->head_len))
 			return CHK_MALFORMED;
 
-		l3_proto = &l3->protocol;
+		cf->l3_proto = &l3->protocol;
 
+
+	/* l3 == ipv6
+	 * ipv6 is a fixed-length header with no header checksum.
+	 * NOTE: does NOT support _all_ ipv6 packets as there may _be_ a "next header",
+	 * but it's good enough for now.
+	 */
+	} else if (l3->version == 6) {
+		struct ipv6hdr *l3 = frame + sizeof(*l2); /* clobber for clarity */
+		cf->head_len = 40;
+		cf->l4.ptr = (void *)l3 + cf->head_len;
+		cf->l4_len = be16toh(l3->payload_len);
+		if (cf->l4_len > (len - sizeof(*l2) - cf->head_len)) {
+			NB_inf("IPv6 missing next header support");
+			return CHK_UNSUPPORTED;
+		}
+
+		cf->l3_proto = &l3->nexthdr;
+
+
+	/* malformed IP protocol */
+	} else {
+		return CHK_MALFORMED;
+	}
+
+
+	/* l4 checksum location by protocol
+	 */
+	if (*cf->l3_proto == IPPROTO_TCP) {
+		cf->l4_check = &cf->l4.tcp->check;
+	} else if (*cf->l3_proto == IPPROTO_UDP) {
+		cf->l4_check = &cf->l4.udp->check;
+	} else if (*cf->l3_proto == IPPROTO_ICMP) {
+		cf->l4_check = &cf->l4.icmp->checksum;
+	} else if (*cf->l3_proto == IPPROTO_ICMPV6) {
+		cf->l4_check = &cf->l4.icmp6->icmp6_cksum;
+	} else {
+		NB_inf("upper-level protocol not recognized");
+		return CHK_UNSUPPORTED;
+	}
+
+	/* checksum field itself must be inside the frame */
+	if ((void *)(cf->l4_check + 1) > frame + len)
+		return CHK_MALFORMED;
+
+	return CHK_OK;
+}
+
+
+/*	checksum_full()
+ * Calculate IP and protocol (tcp/udp) checksums on a parsed frame.
+ * NOTE: all words are network (big-endian) byte order.
+ */
+static void checksum_full(struct checksum_frame *cf)
+{
+	struct iphdr *l3 = cf->l3;
+	union l4 l4 = cf->l4;
+	uint16_t l4_len = cf->l4_len;
+
+#ifndef NO_PSEUDO_HEADER_ON_STACK
+	/* build pseudo-header on the stack */
+	union pseudo {
+		struct pseudo_ip4	v4;
+		struct pseudo_ip6	v6;
+	};
+	union pseudo pseudo = { { 0 } };
+#else
+	/* use for padded values in checksum computes */
+	uint16_t stack = 0;
+#endif
+
+	uint32_t l4_sum; /* accumulator for 1s complement sum of:
+			  * - pseudo-header
+			  * - l4 header
+			  * - payload
+			  */
+
+	/* l3 == ipv4
+	 */
+	if (l3->version == 4) {
 		/* ipv4 has header checksum */
 		l3->check = 0;
-		l3->check = ones_final(ones_sum(l3, head_len, 0));
+		l3->check = ones_final(ones_sum(l3, cf->head_len, 0));
 
 		/* sum pseudo-header */
 #ifndef NO_PSEUDO_HEADER_ON_STACK
@@ -189,23 +450,10 @@ enum checksum_err __attribute__((hot)) checksum(void *frame, size_t len)
 		l4_sum = ones_sum(&stack, sizeof(stack), l4_sum);
 #endif
 
-
 	/* l3 == ipv6
-	 * ipv6 is a fixed-length header with no header checksum.
-	 * NOTE: does NOT support _all_ ipv6 packets as there may _be_ a "next header",
-	 * but it's good enough for now.
 	 */
-	} else if (l3->version == 6) {
-		struct ipv6hdr *l3 = frame + sizeof(*l2); /* clobber for clarity */
-		head_len = 40;
-		l4.ptr = (void *)l3 + head_len;
-		l4_len = be16toh(l3->payload_len);
-		if (l4_len > (len - sizeof(*l2) - head_len)) {
-			NB_inf("IPv6 missing next header support");
-			return CHK_UNSUPPORTED;
-		}
-
-		l3_proto = &l3->nexthdr;
+	} else {
+		struct ipv6hdr *l3 = (void *)cf->l3; /* clobber for clarity */
 
 #ifndef NO_PSEUDO_HEADER_ON_STACK
 		pseudo.v6.saddr = l3->saddr;
@@ -222,45 +470,137 @@ enum checksum_err __attribute__((hot)) checksum(void *frame, size_t len)
 		stack = l3->nexthdr << 8;
 		l4_sum = ones_sum(&stack, sizeof(stack), l4_sum);
 #endif
-
-
-	/* malformed IP protocol */
-	} else {
-		return CHK_MALFORMED;
 	}
 
+	/* ICMPv4 checksum does not include pseudo-header */
+	if (*cf->l3_proto == IPPROTO_ICMP)
+		l4_sum = 0;
+
+	*cf->l4_check = 0;
+	*cf->l4_check = ones_final(ones_sum(l4.ptr, l4_len, l4_sum));
+	//NB_dump(l4.ptr, l4_len, "L4 len %d checksum 0x%04hx", l4_len, be16toh(*cf->l4_check));
 
-	/* l4 checksums by protocol
+	/* '0x0000' UDP checksum value not allowed by the standard,
+	 * since it means "not implemented"
 	 */
-	if (*l3_proto == IPPROTO_TCP) {
-		l4.tcp->check = 0;
-		l4.tcp->check = ones_final(ones_sum(l4.ptr, l4_len, l4_sum));
-		//NB_dump(l4.ptr, l4_len, "TCP len %d checksum 0x%04hx", l4_len, be16toh(l4.udp->check));
-
-	} else if (*l3_proto == IPPROTO_UDP) {
-		l4.udp->check = 0;
-		l4.udp->check = ones_final(ones_sum(l4.ptr, l4_len, l4_sum));
-		/* '0x0000' checksum value not allowed by the standard,
-		 * since it means "not implemented"
-		 */
-		if (!l4.udp->check)
-			l4.udp->check = 0xffff;
-		//NB_dump(l4.ptr, l4_len, "UDP len %d checksum 0x%04hx", l4_len, be16toh(l4.udp->check));
+	if (*cf->l3_proto == IPPROTO_UDP && !*cf->l4_check)
+		*cf->l4_check = 0xffff;
+}
 
-	/* ICMPv4 checksum does not include pseudo-header */
-	} else if (*l3_proto == IPPROTO_ICMP) {
-		l4.icmp->checksum = 0;
-		l4.icmp->checksum = ones_final(ones_sum(l4.ptr, l4_len, 0));
 
-	/* ICMPv6, on the other hand, does */
-	} else if (*l3_proto == IPPROTO_ICMPV6) {
-		l4.icmp6->icmp6_cksum = 0;
-		l4.icmp6->icmp6_cksum = ones_final(ones_sum(l4.ptr, l4_len, l4_sum));
+/*	checksum()
+ * Calculate IP and protocol (tcp/udp) checksums on an ethernet frame.
+ * Returns 0 on success (was able to calculate all checksums).
+ * NOTE: all words are network (big-endian) byte order.
+ */
+enum checksum_err __attribute__((hot)) checksum(void *frame, size_t len)
+{
+	struct checksum_frame cf;
+	enum checksum_err err = checksum_parse(frame, len, &cf);
+	if (err)
+		return err;
+	checksum_full(&cf);
+	return CHK_OK;
+}
 
-	} else {
-		NB_inf("upper-level protocol not recognized");
-		return CHK_UNSUPPORTED;
+
+/*	checksum_patch()
+ * Update checksum '*check' for words in 'sum' having changed from old to new
+ * (RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m') ).
+ */
+NLC_INLINE void checksum_patch(uint16_t *check, uint32_t sum)
+{
+	*check = ones_final((uint16_t)~*check + sum);
+}
+
+
+/*	checksum_incremental()
+ * Patch checksums in 'cf' with the changes journaled in 'checksum_log'.
+ * Returns false if the changes cannot be applied incrementally
+ * (journal overflow; change to lengths, protocol, version or a checksum field;
+ * UDP without a checksum; a checksum received incomplete),
+ * in which case nothing was modified.
+ */
+static bool checksum_incremental(void *frame, struct checksum_frame *cf)
+{
+	if (checksum_log.cnt > CHECKSUM_LOG_MAX || checksum_log.partial)
+		return false;
+
+	const bool v4 = cf->l3->version == 4;
+	const size_t l3_off = sizeof(struct ethhdr);
+	const size_t l4_off = l3_off + cf->head_len;
+	const size_t l4_end = l4_off + cf->l4_len;
+	const size_t l4_check = (void *)cf->l4_check - frame;
+	/* pseudo-header addresses, as offsets from 'l3' */
+	const size_t addr_off = v4 ? 12 : 8;
+	const size_t addr_end = v4 ? 20 : 40;
+	const bool pseudo = *cf->l3_proto != IPPROTO_ICMP;
+
+	if (v4 && *cf->l3_proto == IPPROTO_UDP && !*cf->l4_check)
+		return false;
+
+	uint32_t ip_sum = 0;
+	uint32_t l4_sum = 0;
+	for (size_t i = 0; i < checksum_log.cnt; i++) {
+		struct checksum_word *w = &checksum_log.words[i];
+		if (w->old == w->new)
+			continue;
+
+		/* changed bytes which incremental update cannot express */
+		for (size_t o = w->offt; o < (size_t)w->offt + 2; o++) {
+			if (((uint8_t *)&w->old)[o - w->offt] == ((uint8_t *)&w->new)[o - w->offt])
+				continue;
+			size_t h = o - l3_off;
+			if (o == l4_check || o == l4_check + 1)
+				return false;
+			if (o >= 12 && o < l3_off) /* ethertype */
+				return false;
+			if (o >= l3_off && v4 && (h == 0 || h == 2 || h == 3 || h == 9 || h == 10 || h == 11))
+				return false;
+			if (o >= l3_off && !v4 && (h == 0 || h == 4 || h == 5 || h == 6))
+				return false;
+		}
+
+		uint16_t old = ~w->old;
+		uint16_t new = w->new;
+		if (v4 && w->offt >= l3_off && w->offt < l4_off)
+			ip_sum += old + new;
+		if (pseudo && w->offt >= l3_off + addr_off && w->offt < l3_off + addr_end)
+			l4_sum += old + new;
+		if (w->offt >= l4_off && w->offt < l4_end) {
+			/* trailing byte past the end of L4 is not checksummed */
+			if ((size_t)w->offt + 1 == l4_end) {
+				((uint8_t *)&old)[1] = 0xff;
+				((uint8_t *)&new)[1] = 0;
+			}
+			l4_sum += old + new;
+		}
 	}
 
+	if (ip_sum)
+		checksum_patch(&cf->l3->check, ip_sum);
+	if (l4_sum) {
+		checksum_patch(cf->l4_check, l4_sum);
+		if (*cf->l3_proto == IPPROTO_UDP && !*cf->l4_check)
+			*cf->l4_check = 0xffff;
+	}
+	return true;
+}
+
+
+/*	checksum_update()
+ * Bring IP and protocol checksums on an ethernet frame up to date
+ * after the writes journaled in 'checksum_log': incrementally if possible,
+ * otherwise by recomputing them entirely.
+ * Returns 0 on success, same as checksum().
+ */
+enum checksum_err __attribute__((hot)) checksum_update(void *frame, size_t len)
+{
+	struct checksum_frame cf;
+	enum checksum_err err = checksum_parse(frame, len, &cf);
+	if (err)
+		return err;
+	if (!checksum_incremental(frame, &cf))
+		checksum_full(&cf);
 	return CHK_OK;
 }
@@ -0,0 +1,665 @@
+/*	classifier.c
+ * (c) 2018 Sirio Balmelli
+ */
+
+#include <classifier.h>
+#include <operations.h>
+#include <ndebug.h>
+
+
+/*	classifier_group
+ * Control-plane form of a tuple, used only while building a classifier.
+ * @prio	: priority of the highest-priority (first) rule in group
+ * @hash_JL	: (uint64_t hash) -> (Pvoid_t prio_JL)
+ *		  where prio_JL is (uint64_t prio) -> (struct rout_set *rst)
+ * @range	: field of the interval index, 0 'len' == none
+ * @set_cnt	: number of fields in 'sets'
+ * @sets	: hashed fields, sorted so that identical groups compare equal
+ */
+struct classifier_group {
+	uint64_t		prio;
+	Pvoid_t			hash_JL;
+	struct field_set	range;
+	size_t			set_cnt;
+	struct field_set	sets[];
+};
+
+
+/*	classifier_key
+ * A hashable (exact-match) op of a rule: packet field and the value it must equal.
+ */
+struct classifier_key {
+	struct field_set	set;
+	const uint8_t		*value;
+};
+
+
+/*	classifier_key_cmp()
+ * Order keys by field, so that rules listing the same fields
+ * in a different order fall into the same tuple.
+ */
+static int classifier_key_cmp(const void *a, const void *b)
+{
+	const struct classifier_key *ka = a, *kb = b;
+	if (ka->set.bytes < kb->set.bytes)
+		return -1;
+	return ka->set.bytes > kb->set.bytes;
+}
+
+
+/*	classifier_hashable()
+ * An op can be hashed if it compares a packet field with a constant value
+ * of the same extent: only then is a packet matching exactly when its
+ * field_hash() equals the hash of the value.
+ * field_hash() only knows last-Byte masks: not fields with a 'bitmask'.
+ */
+static bool classifier_hashable(struct op *op)
+{
+	return !op->set.to
+		&& op->set.set_to.flags != OP_KERNEL_BITMASK
+		&& op->src && memref_is_value(op->src)
+		&& op->set.set_to.len
+		&& op->set.set_to.len == op->set.set_from.len
+		&& op->set.set_to.mask == op->set.set_from.mask;
+}
+
+
+/*	classifier_range()
+ * Get the field and bounds of the first range op in 'rst', if any.
+ * This is the range a rule is indexed by.
+ */
+static bool classifier_range(struct rout_set *rst, struct field_set *set,
+				uint64_t *lo, uint64_t *hi)
+{
+	JL_LOOP(&rst->match_JQ,
+		struct op *op = val;
+		if (op_range(op, lo, hi)) {
+			*set = op->set.set_to;
+			set->flags = 0;
+			return true;
+		}
+	);
+	return false;
+}
+
+
+/*	classifier_value_hash()
+ * Hash 'value' exactly as field_hash() would hash the bytes described by 'set'
+ * in a packet.
+ */
+static int classifier_value_hash(struct field_set set, const uint8_t *value, uint64_t *outhash)
+{
+	const uint8_t *start = value;
+	size_t flen = set.len;
+	/* see field.h */
+	FIELD_PACKET_HASHING
+	return 0;
+}
+
+
+/*	classifier_field()
+ * Bitmap of packet field 'set' in 'cls->fields', adding it if new.
+ * Returns 0 if there's no room, in which case 'cls' is no longer pure.
+ */
+static uint32_t classifier_field(struct classifier *cls, struct field_set set)
+{
+	set.flags = 0;
+	for (uint32_t i = 0; i < cls->field_cnt; i++) {
+		if (cls->fields[i].bytes == set.bytes)
+			return 1U << i;
+	}
+	if (cls->field_cnt == CLASSIFIER_FIELD_MAX) {
+		cls->pure = false;
+		return 0;
+	}
+	cls->fields[cls->field_cnt] = set;
+	return 1U << cls->field_cnt++;
+}
+
+
+/*	classifier_fields()
+ * Bitmap of packet fields read by the match ops of 'rst', added to 'cls'.
+ * Clears 'cls->pure' if 'rst' matches against state,
+ * compares fields of different lengths (op_match() then reads past
+ * the shorter one), or scans a window (which the end of the packet
+ * may cut short, so its bytes alone don't decide the outcome).
+ */
+static uint32_t classifier_fields(struct classifier *cls, struct rout_set *rst)
+{
+	uint32_t ret = 0;
+	JL_LOOP(&rst->match_JQ,
+		struct op *op = val;
+		if (op_is_window(op)) {
+			cls->pure = false;
+
+		/* table, set, range: read only their packet field */
+		} else if (op_is_lookup(op)) {
+			ret |= classifier_field(cls, op->set.set_to);
+
+		/* zero-length: reads nothing, always matches */
+		} else if (op->set.set_to.len || op->set.set_from.len) {
+			if (op->set.set_to.len != op->set.set_from.len)
+				cls->pure = false;
+			if (op->dst || (op->src && !memref_is_value(op->src)))
+				cls->pure = false;
+			if (!op->set.to)
+				ret |= classifier_field(cls, op->set.set_to);
+			if (!op->set.from)
+				ret |= classifier_field(cls, op->set.set_from);
+		}
+	);
+	return ret;
+}
+
+
+/*	classifier_groups_free()
+ */
+static void classifier_groups_free(Pvoid_t group_JQ)
+{
+	int __attribute__((unused)) rc;
+	JL_LOOP(&group_JQ,
+		struct classifier_group *group = val;
+		JL_LOOP(&group->hash_JL,
+			Pvoid_t prio_JL = val;
+			JLFA(rc, prio_JL);
+		);
+		JLFA(rc, group->hash_JL);
+		free(group);
+	);
+	JLFA(rc, group_JQ);
+}
+
+
+/*	classifier_group_get()
+ * Get the group hashing exactly 'keys' and indexing 'range',
+ * creating it if necessary.
+ * Since rules are inserted in priority order, new groups are enqueued
+ * in order of their first (highest-priority) rule.
+ */
+static struct classifier_group *classifier_group_get(Pvoid_t *group_JQ, uint64_t prio,
+						struct field_set range,
+						const struct classifier_key *keys, size_t cnt)
+{
+	struct classifier_group *ret = NULL;
+
+	JL_LOOP(group_JQ,
+		struct classifier_group *group = val;
+		/* NOTE: no 'continue' inside JL_LOOP, it would skip the iterator */
+		size_t j = 0;
+		while (group->set_cnt == cnt && j < cnt
+				&& group->sets[j].bytes == keys[j].set.bytes)
+			j++;
+		if (group->set_cnt == cnt && j == cnt && group->range.bytes == range.bytes)
+			return group;
+	);
+
+	NB_die_if(!(
+		ret = calloc(1, sizeof(*ret) + sizeof(ret->sets[0]) * cnt)
+		), "fail alloc size %zu", sizeof(*ret) + sizeof(ret->sets[0]) * cnt);
+	ret->prio = prio;
+	ret->range = range;
+	ret->set_cnt = cnt;
+	for (size_t j = 0; j < cnt; j++)
+		ret->sets[j] = keys[j].set;
+
+	NB_die_if(
+		jl_enqueue(group_JQ, ret)
+		, "");
+	return ret;
+die:
+	free(ret);
+	return NULL;
+}
+
+
+/*	classifier_insert()
+ * Insert 'rst' with priority 'prio' into the groups in 'group_JQ'.
+ * Returns 0 on success.
+ */
+static int classifier_insert(Pvoid_t *group_JQ, uint64_t prio, struct rout_set *rst)
+{
+	int err_cnt = 0;
+	struct classifier_key *keys = NULL;
+	size_t cnt = 0;
+
+	size_t max = jl_count(&rst->match_JQ);
+	if (max) {
+		NB_die_if(!(
+			keys = calloc(max, sizeof(*keys))
+			), "fail alloc size %zu", max * sizeof(*keys));
+	}
+	JL_LOOP(&rst->match_JQ,
+		struct op *op = val;
+		if (classifier_hashable(op)) {
+			keys[cnt].set = op->set.set_to;
+			keys[cnt].set.flags = 0;
+			keys[cnt].value = op->src->bytes;
+			cnt++;
+		}
+	);
+	qsort(keys, cnt, sizeof(*keys), classifier_key_cmp);
+
+	struct field_set range = { .bytes = 0 };
+	uint64_t lo, hi;
+	classifier_range(rst, &range, &lo, &hi);
+
+	struct classifier_group *group;
+	NB_die_if(!(
+		group = classifier_group_get(group_JQ, prio, range, keys, cnt)
+		), "");
+
+	uint64_t hash = fnv_hash64(NULL, NULL, 0);
+	for (size_t j = 0; j < cnt; j++)
+		classifier_value_hash(keys[j].set, keys[j].value, &hash);
+
+	/* rules whose values hash the same share a bucket, in priority order */
+	Pvoid_t prio_JL = jl_get(&group->hash_JL, hash);
+	NB_die_if(
+		jl_insert(&prio_JL, prio, rst, false)
+		, "duplicate priority %lu", prio);
+	NB_die_if(
+		jl_insert(&group->hash_JL, hash, prio_JL, true)
+		, "");
+
+die:
+	free(keys);
+	return err_cnt;
+}
+
+
+/*	classifier_free()
+ */
+void classifier_free(struct classifier *cls)
+{
+	if (!cls)
+		return;
+	free(cls->tuples);
+	free(cls->sets);
+	free(cls->slots);
+	free(cls->cands);
+	free(cls->segs);
+	free(cls);
+}
+
+
+/*	classifier_event
+ * A candidate entering (at the start of its range)
+ * or leaving (past the end of its range) an interval index.
+ */
+struct classifier_event {
+	uint64_t		at;
+	uint64_t		prio;
+	struct rout_set		*rst;
+	bool			enter;
+};
+
+
+/*	classifier_event_set()
+ */
+static void classifier_event_set(struct classifier_event *ev, uint64_t at,
+				uint64_t prio, struct rout_set *rst, bool enter)
+{
+	ev->at = at;
+	ev->prio = prio;
+	ev->rst = rst;
+	ev->enter = enter;
+}
+
+
+/*	classifier_event_cmp()
+ */
+static int classifier_event_cmp(const void *a, const void *b)
+{
+	const struct classifier_event *ea = a, *eb = b;
+	return ea->at < eb->at ? -1 : ea->at > eb->at;
+}
+
+
+/*	classifier_cand_set()
+ * Fill in candidate 'prio', 'rst' at '*cand_cnt' in 'cls->cands', advancing it.
+ */
+static void classifier_cand_set(struct classifier *cls, size_t *cand_cnt,
+				uint64_t prio, struct rout_set *rst)
+{
+	struct classifier_cand *cand = &cls->cands[(*cand_cnt)++];
+	cand->prio = prio;
+	cand->rst = rst;
+	cand->fields = classifier_fields(cls, rst);
+}
+
+
+/*	classifier_segs()
+ * Build the interval index of the candidates in 'prio_JL',
+ * which all have a range on the same field (see classifier_range()).
+ * Segments start at 0 and at every range start and end + 1,
+ * where the set of candidates covering them changes.
+ * Past CLASSIFIER_SEG_FACTOR (see classifier.h) there is only one segment,
+ * holding all candidates.
+ * Segments are written to 'segs' and their candidates to 'cls->cands'
+ * at '*cand_cnt', unless 'segs' is NULL, when they are only counted.
+ * In both cases '*cand_cnt' is advanced.
+ * Returns the number of segments, 0 on failure.
+ */
+static uint32_t classifier_segs(struct classifier *cls, Pvoid_t prio_JL,
+				struct classifier_seg *segs, size_t *cand_cnt)
+{
+	uint32_t ret = 0;
+	Pvoid_t active_JL = NULL; /* (uint64_t prio) -> (struct rout_set *rst) */
+	size_t n = jl_count(&prio_JL);
+	size_t ev_cnt = 0;
+	struct classifier_event *evs = NULL;
+	NB_die_if(!(
+		evs = calloc(n * 2, sizeof(*evs))
+		), "fail alloc interval index of %zu candidates", n);
+
+	JL_LOOP(&prio_JL,
+		struct field_set set;
+		uint64_t lo;
+		uint64_t hi;
+		classifier_range(val, &set, &lo, &hi);
+		classifier_event_set(&evs[ev_cnt++], lo, index, val, true);
+		if (hi < UINT64_MAX)
+			classifier_event_set(&evs[ev_cnt++], hi + 1, index, val, false);
+	);
+	qsort(evs, ev_cnt, sizeof(*evs), classifier_event_cmp);
+
+	/* size the index without building it: a sweep over the events */
+	size_t seg_cnt = evs[0].at ? 1 : 0;
+	size_t total = 0, active = 0;
+	for (size_t e = 0; e < ev_cnt; seg_cnt++, total += active) {
+		uint64_t at = evs[e].at;
+		for (; e < ev_cnt && evs[e].at == at; e++)
+			active = evs[e].enter ? active + 1 : active - 1;
+	}
+
+	/* nested or overlapping ranges: don't index, verify every candidate */
+	if (total > n * CLASSIFIER_SEG_FACTOR) {
+		if (segs) {
+			segs[0] = (struct classifier_seg){ .lo = 0, .first = *cand_cnt, .cnt = n };
+			JL_LOOP(&prio_JL,
+				classifier_cand_set(cls, cand_cnt, index, val);
+			);
+		} else {
+			*cand_cnt += n;
+		}
+		ret = 1;
+		goto die;
+	}
+	if (!segs) {
+		*cand_cnt += total;
+		ret = seg_cnt;
+		goto die;
+	}
+
+	if (evs[0].at)
+		segs[ret++] = (struct classifier_seg){ .lo = 0, .first = *cand_cnt, .cnt = 0 };
+	for (size_t e = 0; e < ev_cnt; ret++) {
+		uint64_t at = evs[e].at;
+		for (; e < ev_cnt && evs[e].at == at; e++) {
+			if (evs[e].enter) {
+				NB_die_if(
+					jl_insert(&active_JL, evs[e].prio, evs[e].rst, false)
+					, "");
+			} else {
+				j_delete(&active_JL, evs[e].prio);
+			}
+		}
+		segs[ret] = (struct classifier_seg){ .lo = at, .first = *cand_cnt };
+		JL_LOOP(&active_JL,
+			classifier_cand_set(cls, cand_cnt, index, val);
+		);
+		segs[ret].cnt = *cand_cnt - segs[ret].first;
+	}
+
+die:
+	free(evs);
+	int __attribute__((unused)) rc;
+	JLFA(rc, active_JL);
+	return ret;
+}
+
+
+/*	classifier_compile()
+ * Flatten 'group_JQ' into the contiguous arrays of 'ret'.
+ * Each group becomes a tuple whose hash table is sized to a power of 2
+ * at least twice the number of buckets, so probing always finds an empty slot.
+ * The buckets of a group with a range field each get an interval index.
+ */
+static int classifier_compile(struct classifier *ret, Pvoid_t group_JQ)
+{
+	int err_cnt = 0;
+	size_t set_cnt = 0, slot_cnt = 0, cand_cnt = 0, seg_cnt = 0;
+	ret->tuple_cnt = jl_count(&group_JQ);
+	JL_LOOP(&group_JQ,
+		struct classifier_group *group = val;
+		set_cnt += group->set_cnt;
+		size_t size = 2;
+		while (size < 2 * jl_count(&group->hash_JL))
+			size <<= 1;
+		slot_cnt += size;
+		JL_LOOP(&group->hash_JL,
+			Pvoid_t prio_JL = val;
+			if (group->range.len) {
+				uint32_t segs;
+				NB_die_if(!(
+					segs = classifier_segs(ret, prio_JL, NULL, &cand_cnt)
+					), "");
+				seg_cnt += segs;
+			} else {
+				cand_cnt += jl_count(&prio_JL);
+			}
+		);
+	);
+	NB_die_if(slot_cnt > UINT32_MAX || cand_cnt > UINT32_MAX || seg_cnt > UINT32_MAX,
+		"classifier too large: %zu slots %zu candidates %zu segments",
+		slot_cnt, cand_cnt, seg_cnt);
+
+	NB_die_if(!(
+		(ret->tuples = calloc(ret->tuple_cnt, sizeof(*ret->tuples)))
+		&& (ret->sets = calloc(set_cnt, sizeof(*ret->sets)))
+		&& (ret->slots = calloc(slot_cnt, sizeof(*ret->slots)))
+		&& (ret->cands = calloc(cand_cnt, sizeof(*ret->cands)))
+		&& (ret->segs = calloc(seg_cnt, sizeof(*ret->segs)))
+		), "fail alloc %zu tuples %zu sets %zu slots %zu candidates %zu segments",
+		ret->tuple_cnt, set_cnt, slot_cnt, cand_cnt, seg_cnt);
+
+	set_cnt = slot_cnt = cand_cnt = seg_cnt = 0;
+	JL_LOOP(&group_JQ,
+		struct classifier_group *group = val;
+		struct classifier_tuple *tuple = &ret->tuples[i];
+		tuple->prio = group->prio;
+		tuple->set_first = set_cnt;
+		tuple->set_cnt = group->set_cnt;
+		memcpy(&ret->sets[set_cnt], group->sets, sizeof(group->sets[0]) * group->set_cnt);
+		set_cnt += group->set_cnt;
+		for (size_t j = 0; j < group->set_cnt; j++)
+			tuple->fields |= classifier_field(ret, group->sets[j]);
+		tuple->range = group->range;
+		if (group->range.len)
+			tuple->fields |= classifier_field(ret, group->range);
+
+		size_t size = 2;
+		while (size < 2 * jl_count(&group->hash_JL))
+			size <<= 1;
+		tuple->slot_first = slot_cnt;
+		tuple->slot_mask = size - 1;
+		struct classifier_slot *slots = &ret->slots[slot_cnt];
+		slot_cnt += size;
+
+		JL_LOOP(&group->hash_JL,
+			uint64_t hash = index;
+			Pvoid_t prio_JL = val;
+			uint32_t j = hash & tuple->slot_mask;
+			while (slots[j].cnt)
+				j = (j + 1) & tuple->slot_mask;
+			slots[j].hash = hash;
+			if (group->range.len) {
+				slots[j].first = seg_cnt;
+				NB_die_if(!(
+					slots[j].cnt = classifier_segs(ret, prio_JL,
+							&ret->segs[seg_cnt], &cand_cnt)
+					), "");
+				seg_cnt += slots[j].cnt;
+			} else {
+				slots[j].first = cand_cnt;
+				slots[j].cnt = jl_count(&prio_JL);
+				JL_LOOP(&prio_JL,
+					ret->cands[cand_cnt].prio = index;
+					ret->cands[cand_cnt].rst = val;
+					ret->cands[cand_cnt].fields = classifier_fields(ret, val);
+					cand_cnt++;
+				);
+			}
+		);
+	);
+
+die:
+	return err_cnt;
+}
+
+
+/*	classifier_new()
+ * Build a classifier for all rules in 'rout_set_JQ';
+ * their sequence number in 'rout_set_JQ' is their priority.
+ * Does NOT take charge of 'rout_set_JQ', which must outlive the classifier.
+ */
+struct classifier *classifier_new(Pvoid_t rout_set_JQ)
+{
+	struct classifier *ret = NULL;
+	Pvoid_t group_JQ = NULL;
+
+	NB_die_if(!(
+		ret = calloc(1, sizeof(*ret))
+		), "fail alloc size %zu", sizeof(*ret));
+	ret->pure = true;
+
+	JL_LOOP(&rout_set_JQ,
+		NB_die_if(
+			classifier_insert(&group_JQ, index, val)
+			, "");
+	);
+	NB_die_if(
+		classifier_compile(ret, group_JQ)
+		, "");
+
+	NB_inf("%zu rules in %zu tuples, %u fields%s", jl_count(&rout_set_JQ),
+		ret->tuple_cnt, ret->field_cnt, ret->pure ? "" : " (impure)");
+	classifier_groups_free(group_JQ);
+	return ret;
+die:
+	classifier_groups_free(group_JQ);
+	classifier_free(ret);
+	return NULL;
+}
+
+
+/*	classifier_range_value()
+ * Read the value of range field 'set' in 'pkt' (see op_range_value()).
+ * Returns non-zero if the field lies (partly) outside the packet.
+ */
+NLC_INLINE
+int classifier_range_value(const uint8_t *pkt, size_t plen, struct field_set set, uint64_t *out)
+{
+	FIELD_PACKET_INDEXING
+	*out = op_range_value(start, flen, set.mask);
+	return 0;
+}
+
+
+/*	classifier_seg_find()
+ * The segment of 'segs' (of which there are 'cnt', the first starting at 0)
+ * containing 'v'.
+ */
+NLC_INLINE
+const struct classifier_seg *classifier_seg_find(const struct classifier_seg *segs,
+						uint32_t cnt, uint64_t v)
+{
+	uint32_t lo = 0, hi = cnt;
+	while (hi - lo > 1) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (segs[mid].lo <= v)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return &segs[lo];
+}
+
+
+/*	classifier_tuple_lookup()
+ * Look up 'pkt' in 'tuple', returning the first candidate which matches
+ * and has a priority better than '*best' (which is then updated).
+ * Adds all packet fields read to '*fields'.
+ */
+static struct rout_set __attribute__((hot)) *classifier_tuple_lookup(
+						const struct classifier *cls,
+						const struct classifier_tuple *tuple,
+						const void *pkt, size_t plen,
+						uint64_t *best, uint32_t *fields)
+{
+	*fields |= tuple->fields;
+
+	const struct field_set *sets = &cls->sets[tuple->set_first];
+	uint64_t hash = fnv_hash64(NULL, NULL, 0);
+	for (uint32_t j = 0; j < tuple->set_cnt; j++) {
+		/* packet too short for a field: no rule in tuple can match */
+		if (field_hash(sets[j], pkt, plen, &hash))
+			return NULL;
+	}
+
+	const struct classifier_slot *slots = &cls->slots[tuple->slot_first];
+	uint32_t j = hash & tuple->slot_mask;
+	while (slots[j].cnt && slots[j].hash != hash)
+		j = (j + 1) & tuple->slot_mask;
+
+	uint32_t first = slots[j].first;
+	uint32_t cnt = slots[j].cnt;
+	/* interval index: only candidates whose range holds the packet value */
+	if (tuple->range.len && cnt) {
+		uint64_t v;
+		/* packet too short for the field: no rule in tuple can match */
+		if (classifier_range_value(pkt, plen, tuple->range, &v))
+			return NULL;
+		const struct classifier_seg *seg = classifier_seg_find(&cls->segs[first], cnt, v);
+		first = seg->first;
+		cnt = seg->cnt;
+	}
+
+	const struct classifier_cand *cand = &cls->cands[first];
+	for (uint32_t k = 0; k < cnt && cand[k].prio < *best; k++) {
+		/* resolves hash collisions and checks any non-hashed ops */
+		*fields |= cand[k].fields;
+		if (rout_set_match(cand[k].rst, pkt, plen)) {
+			*best = cand[k].prio;
+			return cand[k].rst;
+		}
+	}
+	return NULL;
+}
+
+
+/*	classifier_lookup()
+ * Return the highest-priority rule matching 'pkt', or NULL if none match.
+ * If 'fields' is given, it is set to the bitmap of packet fields
+ * the result was decided by: if 'cls' is pure, any packet with the same
+ * bytes in these fields (and the same ones out of bounds) gets the same result.
+ */
+struct rout_set __attribute__((hot)) *classifier_lookup(struct classifier *cls,
+							const void *pkt, size_t plen,
+							uint32_t *fields)
+{
+	struct rout_set *ret = NULL;
+	uint64_t best = UINT64_MAX;
+	uint32_t read = 0;
+
+	/* tuples are sorted by their best priority: stop when none left can do better */
+	for (size_t t = 0; t < cls->tuple_cnt && cls->tuples[t].prio < best; t++) {
+		struct rout_set *rst = classifier_tuple_lookup(cls, &cls->tuples[t], pkt, plen,
+								&best, &read);
+		if (rst)
+			ret = rst;
+	}
+	if (fields)
+		*fields = read;
+	return ret;
+}
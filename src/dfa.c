@@ -0,0 +1,761 @@
+/*	dfa.c
+ * (c) 2018 Sirio Balmelli
+ */
+
+#include <dfa.h>
+#include <ndebug.h>
+#include <nstring.h>
+#include <fnv.h>
+
+
+#define DFA_NONE UINT32_MAX /* dangling NFA transition */
+
+/*	dfa_frag
+ * Part of the NFA under construction: 'end' is always an EPS state
+ * whose 'out' is still dangling.
+ */
+struct dfa_frag {
+	uint32_t	start;
+	uint32_t	end;
+};
+
+/*	dfa_parse
+ * @p	: next character to parse
+ * @end	: end of the expression (before any '$' anchor)
+ */
+struct dfa_parse {
+	struct dfa	*dfa;
+	const char	*pattern;
+	const char	*p;
+	const char	*end;
+};
+
+
+/*	dfa_set_has()
+ */
+NLC_INLINE bool dfa_set_has(const uint64_t *set, uint32_t i)
+{
+	return set[i >> 6] & 1ULL << (i & 63);
+}
+
+/*	dfa_set_add()
+ */
+NLC_INLINE void dfa_set_add(uint64_t *set, uint32_t i)
+{
+	set[i >> 6] |= 1ULL << (i & 63);
+}
+
+
+/*	dfa_free()
+ */
+void dfa_free(struct dfa *dfa)
+{
+	if (!dfa)
+		return;
+	free(dfa->pattern);
+	free(dfa->nfa);
+	free(dfa->closure);
+	free(dfa->delta);
+	free(dfa->accept);
+	free(dfa->sets);
+	free(dfa);
+}
+
+
+/*	dfa_nfa_add()
+ * Returns index of new NFA state, DFA_NONE if there's no room.
+ */
+static uint32_t dfa_nfa_add(struct dfa *dfa, enum dfa_nfa_type type)
+{
+	if (dfa->nfa_cnt == DFA_NFA_MAX)
+		return DFA_NONE;
+	struct dfa_nfa *nfa = &dfa->nfa[dfa->nfa_cnt];
+	memset(nfa, 0x0, sizeof(*nfa));
+	nfa->type = type;
+	nfa->out = nfa->out1 = DFA_NONE;
+	return dfa->nfa_cnt++;
+}
+
+
+/* Thompson construction: each returns non-zero if the NFA is full.
+ */
+static int dfa_frag_eps(struct dfa *dfa, struct dfa_frag *out)
+{
+	uint32_t e = dfa_nfa_add(dfa, DFA_NFA_EPS);
+	if (e == DFA_NONE)
+		return 1;
+	*out = (struct dfa_frag){ .start = e, .end = e };
+	return 0;
+}
+
+static int dfa_frag_set(struct dfa *dfa, const uint64_t set[4], struct dfa_frag *out)
+{
+	uint32_t b = dfa_nfa_add(dfa, DFA_NFA_BYTE);
+	uint32_t e = dfa_nfa_add(dfa, DFA_NFA_EPS);
+	if (b == DFA_NONE || e == DFA_NONE)
+		return 1;
+	memcpy(dfa->nfa[b].set, set, sizeof(dfa->nfa[b].set));
+	dfa->nfa[b].out = e;
+	*out = (struct dfa_frag){ .start = b, .end = e };
+	return 0;
+}
+
+static void dfa_frag_concat(struct dfa *dfa, struct dfa_frag *a, struct dfa_frag b)
+{
+	dfa->nfa[a->end].out = b.start;
+	a->end = b.end;
+}
+
+static int dfa_frag_alt(struct dfa *dfa, struct dfa_frag *a, struct dfa_frag b)
+{
+	uint32_t s = dfa_nfa_add(dfa, DFA_NFA_SPLIT);
+	uint32_t e = dfa_nfa_add(dfa, DFA_NFA_EPS);
+	if (s == DFA_NONE || e == DFA_NONE)
+		return 1;
+	dfa->nfa[s].out = a->start;
+	dfa->nfa[s].out1 = b.start;
+	dfa->nfa[a->end].out = e;
+	dfa->nfa[b.end].out = e;
+	*a = (struct dfa_frag){ .start = s, .end = e };
+	return 0;
+}
+
+static int dfa_frag_star(struct dfa *dfa, struct dfa_frag *a)
+{
+	uint32_t s = dfa_nfa_add(dfa, DFA_NFA_SPLIT);
+	uint32_t e = dfa_nfa_add(dfa, DFA_NFA_EPS);
+	if (s == DFA_NONE || e == DFA_NONE)
+		return 1;
+	dfa->nfa[s].out = a->start;
+	dfa->nfa[s].out1 = e;
+	dfa->nfa[a->end].out = s;
+	*a = (struct dfa_frag){ .start = s, .end = e };
+	return 0;
+}
+
+static int dfa_frag_plus(struct dfa *dfa, struct dfa_frag *a)
+{
+	uint32_t s = dfa_nfa_add(dfa, DFA_NFA_SPLIT);
+	uint32_t e = dfa_nfa_add(dfa, DFA_NFA_EPS);
+	if (s == DFA_NONE || e == DFA_NONE)
+		return 1;
+	dfa->nfa[s].out = a->start;
+	dfa->nfa[s].out1 = e;
+	dfa->nfa[a->end].out = s;
+	a->end = e;
+	return 0;
+}
+
+static int dfa_frag_quest(struct dfa *dfa, struct dfa_frag *a)
+{
+	uint32_t s = dfa_nfa_add(dfa, DFA_NFA_SPLIT);
+	if (s == DFA_NONE)
+		return 1;
+	dfa->nfa[s].out = a->start;
+	dfa->nfa[s].out1 = a->end;
+	a->start = s;
+	return 0;
+}
+
+
+/*	dfa_parse_hex()
+ */
+static int dfa_parse_hex(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/*	dfa_parse_escape()
+ * Parse the escape after a '\' at 'ps->p', adding its Bytes to 'set'.
+ * Returns the Byte if it is a single one, -1 if it is a class (e.g. '\d'),
+ * -2 on error.
+ */
+static int dfa_parse_escape(struct dfa_parse *ps, uint64_t set[4])
+{
+	int err_cnt = 0;
+	NB_die_if(ps->p == ps->end, "'%s': trailing '\\'", ps->pattern);
+	char c = *ps->p++;
+
+	uint64_t cls[4] = { 0 };
+	switch (c) {
+	case 'x':
+	{
+		int hi = ps->end - ps->p >= 2 ? dfa_parse_hex(ps->p[0]) : -1;
+		int lo = hi >= 0 ? dfa_parse_hex(ps->p[1]) : -1;
+		NB_die_if(lo < 0, "'%s': '\\x' needs 2 hex digits", ps->pattern);
+		ps->p += 2;
+		dfa_set_add(set, hi << 4 | lo);
+		return hi << 4 | lo;
+	}
+	case 'n':	dfa_set_add(set, '\n');	return '\n';
+	case 'r':	dfa_set_add(set, '\r');	return '\r';
+	case 't':	dfa_set_add(set, '\t');	return '\t';
+	case 'd':
+	case 'D':
+		for (int b = '0'; b <= '9'; b++)
+			dfa_set_add(cls, b);
+		break;
+	case 'w':
+	case 'W':
+		for (int b = 0; b < 256; b++) {
+			if ((b >= '0' && b <= '9') || (b >= 'a' && b <= 'z')
+					|| (b >= 'A' && b <= 'Z') || b == '_')
+				dfa_set_add(cls, b);
+		}
+		break;
+	case 's':
+	case 'S':
+	{
+		const char space[] = " \t\n\r\f\v";
+		for (unsigned int i = 0; i < sizeof(space) - 1; i++)
+			dfa_set_add(cls, space[i]);
+		break;
+	}
+	default:
+		/* letters and digits are reserved for future escapes */
+		NB_die_if((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'),
+			"'%s': unknown escape '\\%c'", ps->pattern, c);
+		dfa_set_add(set, (uint8_t)c);
+		return (uint8_t)c;
+	}
+
+	bool negate = c == 'D' || c == 'W' || c == 'S';
+	for (unsigned int i = 0; i < 4; i++)
+		set[i] |= negate ? ~cls[i] : cls[i];
+	return -1;
+die:
+	return -2;
+}
+
+/*	dfa_parse_class()
+ * Parse a '[...]' Byte class, 'ps->p' being just past the '['.
+ */
+static int dfa_parse_class(struct dfa_parse *ps, uint64_t set[4])
+{
+	int err_cnt = 0;
+	bool negate = false;
+	if (ps->p < ps->end && *ps->p == '^') {
+		negate = true;
+		ps->p++;
+	}
+
+	/* a leading ']' is literal */
+	bool first = true;
+	while (ps->p < ps->end && (*ps->p != ']' || first)) {
+		first = false;
+		int lo = (uint8_t)*ps->p++;
+		if (lo == '\\') {
+			NB_die_if((lo = dfa_parse_escape(ps, set)) == -2, "");
+		} else {
+			dfa_set_add(set, lo);
+		}
+
+		if (ps->end - ps->p < 2 || ps->p[0] != '-' || ps->p[1] == ']')
+			continue;
+		ps->p++;
+		int hi = (uint8_t)*ps->p++;
+		if (hi == '\\') {
+			uint64_t tmp[4] = { 0 };
+			NB_die_if((hi = dfa_parse_escape(ps, tmp)) == -2, "");
+		}
+		NB_die_if(lo < 0 || hi < 0, "'%s': range of a class", ps->pattern);
+		NB_die_if(lo > hi, "'%s': range '%c-%c' is empty", ps->pattern, lo, hi);
+		for (int b = lo; b <= hi; b++)
+			dfa_set_add(set, b);
+	}
+	NB_die_if(ps->p == ps->end, "'%s': unterminated '['", ps->pattern);
+	ps->p++;
+
+	if (negate) {
+		for (unsigned int i = 0; i < 4; i++)
+			set[i] = ~set[i];
+	}
+die:
+	return err_cnt;
+}
+
+static int dfa_parse_alt(struct dfa_parse *ps, struct dfa_frag *out);
+
+/*	dfa_parse_atom()
+ */
+static int dfa_parse_atom(struct dfa_parse *ps, struct dfa_frag *out)
+{
+	int err_cnt = 0;
+	uint64_t set[4] = { 0 };
+	char c = *ps->p++;
+
+	switch (c) {
+	case '(':
+		NB_die_if(dfa_parse_alt(ps, out), "");
+		NB_die_if(ps->p == ps->end || *ps->p != ')', "'%s': unmatched '('", ps->pattern);
+		ps->p++;
+		return 0;
+	case '[':
+		NB_die_if(dfa_parse_class(ps, set), "");
+		break;
+	case '.':
+		memset(set, 0xff, sizeof(set));
+		break;
+	case '\\':
+		NB_die_if(dfa_parse_escape(ps, set) == -2, "");
+		break;
+	case '*':
+	case '+':
+	case '?':
+	case '{':
+		NB_die("'%s': nothing to repeat before '%c'", ps->pattern, c);
+	case '^':
+	case '$':
+		NB_die("'%s': '%c' only allowed at the %s", ps->pattern, c,
+			c == '^' ? "start" : "end");
+	default:
+		dfa_set_add(set, (uint8_t)c);
+	}
+	NB_die_if(dfa_frag_set(ps->dfa, set, out),
+		"'%s': more than %d NFA states", ps->pattern, DFA_NFA_MAX);
+die:
+	return err_cnt;
+}
+
+/*	dfa_parse_count()
+ * Parse a decimal repeat count.
+ */
+static int dfa_parse_count(struct dfa_parse *ps, long *count)
+{
+	int err_cnt = 0;
+	NB_die_if(ps->p == ps->end || *ps->p < '0' || *ps->p > '9',
+		"'%s': bad '{m,n}'", ps->pattern);
+	*count = 0;
+	while (ps->p < ps->end && *ps->p >= '0' && *ps->p <= '9') {
+		*count = *count * 10 + *ps->p++ - '0';
+		NB_die_if(*count > DFA_REPEAT_MAX,
+			"'%s': repeat count larger than %d", ps->pattern, DFA_REPEAT_MAX);
+	}
+die:
+	return err_cnt;
+}
+
+/*	dfa_parse_repeat()
+ * An atom, optionally followed by one repetition.
+ * '{m,n}' is expanded: the atom is parsed again for each copy.
+ */
+static int dfa_parse_repeat(struct dfa_parse *ps, struct dfa_frag *out)
+{
+	int err_cnt = 0;
+	struct dfa *dfa = ps->dfa;
+	const char *atom = ps->p;
+	NB_die_if(dfa_parse_atom(ps, out), "");
+	if (ps->p == ps->end)
+		return 0;
+
+	int full = 0;
+	switch (*ps->p) {
+	case '*':
+		ps->p++;
+		full = dfa_frag_star(dfa, out);
+		break;
+	case '+':
+		ps->p++;
+		full = dfa_frag_plus(dfa, out);
+		break;
+	case '?':
+		ps->p++;
+		full = dfa_frag_quest(dfa, out);
+		break;
+	case '{':
+	{
+		long m, n;
+		ps->p++;
+		NB_die_if(dfa_parse_count(ps, &m), "");
+		n = m;
+		if (ps->p < ps->end && *ps->p == ',') {
+			ps->p++;
+			n = -1; /* unbounded */
+			if (ps->p < ps->end && *ps->p != '}')
+				NB_die_if(dfa_parse_count(ps, &n), "");
+		}
+		NB_die_if(ps->p == ps->end || *ps->p != '}', "'%s': bad '{m,n}'", ps->pattern);
+		NB_die_if(n >= 0 && n < m, "'%s': '{%ld,%ld}' is empty", ps->pattern, m, n);
+		const char *after = ++ps->p;
+
+		/* first copy is already parsed */
+		struct dfa_frag copy = *out;
+		if (!m && !n) {
+			full = dfa_frag_eps(dfa, out);
+			break;
+		} else if (!m) {
+			full = n < 0 ? dfa_frag_star(dfa, out) : dfa_frag_quest(dfa, out);
+		}
+		for (long i = 1; !full && i < (n < 0 ? m + 1 : n); i++) {
+			ps->p = atom;
+			NB_die_if(dfa_parse_atom(ps, &copy), "");
+			if (i >= m)
+				full = n < 0 ? dfa_frag_star(dfa, &copy) : dfa_frag_quest(dfa, &copy);
+			dfa_frag_concat(dfa, out, copy);
+		}
+		ps->p = after;
+		break;
+	}
+	default:
+		return 0;
+	}
+	NB_die_if(full, "'%s': more than %d NFA states", ps->pattern, DFA_NFA_MAX);
+	NB_die_if(ps->p < ps->end && strchr("*+?{", *ps->p),
+		"'%s': nested repetition: use '( )'", ps->pattern);
+die:
+	return err_cnt;
+}
+
+/*	dfa_parse_concat()
+ */
+static int dfa_parse_concat(struct dfa_parse *ps, struct dfa_frag *out)
+{
+	int err_cnt = 0;
+	bool empty = true;
+	while (ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+		struct dfa_frag next;
+		NB_die_if(dfa_parse_repeat(ps, &next), "");
+		if (empty)
+			*out = next;
+		else
+			dfa_frag_concat(ps->dfa, out, next);
+		empty = false;
+	}
+	if (empty) {
+		NB_die_if(dfa_frag_eps(ps->dfa, out),
+			"'%s': more than %d NFA states", ps->pattern, DFA_NFA_MAX);
+	}
+die:
+	return err_cnt;
+}
+
+/*	dfa_parse_alt()
+ */
+static int dfa_parse_alt(struct dfa_parse *ps, struct dfa_frag *out)
+{
+	int err_cnt = 0;
+	NB_die_if(dfa_parse_concat(ps, out), "");
+	while (ps->p < ps->end && *ps->p == '|') {
+		ps->p++;
+		struct dfa_frag next;
+		NB_die_if(dfa_parse_concat(ps, &next), "");
+		NB_die_if(dfa_frag_alt(ps->dfa, out, next),
+			"'%s': more than %d NFA states", ps->pattern, DFA_NFA_MAX);
+	}
+die:
+	return err_cnt;
+}
+
+
+/*	dfa_nfa_build()
+ * Parse 'dfa->pattern' into the NFA of 'dfa'.
+ */
+static int dfa_nfa_build(struct dfa *dfa)
+{
+	int err_cnt = 0;
+	size_t len = strlen(dfa->pattern);
+	struct dfa_parse ps = {
+		.dfa = dfa,
+		.pattern = dfa->pattern,
+		.p = dfa->pattern,
+		.end = dfa->pattern + len
+	};
+
+	if (len && *ps.p == '^') {
+		dfa->anchor_start = true;
+		ps.p++;
+	}
+	/* a '$' is an anchor unless escaped by an odd number of '\' */
+	if (ps.end > ps.p && ps.end[-1] == '$') {
+		size_t slashes = 0;
+		while (ps.end - 1 - slashes > ps.p && ps.end[-2 - (long)slashes] == '\\')
+			slashes++;
+		if (!(slashes & 1)) {
+			dfa->anchor_end = true;
+			ps.end--;
+		}
+	}
+
+	NB_die_if(!(
+		dfa->nfa = calloc(DFA_NFA_MAX, sizeof(*dfa->nfa))
+		), "fail alloc size %zu", DFA_NFA_MAX * sizeof(*dfa->nfa));
+
+	struct dfa_frag frag;
+	NB_die_if(dfa_parse_alt(&ps, &frag), "");
+	NB_die_if(ps.p != ps.end, "'%s': unmatched ')'", dfa->pattern);
+	NB_die_if((dfa->match = dfa_nfa_add(dfa, DFA_NFA_MATCH)) == DFA_NONE,
+		"'%s': more than %d NFA states", dfa->pattern, DFA_NFA_MAX);
+	dfa->nfa[frag.end].out = dfa->match;
+	dfa->start = frag.start;
+
+	struct dfa_nfa *shrunk = realloc(dfa->nfa, dfa->nfa_cnt * sizeof(*dfa->nfa));
+	if (shrunk)
+		dfa->nfa = shrunk;
+die:
+	return err_cnt;
+}
+
+/*	dfa_closure_build()
+ * For every NFA state, the BYTE and MATCH states reachable without
+ * consuming a Byte.
+ */
+static int dfa_closure_build(struct dfa *dfa)
+{
+	int err_cnt = 0;
+	uint32_t *stack = NULL;
+	uint64_t *seen = NULL;
+	dfa->words = (dfa->nfa_cnt + 63) / 64;
+	NB_die_if(!(
+		(dfa->closure = calloc((size_t)dfa->nfa_cnt * dfa->words, sizeof(*dfa->closure)))
+		&& (stack = calloc((size_t)dfa->nfa_cnt * 2 + 1, sizeof(*stack)))
+		&& (seen = calloc(dfa->words, sizeof(*seen)))
+		), "fail alloc closure of %u NFA states", dfa->nfa_cnt);
+
+	for (uint32_t s = 0; s < dfa->nfa_cnt; s++) {
+		uint64_t *closure = &dfa->closure[(size_t)s * dfa->words];
+		memset(seen, 0x0, dfa->words * sizeof(*seen));
+		size_t top = 0;
+		stack[top++] = s;
+		while (top) {
+			uint32_t i = stack[--top];
+			if (i == DFA_NONE || dfa_set_has(seen, i))
+				continue;
+			dfa_set_add(seen, i);
+			const struct dfa_nfa *nfa = &dfa->nfa[i];
+			if (nfa->type == DFA_NFA_BYTE || nfa->type == DFA_NFA_MATCH) {
+				dfa_set_add(closure, i);
+			} else {
+				/* each state is pushed at most once per out: no overflow */
+				stack[top++] = nfa->out;
+				if (nfa->type == DFA_NFA_SPLIT)
+					stack[top++] = nfa->out1;
+			}
+		}
+	}
+die:
+	free(stack);
+	free(seen);
+	return err_cnt;
+}
+
+/*	dfa_classes_build()
+ * Split Bytes into classes which no BYTE state tells apart.
+ */
+static void dfa_classes_build(struct dfa *dfa)
+{
+	dfa->class_cnt = 1;
+	for (uint32_t s = 0; s < dfa->nfa_cnt; s++) {
+		if (dfa->nfa[s].type != DFA_NFA_BYTE)
+			continue;
+		uint16_t remap[256][2];
+		memset(remap, 0xff, sizeof(remap));
+		uint32_t cnt = 0;
+		for (unsigned int b = 0; b < 256; b++) {
+			uint16_t *to = &remap[dfa->classes[b]][dfa_set_has(dfa->nfa[s].set, b)];
+			if (*to == UINT16_MAX)
+				*to = cnt++;
+			dfa->classes[b] = *to;
+		}
+		dfa->class_cnt = cnt;
+	}
+}
+
+/*	dfa_step()
+ * The set of NFA states after Byte 'b' from the set 'cur'.
+ * Returns true if it is not empty.
+ */
+static bool dfa_step(const struct dfa *dfa, const uint64_t *cur, uint8_t b, uint64_t *next)
+{
+	if (dfa->anchor_start)
+		memset(next, 0x0, dfa->words * sizeof(*next));
+	else
+		memcpy(next, &dfa->closure[(size_t)dfa->start * dfa->words],
+			dfa->words * sizeof(*next));
+
+	for (uint32_t w = 0; w < dfa->words; w++) {
+		for (uint64_t bits = cur[w]; bits; bits &= bits - 1) {
+			const struct dfa_nfa *nfa = &dfa->nfa[w * 64 + __builtin_ctzll(bits)];
+			if (nfa->type != DFA_NFA_BYTE || !dfa_set_has(nfa->set, b))
+				continue;
+			const uint64_t *closure = &dfa->closure[(size_t)nfa->out * dfa->words];
+			for (uint32_t i = 0; i < dfa->words; i++)
+				next[i] |= closure[i];
+		}
+	}
+
+	uint64_t any = 0;
+	for (uint32_t w = 0; w < dfa->words; w++)
+		any |= next[w];
+	return any;
+}
+
+/*	dfa_state_find()
+ * Index of the DFA state with NFA states 'set', adding it if there is room
+ * (DFA_STATE_SPILL otherwise).
+ * 'slots' is an open-addressing table of 'slot_mask + 1' state indices.
+ */
+static uint16_t dfa_state_find(struct dfa *dfa, const uint64_t *set,
+				uint16_t *slots, uint32_t slot_mask)
+{
+	size_t bytes = dfa->words * sizeof(*set);
+	uint64_t hash = fnv_hash64(NULL, NULL, 0);
+	hash = fnv_hash64(&hash, set, bytes);
+
+	uint32_t i = hash & slot_mask;
+	for (; slots[i]; i = (i + 1) & slot_mask) {
+		if (!memcmp(&dfa->sets[(size_t)slots[i] * dfa->words], set, bytes))
+			return slots[i];
+	}
+	if (dfa->state_cnt == DFA_STATES_MAX)
+		return DFA_STATE_SPILL;
+
+	uint16_t state = dfa->state_cnt++;
+	memcpy(&dfa->sets[(size_t)state * dfa->words], set, bytes);
+	dfa->accept[state] = dfa_set_has(set, dfa->match);
+	slots[i] = state;
+	return state;
+}
+
+/*	dfa_states_build()
+ * Subset construction, breadth first, up to DFA_STATES_MAX states.
+ * Without '$', a transition into a state holding 'match' is DFA_STATE_HIT.
+ */
+static int dfa_states_build(struct dfa *dfa)
+{
+	int err_cnt = 0;
+	uint16_t *slots = NULL;
+	uint64_t *next = NULL;
+	const uint32_t slot_mask = DFA_STATES_MAX * 2 - 1;
+	NB_die_if(!(
+		(dfa->sets = calloc((size_t)DFA_STATES_MAX * dfa->words, sizeof(*dfa->sets)))
+		&& (dfa->delta = calloc((size_t)DFA_STATES_MAX * dfa->class_cnt, sizeof(*dfa->delta)))
+		&& (dfa->accept = calloc(DFA_STATES_MAX, sizeof(*dfa->accept)))
+		&& (slots = calloc(slot_mask + 1, sizeof(*slots)))
+		&& (next = calloc(dfa->words, sizeof(*next)))
+		), "fail alloc %d DFA states", DFA_STATES_MAX);
+
+	/* state 0 (dead) has an empty set and only leads to itself */
+	dfa->state_cnt = DFA_STATE_START;
+	dfa_state_find(dfa, &dfa->closure[(size_t)dfa->start * dfa->words], slots, slot_mask);
+	dfa->always = dfa->accept[DFA_STATE_START] && !dfa->anchor_end;
+
+	/* representative Byte of each class */
+	uint8_t reps[256];
+	for (int b = 255; b >= 0; b--)
+		reps[dfa->classes[b]] = b;
+
+	for (uint32_t s = DFA_STATE_START; s < dfa->state_cnt; s++) {
+		for (uint32_t c = 0; c < dfa->class_cnt; c++) {
+			uint16_t to;
+			if (!dfa_step(dfa, &dfa->sets[(size_t)s * dfa->words], reps[c], next))
+				to = DFA_STATE_DEAD;
+			else if (!dfa->anchor_end && dfa_set_has(next, dfa->match))
+				to = DFA_STATE_HIT;
+			else
+				to = dfa_state_find(dfa, next, slots, slot_mask);
+			dfa->delta[(size_t)s * dfa->class_cnt + c] = to;
+		}
+	}
+	NB_wrn_if(dfa->state_cnt == DFA_STATES_MAX,
+		"'%s': more than %d DFA states, rest computed while matching",
+		dfa->pattern, DFA_STATES_MAX);
+
+	void *shrunk = realloc(dfa->delta, (size_t)dfa->state_cnt * dfa->class_cnt * sizeof(*dfa->delta));
+	if (shrunk)
+		dfa->delta = shrunk;
+	shrunk = realloc(dfa->sets, (size_t)dfa->state_cnt * dfa->words * sizeof(*dfa->sets));
+	if (shrunk)
+		dfa->sets = shrunk;
+die:
+	free(slots);
+	free(next);
+	return err_cnt;
+}
+
+
+/*	dfa_new()
+ * Compile the regular expression 'pattern', see dfa.h for syntax.
+ */
+struct dfa *dfa_new(const char *pattern)
+{
+	struct dfa *ret = NULL;
+	NB_die_if(!pattern, "no regex given");
+	NB_die_if(!(
+		ret = calloc(1, sizeof(*ret))
+		), "fail alloc size %zu", sizeof(*ret));
+	errno = 0;
+	NB_die_if(!(
+		ret->pattern = nstralloc(pattern, DFA_NFA_MAX, NULL)
+		), "string alloc fail");
+	NB_die_if(errno == E2BIG, "regex too long: '%s'", ret->pattern);
+
+	NB_die_if(dfa_nfa_build(ret), "");
+	NB_die_if(dfa_closure_build(ret), "");
+	dfa_classes_build(ret);
+	NB_die_if(dfa_states_build(ret), "");
+
+	NB_inf("'%s': %u NFA states, %u DFA states, %u Byte classes",
+		ret->pattern, ret->nfa_cnt, ret->state_cnt, ret->class_cnt);
+	return ret;
+die:
+	dfa_free(ret);
+	return NULL;
+}
+
+
+/*	dfa_match_nfa()
+ * Carry on matching from NFA states 'set', for states never built.
+ */
+static bool dfa_match_nfa(const struct dfa *dfa, const uint64_t *set,
+			const uint8_t *p, size_t len)
+{
+	uint64_t bufs[2][DFA_NFA_WORDS];
+	uint64_t *cur = bufs[0];
+	uint64_t *next = bufs[1];
+	memcpy(cur, set, dfa->words * sizeof(*cur));
+
+	for (size_t i = 0; i < len; i++) {
+		if (!dfa_step(dfa, cur, p[i], next))
+			return false;
+		if (!dfa->anchor_end && dfa_set_has(next, dfa->match))
+			return true;
+		uint64_t *tmp = cur;
+		cur = next;
+		next = tmp;
+	}
+	return dfa->anchor_end && dfa_set_has(cur, dfa->match);
+}
+
+
+/*	dfa_match()
+ * Returns true if 'dfa' matches anywhere in the 'len' Bytes at 'p'
+ * (with '^' and '$': at their start and end).
+ */
+bool __attribute__((hot)) dfa_match(const struct dfa *dfa, const uint8_t *p, size_t len)
+{
+	if (dfa->always)
+		return true;
+
+	const uint16_t *delta = dfa->delta;
+	const uint32_t class_cnt = dfa->class_cnt;
+	uint32_t state = DFA_STATE_START;
+	for (size_t i = 0; i < len; i++) {
+		uint16_t next = delta[state * class_cnt + dfa->classes[p[i]]];
+		if (NLC_UNLIKELY(next >= DFA_STATE_SPILL)) {
+			if (next == DFA_STATE_HIT)
+				return true;
+			return dfa_match_nfa(dfa, &dfa->sets[(size_t)state * dfa->words],
+					&p[i], len - i);
+		}
+		if (next == DFA_STATE_DEAD)
+			return false;
+		state = next;
+	}
+	return dfa->anchor_end && dfa->accept[state];
+}
@@ -3,10 +3,168 @@
 #include <yamlutils.h>
 #include <nstring.h>
 #include <refcnt.h>
+#include <value.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
 
 
 static Pvoid_t field_JS = NULL; /* (char *field_name) -> (struct field *field) */
 
+const char *field_anchor_names[] = {
+	"packet",
+	"l3",
+	"l4",
+	"payload",
+	"computed"
+};
+NLC_ASSERT(field_anchor_names_check,
+	NLC_ARRAY_LEN(field_anchor_names) == FIELD_ANCHOR_COMPUTED + 1);
+
+__thread struct field_anchors field_anchors = { { 0 } };
+
+/*	field_anchors_reset()
+ * Mark every anchor but the start of the packet absent, until a packet
+ * is parsed: for the main thread at startup, and for each worker thread.
+ */
+void __attribute__((constructor)) field_anchors_reset()
+{
+	for (unsigned int i = FIELD_ANCHOR_L3; i < FIELD_ANCHOR_CNT; i++)
+		field_anchors.offt[i] = FIELD_ANCHOR_ABSENT;
+}
+
+
+/*	field_compute
+ * A computed anchor (see 'struct field_from'),
+ * shared by all fields with the same 'offt_from'.
+ * @src		: field holding the value
+ * @refcnt	: fields anchored here; 0 means the slot is free
+ */
+struct field_compute {
+	struct field_set	src;
+	uint8_t			shift;
+	uint16_t		mult;
+	int32_t			add;
+	uint32_t		refcnt;
+};
+
+static struct field_compute field_computes[FIELD_COMPUTED_MAX];
+
+/* Slots in use, in order of creation: since 'src' must exist beforehand,
+ * a slot only ever depends on slots before it.
+ */
+static uint8_t field_compute_order[FIELD_COMPUTED_MAX] = { 0 };
+static unsigned int field_compute_cnt = 0;
+
+
+/*	field_compute_find()
+ * Returns the slot in use holding the same computation as 'want', or -1.
+ */
+static int field_compute_find(const struct field_compute *want)
+{
+	for (unsigned int i = 0; i < field_compute_cnt; i++) {
+		struct field_compute *fc = &field_computes[field_compute_order[i]];
+		if (fc->src.bytes == want->src.bytes && fc->shift == want->shift
+			&& fc->mult == want->mult && fc->add == want->add)
+		{
+			return field_compute_order[i];
+		}
+	}
+	return -1;
+}
+
+/*	field_compute_take()
+ * Take a reference to the slot computing 'want', filling a free one
+ * if there is none.
+ * Returns the slot, or -1 if all slots are in use.
+ */
+static int field_compute_take(const struct field_compute *want)
+{
+	int slot = field_compute_find(want);
+	if (slot < 0) {
+		if (field_compute_cnt == FIELD_COMPUTED_MAX)
+			return -1;
+		for (slot = 0; field_computes[slot].refcnt; slot++)
+			;
+		field_computes[slot] = *want;
+		field_compute_order[field_compute_cnt++] = slot;
+	}
+	struct field_compute *fc = &field_computes[slot];
+	refcnt_take(fc);
+	return slot;
+}
+
+/*	field_compute_release()
+ */
+static void field_compute_release(unsigned int slot)
+{
+	struct field_compute *fc = &field_computes[slot];
+	refcnt_release(fc);
+	if (fc->refcnt)
+		return;
+
+	unsigned int i = 0;
+	while (field_compute_order[i] != slot)
+		i++;
+	field_compute_cnt--;
+	memmove(&field_compute_order[i], &field_compute_order[i + 1],
+		field_compute_cnt - i);
+}
+
+/*	field_compute_parse()
+ * Validate the user-supplied 'from' into 'out'.
+ * Returns 0 on success.
+ */
+static int field_compute_parse(const struct field_from *from, struct field_compute *out)
+{
+	int err_cnt = 0;
+	struct field *src = NULL;
+	NB_die_if(!from->field || !(
+		src = js_get(&field_JS, from->field)
+		), "'offt_from' field '%s' does not exist", from->field ? from->field : "");
+	NB_die_if(src->bitmask,
+		"'offt_from' field '%s' cannot have a 'bitmask'", src->name);
+	NB_die_if(!src->set.len || src->set.len > sizeof(uint32_t),
+		"'offt_from' field '%s' must be 1 to %zu Bytes long",
+		src->name, sizeof(uint32_t));
+	NB_die_if(from->shift < 0 || from->shift >= 32,
+		"'offt_from' shift '%ld' out of bounds", from->shift);
+
+	out->src = src->set;
+	out->shift = from->shift;
+	/* see 'test/overflow_test.c' for a proof that this is kosher */
+	NB_die_if(__builtin_add_overflow(from->mult, 0, &out->mult),
+		"'offt_from' mult '%ld' out of bounds", from->mult);
+	NB_die_if(from->add < FIELD_OFFT_MIN || from->add > FIELD_OFFT_MAX,
+		"'offt_from' add '%ld' out of bounds", from->add);
+	out->add = from->add;
+	out->refcnt = 0;
+die:
+	return err_cnt;
+}
+
+/*	field_compute_offt()
+ * Offset of the anchor computed by 'fc' in 'pkt', or FIELD_ANCHOR_ABSENT
+ * if its field lies (partly) outside the packet or the result does.
+ */
+NLC_INLINE uint32_t field_compute_offt(const struct field_compute *fc,
+					const uint8_t *pkt, size_t plen)
+{
+	size_t offt = field_offt(fc->src, plen);
+	if (offt > plen || fc->src.len > plen - offt)
+		return FIELD_ANCHOR_ABSENT;
+
+	uint64_t v = 0;
+	for (size_t i = 0; i + 1 < fc->src.len; i++)
+		v = v << 8 | pkt[offt + i];
+	v = v << 8 | (pkt[offt + fc->src.len - 1] & fc->src.mask);
+
+	int64_t ret = (int64_t)field_anchors.offt[fc->src.anchor]
+			+ (int64_t)((v >> fc->shift) * fc->mult) + fc->add;
+	if (ret < 0 || ret > UINT16_MAX)
+		return FIELD_ANCHOR_ABSENT;
+	return ret;
+}
+
 
 /*	field_free()
  */
@@ -25,6 +183,10 @@ void field_free(void *arg)
 	if (js_get(&field_JS, fl->name) == fl)
 		js_delete(&field_JS, fl->name);
 
+	if (fl->set.anchor >= FIELD_ANCHOR_COMPUTED)
+		field_compute_release(fl->set.anchor - FIELD_ANCHOR_COMPUTED);
+	field_release(fl->from);
+	free(fl->bitmask);
 	free(fl->name);
 	free(fl);
 die:
@@ -35,18 +197,87 @@ die:
  */
 void __attribute__((destructor(102))) field_free_all()
 {
+	/* fields computed from others keep them in use: drop that first */
+	JS_LOOP(&field_JS,
+		struct field *fl = val;
+		field_release(fl->from);
+		fl->from = NULL;
+	);
 	JS_LOOP(&field_JS,
 		field_free(val);
 	);
 }
 
+/*	field_bitmask_parse()
+ * Parse the user-supplied 'bitmask' (any value syntax, see value_parse())
+ * over 'len' Bytes into 'out'.
+ * A mask of the last Byte only is returned in 'mask' instead,
+ * leaving 'out' NULL, as it needs no bitmask kernel.
+ * Returns 0 on success.
+ */
+static int field_bitmask_parse(const char *bitmask, long len, long *mask, uint8_t **out)
+{
+	int err_cnt = 0;
+	uint8_t *bits = NULL;
+	NB_die_if(*mask && *mask != 0xff,
+		"'mask' and 'bitmask' exclude each other");
+	NB_die_if(len < 1 || len > UINT16_MAX,
+		"'bitmask' needs a 'len' of 1 to %u", UINT16_MAX);
+	NB_die_if(!(
+		bits = malloc(len)
+		), "fail alloc size %ld", len);
+	NB_die_if(
+		value_parse(bitmask, bits, len)
+		, "cannot parse 'bitmask' '%s'", bitmask);
+
+	long i = 0;
+	while (i < len - 1 && bits[i] == 0xff)
+		i++;
+	if (i == len - 1) {
+		*mask = bits[i];
+		free(bits);
+		bits = NULL;
+	}
+	*out = bits;
+	return 0;
+die:
+	free(bits);
+	return err_cnt;
+}
+
 /*	field_new()
  * Create a new field.
+ * 'bitmask' is optional: a mask over all Bytes, replacing 'mask'.
+ * 'from' is optional: if given, 'anchor' is computed from another field
+ * and must be FIELD_ANCHOR_PACKET.
  */
-struct field *field_new	(const char *name, long offt, long len, long mask)
+struct field *field_new	(const char *name, enum field_anchor anchor,
+			long offt, long len, long mask,
+			const char *bitmask, const struct field_from *from)
 {
 	struct field *ret = NULL;
+	struct field_compute compute;
+	uint8_t *bits = NULL;
 	NB_die_if(!name, "no name given for field");
+	NB_die_if(anchor >= FIELD_ANCHOR_COMPUTED,
+		"field '%s': anchor %d unknown", name, anchor);
+
+	if (from) {
+		NB_die_if(anchor != FIELD_ANCHOR_PACKET,
+			"field '%s': 'anchor' and 'offt_from' exclude each other", name);
+		NB_die_if(from->field && !strcmp(from->field, name),
+			"field '%s': 'offt_from' cannot be the field itself", name);
+		NB_die_if(field_compute_parse(from, &compute),
+			"field '%s': invalid 'offt_from'", name);
+		/* only ever identical to an existing field if its slot exists */
+		int slot = field_compute_find(&compute);
+		anchor = slot < 0 ? FIELD_ANCHOR_CNT : FIELD_ANCHOR_COMPUTED + slot;
+	}
+	NB_die_if(anchor != FIELD_ANCHOR_PACKET && offt < 0,
+		"field '%s': offt '%ld' from the end of the packet cannot have an anchor",
+		name, offt);
+	NB_die_if(bitmask && field_bitmask_parse(bitmask, len, &mask, &bits),
+		"field '%s': invalid 'bitmask'", name);
 
 #ifdef XDPACKET_DISALLOW_CLOBBER
 	NB_die_if(
@@ -55,10 +286,17 @@ struct field *field_new	(const char *name, long offt, long len, long mask)
 #else
 	/* Return already existing ONLY if identical */
 	if ((ret = js_get(&field_JS, name))) {
-		if (ret->set.offt == offt && ret->set.len == len && ret->set.mask == mask)
+		if (ret->set.anchor == anchor && ret->set.offt == offt
+			&& ret->set.len == len && ret->set.mask == mask
+			&& !ret->bitmask == !bits
+			&& (!bits || !memcmp(ret->bitmask, bits, len)))
+		{
+			free(bits);
 			return ret;
+		}
 		NB_wrn("field '%s' already exists but not identical: deleting", name);
 		field_free(ret);
+		ret = NULL;
 	}
 #endif
 
@@ -72,6 +310,19 @@ struct field *field_new	(const char *name, long offt, long len, long mask)
 	NB_die_if(!(
 		ret = calloc(sizeof(struct field), 1)
 		), "fail alloc sz %zu", sizeof(struct field));
+	ret->bitmask = bits;
+	bits = NULL;
+
+	if (from) {
+		int slot = field_compute_take(&compute);
+		NB_die_if(slot < 0,
+			"field '%s': more than %d different 'offt_from'",
+			name, FIELD_COMPUTED_MAX);
+		ret->set.anchor = FIELD_ANCHOR_COMPUTED + slot;
+		ret->from = field_get(from->field);
+	} else {
+		ret->set.anchor = anchor;
+	}
 	
 	errno = 0;
 	NB_die_if(!(
@@ -79,12 +330,15 @@ struct field *field_new	(const char *name, long offt, long len, long mask)
 		), "string alloc fail");
 	NB_die_if(errno == E2BIG, "value truncated:\n%s", ret->name);
 
+	/* a bitfield has no address: range-check by hand */
+	NB_die_if(offt < FIELD_OFFT_MIN || offt > FIELD_OFFT_MAX,
+		"offt '%ld' out of bounds", offt);
+	ret->set.offt = offt;
+
 	/* see 'test/overflow_test.c' for a proof that this is kosher */
 	#pragma GCC diagnostic push
 	#pragma GCC diagnostic ignored "-Wpragmas"  /* GCC ignoring own option */
 	#pragma GCC diagnostic ignored "-Waddress-of-packed-member"
-	NB_die_if(__builtin_add_overflow(offt, 0, &ret->set.offt),
-		"offt '%ld' out of bounds", offt);
 	NB_die_if(__builtin_add_overflow(len, 0, &ret->set.len),
 		"len '%ld' out of bounds", len);
 	NB_die_if(__builtin_add_overflow(mask, 0, &ret->set.mask),
@@ -99,6 +353,7 @@ struct field *field_new	(const char *name, long offt, long len, long mask)
 	return ret;
 
 die:
+	free(bits);
 	field_free(ret);
 	return NULL;
 }
@@ -151,6 +406,112 @@ int __attribute__((hot)) field_hash(struct field_set set, const void *pkt, size_
 }
 
 
+/*	field_anchors_headers()
+ * Locate the headers of 'pkt' in 'anchor':
+ * - L3 is whatever follows Ethernet and up to two VLAN tags.
+ * - L4 follows IPv4 (with options) or IPv6 (with hop-by-hop, routing,
+ *   fragment and destination options headers); it is absent
+ *   from fragments other than the first.
+ * - payload follows a TCP (with options), UDP or ICMP header.
+ * Header lengths are only checked against 'plen' as far as needed
+ * to read them: anchored fields are bounds-checked when resolved.
+ */
+NLC_INLINE void field_anchors_headers(const uint8_t *p, size_t plen, uint32_t *anchor)
+{
+	anchor[FIELD_ANCHOR_L3] = FIELD_ANCHOR_ABSENT;
+	anchor[FIELD_ANCHOR_L4] = FIELD_ANCHOR_ABSENT;
+	anchor[FIELD_ANCHOR_PAYLOAD] = FIELD_ANCHOR_ABSENT;
+
+	/* L2 */
+	size_t o = ETH_HLEN;
+	if (plen < o)
+		return;
+	uint16_t proto = (uint16_t)p[12] << 8 | p[13];
+	for (unsigned int i = 0; i < 2 && (proto == ETH_P_8021Q || proto == ETH_P_8021AD); i++) {
+		if (plen < o + 4)
+			return;
+		proto = (uint16_t)p[o + 2] << 8 | p[o + 3];
+		o += 4;
+	}
+	anchor[FIELD_ANCHOR_L3] = o;
+
+	/* L3 */
+	uint8_t l4_proto;
+	if (proto == ETH_P_IP) {
+		if (plen < o + 20 || p[o] >> 4 != 4)
+			return;
+		size_t ihl = (size_t)(p[o] & 0xf) << 2;
+		if (ihl < 20)
+			return;
+		/* fragments other than the first carry no L4 header */
+		if ((p[o + 6] & 0x1f) || p[o + 7])
+			return;
+		l4_proto = p[o + 9];
+		o += ihl;
+
+	} else if (proto == ETH_P_IPV6) {
+		if (plen < o + 40 || p[o] >> 4 != 6)
+			return;
+		l4_proto = p[o + 6];
+		o += 40;
+		/* extension headers: at most one of each, destination options twice */
+		for (unsigned int i = 0; i < 5; i++) {
+			if (l4_proto != IPPROTO_HOPOPTS && l4_proto != IPPROTO_ROUTING
+				&& l4_proto != IPPROTO_FRAGMENT && l4_proto != IPPROTO_DSTOPTS)
+			{
+				break;
+			}
+			if (plen < o + 8)
+				return;
+			if (l4_proto == IPPROTO_FRAGMENT && (((uint16_t)p[o + 2] << 8 | p[o + 3]) & ~0x7))
+				return;
+			size_t len = l4_proto == IPPROTO_FRAGMENT ? 8 : ((size_t)p[o + 1] + 1) << 3;
+			l4_proto = p[o];
+			o += len;
+		}
+		if (l4_proto == IPPROTO_HOPOPTS || l4_proto == IPPROTO_ROUTING
+			|| l4_proto == IPPROTO_FRAGMENT || l4_proto == IPPROTO_DSTOPTS
+			|| l4_proto == IPPROTO_NONE)
+		{
+			return;
+		}
+
+	} else {
+		return;
+	}
+	anchor[FIELD_ANCHOR_L4] = o;
+
+	/* L4 */
+	if (l4_proto == IPPROTO_TCP) {
+		if (plen < o + 13 || p[o + 12] >> 4 < 5)
+			return;
+		anchor[FIELD_ANCHOR_PAYLOAD] = o + ((size_t)(p[o + 12] >> 4) << 2);
+	} else if (l4_proto == IPPROTO_UDP || l4_proto == IPPROTO_ICMP
+		|| l4_proto == IPPROTO_ICMPV6)
+	{
+		anchor[FIELD_ANCHOR_PAYLOAD] = o + 8;
+	}
+}
+
+/*	field_anchors_parse()
+ * Fill 'field_anchors' for all anchored fields to use while 'pkt'
+ * is processed: headers first, then computed anchors in order,
+ * as each may be computed from a field anchored to the ones before.
+ */
+void __attribute__((hot)) field_anchors_parse(const void *pkt, size_t plen)
+{
+	if (!pkt)
+		plen = 0;
+	field_anchors_headers(pkt, plen, field_anchors.offt);
+
+	for (unsigned int i = 0; i < field_compute_cnt; i++) {
+		uint8_t slot = field_compute_order[i];
+		field_anchors.offt[FIELD_ANCHOR_COMPUTED + slot] =
+			field_compute_offt(&field_computes[slot], pkt, plen);
+	}
+}
+
+
 /*	field_parse()
  * Parse 'root' according to 'mode' (add | rem | prn).
  * NOTE: 'outdoc' and 'outlist' are ONLY handled by field_emit(),
@@ -168,13 +529,24 @@ int field_parse(enum parse_mode	mode,
 	 * All 'long' because we use strtol() to parse.
 	 */
 	const char *name = "";
+	enum field_anchor anchor = FIELD_ANCHOR_PACKET;
 	long offt = 0;
 	long len = 0;
 	long mask = 0;
+	const char *bitmask = NULL;
+	struct field_from from = { .mult = 1 };
+	bool has_from = false;
 
 	/* {
 	 *   field: length check	(scalar)
+	 *   anchor: l4			(scalar)
 	 *   offt: 32			(scalar)
+	 *   offt_from: {		(mapping)
+	 *     field: ip hlen		(scalar)
+	 *     shift: 0			(scalar)
+	 *     mult: 4			(scalar)
+	 *     add: 14			(scalar)
+	 *   }
 	 * } # field			(mapping)
 	 */
 	Y_FOR_MAP(doc, mapping,
@@ -182,11 +554,48 @@ int field_parse(enum parse_mode	mode,
 		if (!strcmp("field", keyname) || !strcmp("f", keyname)) {
 			name = txt;
 
+		} else if (!strcmp("anchor", keyname) || !strcmp("a", keyname)) {
+			for (anchor = 0; anchor < FIELD_ANCHOR_COMPUTED; anchor++) {
+				if (!strcmp(field_anchor_names[anchor], txt))
+					break;
+			}
+			NB_die_if(anchor == FIELD_ANCHOR_COMPUTED,
+				"'%s': '%s' is not one of packet | l3 | l4 | payload",
+				keyname, txt);
+
 		} else if (!strcmp("offt", keyname) || !strcmp("o", keyname)) {
 			errno = 0;
 			offt = strtol(txt, NULL, 0);
 			NB_die_if(errno, "'%s': '%s' could not be parsed", keyname, txt);
 
+		} else if (!strcmp("offt_from", keyname)) {
+			NB_die_if(type != YAML_MAPPING_NODE,
+				"'%s' must be a mapping", keyname);
+			has_from = true;
+			Y_FOR_MAP(doc, map,
+				if (!strcmp("field", keyname) || !strcmp("f", keyname)) {
+					from.field = txt;
+
+				} else if (!strcmp("shift", keyname)) {
+					errno = 0;
+					from.shift = strtol(txt, NULL, 0);
+					NB_die_if(errno, "'%s': '%s' could not be parsed", keyname, txt);
+
+				} else if (!strcmp("mult", keyname)) {
+					errno = 0;
+					from.mult = strtol(txt, NULL, 0);
+					NB_die_if(errno, "'%s': '%s' could not be parsed", keyname, txt);
+
+				} else if (!strcmp("add", keyname)) {
+					errno = 0;
+					from.add = strtol(txt, NULL, 0);
+					NB_die_if(errno, "'%s': '%s' could not be parsed", keyname, txt);
+
+				} else {
+					NB_err("'offt_from' does not implement '%s'", keyname);
+				}
+			);
+
 		} else if (!strcmp("len", keyname) || !strcmp("l", keyname)) {
 			errno = 0;
 			len = strtol(txt, NULL, 0);
@@ -197,6 +606,9 @@ int field_parse(enum parse_mode	mode,
 			mask = strtol(txt, NULL, 0);
 			NB_die_if(errno, "'%s': '%s' could not be parsed", keyname, txt);
 
+		} else if (!strcmp("bitmask", keyname)) {
+			bitmask = txt;
+
 		} else {
 			NB_err("'iface' does not implement '%s'", keyname);
 		}
@@ -207,7 +619,8 @@ int field_parse(enum parse_mode	mode,
 	case PARSE_ADD:
 	{
 		NB_die_if(!(
-			field = field_new(name, offt, len, mask)
+			field = field_new(name, anchor, offt, len, mask, bitmask,
+					has_from ? &from : NULL)
 			), "could not create new field '%s'", name);
 		NB_die_if(
 			field_emit(field, outdoc, outlist)
@@ -248,6 +661,40 @@ die:
 	return err_cnt;
 }
 
+/*	field_emit_from()
+ * Emit the 'offt_from' of 'field' into 'reply', eliding defaults.
+ */
+static int field_emit_from(struct field *field, yaml_document_t *outdoc, int reply)
+{
+	int err_cnt = 0;
+	const struct field_compute *fc =
+		&field_computes[field->set.anchor - FIELD_ANCHOR_COMPUTED];
+	int from = yaml_document_add_mapping(outdoc, NULL, YAML_BLOCK_MAPPING_STYLE);
+	NB_die_if(
+		y_pair_insert(outdoc, from, "field", field->from->name)
+		, "");
+	if (fc->shift) {
+		NB_die_if(
+			y_pair_insert_nf(outdoc, from, "shift", "%u", fc->shift)
+			, "");
+	}
+	if (fc->mult != 1) {
+		NB_die_if(
+			y_pair_insert_nf(outdoc, from, "mult", "%u", fc->mult)
+			, "");
+	}
+	if (fc->add) {
+		NB_die_if(
+			y_pair_insert_nf(outdoc, from, "add", "%d", fc->add)
+			, "");
+	}
+	NB_die_if(
+		y_pair_insert_obj(outdoc, reply, "offt_from", from)
+		, "");
+die:
+	return err_cnt;
+}
+
 /*	field_emit()
  * Emit an interface as a mapping under 'outlist' in 'outdoc'.
  */
@@ -270,6 +717,23 @@ int field_emit(struct field *field, yaml_document_t *outdoc, int outlist)
 			y_pair_insert_nf(outdoc, reply, "mask", "0x%x", field->set.mask)
 			, "");
 	}
+	if (field->bitmask) {
+		char *rendered = value_render(field->bitmask, field->set.len);
+		NB_die_if(!rendered, "");
+		err_cnt = y_pair_insert(outdoc, reply, "bitmask", rendered);
+		free(rendered);
+		NB_die_if(err_cnt, "");
+	}
+	/* elide the default anchor (aka: start of packet) */
+	if (field->from) {
+		NB_die_if(
+			field_emit_from(field, outdoc, reply)
+			, "");
+	} else if (field->set.anchor != FIELD_ANCHOR_PACKET) {
+		NB_die_if(
+			y_pair_insert(outdoc, reply, "anchor", field_anchor_prn(field->set.anchor))
+			, "");
+	}
 	NB_die_if(!(
 		yaml_document_append_sequence_item(outdoc, outlist, reply)
 		), "");
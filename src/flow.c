@@ -0,0 +1,194 @@
+/*	flow.c
+ * (c) 2018 Sirio Balmelli
+ */
+
+#include <flow.h>
+#include <ndebug.h>
+
+
+/*	flow_field()
+ * Point 'out' at the bytes of 'set' in 'pkt'.
+ * Returns non-zero if the field lies (partly) outside the packet.
+ */
+NLC_INLINE
+int flow_field(const uint8_t *pkt, size_t plen, struct field_set set, const uint8_t **out)
+{
+	FIELD_PACKET_INDEXING
+	*out = start;
+	return 0;
+}
+
+
+/*	flow_key()
+ * Write the key of 'pkt' made of the fields in bitmap 'fields' into 'key'.
+ * Returns key length.
+ */
+static size_t flow_key(const struct classifier *cls, uint32_t fields,
+			const uint8_t *pkt, size_t plen, uint8_t *key)
+{
+	size_t len = 0;
+	for (; fields; fields &= fields - 1) {
+		struct field_set set = cls->fields[__builtin_ctz(fields)];
+		const uint8_t *start;
+		if (flow_field(pkt, plen, set, &start)) {
+			key[len++] = 0;
+		} else {
+			key[len++] = 1;
+			memcpy(&key[len], start, set.len);
+			len += set.len;
+			key[len - 1] &= set.mask;
+		}
+	}
+	return len;
+}
+
+
+/*	flow_hash()
+ * Never 0, which marks an empty entry.
+ */
+NLC_INLINE
+uint64_t flow_hash(uint32_t fields, const uint8_t *key, size_t len)
+{
+	uint64_t hash = fnv_hash64(NULL, NULL, 0);
+	hash = fnv_hash64(&hash, &fields, sizeof(fields));
+	return fnv_hash64(&hash, key, len) | 0x1;
+}
+
+
+/*	flow_entry_hit()
+ */
+NLC_INLINE
+bool flow_entry_hit(const struct flow_entry *ent, uint64_t hash, uint32_t fields,
+			const uint8_t *key, size_t len)
+{
+	return ent->hash == hash
+		&& ent->len == len
+		&& ent->fields == fields
+		&& !memcmp(ent->key, key, len);
+}
+
+
+/*	flow_entry_set()
+ */
+NLC_INLINE
+void flow_entry_set(struct flow_entry *ent, uint64_t hash, uint32_t fields,
+			const uint8_t *key, size_t len, struct rout_set *rst)
+{
+	ent->hash = hash;
+	ent->rst = rst;
+	ent->fields = fields;
+	ent->len = len;
+	memcpy(ent->key, key, len);
+}
+
+
+/*	flow_cache_flush()
+ */
+static void flow_cache_flush(struct flow_cache *fc)
+{
+	fc->mask_cnt = 0;
+	fc->mask_next = 0;
+	memset(fc->micro, 0, sizeof(fc->micro));
+	memset(fc->mega, 0, sizeof(fc->mega));
+	fc->set_gen = set_generation;
+}
+
+
+/*	flow_cacheable()
+ * Lookups in 'cls' can be cached if they depend only on packet bytes,
+ * and if the key of all its fields fits a flow_entry.
+ */
+bool flow_cacheable(const struct classifier *cls)
+{
+	if (!cls->pure)
+		return false;
+	size_t len = 0;
+	for (uint32_t i = 0; i < cls->field_cnt; i++)
+		len += 1 + cls->fields[i].len;
+	return len <= FLOW_KEY_MAX;
+}
+
+
+/*	flow_cache_free()
+ */
+void flow_cache_free(struct flow_cache *fc)
+{
+	free(fc);
+}
+
+
+/*	flow_cache_new()
+ * Caller must have checked that 'cls' is flow_cacheable().
+ */
+struct flow_cache *flow_cache_new(struct classifier *cls)
+{
+	struct flow_cache *ret = NULL;
+	NB_die_if(!(
+		ret = calloc(1, sizeof(*ret))
+		), "fail alloc size %zu", sizeof(*ret));
+	ret->cls = cls;
+	ret->set_gen = set_generation;
+	ret->all = cls->field_cnt < 32 ? (1U << cls->field_cnt) - 1 : UINT32_MAX;
+die:
+	return ret;
+}
+
+
+/*	flow_lookup()
+ * Same result as classifier_lookup(), from cache if possible.
+ */
+struct rout_set __attribute__((hot)) *flow_lookup(struct flow_cache *fc,
+						const void *pkt, size_t plen)
+{
+	uint8_t key[FLOW_KEY_MAX];
+	uint8_t mkey[FLOW_KEY_MAX];
+
+	if (NLC_UNLIKELY(fc->set_gen != set_generation))
+		flow_cache_flush(fc);
+
+	/* microflow */
+	size_t len = flow_key(fc->cls, fc->all, pkt, plen, key);
+	uint64_t hash = flow_hash(fc->all, key, len);
+	struct flow_entry *micro = &fc->micro[hash & (FLOW_MICRO_CNT - 1)];
+	if (flow_entry_hit(micro, hash, fc->all, key, len)) {
+		fc->hit_micro++;
+		return micro->rst;
+	}
+
+	/* megaflow: any entry found is valid, whichever mask it was found with */
+	for (uint32_t i = 0; i < fc->mask_cnt; i++) {
+		uint32_t fields = fc->masks[i];
+		size_t mlen = flow_key(fc->cls, fields, pkt, plen, mkey);
+		uint64_t mhash = flow_hash(fields, mkey, mlen);
+		struct flow_entry *mega = &fc->mega[mhash & (FLOW_MEGA_CNT - 1)];
+		if (flow_entry_hit(mega, mhash, fields, mkey, mlen)) {
+			fc->hit_mega++;
+			flow_entry_set(micro, hash, fc->all, key, len, mega->rst);
+			return mega->rst;
+		}
+	}
+
+	/* miss: classify and install in both tiers */
+	fc->miss++;
+	uint32_t fields;
+	struct rout_set *ret = classifier_lookup(fc->cls, pkt, plen, &fields);
+	flow_entry_set(micro, hash, fc->all, key, len, ret);
+
+	uint32_t i;
+	for (i = 0; i < fc->mask_cnt && fc->masks[i] != fields; i++)
+		;
+	if (i == fc->mask_cnt) {
+		if (fc->mask_cnt < FLOW_MASK_MAX) {
+			i = fc->mask_cnt++;
+		} else {
+			i = fc->mask_next;
+			fc->mask_next = (fc->mask_next + 1) % FLOW_MASK_MAX;
+		}
+		fc->masks[i] = fields;
+	}
+	size_t mlen = flow_key(fc->cls, fields, pkt, plen, mkey);
+	uint64_t mhash = flow_hash(fields, mkey, mlen);
+	flow_entry_set(&fc->mega[mhash & (FLOW_MEGA_CNT - 1)], mhash, fields, mkey, mlen, ret);
+
+	return ret;
+}
@@ -1,11 +1,16 @@
+#define _GNU_SOURCE	/* recvmmsg(), sendmmsg(), pthread_attr_setaffinity_np() */
 #include <iface.h>
 #include <arpa/inet.h>
 #include <linux/if_arp.h>	/* struct sockaddr_ll.sll_hatype */
 #include <linux/if_ether.h>	/* ETH_P_ALL and friends */
 #include <linux/if_packet.h>	/* struct packet_mreq */
+#include <sched.h>	/* CPU_SET() */
+#include <signal.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>	/* mmap() */
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>	/* clock_gettime() */
 
 #include <ndebug.h>
 #include <nstring.h>
@@ -13,9 +18,13 @@
 #include <yamlutils.h>
 
 #include <checksums.h>
+#include <field.h>	/* field_anchors_reset() */
 #include <refcnt.h>
 
 
+/* control buffer for the PACKET_AUXDATA of one received frame */
+#define IFACE_AUXDATA_LEN CMSG_SPACE(sizeof(struct tpacket_auxdata))
+
 #define XDPK_MAC_PROTO "%02hhx:%02hhx:%02hhx:%02hhx:%02hhx:%02hhx"
 #define XDPK_MAC_BYTES(ptr) ptr[0], ptr[1], ptr[2], ptr[3], ptr[4], ptr[5]
 #define XDPK_SOCK_PRN(sk_p) "%d: %s %s "XDPK_MAC_PROTO" mtu %d", \
@@ -27,6 +36,109 @@
 
 static Pvoid_t iface_JS = NULL; /* (char *iface_name) -> (struct iface *iface) */
 
+/* ifaces with frames staged in their tx ring, waiting for a kick:
+ * one list per thread, a worker only ever stages on its own sockets.
+ */
+static __thread struct iface *iface_tx_pending = NULL;
+
+/* worker socket serviced by this thread, NULL in main() */
+static __thread struct iface *iface_self = NULL;
+
+/* Workers hold this for reading while handling a batch of packets;
+ * the control plane holds it for writing while changing anything
+ * workers may be looking at (see iface_fence()).
+ */
+static pthread_rwlock_t iface_fence_lock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+
+/* bitmap of worker ids in use; only touched by the control plane */
+static uint64_t iface_worker_ids = 0;
+NLC_ASSERT(iface_worker_ids_check, IFACE_WORKER_MAX <= 64);
+
+
+static struct iface	*iface_worker_new	(struct iface *parent,
+						unsigned int idx,
+						int cpu);
+static void		iface_worker_free	(struct iface *worker);
+
+
+const char *iface_ios[] = {
+	"socket",
+	"ring",
+	"mmsg",
+	"xdp",
+	"INVALID"
+};
+
+/*	iface_io_parse()
+ * Return the iface_io named by 'txt', or IFACE_IO_INVALID.
+ */
+enum iface_io iface_io_parse(const char *txt)
+{
+	enum iface_io io = IFACE_IO_SOCKET;
+	for (; io < IFACE_IO_INVALID; io++) {
+		if (!strcmp(iface_ios[io], txt))
+			break;
+	}
+	return io;
+}
+
+
+const char *iface_fanouts[] = {
+	"hash",
+	"cpu",
+	"qm",
+	"INVALID"
+};
+
+/* kernel PACKET_FANOUT_* value of each iface_fanout */
+static const int iface_fanout_modes[] = {
+	PACKET_FANOUT_HASH,
+	PACKET_FANOUT_CPU,
+	PACKET_FANOUT_QM
+};
+
+/*	iface_fanout_parse()
+ * Return the iface_fanout named by 'txt', or IFACE_FANOUT_INVALID.
+ */
+enum iface_fanout iface_fanout_parse(const char *txt)
+{
+	enum iface_fanout fanout = IFACE_FANOUT_HASH;
+	for (; fanout < IFACE_FANOUT_INVALID; fanout++) {
+		if (!strcmp(iface_fanouts[fanout], txt))
+			break;
+	}
+	return fanout;
+}
+
+
+/*	iface_sock_close()
+ * Release the socket of 'iface' and everything set up on it.
+ */
+static void iface_sock_close(struct iface *iface)
+{
+	/* never leave a dangling pointer in the pending-kick list */
+	for (struct iface **pp = &iface_tx_pending; *pp; pp = &(*pp)->tx_next) {
+		if (*pp == iface) {
+			*pp = iface->tx_next;
+			break;
+		}
+	}
+
+	if (iface->ring)
+		munmap(iface->ring, iface->ring_len);
+	free(iface->rx_msgs);
+	free(iface->rx_iovs);
+	free(iface->rx_addrs);
+	free(iface->rx_ctrls);
+	free(iface->rx_bufs);
+	free(iface->tx_msgs);
+	free(iface->tx_iovs);
+	free(iface->tx_bufs);
+	xsk_free(iface->xsk);
+	if (iface->fd != -1)
+		close(iface->fd);
+}
+
 
 /*	iface_free()
  */
@@ -44,8 +156,17 @@ void iface_free(void *arg)
 
 	NB_wrn("close "XDPK_SOCK_PRN(iface));
 
-	if (iface->fd != -1)
-		close(iface->fd);
+	/* signal all workers before waiting on any of them */
+	for (unsigned int i = 0; i < iface->worker_cnt; i++) {
+		if (iface->workers[i])
+			__atomic_store_n(&iface->workers[i]->stop, true, __ATOMIC_RELEASE);
+	}
+	for (unsigned int i = 0; i < iface->worker_cnt; i++)
+		iface_worker_free(iface->workers[i]);
+	free(iface->workers);
+	free(iface->wcount);
+
+	iface_sock_close(iface);
 
 	free(iface->addr);
 	free(iface->hwaddr);
@@ -66,13 +187,231 @@ void __attribute__((destructor(101))) iface_free_all()
 	);
 }
 
+/*	iface_ring_setup()
+ * Set up TPACKET_V3 rx (only if 'rx') and/or tx rings on 'iface' and mmap() them.
+ * Must be called before bind() so that no packets are queued
+ * on the socket outside the ring.
+ */
+static int iface_ring_setup(struct iface *iface, bool rx)
+{
+	int err_cnt = 0;
+	size_t rx_len = 0;
+
+	int version = TPACKET_V3;
+	NB_die_if(
+		setsockopt(iface->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))
+		, "could not set TPACKET_V3 on %s", iface->name);
+
+	if (rx && iface->rx_io == IFACE_IO_RING) {
+		struct tpacket_req3 req = {
+			.tp_block_size = IFACE_RING_BLOCK_SZ,
+			.tp_block_nr = IFACE_RING_BLOCK_CNT,
+			.tp_frame_size = IFACE_RING_FRAME_SZ,
+			.tp_frame_nr = (IFACE_RING_BLOCK_SZ / IFACE_RING_FRAME_SZ)
+					* IFACE_RING_BLOCK_CNT,
+			.tp_retire_blk_tov = IFACE_RING_TIMEOUT_MS
+		};
+		NB_die_if(
+			setsockopt(iface->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))
+			, "could not set up rx ring on %s", iface->name);
+		rx_len = (size_t)req.tp_block_size * req.tp_block_nr;
+	}
+
+	if (iface->tx_io == IFACE_IO_RING) {
+		/* a slot must fit header and a full-MTU Ethernet frame */
+		iface->tx_frame_sz = IFACE_RING_FRAME_SZ;
+		while (iface->tx_frame_sz < TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+						+ ETH_HLEN + iface->mtu)
+			iface->tx_frame_sz <<= 1;
+		unsigned int block_sz = iface->tx_frame_sz > IFACE_RING_BLOCK_SZ ?
+					iface->tx_frame_sz : IFACE_RING_BLOCK_SZ;
+		iface->tx_frame_cnt = (block_sz / iface->tx_frame_sz) * IFACE_RING_TX_BLOCK_CNT;
+
+		/* tx ring only accepts geometry: no timeouts or private area */
+		struct tpacket_req3 req = {
+			.tp_block_size = block_sz,
+			.tp_block_nr = IFACE_RING_TX_BLOCK_CNT,
+			.tp_frame_size = iface->tx_frame_sz,
+			.tp_frame_nr = iface->tx_frame_cnt
+		};
+		NB_die_if(
+			setsockopt(iface->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req))
+			, "could not set up tx ring on %s", iface->name);
+
+		/* we are the only writer: skip qdisc and hand frames to the driver */
+		int yes = 1;
+		NB_err_if(
+			setsockopt(iface->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &yes, sizeof(yes))
+			, "could not set qdisc bypass on %s", iface->name);
+	}
+
+	/* the kernel maps rx ring first, tx ring immediately after */
+	iface->ring_len = rx_len + (size_t)iface->tx_frame_sz * iface->tx_frame_cnt;
+	iface->ring = mmap(NULL, iface->ring_len, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, iface->fd, 0);
+	if (iface->ring == MAP_FAILED) {
+		iface->ring = NULL;
+		NB_die("could not mmap %zu B ring on %s", iface->ring_len, iface->name);
+	}
+	if (rx && iface->rx_io == IFACE_IO_RING)
+		iface->rx_ring = iface->ring;
+	if (iface->tx_io == IFACE_IO_RING)
+		iface->tx_ring = iface->ring + rx_len;
+
+die:
+	return err_cnt;
+}
+
+
+/*	iface_mmsg_setup()
+ * Preallocate buffers and message headers for recvmmsg() (only if 'rx')
+ * and/or sendmmsg().
+ * Headers are pointed at their buffers once, here: recvmmsg() only needs
+ * 'msg_namelen' and 'msg_controllen' reset before each call,
+ * sendmmsg() only 'iov_len'.
+ */
+static int iface_mmsg_setup(struct iface *iface, bool rx)
+{
+	int err_cnt = 0;
+
+	/* a slot must fit a full-MTU Ethernet frame */
+	iface->mmsg_slot_sz = IFACE_RING_FRAME_SZ;
+	while (iface->mmsg_slot_sz < ETH_HLEN + (unsigned int)iface->mtu)
+		iface->mmsg_slot_sz <<= 1;
+
+	if (rx && iface->rx_io == IFACE_IO_MMSG) {
+		NB_die_if(!(
+			iface->rx_msgs = calloc(IFACE_MMSG_BATCH, sizeof(*iface->rx_msgs))
+			) || !(
+			iface->rx_iovs = calloc(IFACE_MMSG_BATCH, sizeof(*iface->rx_iovs))
+			) || !(
+			iface->rx_addrs = calloc(IFACE_MMSG_BATCH, sizeof(*iface->rx_addrs))
+			) || !(
+			iface->rx_ctrls = calloc(IFACE_MMSG_BATCH, IFACE_AUXDATA_LEN)
+			) || !(
+			iface->rx_bufs = calloc(IFACE_MMSG_BATCH, iface->mmsg_slot_sz)
+			), "fail alloc rx batch on %s", iface->name);
+		for (unsigned int i = 0; i < IFACE_MMSG_BATCH; i++) {
+			iface->rx_iovs[i].iov_base = iface->rx_bufs + (size_t)i * iface->mmsg_slot_sz;
+			iface->rx_iovs[i].iov_len = iface->mmsg_slot_sz;
+			iface->rx_msgs[i].msg_hdr.msg_iov = &iface->rx_iovs[i];
+			iface->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+			iface->rx_msgs[i].msg_hdr.msg_name = &iface->rx_addrs[i];
+			iface->rx_msgs[i].msg_hdr.msg_control = iface->rx_ctrls
+								+ i * IFACE_AUXDATA_LEN;
+		}
+	}
+
+	if (iface->tx_io == IFACE_IO_MMSG) {
+		NB_die_if(!(
+			iface->tx_msgs = calloc(IFACE_MMSG_BATCH, sizeof(*iface->tx_msgs))
+			) || !(
+			iface->tx_iovs = calloc(IFACE_MMSG_BATCH, sizeof(*iface->tx_iovs))
+			) || !(
+			iface->tx_bufs = calloc(IFACE_MMSG_BATCH, iface->mmsg_slot_sz)
+			), "fail alloc tx batch on %s", iface->name);
+		for (unsigned int i = 0; i < IFACE_MMSG_BATCH; i++) {
+			iface->tx_iovs[i].iov_base = iface->tx_bufs + (size_t)i * iface->mmsg_slot_sz;
+			iface->tx_msgs[i].msg_hdr.msg_iov = &iface->tx_iovs[i];
+			iface->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+	}
+
+die:
+	return err_cnt;
+}
+
+
+/*	iface_sock_setup()
+ * Set up I/O on 'iface->fd' according to 'rx_io' and 'tx_io', then bind it.
+ * If '!rx' (packets are received by workers instead) nothing is set up
+ * for receiving: the socket must have been opened with protocol 0.
+ */
+static int iface_sock_setup(struct iface *iface, bool rx)
+{
+	int err_cnt = 0;
+
+	/* Don't see our own output (nor anyone else's) on the way back in.
+	 * Not fatal on older kernels: outgoing packets are then discarded
+	 * in iface_callback().
+	 */
+	int yes = 1;
+	NB_wrn_if(
+		setsockopt(iface->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &yes, sizeof(yes))
+		, "could not ignore outgoing packets on %s", iface->name);
+
+	/* Learn whether each frame was received with its checksum incomplete
+	 * (see checksum_log_rx()): rings have it in their frame header.
+	 */
+	if (rx && (iface->rx_io == IFACE_IO_SOCKET || iface->rx_io == IFACE_IO_MMSG)) {
+		NB_wrn_if(
+			setsockopt(iface->fd, SOL_PACKET, PACKET_AUXDATA, &yes, sizeof(yes))
+			, "could not get auxiliary data on %s", iface->name);
+	}
+
+	/* rings and batches, if any */
+	if ((rx && iface->rx_io == IFACE_IO_RING) || iface->tx_io == IFACE_IO_RING) {
+		NB_die_if(
+			iface_ring_setup(iface, rx)
+			, "");
+	}
+	if ((rx && iface->rx_io == IFACE_IO_MMSG) || iface->tx_io == IFACE_IO_MMSG) {
+		NB_die_if(
+			iface_mmsg_setup(iface, rx)
+			, "");
+	}
+
+	bool rx_xdp = rx && iface->rx_io == IFACE_IO_XDP;
+	if (rx_xdp || iface->tx_io == IFACE_IO_XDP) {
+		NB_die_if(!(
+			iface->xsk = xsk_new(iface->ifindex, iface->mtu,
+					rx_xdp, iface->tx_io == IFACE_IO_XDP)
+			), "could not open AF_XDP socket on %s", iface->name);
+	}
+
+	/* Bind to interface.
+	 * With 'rx: xdp' the socket is only used for ioctl() and possibly
+	 * sending: it was opened with protocol 0 and receives nothing.
+	 */
+	struct sockaddr_ll saddr = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = (rx && !rx_xdp) ? htons(ETH_P_ALL) : 0,
+		.sll_ifindex = iface->ifindex,
+		.sll_halen = 6,
+		.sll_addr = {
+			iface->hwaddr->sa_data[0], iface->hwaddr->sa_data[1], iface->hwaddr->sa_data[2],
+			iface->hwaddr->sa_data[3], iface->hwaddr->sa_data[4], iface->hwaddr->sa_data[5]},
+		/* ignored by bind call */
+		.sll_hatype = 0,
+		.sll_pkttype = 0
+	};
+	NB_die_if(
+		bind(iface->fd, (struct sockaddr *)&saddr, sizeof(saddr))
+		, "");
+
+die:
+	return err_cnt;
+}
+
+
 /*	iface_new()
  * Open a socket on 'ifname' or return an already open socket.
+ * If 'worker_cnt', packets are instead received by that many worker threads,
+ * the first pinned to 'cpus[0]' etc., each on its own socket.
  */
-struct iface *iface_new(const char *name)
+struct iface *iface_new(const char *name, enum iface_io rx_io, enum iface_io tx_io,
+			long budget, enum iface_fanout fanout,
+			const int *cpus, unsigned int worker_cnt)
 {
 	struct iface *ret = NULL;
 	NB_die_if(!name, "no name given for iface");
+	NB_die_if(rx_io >= IFACE_IO_INVALID, "iface '%s' invalid rx mode", name);
+	NB_die_if(tx_io >= IFACE_IO_INVALID, "iface '%s' invalid tx mode", name);
+	NB_die_if(budget < 1 || budget > UINT16_MAX,
+		"iface '%s' budget '%ld' out of bounds", name, budget);
+	NB_die_if(fanout >= IFACE_FANOUT_INVALID, "iface '%s' invalid fanout", name);
+	NB_die_if(worker_cnt && (rx_io == IFACE_IO_XDP || tx_io == IFACE_IO_XDP),
+		"iface '%s': workers not supported with xdp", name);
 
 #ifdef XDPACKET_DISALLOW_CLOBBER
 	NB_die_if(js_get(&iface_JS, name) != NULL,
@@ -104,9 +443,22 @@ struct iface *iface_new(const char *name)
 		), "fail alloc size %zu", sizeof(*ret->hwaddr));
 
 	/* socket */
+	ret->rx_io = rx_io;
+	ret->tx_io = tx_io;
+	ret->budget = budget;
+	ret->fanout = fanout;
 	ret->fd = -1;
+	ret->xfd = -1;
+	NB_die_if(!(
+		ret->wcount = aligned_alloc(NLC_CACHE_LINE, IFACE_WORKER_MAX * sizeof(*ret->wcount))
+		), "fail alloc size %zu", IFACE_WORKER_MAX * sizeof(*ret->wcount));
+	memset(ret->wcount, 0x0, IFACE_WORKER_MAX * sizeof(*ret->wcount));
+	/* Protocol 0 receives nothing, bind() cannot change that later:
+	 * for when packets are received by workers or an XSK instead.
+	 */
+	bool rx = !worker_cnt && rx_io != IFACE_IO_XDP;
 	NB_die_if((
-		ret->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))
+		ret->fd = socket(AF_PACKET, SOCK_RAW, rx ? htons(ETH_P_ALL) : 0)
 		) < 0, "unable to open socket on %s", ret->name);
 	struct ifreq ifr = {{{0}}};
 	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", name);
@@ -147,23 +499,24 @@ struct iface *iface_new(const char *name)
 		ioctl(ret->fd, SIOCSIFFLAGS, &ifr)
 		, "");
 
-	/* bind to interface */
-	struct sockaddr_ll saddr = {
-		.sll_family = AF_PACKET,
-		.sll_protocol = htons(ETH_P_ALL),
-		.sll_ifindex = ret->ifindex,
-		.sll_halen = 6,
-		.sll_addr = {
-			ret->hwaddr->sa_data[0], ret->hwaddr->sa_data[1], ret->hwaddr->sa_data[2],
-			ret->hwaddr->sa_data[3], ret->hwaddr->sa_data[4], ret->hwaddr->sa_data[5]},
-		/* ignored by bind call */
-		.sll_hatype = 0,
-		.sll_pkttype = 0
-	};
 	NB_die_if(
-		bind(ret->fd, (struct sockaddr *)&saddr, sizeof(saddr))
+		iface_sock_setup(ret, !worker_cnt)
 		, "");
 
+	/* workers: the fanout group is created by the first one to join */
+	if (worker_cnt) {
+		NB_die_if(!(
+			ret->workers = calloc(worker_cnt, sizeof(*ret->workers))
+			), "fail alloc size %zu", worker_cnt * sizeof(*ret->workers));
+		for (; ret->worker_cnt < worker_cnt; ret->worker_cnt++) {
+			NB_die_if(!(
+				ret->workers[ret->worker_cnt] = iface_worker_new(ret,
+								ret->worker_cnt,
+								cpus[ret->worker_cnt])
+				), "could not start worker %u of %s", ret->worker_cnt, ret->name);
+		}
+	}
+
 	NB_die_if(
 		js_insert(&iface_JS, ret->name, ret, true)
 		, "");
@@ -197,32 +550,314 @@ struct iface *iface_get(const char *name)
 }
 
 
-/*	iface_callback()
+/*	iface_rx_partial()
+ * Return true if the PACKET_AUXDATA of 'msg' reports the checksum
+ * of the frame as not yet computed.
+ */
+static bool iface_rx_partial(struct msghdr *msg)
+{
+	for (struct cmsghdr *cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+		if (cm->cmsg_level == SOL_PACKET && cm->cmsg_type == PACKET_AUXDATA) {
+			struct tpacket_auxdata aux;
+			memcpy(&aux, CMSG_DATA(cm), sizeof(aux));
+			return aux.tp_status & TP_STATUS_CSUMNOTREADY;
+		}
+	}
+	return false;
+}
+
+
+/*	iface_socket_callback()
+ * Receive (copy) up to 'budget' packets from the socket
+ * and hand them to the handler.
  */
-int iface_callback(int fd, uint32_t events, void *context)
+static int iface_socket_callback(struct iface *sk)
 {
-	/* receive packet and discard outgoing packets */
 	struct sockaddr_ll addr;
-        socklen_t addr_len = sizeof(addr);
 	char buf[16384];
-	ssize_t res = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&addr, &addr_len);
-	if (res < 1)
-		return 1;
+	union {
+		struct cmsghdr	align;
+		uint8_t		buf[IFACE_AUXDATA_LEN];
+	} ctrl;
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+	struct msghdr msg = {
+		.msg_name = &addr,
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = &ctrl
+	};
 
-	/* handle packet */
-	struct iface *sk = (struct iface *)context;
-	if (addr.sll_pkttype == PACKET_OUTGOING) {
-		sk->count_out++;
-	} else {
-		sk->count_in++;
-		if (sk->handler)
-			sk->handler(sk->context, buf, res);
+	for (unsigned int i = 0; i < sk->budget; i++) {
+		/* receive packet and discard outgoing packets */
+		msg.msg_namelen = sizeof(addr);
+		msg.msg_controllen = sizeof(ctrl);
+		ssize_t res = recvmsg(sk->fd, &msg, MSG_DONTWAIT);
+		if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			sk->count_empty++;
+			return 0;
+		}
+		if (res < 1)
+			return 1;
+
+		/* handle packet */
+		if (addr.sll_pkttype != PACKET_OUTGOING) {
+			sk->count_in++;
+			checksum_log_rx(iface_rx_partial(&msg));
+			if (sk->handler)
+				sk->handler(sk->context, buf, res);
+		}
+	}
+
+	sk->count_exhausted++;
+	return 0;
+}
+
+
+/*	iface_mmsg_callback()
+ * Receive up to 'budget' packets with as few recvmmsg() calls as possible
+ * and hand them to the handler.
+ */
+static int iface_mmsg_callback(struct iface *sk)
+{
+	unsigned int budget = sk->budget;
+	while (budget) {
+		unsigned int vlen = budget < IFACE_MMSG_BATCH ? budget : IFACE_MMSG_BATCH;
+		for (unsigned int i = 0; i < vlen; i++) {
+			sk->rx_msgs[i].msg_hdr.msg_namelen = sizeof(sk->rx_addrs[i]);
+			sk->rx_msgs[i].msg_hdr.msg_controllen = IFACE_AUXDATA_LEN;
+		}
+
+		int res = recvmmsg(sk->fd, sk->rx_msgs, vlen, MSG_DONTWAIT, NULL);
+		if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			sk->count_empty++;
+			return 0;
+		}
+		if (res < 1)
+			return 1;
+
+		/* handle packets and discard outgoing packets */
+		for (int i = 0; i < res; i++) {
+			if (sk->rx_addrs[i].sll_pkttype == PACKET_OUTGOING)
+				continue;
+			sk->count_in++;
+			checksum_log_rx(iface_rx_partial(&sk->rx_msgs[i].msg_hdr));
+			if (sk->handler)
+				sk->handler(sk->context, sk->rx_iovs[i].iov_base,
+						sk->rx_msgs[i].msg_len);
+		}
+
+		/* a short batch means the queue is drained */
+		budget -= res;
+		if ((unsigned int)res < vlen) {
+			sk->count_empty++;
+			return 0;
+		}
+	}
+
+	sk->count_exhausted++;
+	return 0;
+}
+
+
+/*	iface_xsk_callback()
+ * Hand up to 'budget' packets from the XSK rx ring to the handler.
+ * XDP gives no checksum status: frames are taken to be complete.
+ */
+static int iface_xsk_callback(struct iface *sk)
+{
+	checksum_log_rx(false);
+	unsigned int n = xsk_rx_burst(sk->xsk, sk->budget, sk->handler, sk->context);
+	sk->count_in += n;
+	if (n < sk->budget)
+		sk->count_empty++;
+	else
+		sk->count_exhausted++;
+	return 0;
+}
+
+
+/*	iface_ring_callback()
+ * Hand up to 'budget' packets to the handler, in-place in the rx ring.
+ * Each block is retired to the kernel as soon as all its packets are handled;
+ * a partially handled block is resumed at the next wakeup.
+ */
+static int iface_ring_callback(struct iface *sk)
+{
+	unsigned int budget = sk->budget;
+	while (budget) {
+		struct tpacket_block_desc *block = (void *)sk->rx_ring
+						+ (size_t)sk->rx_block * IFACE_RING_BLOCK_SZ;
+		/* Block still owned by the kernel: nothing (left) to receive.
+		 * Pairs with the kernel's release of the block.
+		 */
+		if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE)
+				& TP_STATUS_USER))
+		{
+			sk->count_empty++;
+			return 0;
+		}
+
+		if (!sk->rx_pkt)
+			sk->rx_offt = block->hdr.bh1.offset_to_first_pkt;
+		for (; sk->rx_pkt < block->hdr.bh1.num_pkts && budget; sk->rx_pkt++, budget--) {
+			struct tpacket3_hdr *hdr = (void *)block + sk->rx_offt;
+			const struct sockaddr_ll *addr = (void *)hdr + TPACKET_ALIGN(sizeof(*hdr));
+			if (addr->sll_pkttype != PACKET_OUTGOING) {
+				sk->count_in++;
+				checksum_log_rx(hdr->tp_status & TP_STATUS_CSUMNOTREADY);
+				if (sk->handler)
+					sk->handler(sk->context, (void *)hdr + hdr->tp_mac,
+							hdr->tp_snaplen);
+			}
+			sk->rx_offt += hdr->tp_next_offset;
+		}
+		if (sk->rx_pkt < block->hdr.bh1.num_pkts)
+			break;
+
+		/* all frames in block consumed: return it to the kernel */
+		__atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		sk->rx_block = (sk->rx_block + 1) % IFACE_RING_BLOCK_CNT;
+		sk->rx_pkt = 0;
 	}
 
+	sk->count_exhausted++;
 	return 0;
 }
 
 
+/*	iface_mmsg_send()
+ * Send all frames queued in 'tx_msgs'.
+ * Frames the socket refuses are dropped: the batch is always emptied.
+ */
+static void iface_mmsg_send(struct iface *iface)
+{
+	unsigned int sent = 0;
+	while (sent < iface->tx_pending) {
+		int res = sendmmsg(iface->fd, &iface->tx_msgs[sent],
+					iface->tx_pending - sent, MSG_DONTWAIT);
+		if (res < 1) {
+			NB_wrn("sockdrop of %u packets on %s",
+				iface->tx_pending - sent, iface->name);
+			iface->count_sockdrop += iface->tx_pending - sent;
+			break;
+		}
+		iface->count_out += res;
+		sent += res;
+	}
+	iface->tx_pending = 0;
+}
+
+
+/*	iface_ring_unsent()
+ * Number of the frames staged on the tx ring of 'iface' since the last
+ * kick which the kernel has not yet taken.
+ * The kernel takes frames in ring order; a slot can only have been staged
+ * again once taken, so only the last 'tx_frame_cnt' frames need looking at.
+ */
+static unsigned int iface_ring_unsent(struct iface *iface)
+{
+	unsigned int i = iface->tx_pending < iface->tx_frame_cnt ?
+				iface->tx_pending : iface->tx_frame_cnt;
+	for (; i > 0; i--) {
+		size_t frame = (iface->tx_frame + iface->tx_frame_cnt - i) % iface->tx_frame_cnt;
+		struct tpacket3_hdr *hdr = (void *)iface->tx_ring + frame * iface->tx_frame_sz;
+		if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) & TP_STATUS_SEND_REQUEST)
+			break;
+	}
+	return i;
+}
+
+
+/*	iface_flush()
+ * Send every frame staged on every iface during this receive batch:
+ * one syscall per iface (in the common case).
+ * Called at the end of every receive batch, and by iface_tx_retry().
+ */
+static void iface_flush()
+{
+	struct iface *stalled = NULL;
+	while (iface_tx_pending) {
+		struct iface *iface = iface_tx_pending;
+		iface_tx_pending = iface->tx_next;
+		iface->tx_next = NULL;
+
+		if (iface->tx_io == IFACE_IO_MMSG) {
+			iface_mmsg_send(iface);
+			continue;
+		}
+
+		/* Ring and XSK: counted as output once the kernel takes them.
+		 * Frames it has not yet taken (EAGAIN) stay staged and 'iface'
+		 * queued, to be kicked again (see iface_tx_retry()).
+		 */
+		int unsent;
+		if (iface->tx_io == IFACE_IO_XDP)
+			unsent = xsk_tx_kick(iface->xsk);
+		else if (send(iface->fd, NULL, 0, MSG_DONTWAIT) < 0 && errno != EAGAIN)
+			unsent = -1;
+		else
+			unsent = iface_ring_unsent(iface);
+
+		if (unsent < 0) {
+			NB_wrn("sockdrop (tx kick failed) of %u packets on %s",
+				iface->tx_pending, iface->name);
+			iface->count_sockdrop += iface->tx_pending;
+			iface->tx_pending = 0;
+			continue;
+		}
+		if ((unsigned int)unsent > iface->tx_pending)
+			unsent = iface->tx_pending;
+		iface->count_out += iface->tx_pending - unsent;
+		iface->tx_pending = unsent;
+		if (unsent) {
+			iface->tx_next = stalled;
+			stalled = iface;
+		}
+	}
+	iface_tx_pending = stalled;
+}
+
+
+/*	iface_tx_retry()
+ * Kick again the tx rings of the calling thread which the kernel
+ * has not yet emptied: frames staged on an iface receiving nothing more
+ * must not wait for the next packet to be sent.
+ * Returns the epoll timeout to wait for: 'timeout' if nothing is left
+ * to kick, otherwise IFACE_TX_RETRY_MS.
+ */
+int iface_tx_retry(int timeout)
+{
+	if (!iface_tx_pending)
+		return timeout;
+	iface_flush();
+	return iface_tx_pending ? IFACE_TX_RETRY_MS : timeout;
+}
+
+
+/*	iface_callback()
+ */
+int iface_callback(int __attribute__((unused)) fd, uint32_t events, void *context)
+{
+	struct iface *sk = (struct iface *)context;
+	int ret;
+	switch (sk->rx_io) {
+	case IFACE_IO_RING:
+		ret = iface_ring_callback(sk);
+		break;
+	case IFACE_IO_MMSG:
+		ret = iface_mmsg_callback(sk);
+		break;
+	case IFACE_IO_XDP:
+		ret = iface_xsk_callback(sk);
+		break;
+	default:
+		ret = iface_socket_callback(sk);
+	}
+	iface_flush();
+	return ret;
+}
+
+
 /*	iface_handler_register()
  */
 int iface_handler_register (struct iface *iface, iface_handler_t handler, void *context)
@@ -232,6 +867,10 @@ int iface_handler_register (struct iface *iface, iface_handler_t handler, void *
 		, "iface '%s' has existing non-identical handler", iface->name);
 	iface->handler = handler;
 	iface->context = context;
+	for (unsigned int i = 0; i < iface->worker_cnt; i++) {
+		iface->workers[i]->handler = handler;
+		iface->workers[i]->context = context;
+	}
 die:
 	return err_cnt;
 }
@@ -246,16 +885,346 @@ int iface_handler_clear (struct iface *iface, iface_handler_t handler, void *con
 		|| !iface->handler
 		|| (iface->handler != handler || iface->context != context)
 		, "");
-	iface->handler = iface->context = NULL;
+	iface->handler = NULL;
+	iface->context = NULL;
+	for (unsigned int i = 0; i < iface->worker_cnt; i++) {
+		iface->workers[i]->handler = NULL;
+		iface->workers[i]->context = NULL;
+	}
 die:
 	return err_cnt;
 }
 
+/*	iface_fence()
+ * Wait for all workers to finish the batch they are handling
+ * and keep them from starting another until iface_unfence().
+ * To be held while changing anything workers may use
+ * (ifaces, fields, rules, processes ...).
+ */
+void iface_fence()
+{
+	pthread_rwlock_wrlock(&iface_fence_lock);
+}
+
+/*	iface_unfence()
+ */
+void iface_unfence()
+{
+	pthread_rwlock_unlock(&iface_fence_lock);
+}
+
+
+/*	iface_worker_callback()
+ * Like iface_callback(), but only while the control plane is not fenced.
+ */
+static int iface_worker_callback(int fd, uint32_t events, void *context)
+{
+	struct iface *sk = context;
+
+	/* Fenced: wait for the control plane, but not for good,
+	 * it may be waiting for us to exit (see iface_worker_free()).
+	 * On timeout packets stay queued, and our caller checks 'stop'
+	 * before epoll calls us again.
+	 */
+	if (NLC_UNLIKELY(pthread_rwlock_tryrdlock(&iface_fence_lock))) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += IFACE_WORKER_POLL_MS * 1000000L;
+		ts.tv_sec += ts.tv_nsec / 1000000000L;
+		ts.tv_nsec %= 1000000000L;
+		if (pthread_rwlock_timedrdlock(&iface_fence_lock, &ts))
+			return 0;
+	}
+	int ret = iface_callback(fd, events, context);
+	pthread_rwlock_unlock(&iface_fence_lock);
+
+	/* epoll_track will close() the socket: don't close it again */
+	if (ret) {
+		NB_err("worker %u of %s: socket failed", sk->worker_id, sk->name);
+		sk->fd = -1;
+	}
+	return ret;
+}
+
+/*	iface_worker_main()
+ * Worker thread: service one worker socket until told to stop.
+ */
+static void *iface_worker_main(void *arg)
+{
+	struct iface *sk = arg;
+	iface_self = sk;
+	field_anchors_reset();
+
+	while (!__atomic_load_n(&sk->stop, __ATOMIC_ACQUIRE)) {
+		/* counters are only touched while not fenced */
+		int timeout = IFACE_WORKER_POLL_MS;
+		if (iface_tx_pending && !pthread_rwlock_tryrdlock(&iface_fence_lock)) {
+			timeout = iface_tx_retry(timeout);
+			pthread_rwlock_unlock(&iface_fence_lock);
+		}
+		if (eptk_pwait_exec(sk->wtk, timeout, NULL) < 0) {
+			NB_err("worker %u of %s: epoll failed", sk->worker_id, sk->name);
+			break;
+		}
+	}
+	return NULL;
+}
+
+/*	iface_worker_close()
+ * Release everything belonging to worker socket 'sk' except the thread.
+ */
+static void iface_worker_close(struct iface *sk)
+{
+	/* epoll_track closes the socket if it was registered */
+	if (sk->wtk) {
+		eptk_free(sk->wtk);
+		sk->fd = -1;
+	}
+	if (sk->xfd != -1)
+		close(sk->xfd);
+	iface_sock_close(sk);
+	iface_worker_ids &= ~(1ULL << sk->worker_id);
+	free(sk);
+}
+
+/*	iface_worker_free()
+ * Wait for the thread of 'sk' to exit (after 'stop' is set), then close 'sk'.
+ */
+static void iface_worker_free(struct iface *sk)
+{
+	if (!sk)
+		return;
+	__atomic_store_n(&sk->stop, true, __ATOMIC_RELEASE);
+	pthread_join(sk->thread, NULL);
+	iface_worker_close(sk);
+}
+
+/*	iface_worker_new()
+ * Open worker socket 'idx' of 'parent', join it to the fanout group
+ * of 'parent' and start a thread pinned to 'cpu' servicing it.
+ */
+static struct iface *iface_worker_new(struct iface *parent, unsigned int idx, int cpu)
+{
+	int err_cnt = 0;
+	struct iface *ret = NULL;
+	NB_die_if(cpu < 0 || cpu >= CPU_SETSIZE, "cpu %d out of bounds", cpu);
+	NB_die_if(iface_worker_ids == UINT64_MAX,
+		"already at max %d workers", IFACE_WORKER_MAX);
+
+	NB_die_if(!(
+		ret = calloc(sizeof(struct iface), 1)
+		), "fail alloc size %zu", sizeof(struct iface));
+	ret->worker_id = __builtin_ctzll(~iface_worker_ids);
+	iface_worker_ids |= 1ULL << ret->worker_id;
+
+	/* inherit everything, metadata is owned by 'parent' */
+	ret->parent = parent;
+	ret->cpu = cpu;
+	ret->budget = parent->budget;
+	ret->ifindex = parent->ifindex;
+	ret->mtu = parent->mtu;
+	ret->handler = parent->handler;
+	ret->context = parent->context;
+	ret->hwaddr = parent->hwaddr;
+	ret->addr = parent->addr;
+	ret->rx_io = parent->rx_io;
+	ret->tx_io = parent->tx_io;
+	ret->name = parent->name;
+	ret->ip_prn = parent->ip_prn;
+	ret->fd = -1;
+	ret->xfd = -1;
+
+	NB_die_if((
+		ret->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))
+		) < 0, "unable to open socket on %s", ret->name);
+	NB_die_if(
+		iface_sock_setup(ret, true)
+		, "");
+
+	/* first worker creates the group, with an id the kernel guarantees unique */
+	int mode = iface_fanout_modes[parent->fanout];
+	if (!idx) {
+		int arg = (mode | PACKET_FANOUT_FLAG_UNIQUEID) << 16;
+		socklen_t len = sizeof(arg);
+		NB_die_if(
+			setsockopt(ret->fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg))
+			|| getsockopt(ret->fd, SOL_PACKET, PACKET_FANOUT, &arg, &len)
+			, "could not create fanout group on %s", ret->name);
+		parent->fanout_id = arg & 0xffff;
+	} else {
+		int arg = parent->fanout_id | (mode << 16);
+		NB_die_if(
+			setsockopt(ret->fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg))
+			, "could not join fanout group %u on %s", parent->fanout_id, ret->name);
+	}
+
+	/* unbound, receives nothing: output to ifaces other than 'parent' */
+	NB_die_if((
+		ret->xfd = socket(AF_PACKET, SOCK_RAW, 0)
+		) < 0, "unable to open output socket for %s", ret->name);
+
+	NB_die_if(!(
+		ret->wtk = eptk_new()
+		), "");
+	if (eptk_register(ret->wtk, ret->fd, EPOLLIN, iface_worker_callback, ret, NULL)) {
+		eptk_free(ret->wtk);
+		ret->wtk = NULL;
+		NB_die("could not register epoll for worker %u of %s", idx, ret->name);
+	}
+
+	/* Pinned from the start.
+	 * Signals are for main(): the thread inherits a fully blocked mask.
+	 */
+	pthread_attr_t attr;
+	cpu_set_t cpuset;
+	sigset_t all, old;
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	sigfillset(&all);
+	pthread_attr_init(&attr);
+	pthread_attr_setaffinity_np(&attr, sizeof(cpuset), &cpuset);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int res = pthread_create(&ret->thread, &attr, iface_worker_main, ret);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_attr_destroy(&attr);
+	NB_die_if(res, "could not start worker %u of %s on cpu %d", idx, ret->name, cpu);
+
+	NB_inf("worker %u of %s on cpu %d", idx, ret->name, cpu);
+	return ret;
+die:
+	if (ret)
+		iface_worker_close(ret);
+	return NULL;
+}
+
+
+/*	iface_worker_output()
+ * Output from a worker thread to an iface other than the one it works for:
+ * that iface's sockets belong to other threads, use our own instead.
+ * Counted in our own slot of 'iface->wcount'.
+ */
+static int iface_worker_output(struct iface *iface, void *pkt, size_t plen, bool checksum)
+{
+	struct iface_wcount *wc = &iface->wcount[iface_self->worker_id];
+	enum checksum_err ret = checksum ? checksum_update(pkt, plen) : CHK_OK;
+	if (ret) {
+		NB_wrn("checksum fail of packet size %zu: %s",
+			plen, checksum_strerr(ret));
+		wc->checkfail++;
+		return 1;
+	}
+
+	struct sockaddr_ll saddr = {
+		.sll_family = AF_PACKET,
+		.sll_ifindex = iface->ifindex
+	};
+	if (sendto(iface_self->xfd, pkt, plen, 0,
+		(struct sockaddr *)&saddr, sizeof(saddr)) != (ssize_t)plen)
+	{
+		NB_wrn("sockdrop (truncation) of packet size %zu", plen);
+		wc->drop++;
+		return 1;
+	}
+	wc->out++;
+	return 0;
+}
+
+
+/*	iface_ring_stage()
+ * Copy 'pkt' into the next free slot of the tx ring of 'iface'
+ * and queue 'iface' to be kicked at the end of the batch.
+ * Returns 0 on success, 1 if the ring is full,
+ * -1 if 'pkt' is larger than a frame.
+ */
+static int iface_ring_stage(struct iface *iface, const void *pkt, size_t plen)
+{
+	const size_t data_off = TPACKET_ALIGN(sizeof(struct tpacket3_hdr));
+	if (plen > iface->tx_frame_sz - data_off)
+		return -1;
+
+	struct tpacket3_hdr *hdr = (void *)iface->tx_ring
+					+ (size_t)iface->tx_frame * iface->tx_frame_sz;
+	/* Ring full: kernel has not yet sent this slot.
+	 * Kick it once (it may simply not have been asked yet) before giving up.
+	 */
+	const uint32_t busy = TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING;
+	if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) & busy) {
+		send(iface->fd, NULL, 0, MSG_DONTWAIT);
+		if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) & busy)
+			return 1;
+	}
+
+	memcpy((void *)hdr + data_off, pkt, plen);
+	hdr->tp_len = plen;
+	hdr->tp_snaplen = plen;
+	hdr->tp_next_offset = 0;
+	__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+	iface->tx_frame = (iface->tx_frame + 1) % iface->tx_frame_cnt;
+
+	if (!iface->tx_pending++) {
+		iface->tx_next = iface_tx_pending;
+		iface_tx_pending = iface;
+	}
+	return 0;
+}
+
+
+/*	iface_mmsg_stage()
+ * Copy 'pkt' into the next slot of 'tx_msgs' and queue 'iface'
+ * to be sent at the end of the batch.
+ * A full batch is sent immediately.
+ * Returns 0 on success.
+ */
+static int iface_mmsg_stage(struct iface *iface, const void *pkt, size_t plen)
+{
+	if (plen > iface->mmsg_slot_sz)
+		return 1;
+
+	/* a full batch is sent now, but iface stays queued for the remainder */
+	int queued = iface->tx_pending;
+	if (iface->tx_pending == IFACE_MMSG_BATCH)
+		iface_mmsg_send(iface);
+
+	struct iovec *iov = &iface->tx_iovs[iface->tx_pending++];
+	memcpy(iov->iov_base, pkt, plen);
+	iov->iov_len = plen;
+
+	if (!queued) {
+		iface->tx_next = iface_tx_pending;
+		iface_tx_pending = iface;
+	}
+	return 0;
+}
+
+
+/*	iface_worker_slot()
+ * Index of the calling thread, for per-thread data of packet handlers:
+ * 0 for the main thread, 'worker_id' + 1 for a worker thread.
+ */
+unsigned int iface_worker_slot()
+{
+	return iface_self ? iface_self->worker_id + 1 : 0;
+}
+
+
 /*	iface_output()
+ * Output 'pkt' on 'iface'.
+ * If 'checksum' is false, the caller knows no byte covered by a checksum
+ * has been changed and the frame is output as-is, whatever its protocol,
+ * unless it was received with its checksum incomplete.
  */
-int iface_output(struct iface *iface, void *pkt, size_t plen)
+int iface_output(struct iface *iface, void *pkt, size_t plen, bool checksum)
 {
-	enum checksum_err ret = checksum(pkt, plen);
+	checksum |= checksum_log.partial;
+
+	/* in a worker thread, only ever use sockets of our own */
+	if (NLC_UNLIKELY(iface_self != NULL)) {
+		if (iface_self->parent != iface)
+			return iface_worker_output(iface, pkt, plen, checksum);
+		iface = iface_self;
+	}
+
+	enum checksum_err ret = checksum ? checksum_update(pkt, plen) : CHK_OK;
 	if (ret) {
 		NB_wrn("checksum fail of packet size %zu: %s",
 			plen, checksum_strerr(ret));
@@ -272,13 +1241,47 @@ int iface_output(struct iface *iface, void *pkt, size_t plen)
 
 	/* We expect hardware to compute FCS (CRC32) for Ethernet.
 	 * TODO: test errno values and close iface if socket died (aka: ifdown)
+	 * Staged frames are counted as output once actually sent,
+	 * in iface_flush() or iface_mmsg_send().
 	 */
-	if (send(iface->fd, pkt, plen, 0) != plen) {
+	if (iface->tx_io == IFACE_IO_RING) {
+		int res = iface_ring_stage(iface, pkt, plen);
+		if (res) {
+			if (res < 0) {
+				NB_wrn("sockdrop (truncation) of packet size %zu", plen);
+			} else {
+				NB_wrn("sockdrop (tx ring full) of packet size %zu", plen);
+			}
+			iface->count_sockdrop++;
+			return 1;
+		}
+		return 0;
+	} else if (iface->tx_io == IFACE_IO_MMSG) {
+		if (iface_mmsg_stage(iface, pkt, plen)) {
+			NB_wrn("sockdrop (oversize) of packet size %zu", plen);
+			iface->count_sockdrop++;
+			return 1;
+		}
+		return 0;
+	/* moves the descriptor if 'pkt' was received on an XSK */
+	} else if (iface->tx_io == IFACE_IO_XDP) {
+		if (xsk_tx_stage(iface->xsk, pkt, plen)) {
+			NB_wrn("sockdrop (XSK tx full) of packet size %zu", plen);
+			iface->count_sockdrop++;
+			return 1;
+		}
+		if (!iface->tx_pending++) {
+			iface->tx_next = iface_tx_pending;
+			iface_tx_pending = iface;
+		}
+		return 0;
+	} else if (send(iface->fd, pkt, plen, 0) != plen) {
 		NB_wrn("sockdrop (truncation) of packet size %zu", plen);
 		iface->count_sockdrop++;
 		return 1;
 	}
 
+	iface->count_out++;
 	return 0;
 }
 
@@ -293,6 +1296,12 @@ int iface_parse(enum parse_mode	mode,
 {
 	int err_cnt = 0;
 	const char *name = "";
+	enum iface_io rx_io = IFACE_IO_SOCKET;
+	enum iface_io tx_io = IFACE_IO_SOCKET;
+	long budget = IFACE_BUDGET_DEFAULT;
+	enum iface_fanout fanout = IFACE_FANOUT_HASH;
+	int cpus[IFACE_WORKER_MAX];
+	unsigned int worker_cnt = 0;
 	struct iface *iface = NULL;
 
 	/* parse mapping */
@@ -311,9 +1320,41 @@ int iface_parse(enum parse_mode	mode,
 			if (!strcmp("iface", keyname) || !strcmp("i", keyname))
 				name = valtxt;
 
+			else if (!strcmp("rx", keyname))
+				NB_die_if((
+					rx_io = iface_io_parse(valtxt)
+					) == IFACE_IO_INVALID, "iface rx '%s' invalid", valtxt);
+
+			else if (!strcmp("tx", keyname))
+				NB_die_if((
+					tx_io = iface_io_parse(valtxt)
+					) == IFACE_IO_INVALID, "iface tx '%s' invalid", valtxt);
+
+			else if (!strcmp("budget", keyname)) {
+				errno = 0;
+				budget = strtol(valtxt, NULL, 0);
+				NB_die_if(errno, "'%s': '%s' could not be parsed", keyname, valtxt);
+			}
+
+			else if (!strcmp("fanout", keyname))
+				NB_die_if((
+					fanout = iface_fanout_parse(valtxt)
+					) == IFACE_FANOUT_INVALID, "iface fanout '%s' invalid", valtxt);
+
 			else
 				NB_err("'iface' does not implement '%s'", keyname);
 
+		/* one worker per CPU listed */
+		} else if (val->type == YAML_SEQUENCE_NODE && !strcmp("cpus", keyname)) {
+			Y_FOR_SEQ(doc, val,
+				NB_die_if(type != YAML_SCALAR_NODE, "'cpus' expects a list of numbers");
+				NB_die_if(worker_cnt == IFACE_WORKER_MAX,
+					"max %d workers", IFACE_WORKER_MAX);
+				errno = 0;
+				cpus[worker_cnt++] = strtol(txt, NULL, 0);
+				NB_die_if(errno, "'%s': '%s' could not be parsed", keyname, txt);
+			);
+
 		} else {
 			NB_die("'%s' in iface not a scalar", keyname);
 		}
@@ -324,10 +1365,10 @@ int iface_parse(enum parse_mode	mode,
 	case PARSE_ADD:
 	{
 		NB_die_if(!(
-			iface = iface_new(name)
+			iface = iface_new(name, rx_io, tx_io, budget, fanout, cpus, worker_cnt)
 			), "");
 		NB_die_if(
-			eptk_register(tk, iface->fd, EPOLLIN, iface_callback, iface, iface_free)
+			eptk_register(tk, iface_rx_fd(iface), EPOLLIN, iface_callback, iface, iface_free)
 			, "could not register epoll on '%s'", iface->name);
 		NB_die_if(
 			iface_emit(iface, outdoc, outlist)
@@ -347,7 +1388,7 @@ int iface_parse(enum parse_mode	mode,
 		 * which will also remove it from the JS array.
 		 */
 		NB_die_if((
-			eptk_remove(tk, iface->fd)
+			eptk_remove(tk, iface_rx_fd(iface))
 			) != 1, "could not remove '%s'", name);
 		break;
 
@@ -380,14 +1421,82 @@ int iface_emit(struct iface *iface, yaml_document_t *outdoc, int outlist)
 {
 	int err_cnt = 0;
 	int reply = yaml_document_add_mapping(outdoc, NULL, YAML_BLOCK_MAPPING_STYLE);
+
+	/* Totals over our own socket, our workers' sockets,
+	 * and output from workers of other ifaces.
+	 * Workers are fenced while we are parsing: no need for atomics.
+	 */
+	size_t in = iface->count_in, out = iface->count_out;
+	size_t drop = iface->count_sockdrop, checkfail = iface->count_checkfail;
+	size_t exhausted = iface->count_exhausted, empty = iface->count_empty;
+	for (unsigned int i = 0; i < iface->worker_cnt; i++) {
+		struct iface *w = iface->workers[i];
+		in += w->count_in;
+		out += w->count_out;
+		drop += w->count_sockdrop;
+		checkfail += w->count_checkfail;
+		exhausted += w->count_exhausted;
+		empty += w->count_empty;
+	}
+	for (unsigned int i = 0; i < IFACE_WORKER_MAX; i++) {
+		out += iface->wcount[i].out;
+		drop += iface->wcount[i].drop;
+		checkfail += iface->wcount[i].checkfail;
+	}
+
 	NB_die_if(
 		y_pair_insert(outdoc, reply, "iface", iface->name)
 		|| y_pair_insert_nf(outdoc, reply, "address", "%s", iface->ip_prn)
-		|| y_pair_insert_nf(outdoc, reply, "pkt in", "%zu", iface->count_in)
-		|| y_pair_insert_nf(outdoc, reply, "pkt out", "%zu", iface->count_out)
-		|| y_pair_insert_nf(outdoc, reply, "pkt drop/truncate", "%zu", iface->count_sockdrop)
-		|| y_pair_insert_nf(outdoc, reply, "pkt fail checksum", "%zu", iface->count_checkfail)
+		|| y_pair_insert_nf(outdoc, reply, "pkt in", "%zu", in)
+		|| y_pair_insert_nf(outdoc, reply, "pkt out", "%zu", out)
+		|| y_pair_insert_nf(outdoc, reply, "pkt drop/truncate", "%zu", drop)
+		|| y_pair_insert_nf(outdoc, reply, "pkt fail checksum", "%zu", checkfail)
+		|| y_pair_insert_nf(outdoc, reply, "rx budget exhausted", "%zu", exhausted)
+		|| y_pair_insert_nf(outdoc, reply, "rx queue empty", "%zu", empty)
 		, "");
+	/* elide default budget */
+	if (iface->budget != IFACE_BUDGET_DEFAULT) {
+		NB_die_if(
+			y_pair_insert_nf(outdoc, reply, "budget", "%u", iface->budget)
+			, "");
+	}
+	/* elide default (socket) I/O */
+	if (iface->rx_io != IFACE_IO_SOCKET) {
+		NB_die_if(
+			y_pair_insert(outdoc, reply, "rx", iface_io_prn(iface->rx_io))
+			, "");
+	}
+	if (iface->tx_io != IFACE_IO_SOCKET) {
+		NB_die_if(
+			y_pair_insert(outdoc, reply, "tx", iface_io_prn(iface->tx_io))
+			, "");
+	}
+	if (iface->xsk) {
+		NB_die_if(
+			y_pair_insert(outdoc, reply, "xdp mode", xsk_mode_prn(iface->xsk))
+			, "");
+	}
+	/* workers: elide default (hash) fanout */
+	if (iface->worker_cnt) {
+		int cpus = yaml_document_add_sequence(outdoc, NULL, YAML_FLOW_SEQUENCE_STYLE);
+		for (unsigned int i = 0; i < iface->worker_cnt; i++) {
+			char buf[16];
+			snprintf(buf, sizeof(buf), "%d", iface->workers[i]->cpu);
+			NB_die_if(!(
+				yaml_document_append_sequence_item(outdoc, cpus,
+					yaml_document_add_scalar(outdoc, NULL, (yaml_char_t *)buf,
+								-1, YAML_PLAIN_SCALAR_STYLE))
+				), "");
+		}
+		NB_die_if(
+			y_pair_insert_obj(outdoc, reply, "cpus", cpus)
+			, "");
+		if (iface->fanout != IFACE_FANOUT_HASH) {
+			NB_die_if(
+				y_pair_insert(outdoc, reply, "fanout", iface_fanout_prn(iface->fanout))
+				, "");
+		}
+	}
 	NB_die_if(!(
 		yaml_document_append_sequence_item(outdoc, outlist, reply)
 		), "");
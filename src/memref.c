@@ -6,6 +6,12 @@
 
 
 static Pvoid_t state_JS = NULL; /* (char *field_name) -> (struct memref *ref) */
+static Pvoid_t scratch_JS = NULL; /* (char *scratch_name) -> (struct memref *ref) */
+
+/* bitmap of the MEMREF_SCRATCH_ALIGN-sized slots of the register file in use */
+static uint32_t scratch_slots = 0;
+NLC_ASSERT(scratch_slots_check,
+	MEMREF_SCRATCH_LEN / MEMREF_SCRATCH_ALIGN <= sizeof(scratch_slots) * 8);
 
 /*	state_check_exit()
  * Catch memory leaks.
@@ -16,6 +22,20 @@ static void __attribute__((destructor(103))) memref_check_exit()
 		struct memref *ref = val;
 		NB_err("memref '%s' was not freed/released == leak", ref->name);
 	);
+	JS_LOOP(&scratch_JS,
+		struct memref *ref = val;
+		NB_err("scratch '%s' was not freed/released == leak", ref->name);
+	);
+}
+
+
+/*	memref_scratch_mask()
+ * Bitmap of 'scratch_slots' covering 'len' Bytes, starting at slot 'first'.
+ */
+static uint64_t memref_scratch_mask(size_t len, size_t first)
+{
+	size_t cnt = (len + MEMREF_SCRATCH_ALIGN - 1) / MEMREF_SCRATCH_ALIGN;
+	return ((1ULL << cnt) - 1) << first;
 }
 
 
@@ -49,32 +69,43 @@ void memref_release(void *arg)
 
 	/* _only_ remove from state_JS if _we_ are there:
 	 * we may never have been added or may be a dup.
+	 * A scratch register holds its slots exactly while in scratch_JS.
 	 */
-	if (js_get(&state_JS, ref->name) == ref)
+	if (memref_is_scratch(ref)) {
+		if (js_get(&scratch_JS, ref->name) == ref) {
+			js_delete(&scratch_JS, ref->name);
+			scratch_slots &= ~memref_scratch_mask(ref->set.len,
+						ref->set.offt / MEMREF_SCRATCH_ALIGN);
+		}
+	} else if (js_get(&state_JS, ref->name) == ref) {
 		js_delete(&state_JS, ref->name);
+	}
 
 	free(ref->name);
 	free(ref);
 }
 
 
-/* code shared by both memref_value_new() and memref_state_get()
+/* code shared by both memref_value_new() and memref_state_get():
+ * 'size' Bytes follow the memref
  */
-#define MEMREF_ALLOC_COMMON							\
+#define MEMREF_ALLOC_COMMON(size)						\
 	NB_die_if(!(								\
-		ret = calloc(1, sizeof(*ret) + field->set.len)			\
-		), "fail alloc size %zu", sizeof(*ret) + field->set.len);	\
+		ret = calloc(1, sizeof(*ret) + (size))				\
+		), "fail alloc size %zu", sizeof(*ret) + (size));		\
 	ret->set = field->set;
 
 
 /*	memref_value_new()
+ * If 'field' has a bitmask, the value is stored masked and followed by
+ * a copy of the bitmask (see bitmask.h).
  */
 struct memref *memref_value_new(const struct field *field, const char *value)
 {
 	struct memref *ret = NULL;
 	NB_die_if(!field || !value, "missing arguments");
 
-	MEMREF_ALLOC_COMMON
+	MEMREF_ALLOC_COMMON(field->bitmask ? 2 * field->set.len : field->set.len)
 	ret->set.flags |= MEMREF_FLAG_STATIC;
 
 	/* If a field-set can store the length of the user value string,
@@ -89,6 +120,11 @@ struct memref *memref_value_new(const struct field *field, const char *value)
 	NB_die_if(
 		value_parse(ret->input, ret->bytes, ret->set.len)
 		, "");
+	if (field->bitmask) {
+		for (unsigned int i = 0; i < ret->set.len; i++)
+			ret->bytes[i] &= field->bitmask[i];
+		memcpy(&ret->bytes[ret->set.len], field->bitmask, ret->set.len);
+	}
 	/* render binary representation as a user-readable hex string */
 	NB_die_if(!(
 		ret->rendered = value_render(ret->bytes, ret->set.len)
@@ -132,7 +168,7 @@ struct memref *memref_state_get(const struct field *field, const char *state_nam
 
 	/* otherwise, allocate a new one */
 	} else {
-		MEMREF_ALLOC_COMMON
+		MEMREF_ALLOC_COMMON(field->set.len)
 		ret->set.flags &= ~MEMREF_FLAG_STATIC;
 
 		errno = 0;
@@ -154,6 +190,70 @@ die:
 }
 
 
+/*	memref_scratch_get()
+ * Get the register named 'scratch_name', allocating it in the register file
+ * with the extent of 'field' if it does not exist.
+ */
+struct memref *memref_scratch_get(const struct field *field, const char *scratch_name)
+{
+	struct memref *ret = NULL;
+	NB_die_if(!field || !scratch_name, "missing arguments");
+
+	/* is there an existing register? */
+	ret = js_get(&scratch_JS, scratch_name);
+
+	/* if one exists, make sure the field is the same */
+	if (ret) {
+		/* see memref_state_get() */
+		NB_die_if(!memref_state_eq(ret->set, field->set) && !(ret = NULL),
+			"field '%s' does not match existing field for scratch '%s'",
+			field->name, scratch_name);
+
+	/* otherwise, allocate a new one: it has no memory of its own */
+	} else {
+		NB_die_if(field->set.len > MEMREF_SCRATCH_LEN,
+			"field '%s' too long for a scratch register (max %d)",
+			field->name, MEMREF_SCRATCH_LEN);
+		NB_die_if(!(
+			ret = calloc(1, sizeof(*ret))
+			), "fail alloc size %zu", sizeof(*ret));
+		ret->set = field->set;
+		ret->set.flags = MEMREF_FLAG_SCRATCH;
+
+		errno = 0;
+		NB_die_if(!(
+			ret->name = nstralloc(scratch_name, MAXLINELEN, NULL)
+			), "string alloc fail");
+		NB_die_if(errno == E2BIG, "value truncated:\n%s", ret->name);
+
+		/* first fit */
+		size_t slot_cnt = MEMREF_SCRATCH_LEN / MEMREF_SCRATCH_ALIGN;
+		size_t first = 0;
+		while (first < slot_cnt
+			&& (scratch_slots & memref_scratch_mask(ret->set.len, first)))
+		{
+			first++;
+		}
+		NB_die_if(first == slot_cnt
+			|| memref_scratch_mask(ret->set.len, first) >> slot_cnt,
+			"no room in register file for scratch '%s'", scratch_name);
+		ret->set.offt = first * MEMREF_SCRATCH_ALIGN;
+
+		NB_die_if(
+			js_insert(&scratch_JS, ret->name, ret, false)
+			, "failed to insert new scratch '%s'", scratch_name);
+		scratch_slots |= memref_scratch_mask(ret->set.len, first);
+	}
+
+	/* always take a ref before returning */
+	refcnt_take(ret);
+	return ret;
+die:
+	memref_release(ret);
+	return NULL;
+}
+
+
 /*	memref_emit()
  */
 int memref_emit (struct memref *ref, yaml_document_t *outdoc, int outmapping)
@@ -167,6 +267,10 @@ int memref_emit (struct memref *ref, yaml_document_t *outdoc, int outmapping)
 		NB_die_if(
 			y_pair_insert(outdoc, outmapping, "bytes", ref->rendered)
 			, "failed to emit bytes");
+	} else if (memref_is_scratch(ref)) {
+		NB_die_if(
+			y_pair_insert(outdoc, outmapping, "scratch", ref->name)
+			, "failed to emit scratch");
 	} else {
 		NB_die_if(
 			y_pair_insert(outdoc, outmapping, "state", ref->name)
@@ -1,6 +1,10 @@
 #include <operations.h>
+#include <checksums.h>
 #include <nonlibc.h>
 #include <ndebug.h>
+#include <value.h>
+#include <inttypes.h> /* PRIu64 */
+#include <errno.h>
 
 
 /*	op_pkt_offset()
@@ -12,22 +16,52 @@
 NLC_INLINE
 const void *op_pkt_offset(const void *pkt, size_t plen, struct field_set set)
 {
-	/* Offset sanity.
-	 * 'offt' may be negative, in which case it denotes offset from
-	 * the end of the packet.
-	 */
-	const void *where = pkt + set.offt;
-	if (set.offt < 0)
-		where += plen;
-	if (where < pkt)
+	/* Offset and size sanity: see field_offt() */
+	size_t offt = field_offt(set, plen);
+	if (offt > plen || set.len > plen - offt)
 		return NULL;
 
-	/* Size sanity. */
-	size_t flen = set.len;
-	if ((where + flen) > (pkt + plen))
-		return NULL;
+	return pkt + offt;
+}
+
+
+/*	op_resolve()
+ * Point 'out_to' and 'out_from' at the data 'op' works on:
+ * state/value memory or a 'scratch' register if 'op' references any,
+ * otherwise into 'pkt'.
+ * This may fail if packet e.g. is not big enough,
+ * or if there is no register file (matching).
+ * If not 'checked', the caller guarantees packet fields lie inside 'pkt'
+ * at their plain offset (see op_bound()).
+ */
+NLC_INLINE
+int op_resolve(struct op_set *op, const void *pkt, size_t plen, uint8_t *scratch,
+			bool checked, const uint8_t **out_to, const uint8_t **out_from)
+{
+	*out_to = op->to;
+	*out_from = op->from;
+
+	if (NLC_UNLIKELY(op->set_from.flags & (OP_SCRATCH_TO | OP_SCRATCH_FROM))) {
+		if (!scratch)
+			return 1;
+		if (op->set_from.flags & OP_SCRATCH_TO)
+			*out_to = scratch + (uintptr_t)op->to;
+		if (op->set_from.flags & OP_SCRATCH_FROM)
+			*out_from = scratch + (uintptr_t)op->from;
+	}
 
-	return where;
+	if (!checked) {
+		if (!*out_to)
+			*out_to = (const uint8_t *)pkt + op->set_to.offt;
+		if (!*out_from)
+			*out_from = (const uint8_t *)pkt + op->set_from.offt;
+		return 0;
+	}
+	if (!*out_to && !(*out_to = op_pkt_offset(pkt, plen, op->set_to)))
+		return 1;
+	if (!*out_from && !(*out_from = op_pkt_offset(pkt, plen, op->set_from)))
+		return 1;
+	return 0;
 }
 
 
@@ -35,8 +69,9 @@ const void *op_pkt_offset(const void *pkt, size_t plen, struct field_set set)
  * Common sanity and offset code for operations.
  */
 NLC_INLINE
-int op_common(struct op_set *op, const void *pkt, size_t plen,
-			size_t *out_len, const uint8_t **out_to, const uint8_t **out_from)
+int op_common(struct op_set *op, const void *pkt, size_t plen, uint8_t *scratch,
+			bool checked, size_t *out_len,
+			const uint8_t **out_to, const uint8_t **out_from)
 {
 	*out_len = op->set_to.len > op->set_from.len ? op->set_to.len : op->set_from.len;
 
@@ -47,29 +82,19 @@ int op_common(struct op_set *op, const void *pkt, size_t plen,
 	}
 
 	*out_len -= 1; /* IMPORTANT: last byte is copied/matched through a mask! */
-	*out_to = op->to;
-	*out_from = op->from;
-
-	/* If not provided with addresses (aka pointers to state),
-	 * point into local packet.
-	 * This may fail if packet e.g. is not big enough.
-	 */
-	if (!*out_to && !(*out_to = op_pkt_offset(pkt, plen, op->set_to)))
-		return 1;
-	if (!*out_from && !(*out_from = op_pkt_offset(pkt, plen, op->set_from)))
-		return 1;
-	return 0;
+	return op_resolve(op, pkt, plen, scratch, checked, out_to, out_from);
 }
 
 
-/*	op_match()
+/*	op_match_generic()
  */
-int __attribute__((hot)) op_match(struct op_set *op, const void *pkt, size_t plen)
+NLC_INLINE
+int op_match_generic(struct op_set *op, const void *pkt, size_t plen, bool checked)
 {
 	size_t len;
 	const uint8_t *to;
 	const uint8_t *from;
-	if (op_common(op, pkt, plen, &len, &to, &from))
+	if (op_common(op, pkt, plen, NULL, checked, &len, &to, &from))
 		return 1;
 
 	/* zero-length always matches */
@@ -84,14 +109,16 @@ int __attribute__((hot)) op_match(struct op_set *op, const void *pkt, size_t ple
 }
 
 
-/*	op_write()
+/*	op_write_generic()
  */
-int __attribute__((hot)) op_write(struct op_set *op, void *pkt, size_t plen)
+NLC_INLINE
+int op_write_generic(struct op_set *op, void *pkt, size_t plen, uint8_t *scratch,
+			bool checked)
 {
 	size_t len;
 	uint8_t *to;
 	const uint8_t *from;
-	if (op_common(op, pkt, plen, &len, (const uint8_t **)&to, &from))
+	if (op_common(op, pkt, plen, scratch, checked, &len, (const uint8_t **)&to, &from))
 		return 1;
 
 	/* zero-length is a nop */
@@ -104,6 +131,457 @@ int __attribute__((hot)) op_write(struct op_set *op, void *pkt, size_t plen)
 	return 0;
 }
 
+
+/*	op_match_w()
+ */
+NLC_INLINE
+int op_match_w(struct op_set *op, const void *pkt, size_t plen, bool checked,
+		size_t w, bool masked)
+{
+	const uint8_t *to;
+	const uint8_t *from;
+	if (op_resolve(op, pkt, plen, NULL, checked, &to, &from))
+		return 1;
+
+	const size_t tail = OP_TAIL(w);
+	const size_t head = w - tail;
+	if (head && op_ld(to, head) != op_ld(from, head))
+		return 1;
+
+	uint64_t t = op_ld(to + head, tail);
+	uint64_t f = op_ld(from + head, tail);
+	if (masked) {
+		t &= op_tail_mask(op->set_to.mask, tail);
+		f &= op_tail_mask(op->set_from.mask, tail);
+	}
+	return t != f;
+}
+
+/*	op_write_w()
+ */
+NLC_INLINE
+int op_write_w(struct op_set *op, void *pkt, size_t plen, uint8_t *scratch,
+		bool checked, size_t w, bool masked)
+{
+	uint8_t *to;
+	const uint8_t *from;
+	if (op_resolve(op, pkt, plen, scratch, checked, (const uint8_t **)&to, &from))
+		return 1;
+
+	const size_t tail = OP_TAIL(w);
+	const size_t head = w - tail;
+	/* load everything before storing anything, like memmove() */
+	uint64_t h = head ? op_ld(from, head) : 0;
+	uint64_t f = op_ld(from + head, tail);
+	if (masked) {
+		uint64_t mt = op_tail_mask(op->set_to.mask, tail);
+		uint64_t mf = op_tail_mask(op->set_from.mask, tail);
+		/* respect existing bits untouched by dst mask */
+		f = (op_ld(to + head, tail) & ~mt) | (f & mt & mf);
+	}
+	if (head)
+		op_st(to, h, head);
+	op_st(to + head, f, tail);
+	return 0;
+}
+
+/*	op_swap_w()
+ * Bits of the last Byte which are outside the mask stay where they are.
+ */
+NLC_INLINE
+int op_swap_w(struct op_set *op, void *pkt, size_t plen, size_t w, bool masked)
+{
+	uint8_t *a = (uint8_t *)op_pkt_offset(pkt, plen, op->set_to);
+	uint8_t *b = (uint8_t *)op_pkt_offset(pkt, plen, op->set_from);
+	if (!a || !b)
+		return 1;
+
+	const size_t tail = OP_TAIL(w);
+	const size_t head = w - tail;
+	uint64_t ha = head ? op_ld(a, head) : 0;
+	uint64_t hb = head ? op_ld(b, head) : 0;
+	uint64_t ta = op_ld(a + head, tail);
+	uint64_t tb = op_ld(b + head, tail);
+	uint64_t x = ta ^ tb;
+	if (masked)
+		x &= op_tail_mask(op->set_to.mask, tail);
+	if (head) {
+		op_st(a, hb, head);
+		op_st(b, ha, head);
+	}
+	op_st(a + head, ta ^ x, tail);
+	op_st(b + head, tb ^ x, tail);
+	return 0;
+}
+
+/*	op_match_table()
+ */
+NLC_INLINE
+int op_match_table(struct op_set *op, const void *pkt, size_t plen)
+{
+	const uint8_t *key = op_pkt_offset(pkt, plen, op->set_to);
+	if (!key)
+		return 1;
+	return !table_lookup(op->from, key, op->set_to.mask);
+}
+
+/*	op_match_member()
+ */
+NLC_INLINE
+int op_match_member(struct op_set *op, const void *pkt, size_t plen)
+{
+	const uint8_t *key = op_pkt_offset(pkt, plen, op->set_to);
+	if (!key)
+		return 1;
+	return !set_lookup(op->from, key, op->set_to.mask);
+}
+
+/*	op_match_range()
+ */
+NLC_INLINE
+int op_match_range(struct op_set *op, const void *pkt, size_t plen)
+{
+	const uint8_t *p = op_pkt_offset(pkt, plen, op->set_to);
+	if (!p)
+		return 1;
+	uint64_t v = op_range_value(p, op->set_to.len, op->set_to.mask);
+	return v < (uintptr_t)op->to || v > (uintptr_t)op->from;
+}
+
+/*	op_pkt_window()
+ * The window scanned by contains and regex ops is the field 'set',
+ * cut short by the end of the packet: only its start must lie inside.
+ * Returns non-zero if it doesn't.
+ */
+NLC_INLINE
+int op_pkt_window(const void *pkt, size_t plen, struct field_set set,
+		const uint8_t **out, size_t *out_len)
+{
+	size_t offt = field_offt(set, plen);
+	if (offt >= plen)
+		return 1;
+	*out = (const uint8_t *)pkt + offt;
+	*out_len = plen - offt;
+	if (*out_len > set.len)
+		*out_len = set.len;
+	return 0;
+}
+
+/*	op_match_search()
+ */
+NLC_INLINE
+int op_match_search(struct op_set *op, const void *pkt, size_t plen)
+{
+	const uint8_t *p;
+	size_t len;
+	if (op_pkt_window(pkt, plen, op->set_to, &p, &len))
+		return 1;
+	return !search_match(op->from, p, len);
+}
+
+/*	op_match_regex()
+ */
+NLC_INLINE
+int op_match_regex(struct op_set *op, const void *pkt, size_t plen)
+{
+	const uint8_t *p;
+	size_t len;
+	if (op_pkt_window(pkt, plen, op->set_to, &p, &len))
+		return 1;
+	return !dfa_match(op->from, p, len);
+}
+
+/*	op_match_bitmask()
+ * 'from' is the value, already masked, followed by the bitmask.
+ */
+NLC_INLINE
+int op_match_bitmask(struct op_set *op, const void *pkt, size_t plen)
+{
+	const uint8_t *p = op_pkt_offset(pkt, plen, op->set_to);
+	if (!p)
+		return 1;
+	const uint8_t *value = op->from;
+	return bitmask_differ(p, value, &value[op->set_to.len], op->set_to.len);
+}
+
+/*	op_write_bitmask()
+ */
+NLC_INLINE
+int op_write_bitmask(struct op_set *op, void *pkt, size_t plen)
+{
+	uint8_t *p = (uint8_t *)op_pkt_offset(pkt, plen, op->set_to);
+	if (!p)
+		return 1;
+	const uint8_t *value = op->from;
+	bitmask_merge(p, value, &value[op->set_to.len], op->set_to.len);
+	return 0;
+}
+
+/* One 'case' per kernel, calling 'kernel(args, width, masked)'.
+ */
+#define OP_KERNEL_CASES(kernel, ...)						\
+	case OP_KERNEL_1:			return kernel(__VA_ARGS__, 1, false);	\
+	case OP_KERNEL_1 | OP_KERNEL_MASKED:	return kernel(__VA_ARGS__, 1, true);	\
+	case OP_KERNEL_2:			return kernel(__VA_ARGS__, 2, false);	\
+	case OP_KERNEL_2 | OP_KERNEL_MASKED:	return kernel(__VA_ARGS__, 2, true);	\
+	case OP_KERNEL_4:			return kernel(__VA_ARGS__, 4, false);	\
+	case OP_KERNEL_4 | OP_KERNEL_MASKED:	return kernel(__VA_ARGS__, 4, true);	\
+	case OP_KERNEL_6:			return kernel(__VA_ARGS__, 6, false);	\
+	case OP_KERNEL_6 | OP_KERNEL_MASKED:	return kernel(__VA_ARGS__, 6, true);	\
+	case OP_KERNEL_8:			return kernel(__VA_ARGS__, 8, false);	\
+	case OP_KERNEL_8 | OP_KERNEL_MASKED:	return kernel(__VA_ARGS__, 8, true);	\
+	case OP_KERNEL_16:			return kernel(__VA_ARGS__, 16, false);	\
+	case OP_KERNEL_16 | OP_KERNEL_MASKED:	return kernel(__VA_ARGS__, 16, true);
+
+
+/*	op_match_kernel()
+ * Lookups check their own bounds: 'checked' only applies to
+ * the generic and width-specialized kernels.
+ */
+NLC_INLINE
+int op_match_kernel(struct op_set *op, const void *pkt, size_t plen, bool checked)
+{
+	switch (op->set_to.flags) {
+	OP_KERNEL_CASES(op_match_w, op, pkt, plen, checked)
+	case OP_KERNEL_TABLE:
+		return op_match_table(op, pkt, plen);
+	case OP_KERNEL_SET:
+		return op_match_member(op, pkt, plen);
+	case OP_KERNEL_RANGE:
+		return op_match_range(op, pkt, plen);
+	case OP_KERNEL_CONTAINS:
+		return op_match_search(op, pkt, plen);
+	case OP_KERNEL_REGEX:
+		return op_match_regex(op, pkt, plen);
+	case OP_KERNEL_BITMASK:
+		return op_match_bitmask(op, pkt, plen);
+	default:
+		return op_match_generic(op, pkt, plen, checked);
+	}
+}
+
+/*	op_match()
+ */
+int __attribute__((hot)) op_match(struct op_set *op, const void *pkt, size_t plen)
+{
+	return op_match_kernel(op, pkt, plen, true);
+}
+
+/*	op_match_unchecked()
+ */
+int __attribute__((hot)) op_match_unchecked(struct op_set *op, const void *pkt, size_t plen)
+{
+	return op_match_kernel(op, pkt, plen, false);
+}
+
+
+/*	op_write_kernel()
+ */
+NLC_INLINE
+int op_write_kernel(struct op_set *op, void *pkt, size_t plen, uint8_t *scratch,
+			bool checked)
+{
+	switch (op->set_to.flags) {
+	OP_KERNEL_CASES(op_write_w, op, pkt, plen, scratch, checked)
+	case OP_KERNEL_BITMASK:
+		return op_write_bitmask(op, pkt, plen);
+	default:
+		return op_write_generic(op, pkt, plen, scratch, checked);
+	}
+}
+
+
+/*	op_swap_generic()
+ */
+NLC_INLINE
+int op_swap_generic(struct op_set *op, void *pkt, size_t plen)
+{
+	size_t len = op->set_to.len;
+	/* zero-length is a nop */
+	if (!len)
+		return 0;
+	uint8_t *a = (uint8_t *)op_pkt_offset(pkt, plen, op->set_to);
+	uint8_t *b = (uint8_t *)op_pkt_offset(pkt, plen, op->set_from);
+	if (!a || !b)
+		return 1;
+
+	len -= 1; /* last byte is swapped through a mask */
+	for (size_t i = 0; i < len; i++) {
+		uint8_t t = a[i];
+		a[i] = b[i];
+		b[i] = t;
+	}
+	uint8_t x = (a[len] ^ b[len]) & op->set_to.mask;
+	a[len] ^= x;
+	b[len] ^= x;
+	return 0;
+}
+
+
+/*	op_swap_kernel()
+ */
+NLC_INLINE
+int op_swap_kernel(struct op_set *op, void *pkt, size_t plen)
+{
+	switch (op->set_to.flags) {
+	OP_KERNEL_CASES(op_swap_w, op, pkt, plen)
+	default:
+		return op_swap_generic(op, pkt, plen);
+	}
+}
+
+
+/*	op_swap()
+ * Both fields are journaled in 'checksum_log': as a single span if they
+ * share a word, since the journal must not hold the same word twice.
+ */
+static int op_swap(struct op_set *op, void *pkt, size_t plen)
+{
+	size_t len = op->set_to.len;
+	size_t a = field_offt(op->set_to, plen);
+	size_t b = field_offt(op->set_from, plen);
+	size_t lo = a < b ? a : b;
+	size_t hi = a < b ? b : a;
+
+	size_t first;
+	if (len && (lo + len - 1) >> 1 >= hi >> 1) {
+		first = checksum_log_old(pkt, plen, lo, hi + len - lo);
+	} else {
+		first = checksum_log_old(pkt, plen, a, len);
+		checksum_log_old(pkt, plen, b, len);
+	}
+
+	int ret = op_swap_kernel(op, pkt, plen);
+	checksum_log_new(pkt, plen, first);
+	return ret;
+}
+
+
+/*	op_write_journaled()
+ * Writes into the packet are journaled in 'checksum_log',
+ * so that checksums can later be updated incrementally.
+ */
+NLC_INLINE
+int op_write_journaled(struct op_set *op, void *pkt, size_t plen, uint8_t *scratch,
+			bool checked)
+{
+	/* writing to state or scratch: packet untouched */
+	if (op->to || (op->set_from.flags & OP_SCRATCH_TO))
+		return op_write_kernel(op, pkt, plen, scratch, checked);
+	if (NLC_UNLIKELY(op->set_from.flags & OP_SWAP))
+		return op_swap(op, pkt, plen);
+
+	size_t len = op->set_to.len > op->set_from.len ? op->set_to.len : op->set_from.len;
+	size_t offt = checked ? field_offt(op->set_to, plen) : (size_t)op->set_to.offt;
+	size_t first = checksum_log_old(pkt, plen, offt, len);
+	int ret = op_write_kernel(op, pkt, plen, scratch, checked);
+	checksum_log_new(pkt, plen, first);
+	return ret;
+}
+
+/*	op_write()
+ */
+int __attribute__((hot)) op_write(struct op_set *op, void *pkt, size_t plen, uint8_t *scratch)
+{
+	return op_write_journaled(op, pkt, plen, scratch, true);
+}
+
+/*	op_write_unchecked()
+ */
+int __attribute__((hot)) op_write_unchecked(struct op_set *op, void *pkt, size_t plen,
+						uint8_t *scratch)
+{
+	return op_write_journaled(op, pkt, plen, scratch, false);
+}
+
+
+/*	op_bound_side()
+ * A field 'len' Bytes long at 'set' lies inside the packet only if
+ * the packet is at least as long as returned:
+ * anchors never move a field backwards, and a negative 'offt'
+ * must not reach before the start of the packet.
+ */
+static size_t op_bound_side(struct field_set set, size_t len, bool *checked)
+{
+	if (set.offt < 0 || set.anchor != FIELD_ANCHOR_PACKET)
+		*checked = true;
+	if (set.offt < 0)
+		return -(long)set.offt;
+	return set.offt + len;
+}
+
+/*	op_bound()
+ * Raise '*min_plen' to the packet length below which 'op' always fails
+ * on bounds, and set '*checked' if 'op' must still check its bounds
+ * against each packet (fields anchored or counted from the end of
+ * the packet), i.e. cannot use op_match_unchecked()/op_write_unchecked().
+ */
+void op_bound(const struct op_set *op, size_t *min_plen, bool *checked)
+{
+	size_t need = 0;
+	size_t len = op->set_to.len > op->set_from.len ? op->set_to.len : op->set_from.len;
+
+	switch (op->set_to.flags) {
+	case OP_KERNEL_TABLE:
+	case OP_KERNEL_SET:
+	case OP_KERNEL_RANGE:
+	case OP_KERNEL_BITMASK:
+		need = op_bound_side(op->set_to, op->set_to.len, checked);
+		break;
+	case OP_KERNEL_CONTAINS:
+	case OP_KERNEL_REGEX:
+		/* only the start of the window must be inside: see op_pkt_window() */
+		need = op_bound_side(op->set_to, 1, checked);
+		break;
+	default:
+		/* zero-length ops (nop) never look at the packet */
+		if (!len)
+			return;
+		if (op->set_from.flags & OP_SWAP) {
+			need = op_bound_side(op->set_to, op->set_to.len, checked);
+			size_t b = op_bound_side(op->set_from, op->set_from.len, checked);
+			if (b > need)
+				need = b;
+			break;
+		}
+		if (!op->to && !(op->set_from.flags & OP_SCRATCH_TO))
+			need = op_bound_side(op->set_to, op->set_to.len, checked);
+		if (!op->from && !(op->set_from.flags & OP_SCRATCH_FROM)) {
+			size_t b = op_bound_side(op->set_from, op->set_from.len, checked);
+			if (b > need)
+				need = b;
+		}
+	}
+	if (need > *min_plen)
+		*min_plen = need;
+}
+
+
+/*	op_kernel_select()
+ * Pick the kernel for 'set', store it in 'set->set_to.flags'.
+ * Only ops where both sides have the same length are specialized;
+ * anything else goes to the generic kernel.
+ */
+void op_kernel_select(struct op_set *set)
+{
+	enum op_kernel kernel = OP_KERNEL_GENERIC;
+	if (set->set_to.len == set->set_from.len) {
+		switch (set->set_to.len) {
+		case 1:		kernel = OP_KERNEL_1;	break;
+		case 2:		kernel = OP_KERNEL_2;	break;
+		case 4:		kernel = OP_KERNEL_4;	break;
+		case 6:		kernel = OP_KERNEL_6;	break;
+		case 8:		kernel = OP_KERNEL_8;	break;
+		case 16:	kernel = OP_KERNEL_16;	break;
+		}
+	}
+	if (kernel != OP_KERNEL_GENERIC
+			&& (set->set_to.mask != 0xff || set->set_from.mask != 0xff))
+		kernel |= OP_KERNEL_MASKED;
+	set->set_to.flags = kernel;
+}
+
+
 /*	op_free()
  */
 void op_free (void *arg)
@@ -116,6 +594,10 @@ void op_free (void *arg)
 	field_release(op->src_field);
 	memref_release(op->dst);
 	memref_release(op->src);
+	table_release(op_table(op));
+	set_release(op_member(op));
+	search_free(op_search(op));
+	dfa_free(op_regex(op));
 
 	free(op);
 }
@@ -123,13 +605,20 @@ void op_free (void *arg)
 /*	op_new()
  */
 struct op *op_new (const char *dst_field_name, const char *dst_state_name,
-		const char *src_field_name, const char *src_state_name, const char *src_value)
+		const char *dst_scratch_name,
+		const char *src_field_name, const char *src_state_name,
+		const char *src_scratch_name, const char *src_value)
 {
 	struct op *ret = NULL;
 	NB_die_if(!dst_field_name && !src_field_name, "must provide at least one field");
-	NB_die_if(!dst_field_name && !dst_state_name, "no destination specified");
-	NB_die_if(!src_field_name && !src_state_name && !src_value, "no source specified");
-	NB_die_if(src_state_name && src_value, "source cannot be both a state and a value");
+	NB_die_if(!dst_field_name && !dst_state_name && !dst_scratch_name,
+		"no destination specified");
+	NB_die_if(!src_field_name && !src_state_name && !src_scratch_name && !src_value,
+		"no source specified");
+	NB_die_if(dst_state_name && dst_scratch_name,
+		"destination cannot be both a state and a scratch");
+	NB_die_if(!!src_state_name + !!src_scratch_name + !!src_value > 1,
+		"source must be only one of a state, a scratch or a value");
 
 	NB_die_if(!(
 		ret = calloc(sizeof(*ret), 1)
@@ -152,6 +641,12 @@ struct op *op_new (const char *dst_field_name, const char *dst_state_name,
 					dst_field_name ? ret->dst_field : ret->src_field,
 					dst_state_name)
 			), "cannot get destination state ref '%s'", dst_state_name);
+	} else if (dst_scratch_name) {
+		NB_die_if(!(
+			ret->dst = memref_scratch_get(
+					dst_field_name ? ret->dst_field : ret->src_field,
+					dst_scratch_name)
+			), "cannot get destination scratch '%s'", dst_scratch_name);
 	}
 
 	if (src_state_name) {
@@ -160,6 +655,12 @@ struct op *op_new (const char *dst_field_name, const char *dst_state_name,
 					src_field_name ? ret->src_field : ret->dst_field,
 					src_state_name)
 			), "cannot get source state ref '%s'", src_state_name);
+	} else if (src_scratch_name) {
+		NB_die_if(!(
+			ret->src = memref_scratch_get(
+					src_field_name ? ret->src_field : ret->dst_field,
+					src_scratch_name)
+			), "cannot get source scratch '%s'", src_scratch_name);
 	} else if (src_value) {
 		NB_die_if(!(
 			ret->src = memref_value_new(
@@ -173,6 +674,283 @@ struct op *op_new (const char *dst_field_name, const char *dst_state_name,
 	ret->set.to = ret->dst ? ret->dst->bytes : NULL;
 	ret->set.from = ret->src ? ret->src->bytes : NULL;
 
+	/* scratch: resolved to a register offset, see op_resolve() */
+	if (ret->dst && memref_is_scratch(ret->dst)) {
+		ret->set.to = (void *)(uintptr_t)ret->dst->set.offt;
+		ret->set.set_from.flags |= OP_SCRATCH_TO;
+	}
+	if (ret->src && memref_is_scratch(ret->src)) {
+		ret->set.from = (void *)(uintptr_t)ret->src->set.offt;
+		ret->set.set_from.flags |= OP_SCRATCH_FROM;
+	}
+	/* ops always access the longer of both sides: registers have no slack */
+	NB_die_if(ret->set.set_from.flags && ret->set.set_to.len != ret->set.set_from.len,
+		"scratch register and field must have the same length");
+	op_kernel_select(&ret->set);
+
+	/* a bitmask is only carried by values, see memref_value_new() */
+	if ((ret->dst_field && ret->dst_field->bitmask)
+		|| (ret->src_field && ret->src_field->bitmask))
+	{
+		NB_die_if(!ret->dst_field || ret->dst || ret->src_field || !src_value,
+			"a field with a 'bitmask' can only be matched or written with a value");
+		ret->set.set_to.flags = OP_KERNEL_BITMASK;
+	}
+
+	return ret;
+die:
+	op_free(ret);
+	return NULL;
+}
+
+/*	op_swap_new()
+ * Exchange the contents of two packet fields, which must have the same
+ * length and mask and may not overlap.
+ */
+struct op *op_swap_new (const char *a_field_name, const char *b_field_name)
+{
+	struct op *ret = NULL;
+	NB_die_if(!a_field_name || !b_field_name, "swap requires two fields");
+
+	NB_die_if(!(
+		ret = calloc(sizeof(*ret), 1)
+		), "fail alloc size %zu", sizeof(*ret));
+	NB_die_if(!(
+		ret->dst_field = field_get(a_field_name)
+		), "cannot get field '%s'", a_field_name);
+	NB_die_if(!(
+		ret->src_field = field_get(b_field_name)
+		), "cannot get field '%s'", b_field_name);
+
+	NB_die_if(ret->dst_field->bitmask || ret->src_field->bitmask,
+		"cannot swap a field with a 'bitmask'");
+	struct field_set a = ret->dst_field->set;
+	struct field_set b = ret->src_field->set;
+	NB_die_if(a.len != b.len || a.mask != b.mask,
+		"cannot swap '%s' and '%s': length or mask differ",
+		a_field_name, b_field_name);
+	/* overlap can only be known beforehand when offsets are from the same place */
+	NB_die_if(a.len && a.anchor == b.anchor && (a.offt < 0) == (b.offt < 0)
+		&& a.offt < b.offt + b.len && b.offt < a.offt + a.len,
+		"cannot swap overlapping fields '%s' and '%s'",
+		a_field_name, b_field_name);
+
+	ret->set.set_to = a;
+	ret->set.set_from = b;
+	ret->set.set_from.flags = OP_SWAP;
+	op_kernel_select(&ret->set);
+
+	return ret;
+die:
+	op_free(ret);
+	return NULL;
+}
+
+/*	op_lookup_new()
+ * Common code for ops looking up packet field 'field_name' in the object
+ * 'set.from' will point to, marked by 'kernel'.
+ * Once 'set.from' is set, op_free() releases it.
+ */
+static struct op *op_lookup_new (const char *field_name, enum op_kernel kernel)
+{
+	struct op *ret = NULL;
+	NB_die_if(!field_name, "lookup requires a field");
+
+	NB_die_if(!(
+		ret = calloc(sizeof(*ret), 1)
+		), "fail alloc size %zu", sizeof(*ret));
+	NB_die_if(!(
+		ret->dst_field = field_get(field_name)
+		), "cannot get field '%s'", field_name);
+	NB_die_if(ret->dst_field->bitmask,
+		"field '%s' has a 'bitmask': it cannot be looked up", field_name);
+
+	ret->set.set_to = ret->dst_field->set;
+	ret->set.set_from = ret->dst_field->set;
+	ret->set.set_to.flags = kernel;
+	return ret;
+die:
+	op_free(ret);
+	return NULL;
+}
+
+/*	op_table_new()
+ * Match packet field 'field_name' against the prefixes in table 'table_name'.
+ */
+struct op *op_table_new (const char *field_name, const char *table_name)
+{
+	struct op *ret = NULL;
+	struct table *table = NULL;
+	NB_die_if(!(
+		ret = op_lookup_new(field_name, OP_KERNEL_TABLE)
+		), "");
+	NB_die_if(!(
+		table = table_get(table_name)
+		), "cannot get table '%s'", table_name);
+	ret->set.from = table;
+	NB_die_if(ret->set.set_to.len != table->len,
+		"field '%s' len %u differs from table '%s' len %u",
+		field_name, ret->set.set_to.len, table_name, table->len);
+
+	return ret;
+die:
+	op_free(ret);
+	return NULL;
+}
+
+/*	op_member_new()
+ * Match if packet field 'field_name' is one of the values in set 'set_name'.
+ */
+struct op *op_member_new (const char *field_name, const char *set_name)
+{
+	struct op *ret = NULL;
+	struct set *set = NULL;
+	NB_die_if(!(
+		ret = op_lookup_new(field_name, OP_KERNEL_SET)
+		), "");
+	NB_die_if(!(
+		set = set_get(set_name)
+		), "cannot get set '%s'", set_name);
+	ret->set.from = set;
+	NB_die_if(ret->set.set_to.len != set->len,
+		"field '%s' len %u differs from set '%s' len %u",
+		field_name, ret->set.set_to.len, set_name, set->len);
+
+	return ret;
+die:
+	op_free(ret);
+	return NULL;
+}
+
+/*	op_range_max()
+ * Largest integer a field of 'len' Bytes holds.
+ */
+static uint64_t op_range_max(size_t len)
+{
+	return len >= 8 ? UINT64_MAX : (1ULL << (len * 8)) - 1;
+}
+
+/*	op_range_parse()
+ * Parse 'value' as 'len' Bytes, read back as a big-endian integer.
+ * value_parse() reads 8 Byte integers as signed: read those unsigned here,
+ * so that any bound emitted by op_emit_range() parses back.
+ */
+static int op_range_parse(const char *value, size_t len, uint64_t *out)
+{
+	if (len == 8 && !strchr(value, '-')) {
+		char *end;
+		errno = 0;
+		unsigned long long tt = strtoull(value, &end, 0);
+		if (!errno && end != value && !*end) {
+			*out = tt;
+			return 0;
+		}
+	}
+
+	uint8_t parsed[8];
+	if (value_parse(value, parsed, len))
+		return 1;
+	*out = op_range_value(parsed, len, 0xff);
+	return 0;
+}
+
+/*	op_range_new()
+ * Match if packet field 'field_name', read as a big-endian unsigned integer,
+ * compares to 'value' as 'cmp' ("lt", "le", "gt", "ge") says,
+ * or if 'cmp' is "between", lies in ['value', 'value_hi'].
+ * The inclusive bounds are kept in 'set.to' and 'set.from'.
+ */
+struct op *op_range_new (const char *field_name, const char *cmp,
+			const char *value, const char *value_hi)
+{
+	struct op *ret = NULL;
+	NB_die_if(!cmp || !value, "range requires a comparison and a value");
+	NB_die_if(!(
+		ret = op_lookup_new(field_name, OP_KERNEL_RANGE)
+		), "");
+
+	size_t len = ret->set.set_to.len;
+	NB_die_if(len != 1 && len != 2 && len != 4 && len != 8,
+		"range on field '%s' of len %zu: only 1, 2, 4 or 8 Bytes", field_name, len);
+	uint64_t max = op_range_max(len);
+	uint64_t v;
+	NB_die_if(
+		op_range_parse(value, len, &v)
+		, "cannot parse '%s' for field '%s'", value, field_name);
+
+	uint64_t lo = 0, hi = max;
+	if (!strcmp("lt", cmp)) {
+		NB_die_if(!v, "'lt: %s' never matches", value);
+		hi = v - 1;
+	} else if (!strcmp("le", cmp)) {
+		hi = v;
+	} else if (!strcmp("gt", cmp)) {
+		NB_die_if(v == max, "'gt: %s' never matches", value);
+		lo = v + 1;
+	} else if (!strcmp("ge", cmp)) {
+		lo = v;
+	} else if (!strcmp("between", cmp)) {
+		NB_die_if(!value_hi, "'between' requires 2 values");
+		NB_die_if(
+			op_range_parse(value_hi, len, &hi)
+			, "cannot parse '%s' for field '%s'", value_hi, field_name);
+		NB_die_if(v > hi, "'between: [%s, %s]' never matches", value, value_hi);
+		lo = v;
+	} else {
+		NB_die("unknown comparison '%s'", cmp);
+	}
+
+	NB_die_if(hi > UINTPTR_MAX, "range bound %" PRIu64 " does not fit a pointer", hi);
+	ret->set.to = (void *)(uintptr_t)lo;
+	ret->set.from = (void *)(uintptr_t)hi;
+	return ret;
+die:
+	op_free(ret);
+	return NULL;
+}
+
+/*	op_search_new()
+ * Match if any of the patterns (char *) in 'pattern_JQ' occurs anywhere
+ * inside packet field 'field_name' (see op_match_search()).
+ * The op owns its compiled search.
+ */
+struct op *op_search_new (const char *field_name, Pvoid_t pattern_JQ)
+{
+	struct op *ret = NULL;
+	struct search *search = NULL;
+	NB_die_if(!(
+		ret = op_lookup_new(field_name, OP_KERNEL_CONTAINS)
+		), "");
+	NB_die_if(!ret->set.set_to.len, "cannot search zero-length field '%s'", field_name);
+	NB_die_if(!(
+		search = search_new(pattern_JQ)
+		), "cannot compile patterns for field '%s'", field_name);
+	ret->set.from = search;
+
+	return ret;
+die:
+	op_free(ret);
+	return NULL;
+}
+
+/*	op_regex_new()
+ * Match if regular expression 'pattern' (see dfa.h) matches inside
+ * packet field 'field_name' (see op_match_regex()).
+ * The op owns its compiled dfa.
+ */
+struct op *op_regex_new (const char *field_name, const char *pattern)
+{
+	struct op *ret = NULL;
+	struct dfa *dfa = NULL;
+	NB_die_if(!(
+		ret = op_lookup_new(field_name, OP_KERNEL_REGEX)
+		), "");
+	NB_die_if(!ret->set.set_to.len, "cannot match zero-length field '%s'", field_name);
+	NB_die_if(!(
+		dfa = dfa_new(pattern)
+		), "cannot compile regex for field '%s'", field_name);
+	ret->set.from = dfa;
+
 	return ret;
 die:
 	op_free(ret);
@@ -185,14 +963,31 @@ struct op *op_parse_new (yaml_document_t *doc, yaml_node_t *mapping)
 {
 	const char	*dst_field_name = NULL;
 	const char	*dst_state_name = NULL;
+	const char	*dst_scratch_name = NULL;
 	const char	*src_field_name = NULL;
 	const char	*src_state_name = NULL;
+	const char	*src_scratch_name = NULL;
 	const char	*src_value = NULL;
+	const char	*src_table_name = NULL;
+	const char	*src_set_name = NULL;
+	const char	*src_regex = NULL;
+	const char	*range_cmp = NULL;
+	const char	*range_values[2] = { NULL };
+	unsigned int	range_cnt = 0;
+	const char	*swap_names[2] = { NULL };
+	unsigned int	swap_cnt = 0;
+	Pvoid_t		contains_JQ = NULL; /* (uint64_t seq) -> (const char *pattern) */
+	struct op	*ret = NULL;
+	int __attribute__((unused)) rc;
 
 	/* {
 	 *   dst: { field: "mac dst" }	(mapping)
 	 *   src: { }			(mapping)
 	 * } # op			(mapping)
+	 * OR
+	 * {
+	 *   swap: [ "mac dst", "mac src" ]	(sequence)
+	 * } # op				(mapping)
 	 */
 	Y_FOR_MAP(doc, mapping,
 		if (!strcmp("dst", keyname) || !strcmp("d", keyname)) {
@@ -205,6 +1000,8 @@ struct op *op_parse_new (yaml_document_t *doc, yaml_node_t *mapping)
 					dst_field_name = txt;
 				} else if (!strcmp("state", keyname) || !strcmp("s", keyname)) {
 					dst_state_name = txt;
+				} else if (!strcmp("scratch", keyname) || !strcmp("x", keyname)) {
+					dst_scratch_name = txt;
 				/* Ignore 'bytes': we output this field and our output
 				 * _must_ be valid input.
 				 */
@@ -225,8 +1022,43 @@ struct op *op_parse_new (yaml_document_t *doc, yaml_node_t *mapping)
 					src_field_name = txt;
 				} else if (!strcmp("state", keyname) || !strcmp("s", keyname)) {
 					src_state_name = txt;
+				} else if (!strcmp("scratch", keyname) || !strcmp("x", keyname)) {
+					src_scratch_name = txt;
 				} else if (!strcmp("value", keyname) || !strcmp("v", keyname)) {
 					src_value = txt;
+				} else if (!strcmp("table", keyname)) {
+					src_table_name = txt;
+				} else if (!strcmp("set", keyname)) {
+					src_set_name = txt;
+				} else if (!strcmp("lt", keyname) || !strcmp("le", keyname)
+					|| !strcmp("gt", keyname) || !strcmp("ge", keyname))
+				{
+					NB_die_if(range_cmp, "only one comparison per op: use 'between'");
+					range_cmp = keyname;
+					range_values[range_cnt++] = txt;
+				} else if (!strcmp("between", keyname)) {
+					NB_die_if(range_cmp, "only one comparison per op: use 'between'");
+					NB_die_if(type != YAML_SEQUENCE_NODE,
+						"between takes a sequence of 2 values");
+					range_cmp = keyname;
+					Y_FOR_SEQ(doc, seq,
+						NB_die_if(type != YAML_SCALAR_NODE || range_cnt == 2,
+							"between takes a sequence of 2 values");
+						range_values[range_cnt++] = txt;
+					);
+				} else if (!strcmp("regex", keyname)) {
+					src_regex = txt;
+				} else if (!strcmp("contains", keyname)) {
+					NB_die_if(contains_JQ, "only one 'contains' per op");
+					NB_die_if(type != YAML_SEQUENCE_NODE,
+						"contains takes a sequence of patterns");
+					Y_FOR_SEQ(doc, seq,
+						NB_die_if(type != YAML_SCALAR_NODE,
+							"contains takes a sequence of patterns");
+						NB_die_if(
+							jl_enqueue(&contains_JQ, (void *)txt)
+							, "");
+					);
 				/* Ignore 'bytes': we output this field and our output
 				 * _must_ be valid input.
 				 */
@@ -237,22 +1069,145 @@ struct op *op_parse_new (yaml_document_t *doc, yaml_node_t *mapping)
 				}
 			);
 
+		} else if (!strcmp("swap", keyname)) {
+			if (type != YAML_SEQUENCE_NODE) {
+				NB_err("swap is not a sequence");
+				continue;
+			}
+			Y_FOR_SEQ(doc, seq,
+				NB_die_if(type != YAML_SCALAR_NODE || swap_cnt == 2,
+					"swap takes a sequence of 2 field names");
+				swap_names[swap_cnt++] = txt;
+			);
+
 		} else {
 			NB_die("'op' does not implement '%s'", keyname);
 		}
 	);
 
-	return op_new(dst_field_name, dst_state_name, src_field_name, src_state_name, src_value);
+	if (swap_cnt) {
+		NB_die_if(dst_field_name || dst_state_name || dst_scratch_name
+			|| src_field_name || src_state_name || src_scratch_name || src_value,
+			"swap cannot have a 'dst' or 'src'");
+		ret = op_swap_new(swap_names[0], swap_names[1]);
+	} else if (src_table_name || src_set_name || range_cmp || contains_JQ || src_regex) {
+		NB_die_if(dst_state_name || dst_scratch_name
+			|| src_state_name || src_scratch_name || src_value,
+			"lookup cannot have a state, scratch or value");
+		NB_die_if(!!src_table_name + !!src_set_name + !!range_cmp
+				+ !!contains_JQ + !!src_regex > 1,
+			"lookup must be only one of a table, a set, a comparison, contains or regex");
+		NB_die_if(dst_field_name && src_field_name,
+			"lookup takes a single field");
+		const char *field_name = dst_field_name ? dst_field_name : src_field_name;
+		if (src_table_name)
+			ret = op_table_new(field_name, src_table_name);
+		else if (src_set_name)
+			ret = op_member_new(field_name, src_set_name);
+		else if (range_cmp)
+			ret = op_range_new(field_name, range_cmp, range_values[0], range_values[1]);
+		else if (contains_JQ)
+			ret = op_search_new(field_name, contains_JQ);
+		else
+			ret = op_regex_new(field_name, src_regex);
+	} else {
+		ret = op_new(dst_field_name, dst_state_name, dst_scratch_name,
+				src_field_name, src_state_name, src_scratch_name, src_value);
+	}
 die:
-	return NULL;
+	/* patterns are copied by op_search_new() */
+	JLFA(rc, contains_JQ);
+	return ret;
 }
 
-/*	op_emit()
+/*	op_emit_swap()
+ * Emit 'op' as a swap of two fields into the mapping 'reply'.
  */
-int op_emit (struct op *op, yaml_document_t *outdoc, int outlist)
+static int op_emit_swap (struct op *op, yaml_document_t *outdoc, int reply)
+{
+	int err_cnt = 0;
+	int swap = yaml_document_add_sequence(outdoc, NULL, YAML_FLOW_SEQUENCE_STYLE);
+	const char *names[] = { op->dst_field->name, op->src_field->name };
+	for (unsigned int i = 0; i < NLC_ARRAY_LEN(names); i++) {
+		NB_die_if(!(
+			yaml_document_append_sequence_item(outdoc, swap,
+				yaml_document_add_scalar(outdoc, NULL, (yaml_char_t *)names[i],
+							-1, YAML_PLAIN_SCALAR_STYLE))
+			), "");
+	}
+	NB_die_if(
+		y_pair_insert_obj(outdoc, reply, "swap", swap)
+		, "failed to emit 'swap'");
+die:
+	return err_cnt;
+}
+
+/*	op_emit_range()
+ * Emit the bounds of range op 'op' into the mapping 'src',
+ * as the shortest comparison giving the same result.
+ */
+static int op_emit_range (struct op *op, yaml_document_t *outdoc, int src)
+{
+	int err_cnt = 0;
+	uint64_t lo, hi;
+	op_range(op, &lo, &hi);
+
+	if (hi == op_range_max(op->set.set_to.len)) {
+		NB_die_if(
+			y_pair_insert_nf(outdoc, src, "ge", "%" PRIu64, lo)
+			, "failed to emit src->ge");
+	} else if (!lo) {
+		NB_die_if(
+			y_pair_insert_nf(outdoc, src, "le", "%" PRIu64, hi)
+			, "failed to emit src->le");
+	} else {
+		int between = yaml_document_add_sequence(outdoc, NULL, YAML_FLOW_SEQUENCE_STYLE);
+		uint64_t bounds[] = { lo, hi };
+		for (unsigned int i = 0; i < NLC_ARRAY_LEN(bounds); i++) {
+			char txt[24];
+			snprintf(txt, sizeof(txt), "%" PRIu64, bounds[i]);
+			NB_die_if(!(
+				yaml_document_append_sequence_item(outdoc, between,
+					yaml_document_add_scalar(outdoc, NULL, (yaml_char_t *)txt,
+								-1, YAML_PLAIN_SCALAR_STYLE))
+				), "");
+		}
+		NB_die_if(
+			y_pair_insert_obj(outdoc, src, "between", between)
+			, "failed to emit src->between");
+	}
+die:
+	return err_cnt;
+}
+
+/*	op_emit_search()
+ * Emit the patterns of contains op 'op' into the mapping 'src'.
+ */
+static int op_emit_search (struct op *op, yaml_document_t *outdoc, int src)
+{
+	int err_cnt = 0;
+	int contains = yaml_document_add_sequence(outdoc, NULL, YAML_FLOW_SEQUENCE_STYLE);
+	/* double quotes escape any non-printable Bytes */
+	JL_LOOP(&op_search(op)->pattern_JQ,
+		NB_die_if(!(
+			yaml_document_append_sequence_item(outdoc, contains,
+				yaml_document_add_scalar(outdoc, NULL, (yaml_char_t *)val,
+							-1, YAML_DOUBLE_QUOTED_SCALAR_STYLE))
+			), "");
+	);
+	NB_die_if(
+		y_pair_insert_obj(outdoc, src, "contains", contains)
+		, "failed to emit src->contains");
+die:
+	return err_cnt;
+}
+
+/*	op_emit_ends()
+ * Emit the 'dst' and 'src' of 'op' into the mapping 'reply'.
+ */
+static int op_emit_ends (struct op *op, yaml_document_t *outdoc, int reply)
 {
 	int err_cnt = 0;
-	int reply = yaml_document_add_mapping(outdoc, NULL, YAML_BLOCK_MAPPING_STYLE);
 	int dst = yaml_document_add_mapping(outdoc, NULL, YAML_BLOCK_MAPPING_STYLE);
 	int src = yaml_document_add_mapping(outdoc, NULL, YAML_BLOCK_MAPPING_STYLE);
 
@@ -280,9 +1235,58 @@ int op_emit (struct op *op, yaml_document_t *outdoc, int outlist)
 			memref_emit(op->src, outdoc, src)
 			, "");
 	}
+	if (op_table(op)) {
+		NB_die_if(
+			y_pair_insert(outdoc, src, "table", op_table(op)->name)
+			, "failed to emit src->table");
+	}
+	if (op_member(op)) {
+		NB_die_if(
+			y_pair_insert(outdoc, src, "set", op_member(op)->name)
+			, "failed to emit src->set");
+	}
+	if (op->set.set_to.flags == OP_KERNEL_RANGE) {
+		NB_die_if(
+			op_emit_range(op, outdoc, src)
+			, "");
+	}
+	if (op_search(op)) {
+		NB_die_if(
+			op_emit_search(op, outdoc, src)
+			, "");
+	}
+	if (op_regex(op)) {
+		/* double quotes escape any non-printable Bytes */
+		int regex = yaml_document_add_scalar(outdoc, NULL,
+					(yaml_char_t *)op_regex(op)->pattern,
+					-1, YAML_DOUBLE_QUOTED_SCALAR_STYLE);
+		NB_die_if(
+			y_pair_insert_obj(outdoc, src, "regex", regex)
+			, "failed to emit src->regex");
+	}
 	NB_die_if(
 		y_pair_insert_obj(outdoc, reply, "src", src)
 		, "failed to emit 'src'");
+die:
+	return err_cnt;
+}
+
+/*	op_emit()
+ */
+int op_emit (struct op *op, yaml_document_t *outdoc, int outlist)
+{
+	int err_cnt = 0;
+	int reply = yaml_document_add_mapping(outdoc, NULL, YAML_BLOCK_MAPPING_STYLE);
+
+	if (op->set.set_from.flags & OP_SWAP) {
+		NB_die_if(
+			op_emit_swap(op, outdoc, reply)
+			, "");
+	} else {
+		NB_die_if(
+			op_emit_ends(op, outdoc, reply)
+			, "");
+	}
 
 	NB_die_if(!(
 		yaml_document_append_sequence_item(outdoc, outlist, reply)
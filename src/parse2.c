@@ -6,6 +6,8 @@
 /* subsystems which implement parsers */
 #include <iface.h>
 #include <field.h>
+#include <table.h>
+#include <set.h>
 #include <rule.h>
 #include <process.h>
 
@@ -198,10 +200,14 @@ int parse(const unsigned char *buf, size_t buf_len, int outfd)
 	 * structure, ignore it silently.
 	 * By "silently" is meant DO NOT EMIT (in 'die' block below).
 	 */
-	if (root && root->type == YAML_MAPPING_NODE)
+	if (root && root->type == YAML_MAPPING_NODE) {
+		/* nothing may change under the feet of worker threads */
+		iface_fence();
 		err_cnt += parse_mapping(&doc, root, &outdoc, outroot);
-	else
+		iface_unfence();
+	} else {
 		outroot = 0;
+	}
 
 die:
 	/* serialize err_cnt and dump outdoc if at all possible */
@@ -284,6 +290,8 @@ static int parse_mapping(yaml_document_t *doc, yaml_node_t *root,
 		if (mode == PARSE_PRN && y_seq_empty(val)) {
 			err_cnt += iface_emit_all(outdoc, reply_list);
 			err_cnt += field_emit_all(outdoc, reply_list);
+			err_cnt += table_emit_all(outdoc, reply_list);
+			err_cnt += set_emit_all(outdoc, reply_list);
 			err_cnt += rule_emit_all(outdoc, reply_list);
 			err_cnt += process_emit_all(outdoc, reply_list);
 			/* NOTE: will skip the following 'for' loop,
@@ -316,6 +324,12 @@ static int parse_mapping(yaml_document_t *doc, yaml_node_t *root,
 			else if (!strcmp("field", keyval) || !strcmp("f", keyval))
 				err_cnt += field_parse(mode, doc, mapping, outdoc, reply_list);
 
+			else if (!strcmp("table", keyval))
+				err_cnt += table_parse(mode, doc, mapping, outdoc, reply_list);
+
+			else if (!strcmp("set", keyval))
+				err_cnt += set_parse(mode, doc, mapping, outdoc, reply_list);
+
 			else if (!strcmp("rule", keyval) || !strcmp("r", keyval))
 				err_cnt += rule_parse(mode, doc, mapping, outdoc, reply_list);
 
@@ -3,6 +3,7 @@
  */
 
 #include <process.h>
+#include <checksums.h>
 #include <ndebug.h>
 #include <yamlutils.h>
 
@@ -41,7 +42,7 @@ void process_free(void *arg)
 
 	if (pc->in_iface) {
 		/* this will fail safely if we are not the handler ;) */
-		iface_handler_clear(pc->in_iface, process_exec, pc->rout_set_JQ);
+		iface_handler_clear(pc->in_iface, process_exec, pc);
 		iface_release(pc->in_iface);
 
 		/* we may be a dup: only remove from process_JS if it points to us */
@@ -49,6 +50,9 @@ void process_free(void *arg)
 			js_delete(&process_JS, pc->in_iface->name);
 	}
 
+	for (unsigned int i = 0; i < NLC_ARRAY_LEN(pc->flows); i++)
+		flow_cache_free(pc->flows[i]);
+	classifier_free(pc->cls);
 	process_release_refs(pc->rout_JQ, pc->rout_set_JQ);
 
 	free(pc);
@@ -84,7 +88,12 @@ struct process *process_new(const char *in_iface_name, Pvoid_t rout_JQ)
 	JL_LOOP(&ret->rout_JQ,
 		struct rout *rt = val;
 		jl_enqueue(&ret->rout_set_JQ, rt->set);
+		ret->anchored |= rt->set->anchored;
 	);
+	NB_die_if(!(
+		ret->cls = classifier_new(ret->rout_set_JQ)
+		), "could not build classifier");
+	ret->cacheable = flow_cacheable(ret->cls);
 
 	NB_die_if(!in_iface_name, "process requires in_iface_name");
 
@@ -104,7 +113,7 @@ struct process *process_new(const char *in_iface_name, Pvoid_t rout_JQ)
 		ret->in_iface = iface_get(in_iface_name)
 		), "could not get interface '%s'", in_iface_name);
 	NB_die_if(
-		iface_handler_register(ret->in_iface, process_exec, ret->rout_set_JQ)
+		iface_handler_register(ret->in_iface, process_exec, ret)
 		, "");
 
 	js_insert(&process_JS, ret->in_iface->name, ret, true);
@@ -119,23 +128,36 @@ die:
 
 /*	process_exec()
  * Packet matching/handling hot-path.
+ * 'context' is the process.
  */
 void __attribute__((hot)) process_exec(void *context, void *pkt, size_t len)
 {
-	Pvoid_t rout_set_JQ = context;
-	JL_LOOP(&rout_set_JQ,
-		struct rout_set *rst = val;
-		/* Matching packets which fail rule execution should be discarded
-		 * rather than be processed by later rules in an incoherent
-		 * (half-mangled) state.
-		 */
-		if (rout_set_match(rst, pkt, len)) {
-			if (rout_set_exec(rst, pkt, len)) {
-				iface_output(rst->if_out, pkt, len);
-			}
-			break;
-		}
-	);
+	struct process *pc = context;
+	struct rout_set *rst;
+	unsigned int slot = iface_worker_slot();
+	/* only pay for header parsing if some field needs it */
+	if (pc->anchored)
+		field_anchors_parse(pkt, len);
+	if (pc->cacheable) {
+		struct flow_cache **fc = &pc->flows[slot];
+		if (NLC_UNLIKELY(!*fc))
+			*fc = flow_cache_new(pc->cls);
+		rst = *fc ? flow_lookup(*fc, pkt, len)
+			: classifier_lookup(pc->cls, pkt, len, NULL);
+	} else {
+		rst = classifier_lookup(pc->cls, pkt, len, NULL);
+	}
+	if (!rst)
+		return;
+
+	rst->wcount[slot].match++;
+	checksum_log_reset();
+	/* Matching packets which fail rule execution should be discarded
+	 * rather than be processed by later rules in an incoherent
+	 * (half-mangled) state.
+	 */
+	if (rout_set_exec(rst, pkt, len))
+		iface_output(rst->if_out, pkt, len, rst->checksum);
 }
 
 
@@ -251,10 +273,27 @@ int process_emit(struct process *process, yaml_document_t *outdoc, int outlist)
 			, "fail to emit rout");
 	);
 
+	size_t hit_micro = 0, hit_mega = 0, miss = 0;
+	for (unsigned int i = 0; i < NLC_ARRAY_LEN(process->flows); i++) {
+		struct flow_cache *fc = process->flows[i];
+		if (!fc)
+			continue;
+		hit_micro += fc->hit_micro;
+		hit_mega += fc->hit_mega;
+		miss += fc->miss;
+	}
+
 	NB_die_if(
 		y_pair_insert(outdoc, reply, "process", process->in_iface->name)
 		|| y_pair_insert_obj(outdoc, reply, "nodes", nodes)
 		, "");
+	if (process->cacheable) {
+		NB_die_if(
+			y_pair_insert_nf(outdoc, reply, "flow hit micro", "%zu", hit_micro)
+			|| y_pair_insert_nf(outdoc, reply, "flow hit mega", "%zu", hit_mega)
+			|| y_pair_insert_nf(outdoc, reply, "flow miss", "%zu", miss)
+			, "");
+	}
 	NB_die_if(!(
 		yaml_document_append_sequence_item(outdoc, outlist, reply)
 		), "");
@@ -0,0 +1,692 @@
+/*	program.c
+ * (c) 2019 Sirio Balmelli
+ */
+
+#include <program.h>
+#include <checksums.h>
+#include <ndebug.h>
+
+
+/*	prog_ir
+ * An op of a rule, as the passes of program_new() rewrite it.
+ * @set		: copy of the op_set; 'from' points to 'imm' for a value
+ * @imm		: value operand, or NULL (a bitmask follows the value)
+ * @imm_len	: Bytes of 'imm'
+ * @write	: a write op, otherwise a match op
+ * @dead	: removed by a pass
+ */
+struct prog_ir {
+	struct op_set		set;
+	uint8_t			*imm;
+	size_t			imm_len;
+	bool			write;
+	bool			dead;
+};
+
+
+/*	prog_ir_free()
+ */
+static void prog_ir_free(struct prog_ir *ir, size_t cnt)
+{
+	if (!ir)
+		return;
+	for (size_t i = 0; i < cnt; i++)
+		free(ir[i].imm);
+	free(ir);
+}
+
+/*	prog_ir_len()
+ * Bytes an op reads or writes on either side.
+ */
+NLC_INLINE size_t prog_ir_len(const struct prog_ir *ir)
+{
+	return ir->set.set_to.len > ir->set.set_from.len ?
+		ir->set.set_to.len : ir->set.set_from.len;
+}
+
+/*	prog_ir_lower()
+ * Copy 'op' into 'ir'.
+ * Room is left for the full extent op_match()/op_write() may read
+ * from a value, as in the memref it is copied from.
+ */
+static int prog_ir_lower(struct prog_ir *ir, struct op *op, bool write)
+{
+	int err_cnt = 0;
+	ir->set = op->set;
+	ir->write = write;
+	if (!op->src || !memref_is_value(op->src))
+		return 0;
+
+	ir->imm_len = op->src->set.len;
+	if (op->set.set_to.flags == OP_KERNEL_BITMASK)
+		ir->imm_len *= 2;
+	size_t size = ir->imm_len > prog_ir_len(ir) ? ir->imm_len : prog_ir_len(ir);
+	NB_die_if(!(
+		ir->imm = calloc(1, size + 1)
+		), "fail alloc size %zu", size + 1);
+	memcpy(ir->imm, op->src->bytes, ir->imm_len);
+	ir->set.from = ir->imm;
+die:
+	return err_cnt;
+}
+
+
+/*	prog_plain()
+ * Ops run by the generic or a width-specialized kernel.
+ */
+NLC_INLINE bool prog_plain(const struct op_set *set)
+{
+	return (set->set_to.flags & ~OP_KERNEL_MASKED) <= OP_KERNEL_16;
+}
+
+/*	prog_swap()
+ */
+NLC_INLINE bool prog_swap(const struct op_set *set)
+{
+	return set->set_from.flags & OP_SWAP;
+}
+
+/*	prog_pkt_to()
+ * 'set_to' is a field of the packet.
+ */
+NLC_INLINE bool prog_pkt_to(const struct op_set *set)
+{
+	if (!prog_plain(set))
+		return true;
+	return !set->to && !(set->set_from.flags & OP_SCRATCH_TO);
+}
+
+/*	prog_pkt_from()
+ * 'set_from' is a field of the packet.
+ */
+NLC_INLINE bool prog_pkt_from(const struct op_set *set)
+{
+	return prog_plain(set) && !set->from && !(set->set_from.flags & OP_SCRATCH_FROM);
+}
+
+/*	prog_static()
+ * The position of field 'set' is known before seeing the packet,
+ * and the length guard of the program ensures it is inside the packet.
+ */
+NLC_INLINE bool prog_static(struct field_set set)
+{
+	return set.anchor == FIELD_ANCHOR_PACKET && set.offt >= 0;
+}
+
+/*	prog_overlap()
+ * A field of the packet at 'set' may overlap 'len' Bytes at static 'offt'.
+ */
+NLC_INLINE bool prog_overlap(struct field_set set, size_t set_len, long offt, size_t len)
+{
+	if (!prog_static(set))
+		return true;
+	return set.offt < offt + (long)len && offt < set.offt + (long)set_len;
+}
+
+/*	prog_infallible()
+ * Once the length guard passed, the write 'ir' cannot fail.
+ */
+NLC_INLINE bool prog_infallible(const struct prog_ir *ir)
+{
+	const struct op_set *set = &ir->set;
+	if (!prog_plain(set) || prog_swap(set))
+		return false;
+	if (prog_pkt_to(set) && !prog_static(set->set_to))
+		return false;
+	return !prog_pkt_from(set) || prog_static(set->set_from);
+}
+
+/*	prog_reads()
+ * 'ir' may read packet Bytes in 'len' Bytes at static 'offt'.
+ * Swaps and bitmask writes read the Bytes they write,
+ * other masked writes the last Byte.
+ */
+static bool prog_reads(const struct prog_ir *ir, long offt, size_t len)
+{
+	const struct op_set *set = &ir->set;
+	size_t l = prog_ir_len(ir);
+	if (prog_pkt_from(set) && prog_overlap(set->set_from, l, offt, len))
+		return true;
+	if (!prog_pkt_to(set))
+		return false;
+	if (!ir->write || prog_swap(set) || !prog_plain(set))
+		return prog_overlap(set->set_to, l, offt, len);
+	if (set->set_to.mask != 0xff && l) {
+		struct field_set last = set->set_to;
+		last.offt += l - 1;
+		return prog_overlap(last, 1, offt, len);
+	}
+	return false;
+}
+
+/*	prog_writes()
+ * 'ir' may write packet Bytes in 'len' Bytes at static 'offt'.
+ */
+static bool prog_writes(const struct prog_ir *ir, long offt, size_t len)
+{
+	const struct op_set *set = &ir->set;
+	size_t l = prog_ir_len(ir);
+	if (!ir->write)
+		return false;
+	if (prog_pkt_to(set) && prog_overlap(set->set_to, l, offt, len))
+		return true;
+	return prog_swap(set) && prog_overlap(set->set_from, l, offt, len);
+}
+
+/*	prog_next()
+ * Index of the first op after 'i' still alive, 'cnt' if none.
+ */
+static size_t prog_next(const struct prog_ir *ir, size_t cnt, size_t i)
+{
+	for (i++; i < cnt && ir[i].dead; i++)
+		;
+	return i;
+}
+
+
+/*	prog_pass_nop()
+ * Zero-length ops never look at the packet: see op_common().
+ */
+static void prog_pass_nop(struct prog_ir *ir, size_t cnt)
+{
+	for (size_t i = 0; i < cnt; i++) {
+		if (ir[i].set.set_to.flags == OP_KERNEL_GENERIC && !prog_ir_len(&ir[i]))
+			ir[i].dead = true;
+	}
+}
+
+
+/*	prog_pass_fold()
+ * Drop ops comparing or copying a static packet field with itself.
+ * Read values written into a scratch register (unmasked) from the value
+ * itself, until the register is written again.
+ */
+static int prog_pass_fold(struct prog_ir *ir, size_t cnt)
+{
+	int err_cnt = 0;
+	for (size_t i = 0; i < cnt; i++) {
+		struct op_set *set = &ir[i].set;
+		if (ir[i].dead || !prog_plain(set) || prog_swap(set))
+			continue;
+		if (prog_pkt_to(set) && prog_pkt_from(set)
+			&& prog_static(set->set_to)
+			&& set->set_to.offt == set->set_from.offt
+			&& set->set_to.len == set->set_from.len
+			&& set->set_to.mask == set->set_from.mask)
+		{
+			ir[i].dead = true;
+		}
+	}
+
+	for (size_t i = 0; i < cnt; i++) {
+		struct op_set *set = &ir[i].set;
+		if (ir[i].dead || !ir[i].imm || !prog_plain(set)
+			|| !(set->set_from.flags & OP_SCRATCH_TO)
+			|| set->set_to.len != set->set_from.len
+			|| set->set_to.mask != 0xff || set->set_from.mask != 0xff)
+		{
+			continue;
+		}
+		uintptr_t reg = (uintptr_t)set->to;
+		size_t len = set->set_to.len;
+
+		for (size_t j = prog_next(ir, cnt, i); j < cnt; j = prog_next(ir, cnt, j)) {
+			struct op_set *rd = &ir[j].set;
+			if ((rd->set_from.flags & OP_SCRATCH_FROM) && prog_plain(rd)
+				&& (uintptr_t)rd->from == reg && rd->set_from.len == len)
+			{
+				NB_die_if(!(
+					ir[j].imm = calloc(1, len + 1)
+					), "fail alloc size %zu", len + 1);
+				memcpy(ir[j].imm, ir[i].imm, len);
+				ir[j].imm_len = len;
+				rd->from = ir[j].imm;
+				rd->set_from.flags &= ~OP_SCRATCH_FROM;
+			}
+			/* register clobbered */
+			if ((rd->set_from.flags & OP_SCRATCH_TO)
+				&& (uintptr_t)rd->to < reg + len
+				&& reg < (uintptr_t)rd->to + rd->set_to.len)
+			{
+				break;
+			}
+		}
+	}
+die:
+	return err_cnt;
+}
+
+
+/*	prog_pass_dead()
+ * Drop writes which cannot fail and whose result is never seen:
+ * scratch registers not read afterwards, packet Bytes entirely overwritten
+ * by a later write before anything reads them.
+ * Backwards, so that dropping a write may make earlier ones dead.
+ */
+static void prog_pass_dead(struct prog_ir *ir, size_t cnt)
+{
+	for (size_t i = cnt; i-- > 0; ) {
+		struct op_set *set = &ir[i].set;
+		if (ir[i].dead || !ir[i].write || !prog_infallible(&ir[i]))
+			continue;
+
+		if (set->set_from.flags & OP_SCRATCH_TO) {
+			uintptr_t reg = (uintptr_t)set->to;
+			size_t len = set->set_to.len;
+			bool read = false;
+			for (size_t j = prog_next(ir, cnt, i); j < cnt; j = prog_next(ir, cnt, j)) {
+				const struct op_set *rd = &ir[j].set;
+				if ((rd->set_from.flags & OP_SCRATCH_FROM)
+					&& (uintptr_t)rd->from < reg + len
+					&& reg < (uintptr_t)rd->from + rd->set_from.len)
+				{
+					read = true;
+					break;
+				}
+			}
+			ir[i].dead = !read;
+			continue;
+		}
+
+		if (!prog_pkt_to(set))
+			continue;
+		long offt = set->set_to.offt;
+		size_t len = prog_ir_len(&ir[i]);
+		for (size_t j = prog_next(ir, cnt, i); j < cnt; j = prog_next(ir, cnt, j)) {
+			const struct op_set *wr = &ir[j].set;
+			if (prog_reads(&ir[j], offt, len))
+				break;
+			/* overwritten, including all bits of the last Byte */
+			if (prog_plain(wr) && !prog_swap(wr) && prog_pkt_to(wr)
+				&& prog_static(wr->set_to)
+				&& wr->set_to.len == wr->set_from.len
+				&& wr->set_to.offt <= offt
+				&& wr->set_to.offt + wr->set_to.len >= offt + (long)len
+				&& (wr->set_to.mask == 0xff
+					|| wr->set_to.offt + wr->set_to.len > offt + (long)len))
+			{
+				ir[i].dead = true;
+				break;
+			}
+			if (prog_writes(&ir[j], offt, len))
+				break;
+		}
+	}
+}
+
+
+/*	prog_mergeable()
+ * A value matched against or written into a packet field,
+ * which can be merged with one at a neighbouring offset.
+ */
+NLC_INLINE bool prog_mergeable(const struct prog_ir *ir)
+{
+	const struct op_set *set = &ir->set;
+	return !ir->dead && ir->imm && prog_plain(set) && !prog_swap(set)
+		&& prog_pkt_to(set) && set->set_to.len == set->set_from.len;
+}
+
+/*	prog_merge()
+ * Merge 'hi', the field right after 'lo', into 'lo'.
+ * The last Byte of 'lo' ends up in the middle: it must be unmasked.
+ * Returns true if merged.
+ */
+static bool prog_merge(struct prog_ir *lo, struct prog_ir *hi)
+{
+	struct field_set a = lo->set.set_to;
+	struct field_set b = hi->set.set_to;
+	if (a.anchor != b.anchor || (a.offt < 0) != (b.offt < 0)
+		|| a.offt + a.len != b.offt
+		|| a.mask != 0xff || lo->set.set_from.mask != 0xff
+		|| a.len + b.len > UINT16_MAX)
+	{
+		return false;
+	}
+
+	size_t len = a.len + b.len;
+	uint8_t *imm = realloc(lo->imm, len + 1);
+	if (!imm)
+		return false;
+	memcpy(&imm[a.len], hi->imm, b.len);
+	imm[len] = 0;
+	lo->imm = imm;
+	lo->imm_len = len;
+
+	lo->set.set_to.len = len;
+	lo->set.set_to.mask = b.mask;
+	lo->set.set_from.len = len;
+	lo->set.set_from.mask = hi->set.set_from.mask;
+	lo->set.from = imm;
+	op_kernel_select(&lo->set);
+	hi->dead = true;
+	return true;
+}
+
+/*	prog_pass_merge()
+ * Merge matches of values against contiguous fields (matches can be
+ * reordered: they have no side effects), and consecutive writes of values
+ * into them, until there is nothing left to merge.
+ */
+static void prog_pass_merge(struct prog_ir *ir, size_t cnt)
+{
+	bool again = true;
+	while (again) {
+		again = false;
+		for (size_t i = 0; i < cnt; i++) {
+			if (!prog_mergeable(&ir[i]))
+				continue;
+			for (size_t j = prog_next(ir, cnt, i); j < cnt; j = prog_next(ir, cnt, j)) {
+				if (ir[j].write != ir[i].write)
+					break;
+				if (prog_mergeable(&ir[j])
+					&& (prog_merge(&ir[i], &ir[j]) || prog_merge(&ir[j], &ir[i])))
+				{
+					again = true;
+					break;
+				}
+				if (ir[i].write)
+					break;
+			}
+		}
+	}
+}
+
+
+/*	prog_inline()
+ * The instruction for 'ir', if it has one of its own (otherwise PROG_OP).
+ */
+static enum prog_code prog_inline(const struct prog_ir *ir)
+{
+	const struct op_set *set = &ir->set;
+	if (!ir->imm || !prog_plain(set) || prog_swap(set) || !prog_pkt_to(set)
+		|| !prog_static(set->set_to) || !set->set_to.len
+		|| set->set_to.len != set->set_from.len)
+	{
+		return PROG_OP;
+	}
+	enum prog_code code = ir->write ? PROG_WRITE_1 : PROG_MATCH_1;
+	switch (set->set_to.len) {
+	case 1:		return code;
+	case 2:		return code + 1;
+	case 4:		return code + 2;
+	case 6:		return code + 3;
+	case 8:		return code + 4;
+	case 16:	return code + 5;
+	default:	return code + 6;
+	}
+}
+
+/*	prog_size()
+ * Bytes of the instruction for 'ir' and its operands.
+ */
+static size_t prog_size(const struct prog_ir *ir)
+{
+	if (prog_inline(ir) != PROG_OP)
+		return sizeof(struct prog_insn) + PROG_ALIGN(ir->set.set_to.len);
+	size_t size = sizeof(struct prog_insn) + PROG_ALIGN(sizeof(struct op_set));
+	if (ir->imm) {
+		size_t len = ir->imm_len > prog_ir_len(ir) ? ir->imm_len : prog_ir_len(ir);
+		size += PROG_ALIGN(len);
+	}
+	return size;
+}
+
+/*	prog_emit()
+ * Write the instruction for 'ir' at 'pc', return the next one.
+ */
+static uint8_t *prog_emit(const struct prog_ir *ir, uint8_t *pc)
+{
+	struct prog_insn *in = (void *)pc;
+	uint8_t *operand = pc + sizeof(*in);
+	const struct op_set *set = &ir->set;
+	size_t size = prog_size(ir);
+
+	in->code = prog_inline(ir);
+	if (in->code != PROG_OP) {
+		size_t len = set->set_to.len;
+		in->len = len;
+		in->offt = set->set_to.offt;
+		in->mask = set->set_to.mask;
+		memcpy(operand, ir->imm, len);
+		/* what op_match_generic()/op_write_generic() compare or write */
+		operand[len - 1] &= set->set_from.mask;
+		if (ir->write)
+			operand[len - 1] &= set->set_to.mask;
+		return pc + size;
+	}
+
+	size_t min_plen = 0;
+	bool checked = false;
+	op_bound(set, &min_plen, &checked);
+	in->code = checked ? PROG_OP_CHECKED : PROG_OP;
+	in->offt = size;
+
+	struct op_set *op = (void *)operand;
+	*op = *set;
+	if (ir->imm) {
+		uint8_t *imm = operand + PROG_ALIGN(sizeof(struct op_set));
+		memcpy(imm, ir->imm, ir->imm_len);
+		op->from = imm;
+	}
+	return pc + size;
+}
+
+
+/*	program_free()
+ */
+void program_free(struct program *prog)
+{
+	free(prog);
+}
+
+/*	program_new()
+ * Compile the ops of 'rule'.
+ * NOTE: lookups still point to the tables, sets etc. of the ops of 'rule',
+ * which must not be freed while the program exists.
+ */
+struct program *program_new(struct rule *rule)
+{
+	struct program *ret = NULL;
+	struct prog_ir *ir = NULL;
+	size_t match_cnt = jl_count(&rule->match_JQ);
+	size_t cnt = match_cnt + jl_count(&rule->write_JQ);
+
+	NB_die_if(!(
+		ir = calloc(cnt + 1, sizeof(*ir))
+		), "fail alloc size %zu", (cnt + 1) * sizeof(*ir));
+	JL_LOOP(&rule->match_JQ,
+		NB_die_if(prog_ir_lower(&ir[i], val, false), "");
+	);
+	JL_LOOP(&rule->write_JQ,
+		NB_die_if(prog_ir_lower(&ir[match_cnt + i], val, true), "");
+	);
+
+	/* guard before passes: dropped ops would still have failed */
+	size_t match_plen = 0, write_plen = 0;
+	bool checked;
+	for (size_t i = 0; i < cnt; i++)
+		op_bound(&ir[i].set, ir[i].write ? &write_plen : &match_plen, &checked);
+
+	prog_pass_nop(ir, cnt);
+	NB_die_if(prog_pass_fold(ir, cnt), "");
+	prog_pass_dead(ir, cnt);
+	prog_pass_merge(ir, cnt);
+
+	size_t size = 0;
+	for (size_t i = 0; i < cnt; i++) {
+		if (!ir[i].dead)
+			size += prog_size(&ir[i]);
+	}
+	NB_die_if(!(
+		ret = calloc(1, sizeof(*ret) + size)
+		), "fail alloc size %zu", sizeof(*ret) + size);
+	/* cannot overflow: see FIELD_OFFT_MAX */
+	ret->match_plen = match_plen;
+	ret->write_plen = write_plen;
+
+	uint8_t *pc = ret->code;
+	for (size_t i = 0; i < cnt; i++) {
+		if (ir[i].dead)
+			continue;
+		pc = prog_emit(&ir[i], pc);
+		if (ir[i].write) {
+			ret->write_cnt++;
+		} else {
+			ret->match_cnt++;
+			ret->match_size = pc - ret->code;
+		}
+	}
+	ret->write_size = (pc - ret->code) - ret->match_size;
+
+	prog_ir_free(ir, cnt);
+	return ret;
+die:
+	prog_ir_free(ir, cnt);
+	program_free(ret);
+	return NULL;
+}
+
+
+/*	prog_insn_next()
+ */
+NLC_INLINE const uint8_t *prog_insn_next(const struct prog_insn *in)
+{
+	if (in->code <= PROG_OP_CHECKED)
+		return (const uint8_t *)in + in->offt;
+	return (const uint8_t *)in + sizeof(*in) + PROG_ALIGN(in->len);
+}
+
+/*	prog_differ_w()
+ * As op_match_w(), the last Byte of 'imm' already masked.
+ */
+NLC_INLINE bool prog_differ_w(const struct prog_insn *in, const uint8_t *p,
+				const uint8_t *imm, size_t w)
+{
+	const size_t tail = OP_TAIL(w);
+	const size_t head = w - tail;
+	if (head && op_ld(p, head) != op_ld(imm, head))
+		return true;
+	return (op_ld(p + head, tail) & op_tail_mask(in->mask, tail)) != op_ld(imm + head, tail);
+}
+
+/*	prog_differ_n()
+ */
+NLC_INLINE bool prog_differ_n(const struct prog_insn *in, const uint8_t *p,
+				const uint8_t *imm)
+{
+	size_t len = in->len - 1;
+	return memcmp(p, imm, len) || (p[len] & in->mask) != imm[len];
+}
+
+/*	prog_write_w()
+ * As op_write_w(), the last Byte of 'imm' already masked.
+ */
+NLC_INLINE void prog_write_w(const struct prog_insn *in, uint8_t *p,
+				const uint8_t *imm, size_t w)
+{
+	const size_t tail = OP_TAIL(w);
+	const size_t head = w - tail;
+	uint64_t t = (op_ld(p + head, tail) & ~op_tail_mask(in->mask, tail))
+			| op_ld(imm + head, tail);
+	if (head)
+		op_st(p, op_ld(imm, head), head);
+	op_st(p + head, t, tail);
+}
+
+/*	prog_write_n()
+ */
+NLC_INLINE void prog_write_n(const struct prog_insn *in, uint8_t *p,
+				const uint8_t *imm)
+{
+	size_t len = in->len - 1;
+	memcpy(p, imm, len);
+	p[len] = (p[len] & ~in->mask) | imm[len];
+}
+
+
+/*	program_match()
+ * Return 'true' if 'pkt' of 'plen' Bytes matches all matches in 'prog'.
+ */
+bool __attribute__((hot)) program_match(struct program *prog, const void *pkt, size_t plen)
+{
+	/* some op would fail its bounds check */
+	if (plen < prog->match_plen)
+		return false;
+
+	const uint8_t *pc = prog->code;
+	const uint8_t *end = pc + prog->match_size;
+	for (; pc < end; pc = prog_insn_next((const void *)pc)) {
+		const struct prog_insn *in = (const void *)pc;
+		const uint8_t *imm = pc + sizeof(*in);
+		const uint8_t *p = (const uint8_t *)pkt + in->offt;
+		bool differ;
+
+		switch (in->code) {
+		case PROG_OP:
+			differ = op_match_unchecked((struct op_set *)imm, pkt, plen);
+			break;
+		case PROG_OP_CHECKED:
+			differ = op_match((struct op_set *)imm, pkt, plen);
+			break;
+		case PROG_MATCH_1:	differ = prog_differ_w(in, p, imm, 1);	break;
+		case PROG_MATCH_2:	differ = prog_differ_w(in, p, imm, 2);	break;
+		case PROG_MATCH_4:	differ = prog_differ_w(in, p, imm, 4);	break;
+		case PROG_MATCH_6:	differ = prog_differ_w(in, p, imm, 6);	break;
+		case PROG_MATCH_8:	differ = prog_differ_w(in, p, imm, 8);	break;
+		case PROG_MATCH_16:	differ = prog_differ_w(in, p, imm, 16);	break;
+		default:		differ = prog_differ_n(in, p, imm);	break;
+		}
+		if (differ)
+			return false;
+	}
+	return true;
+}
+
+
+/*	program_exec()
+ * Execute all writes in 'prog' on 'pkt'.
+ * Returns true on success;
+ * on failure returns false and '*pkt' will be in an inconsistent state.
+ * Scratch registers live in a register file on our stack, and are left
+ * uninitialized: rule_new() ensures none is read before being written.
+ * Writes into the packet are journaled in 'checksum_log', as by op_write().
+ */
+bool __attribute__((hot)) program_exec(struct program *prog, void *pkt, size_t plen)
+{
+	uint8_t scratch[MEMREF_SCRATCH_LEN] __attribute__((aligned(MEMREF_SCRATCH_ALIGN)));
+
+	/* fail before writing anything, rather than half-way */
+	if (plen < prog->write_plen)
+		return false;
+
+	const uint8_t *pc = prog->code + prog->match_size;
+	const uint8_t *end = pc + prog->write_size;
+	for (; pc < end; pc = prog_insn_next((const void *)pc)) {
+		const struct prog_insn *in = (const void *)pc;
+		const uint8_t *imm = pc + sizeof(*in);
+
+		if (in->code == PROG_OP) {
+			if (op_write_unchecked((struct op_set *)imm, pkt, plen, scratch))
+				return false;
+			continue;
+		} else if (in->code == PROG_OP_CHECKED) {
+			if (op_write((struct op_set *)imm, pkt, plen, scratch))
+				return false;
+			continue;
+		}
+
+		uint8_t *p = (uint8_t *)pkt + in->offt;
+		size_t first = checksum_log_old(pkt, plen, in->offt, in->len);
+		switch (in->code) {
+		case PROG_WRITE_1:	prog_write_w(in, p, imm, 1);	break;
+		case PROG_WRITE_2:	prog_write_w(in, p, imm, 2);	break;
+		case PROG_WRITE_4:	prog_write_w(in, p, imm, 4);	break;
+		case PROG_WRITE_6:	prog_write_w(in, p, imm, 6);	break;
+		case PROG_WRITE_8:	prog_write_w(in, p, imm, 8);	break;
+		case PROG_WRITE_16:	prog_write_w(in, p, imm, 16);	break;
+		default:		prog_write_n(in, p, imm);	break;
+		}
+		checksum_log_new(pkt, plen, first);
+	}
+	return true;
+}
@@ -13,24 +13,82 @@ void rout_set_free (void *arg)
 {
 	if (!arg)
 		return;
-	free(arg);
+	struct rout_set *rst = arg;
+	program_free(rst->prog);
+	free(rst->wcount);
+	free(rst);
+}
+
+
+/*	rout_set_checksum()
+ * Return true if 'op' may write bytes covered by a checksum.
+ * Offsets from the end of the packet or from an anchor can't be known
+ * until the packet is, so they always count
+ * (and anchors all lie past the L2 addresses anyway).
+ */
+static bool rout_set_checksum(struct op *op)
+{
+	/* state and scratch are not in the packet */
+	if (op->dst)
+		return false;
+	size_t len = op->set.set_to.len > op->set.set_from.len ?
+			op->set.set_to.len : op->set.set_from.len;
+	if (!len)
+		return false;
+	/* a swap writes both fields */
+	if ((op->set.set_from.flags & OP_SWAP)
+		&& (op->set.set_from.anchor || op->set.set_from.offt < 0
+			|| op->set.set_from.offt + len > ROUT_L2_ADDR_LEN))
+	{
+		return true;
+	}
+	return op->set.set_to.anchor || op->set.set_to.offt < 0
+		|| op->set.set_to.offt + len > ROUT_L2_ADDR_LEN;
+}
+
+
+/*	rout_set_anchored()
+ * Return true if 'op' uses a field not counted from the start of the packet
+ * (nor its end): packets must then go through field_anchors_parse().
+ * The 'set_from' of an op with no source field is that of its destination.
+ */
+static bool rout_set_anchored(struct op *op)
+{
+	return op->set.set_to.anchor != FIELD_ANCHOR_PACKET
+		|| op->set.set_from.anchor != FIELD_ANCHOR_PACKET;
 }
 
 
 /*	rout_set_new()
- * @writes_JQ	: (uint64_t seq) -> (struct fval *wrt)
+ * Compile the ops of 'rule' into a rout_set.
+ * NOTE: ops are copied: a rule must not change while a rout_set of it exists
+ * (which is guaranteed by the reference a rout holds on its rule).
  */
 struct rout_set *rout_set_new(struct rule *rule, struct iface *output)
 {
 	struct rout_set *ret = NULL;
-
 	NB_die_if(!(
 		ret = calloc(1, sizeof(*ret))
 		), "fail malloc size %zu", sizeof(*ret));
+	NB_die_if(!(
+		ret->wcount = aligned_alloc(NLC_CACHE_LINE, IFACE_WORKER_SLOTS * sizeof(*ret->wcount))
+		), "fail alloc size %zu", IFACE_WORKER_SLOTS * sizeof(*ret->wcount));
+	memset(ret->wcount, 0x0, IFACE_WORKER_SLOTS * sizeof(*ret->wcount));
 	ret->if_out = output;
 	ret->match_JQ = rule->match_JQ;
 	ret->write_JQ = rule->write_JQ;
 
+	JL_LOOP(&rule->match_JQ,
+		ret->anchored |= rout_set_anchored(val);
+	);
+	JL_LOOP(&rule->write_JQ,
+		ret->checksum |= rout_set_checksum(val);
+		ret->anchored |= rout_set_anchored(val);
+	);
+	NB_die_if(!(
+		ret->prog = program_new(rule)
+		), "could not compile rule '%s'", rule->name);
+
 	return ret;
 die:
 	rout_set_free(ret);
@@ -40,19 +98,13 @@ die:
 
 /*	rule_set_match()
  * Attempt to match 'pkt' of 'plen' Bytes against all matches in 'set'.
- * Return 'true' if matching (and increment matches counter),
- * otherwise return 'false'.
+ * Return 'true' if matching, otherwise return 'false'.
+ * NOTE: does not count matches: the classifier may check several
+ * candidates before settling on the highest-priority one.
  */
 bool __attribute__((hot)) rout_set_match(struct rout_set *set, const void *pkt, size_t plen)
 {
-	JL_LOOP(&set->match_JQ,
-		struct op *op = val;
-		if (op_match(&op->set, pkt, plen))
-			return false;
-	);
-
-	set->count_match++;
-	return true;
+	return program_match(set->prog, pkt, plen);
 }
 
 
@@ -63,12 +115,20 @@ bool __attribute__((hot)) rout_set_match(struct rout_set *set, const void *pkt,
  */
 bool rout_set_exec(struct rout_set *rst, void *pkt, size_t plen)
 {
-	JL_LOOP(&rst->write_JQ,
-		struct op *op = val;
-		if (op_write(&op->set, pkt, plen))
-			return false;
-	);
-	return true;
+	return program_exec(rst->prog, pkt, plen);
+}
+
+
+/*	rout_set_count()
+ * Total packets matched and processed by 'rst', over all threads.
+ * Workers are fenced while the control plane calls this: no need for atomics.
+ */
+size_t rout_set_count(struct rout_set *rst)
+{
+	size_t ret = 0;
+	for (unsigned int i = 0; i < IFACE_WORKER_SLOTS; i++)
+		ret += rst->wcount[i].match;
+	return ret;
 }
 
 
@@ -133,7 +193,7 @@ int rout_emit(struct rout *rout, yaml_document_t *outdoc, int outlist)
 	NB_die_if(
 		y_pair_insert(outdoc, reply, rout->rule->name, rout->output->name)
 		// || y_pair_insert_nf(outdoc, reply, "hash", "0x%"PRIx64, rout->set->hash)
-		|| y_pair_insert_nf(outdoc, reply, "matches", "%zu", rout->set->count_match)
+		|| y_pair_insert_nf(outdoc, reply, "matches", "%zu", rout_set_count(rout->set))
 		, "");
 	NB_die_if(!(
 		yaml_document_append_sequence_item(outdoc, outlist, reply)
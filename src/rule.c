@@ -30,6 +30,50 @@ static void rule_release_refs(Pvoid_t match_JQ, Pvoid_t write_JQ)
 	JLFA(rc, write_JQ);
 }
 
+/*	rule_check_ops()
+ * Scratch registers only exist while the writes of a rule execute:
+ * they cannot be matched against, and must be written before being read.
+ * A swap only makes sense as a write, a table, set, range, contains or regex
+ * lookup only as a match.
+ */
+static int rule_check_ops(Pvoid_t match_JQ, Pvoid_t write_JQ)
+{
+	int err_cnt = 0;
+	int __attribute__((unused)) rc;
+	Pvoid_t written_JL = NULL; /* (struct memref *ref) -> (struct memref *ref) */
+
+	JL_LOOP(&match_JQ,
+		struct op *op = val;
+		NB_die_if((op->dst && memref_is_scratch(op->dst))
+			|| (op->src && memref_is_scratch(op->src)),
+			"scratch registers can only be used in 'write'");
+		NB_die_if(op->set.set_from.flags & OP_SWAP,
+			"swap can only be used in 'write'");
+	);
+	JL_LOOP(&write_JQ,
+		struct op *op = val;
+		NB_die_if(op_table(op),
+			"table '%s' can only be used in 'match'", op_table(op)->name);
+		NB_die_if(op_member(op),
+			"set '%s' can only be used in 'match'", op_member(op)->name);
+		NB_die_if(op_search(op),
+			"contains can only be used in 'match'");
+		NB_die_if(op_regex(op),
+			"regex can only be used in 'match'");
+		NB_die_if(op_is_lookup(op),
+			"comparisons can only be used in 'match'");
+		NB_die_if(op->src && memref_is_scratch(op->src)
+			&& !jl_get(&written_JL, (uintptr_t)op->src),
+			"scratch '%s' read before being written", op->src->name);
+		if (op->dst && memref_is_scratch(op->dst))
+			jl_insert(&written_JL, (uintptr_t)op->dst, op->dst, true);
+	);
+
+die:
+	JLFA(rc, written_JL);
+	return err_cnt;
+}
+
 /*	rule_free()
  */
 void rule_free(void *arg)
@@ -87,6 +131,9 @@ struct rule *rule_new(const char *name, Pvoid_t match_JQ, Pvoid_t write_JQ)
 		ret->name = nstralloc(name, MAXLINELEN, NULL)
 		), "string alloc fail");
 	NB_die_if(errno == E2BIG, "value truncated:\n%s", ret->name);
+	NB_die_if(
+		rule_check_ops(match_JQ, write_JQ)
+		, "rule '%s'", name);
 
 #ifdef XDPACKET_DISALLOW_CLOBBER
 	NB_die_if(js_insert(&rule_JS, ret->name, ret, false)
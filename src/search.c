@@ -0,0 +1,290 @@
+/*	search.c
+ * (c) 2018 Sirio Balmelli
+ */
+
+#include <search.h>
+#include <ndebug.h>
+#include <nstring.h>
+
+
+/*	search_patterns_free()
+ */
+static void search_patterns_free(Pvoid_t pattern_JQ)
+{
+	JL_LOOP(&pattern_JQ,
+		free(val);
+	);
+	int __attribute__((unused)) rc;
+	JLFA(rc, pattern_JQ);
+}
+
+
+/*	search_free()
+ */
+void search_free(struct search *search)
+{
+	if (!search)
+		return;
+	search_patterns_free(search->pattern_JQ);
+	free(search->delta);
+	free(search);
+}
+
+
+/*	search_prefilter_add()
+ * Add the first pair of Bytes of 'pat' (or its only Byte) to the prefilter.
+ * Too many pairs leave 'pair_cnt' at SEARCH_PAIRS_MAX + 1.
+ */
+static void search_prefilter_add(struct search *search, const uint8_t *pat)
+{
+	search->first[pat[0] >> 6] |= 1ULL << (pat[0] & 63);
+	if (search->pair_cnt > SEARCH_PAIRS_MAX)
+		return;
+
+	/* a 1-Byte pattern covers all pairs starting with its Byte */
+	bool any = !pat[1];
+	uint8_t j = 0;
+	for (uint8_t k = 0; k < search->pair_cnt; k++) {
+		if (search->pair_a[k] == pat[0]
+				&& (search->pair_any[k] || (!any && search->pair_b[k] == pat[1])))
+			return;
+		if (any && search->pair_a[k] == pat[0])
+			continue;
+		search->pair_a[j] = search->pair_a[k];
+		search->pair_b[j] = search->pair_b[k];
+		search->pair_any[j] = search->pair_any[k];
+		j++;
+	}
+	search->pair_cnt = j;
+
+	if (search->pair_cnt == SEARCH_PAIRS_MAX) {
+		search->pair_cnt++;
+		return;
+	}
+	search->pair_a[j] = pat[0];
+	search->pair_b[j] = any ? 0 : pat[1];
+	search->pair_any[j] = any;
+	search->pair_cnt++;
+}
+
+
+/*	search_new()
+ * Compile the patterns (char *) in 'pattern_JQ', which are copied.
+ */
+struct search *search_new(Pvoid_t pattern_JQ)
+{
+	struct search *ret = NULL;
+	uint32_t *fail = NULL;
+	uint32_t *queue = NULL;
+	uint8_t *out = NULL;
+	NB_die_if(!(
+		ret = calloc(1, sizeof(*ret))
+		), "fail alloc size %zu", sizeof(*ret));
+
+	size_t bytes = 0;
+	JL_LOOP(&pattern_JQ,
+		size_t len = strlen(val);
+		NB_die_if(!len, "empty search pattern");
+		bytes += len;
+		/* rely on enqueue() to test for a NULL datum */
+		NB_die_if(
+			jl_enqueue(&ret->pattern_JQ, nstralloc(val, SEARCH_BYTES_MAX + 1, NULL))
+			, "");
+	);
+	NB_die_if(!bytes, "no search patterns");
+	NB_die_if(bytes > SEARCH_BYTES_MAX,
+		"search patterns total %zu Bytes, more than %d", bytes, SEARCH_BYTES_MAX);
+
+	/* worst case: one state per Byte, plus the root */
+	size_t max = bytes + 1;
+	NB_die_if(!(
+		(ret->delta = calloc(max << 8, sizeof(*ret->delta)))
+		&& (fail = calloc(max, sizeof(*fail)))
+		&& (queue = calloc(max, sizeof(*queue)))
+		&& (out = calloc(max, sizeof(*out)))
+		), "fail alloc automaton of %zu states", max);
+
+	/* trie: a 0 transition is missing (nothing points back to the root) */
+	ret->state_cnt = 1;
+	JL_LOOP(&ret->pattern_JQ,
+		const uint8_t *pat = val;
+		uint32_t state = 0;
+		for (; *pat; pat++) {
+			uint16_t *next = &ret->delta[(size_t)state << 8 | *pat];
+			if (!*next)
+				*next = ret->state_cnt++;
+			state = *next;
+		}
+		out[state] = 1;
+		search_prefilter_add(ret, val);
+	);
+	if (ret->pair_cnt > SEARCH_PAIRS_MAX)
+		ret->pair_cnt = 0;
+
+	/* Failure links, breadth first so that the failure state of a state
+	 * (always shallower) is complete before it is used:
+	 * missing transitions become those of the failure state.
+	 */
+	size_t head = 0, tail = 0;
+	for (unsigned int c = 0; c < 256; c++) {
+		if (ret->delta[c])
+			queue[tail++] = ret->delta[c];
+	}
+	while (head < tail) {
+		uint32_t state = queue[head++];
+		out[state] |= out[fail[state]];
+		for (unsigned int c = 0; c < 256; c++) {
+			uint16_t *next = &ret->delta[(size_t)state << 8 | c];
+			uint16_t f = ret->delta[(size_t)fail[state] << 8 | c];
+			if (*next) {
+				fail[*next] = f;
+				queue[tail++] = *next;
+			} else {
+				*next = f;
+			}
+		}
+	}
+
+	/* only hit/miss is needed: stop at the first matching state */
+	for (size_t i = 0; i < (size_t)ret->state_cnt << 8; i++) {
+		if (out[ret->delta[i]])
+			ret->delta[i] = SEARCH_STATE_HIT;
+	}
+	uint16_t *shrunk = realloc(ret->delta, ((size_t)ret->state_cnt << 8) * sizeof(*ret->delta));
+	if (shrunk)
+		ret->delta = shrunk;
+
+	free(fail);
+	free(queue);
+	free(out);
+	return ret;
+
+die:
+	free(fail);
+	free(queue);
+	free(out);
+	search_free(ret);
+	return NULL;
+}
+
+
+/*	search_skip_scalar()
+ */
+size_t search_skip_scalar(const struct search *search, const uint8_t *p, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (!(search->first[p[i] >> 6] & 1ULL << (p[i] & 63)))
+			continue;
+		if (!search->pair_cnt)
+			return i;
+		for (uint8_t k = 0; k < search->pair_cnt; k++) {
+			if (p[i] == search->pair_a[k]
+					&& (search->pair_any[k]
+						|| (i + 1 < len && p[i + 1] == search->pair_b[k])))
+				return i;
+		}
+	}
+	return len;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/*	search_skip_sse2()
+ * Compare 16 positions at a time against all pairs:
+ * the first Byte at each position, the second Byte one position later.
+ * Requires a non-zero 'pair_cnt'.
+ */
+size_t __attribute__((target("sse2"))) search_skip_sse2(const struct search *search,
+							const uint8_t *p, size_t len)
+{
+	size_t i = 0;
+	/* second vector reads one Byte past the first */
+	for (; i + sizeof(__m128i) < len; i += sizeof(__m128i)) {
+		__m128i v0 = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(p + i + 1));
+		__m128i hit = _mm_setzero_si128();
+		for (uint8_t k = 0; k < search->pair_cnt; k++) {
+			__m128i e = _mm_cmpeq_epi8(v0, _mm_set1_epi8((char)search->pair_a[k]));
+			if (!search->pair_any[k])
+				e = _mm_and_si128(e, _mm_cmpeq_epi8(v1,
+							_mm_set1_epi8((char)search->pair_b[k])));
+			hit = _mm_or_si128(hit, e);
+		}
+		unsigned int mask = _mm_movemask_epi8(hit);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+	return i + search_skip_scalar(search, p + i, len - i);
+}
+
+/*	search_skip_avx2()
+ * As search_skip_sse2(), 32 positions at a time.
+ */
+size_t __attribute__((target("avx2"))) search_skip_avx2(const struct search *search,
+							const uint8_t *p, size_t len)
+{
+	size_t i = 0;
+	for (; i + sizeof(__m256i) < len; i += sizeof(__m256i)) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i v1 = _mm256_loadu_si256((const __m256i *)(p + i + 1));
+		__m256i hit = _mm256_setzero_si256();
+		for (uint8_t k = 0; k < search->pair_cnt; k++) {
+			__m256i e = _mm256_cmpeq_epi8(v0, _mm256_set1_epi8((char)search->pair_a[k]));
+			if (!search->pair_any[k])
+				e = _mm256_and_si256(e, _mm256_cmpeq_epi8(v1,
+							_mm256_set1_epi8((char)search->pair_b[k])));
+			hit = _mm256_or_si256(hit, e);
+		}
+		unsigned int mask = _mm256_movemask_epi8(hit);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+	return i + search_skip_sse2(search, p + i, len - i);
+}
+#endif
+
+
+/*	search_skip_best
+ * Widest prefilter supported by this CPU, chosen at startup.
+ */
+static size_t (*search_skip_best)(const struct search *search,
+				const uint8_t *p, size_t len) = search_skip_scalar;
+
+static void __attribute__((constructor)) search_skip_select()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		search_skip_best = search_skip_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		search_skip_best = search_skip_sse2;
+#endif
+}
+
+
+/*	search_match()
+ * Returns true if any pattern of 'search' occurs in the 'len' Bytes at 'p'.
+ * While the automaton is in its root state no match is under way,
+ * so the prefilter may skip ahead to the next candidate.
+ */
+bool __attribute__((hot)) search_match(const struct search *search,
+					const uint8_t *p, size_t len)
+{
+	size_t (*skip)(const struct search *search, const uint8_t *p, size_t len) =
+		search->pair_cnt ? search_skip_best : search_skip_scalar;
+
+	uint32_t state = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (!state) {
+			i += skip(search, p + i, len - i);
+			if (i == len)
+				return false;
+		}
+		state = search->delta[(size_t)state << 8 | p[i]];
+		if (state == SEARCH_STATE_HIT)
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,440 @@
+/*	set.c
+ * (c) 2018 Sirio Balmelli
+ */
+
+#include <set.h>
+#include <value.h>
+#include <ndebug.h>
+#include <yamlutils.h>
+#include <nstring.h>
+#include <refcnt.h>
+
+
+static Pvoid_t set_JS = NULL; /* (char *set_name) -> (struct set *set) */
+
+uint32_t set_generation = 0;
+
+
+/*	set_bloom_add()
+ */
+static void set_bloom_add(struct set *set, uint64_t hash)
+{
+	uint64_t bits[2];
+	set_bloom_bits(set, hash, bits);
+	set->bloom[bits[0] >> 6] |= 1ULL << (bits[0] & 63);
+	set->bloom[bits[1] >> 6] |= 1ULL << (bits[1] & 63);
+}
+
+/*	set_bloom_rebuild()
+ * Clear Bloom filter bits left over by deleted values.
+ */
+void set_bloom_rebuild(struct set *set)
+{
+	size_t words = ((size_t)set->slot_mask + 1) * SET_BLOOM_BITS / 64;
+	memset(set->bloom, 0, words * sizeof(*set->bloom));
+	for (uint32_t i = 0; i <= set->slot_mask; i++) {
+		if (set->hashes[i])
+			set_bloom_add(set, set->hashes[i]);
+	}
+}
+
+/*	set_find()
+ * Returns the slot holding 'value', or the empty slot where it belongs.
+ */
+static uint32_t set_find(const struct set *set, const uint8_t *value, uint64_t hash)
+{
+	uint32_t i = set_slot(set, hash);
+	while (set->hashes[i] && (set->hashes[i] != hash
+			|| memcmp(&set->values[(size_t)i * set->len], value, set->len)))
+		i = (i + 1) & set->slot_mask;
+	return i;
+}
+
+/*	set_resize()
+ * Reallocate 'set' with 'slots' slots and reinsert all values.
+ */
+static int set_resize(struct set *set, uint32_t slots)
+{
+	int err_cnt = 0;
+	struct set old = *set;
+
+	set->slot_mask = slots - 1;
+	set->hashes = calloc(slots, sizeof(*set->hashes));
+	set->values = calloc(slots, set->len);
+	set->texts = calloc(slots, sizeof(*set->texts));
+	set->bloom = calloc((size_t)slots * SET_BLOOM_BITS / 64, sizeof(*set->bloom));
+	NB_die_if(!set->hashes || !set->values || !set->texts || !set->bloom,
+		"fail alloc %u slots of len %u", slots, set->len);
+
+	for (uint32_t i = 0; old.hashes && i <= old.slot_mask; i++) {
+		if (!old.hashes[i])
+			continue;
+		const uint8_t *value = &old.values[(size_t)i * old.len];
+		uint32_t j = set_find(set, value, old.hashes[i]);
+		set->hashes[j] = old.hashes[i];
+		memcpy(&set->values[(size_t)j * set->len], value, set->len);
+		set->texts[j] = old.texts[i];
+	}
+	set_bloom_rebuild(set);
+
+	free(old.hashes);
+	free(old.values);
+	free(old.texts);
+	free(old.bloom);
+	return 0;
+
+die:
+	free(set->hashes);
+	free(set->values);
+	free(set->texts);
+	free(set->bloom);
+	*set = old;
+	return err_cnt;
+}
+
+
+/*	set_free()
+ */
+void set_free(void *arg)
+{
+	if (!arg)
+		return;
+	struct set *set = arg;
+	NB_wrn_if(set->name != NULL,
+		"erase set %s", set->name);
+
+	NB_die_if(set->refcnt,
+		"set '%s' free with non-zero refcnt == leak", set->name);
+
+	/* _only_ remove from set_JS if _we_ are there: we may be a dup */
+	if (js_get(&set_JS, set->name) == set)
+		js_delete(&set_JS, set->name);
+
+	for (uint32_t i = 0; set->texts && i <= set->slot_mask; i++)
+		free(set->texts[i]);
+	free(set->hashes);
+	free(set->values);
+	free(set->texts);
+	free(set->bloom);
+	free(set->name);
+	free(set);
+die:
+	return;
+}
+
+/*	set_free_all()
+ * Sets are referenced by rules, so are freed after them.
+ */
+void __attribute__((destructor(103))) set_free_all()
+{
+	JS_LOOP(&set_JS,
+		set_free(val);
+	);
+}
+
+/*	set_new()
+ * Create a new, empty set of values 'len' Bytes long.
+ */
+struct set *set_new(const char *name, long len)
+{
+	struct set *ret = NULL;
+	NB_die_if(!name, "no name given for set");
+	NB_die_if(js_get(&set_JS, name) != NULL,
+		"set '%s' already exists", name);
+	NB_die_if(len < 1 || len > SET_LEN_MAX,
+		"set '%s' len '%ld' not in [1, %d]", name, len, SET_LEN_MAX);
+
+	NB_die_if(!(
+		ret = calloc(1, sizeof(*ret))
+		), "fail alloc size %zu", sizeof(*ret));
+	errno = 0;
+	NB_die_if(!(
+		ret->name = nstralloc(name, MAXLINELEN, NULL)
+		), "string alloc fail");
+	NB_die_if(errno == E2BIG, "value truncated:\n%s", ret->name);
+
+	ret->len = len;
+	NB_die_if(
+		set_resize(ret, SET_SLOTS_MIN)
+		, "");
+
+	NB_die_if(
+		js_insert(&set_JS, ret->name, ret, true)
+		, "");
+	NB_inf("%s", ret->name);
+	return ret;
+
+die:
+	set_free(ret);
+	return NULL;
+}
+
+
+/*	set_release()
+ */
+void set_release(struct set *set)
+{
+	if (!set)
+		return;
+	refcnt_release(set);
+}
+
+/*	set_get()
+ * Increments refcount, don't call from inside this file.
+ */
+struct set *set_get(const char *name)
+{
+	struct set *ret = js_get(&set_JS, name);
+	if (ret)
+		refcnt_take(ret);
+	return ret;
+}
+
+
+/*	set_add()
+ * Add 'value' to 'set'; adding a value already in 'set' is not an error.
+ */
+int set_add(struct set *set, const char *value)
+{
+	int err_cnt = 0;
+	uint8_t parsed[SET_LEN_MAX];
+	NB_die_if(
+		value_parse(value, parsed, set->len)
+		, "set '%s': could not parse value '%s'", set->name, value);
+
+	/* stay at most half full */
+	if ((set->cnt + 1) * 2 > set->slot_mask + 1) {
+		NB_die_if(set->slot_mask >= UINT32_MAX / 2,
+			"set '%s' is full", set->name);
+		NB_die_if(
+			set_resize(set, (set->slot_mask + 1) * 2)
+			, "set '%s'", set->name);
+	}
+
+	uint64_t hash = set_hash(parsed, set->len);
+	uint32_t i = set_find(set, parsed, hash);
+	if (set->hashes[i])
+		return 0;
+
+	errno = 0;
+	NB_die_if(!(
+		set->texts[i] = nstralloc(value, MAXVALUELEN, NULL)
+		), "string alloc fail");
+	NB_die_if(errno == E2BIG, "value truncated:\n%s", set->texts[i]);
+	set->hashes[i] = hash;
+	memcpy(&set->values[(size_t)i * set->len], parsed, set->len);
+	set_bloom_add(set, hash);
+	set->cnt++;
+	set_generation++;
+die:
+	return err_cnt;
+}
+
+/*	set_del()
+ * Remove 'value' from 'set', which must contain it.
+ * Later values in the same probe sequence are shifted back over the hole
+ * (no tombstones), so that lookups can stop at the first empty slot.
+ */
+int set_del(struct set *set, const char *value)
+{
+	int err_cnt = 0;
+	uint8_t parsed[SET_LEN_MAX];
+	NB_die_if(
+		value_parse(value, parsed, set->len)
+		, "set '%s': could not parse value '%s'", set->name, value);
+
+	uint64_t hash = set_hash(parsed, set->len);
+	uint32_t i = set_find(set, parsed, hash);
+	NB_die_if(!set->hashes[i], "set '%s' does not contain '%s'", set->name, value);
+	free(set->texts[i]);
+
+	for (uint32_t j = (i + 1) & set->slot_mask; set->hashes[j]; j = (j + 1) & set->slot_mask) {
+		/* leave 'j' where it is if its home is cyclically in (i, j] */
+		uint32_t home = set_slot(set, set->hashes[j]);
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+		set->hashes[i] = set->hashes[j];
+		memcpy(&set->values[(size_t)i * set->len],
+			&set->values[(size_t)j * set->len], set->len);
+		set->texts[i] = set->texts[j];
+		i = j;
+	}
+	set->hashes[i] = 0;
+	set->texts[i] = NULL;
+	set->cnt--;
+	set_generation++;
+die:
+	return err_cnt;
+}
+
+
+/*	set_parse()
+ * Adding to an existing set adds the values given to it;
+ * deleting with values deletes only those values.
+ */
+int set_parse(enum parse_mode mode,
+		yaml_document_t *doc, yaml_node_t *mapping,
+		yaml_document_t *outdoc, int outlist)
+{
+	int err_cnt = 0;
+	int __attribute__((unused)) rc;
+	struct set *set = NULL;
+
+	const char *name = "";
+	long len = 0;
+	Pvoid_t value_JQ = NULL; /* (uint64_t seq) -> (const char *value) */
+
+	/* {
+	 *   set: allowed		(scalar)
+	 *   len: 6			(scalar)
+	 *   values:			(sequence)
+	 *     - 02:00:00:00:00:aa	(scalar)
+	 * } # set			(mapping)
+	 */
+	Y_FOR_MAP(doc, mapping,
+		if (!strcmp("set", keyname)) {
+			name = txt;
+
+		} else if (!strcmp("len", keyname) || !strcmp("l", keyname)) {
+			errno = 0;
+			len = strtol(txt, NULL, 0);
+			NB_die_if(errno, "'%s': '%s' could not be parsed", keyname, txt);
+
+		} else if (!strcmp("values", keyname)) {
+			if (type != YAML_SEQUENCE_NODE) {
+				NB_err("'values' is not a sequence");
+				continue;
+			}
+			Y_FOR_SEQ(doc, seq,
+				if (type != YAML_SCALAR_NODE) {
+					NB_err("'values' item not a scalar");
+					continue;
+				}
+				NB_err_if(
+					jl_enqueue(&value_JQ, (void *)txt)
+					, "");
+			);
+
+		} else {
+			NB_err("'set' does not implement '%s'", keyname);
+		}
+	);
+
+	/* process based on 'mode' */
+	switch (mode) {
+	case PARSE_ADD:
+	{
+		if ((set = js_get(&set_JS, name))) {
+			NB_die_if(len && len != set->len,
+				"set '%s' exists with len %u", name, set->len);
+		} else {
+			NB_die_if(!(
+				set = set_new(name, len)
+				), "could not create new set '%s'", name);
+		}
+		JL_LOOP(&value_JQ,
+			NB_err_if(
+				set_add(set, val)
+				, "");
+		);
+		NB_die_if(
+			set_emit(set, outdoc, outlist)
+			, "");
+		break;
+	}
+
+	case PARSE_DEL:
+		NB_die_if(!(
+			set = js_get(&set_JS, name)
+			), "could not get set '%s'", name);
+		if (value_JQ) {
+			JL_LOOP(&value_JQ,
+				NB_err_if(
+					set_del(set, val)
+					, "");
+			);
+			set_bloom_rebuild(set);
+			NB_die_if(
+				set_emit(set, outdoc, outlist)
+				, "");
+			break;
+		}
+		NB_die_if(set->refcnt, "set '%s' still in use", name);
+		NB_die_if(
+			set_emit(set, outdoc, outlist)
+			, "");
+		set_free(set);
+		break;
+
+	case PARSE_PRN:
+		/* if nothing is given, print all */
+		if (!strcmp("", name)) {
+			NB_die_if(
+				set_emit_all(outdoc, outlist)
+				, "");
+		/* otherwise, search for a literal match */
+		} else if ((set = js_get(&set_JS, name))) {
+			NB_die_if(
+				set_emit(set, outdoc, outlist)
+				, "");
+		}
+		break;
+
+	default:
+		NB_err("unknown mode %s", parse_mode_prn(mode));
+	};
+
+die:
+	JLFA(rc, value_JQ);
+	return err_cnt;
+}
+
+/*	set_emit()
+ * Emit a set as a mapping under 'outlist' in 'outdoc'.
+ */
+int set_emit(struct set *set, yaml_document_t *outdoc, int outlist)
+{
+	/* allow internal/test parsing without an output doc */
+	if (!outdoc)
+		return 0;
+
+	int err_cnt = 0;
+	int reply = yaml_document_add_mapping(outdoc, NULL, YAML_BLOCK_MAPPING_STYLE);
+	int values = yaml_document_add_sequence(outdoc, NULL, YAML_FLOW_SEQUENCE_STYLE);
+	for (uint32_t i = 0; i <= set->slot_mask; i++) {
+		if (!set->hashes[i])
+			continue;
+		NB_die_if(!(
+			yaml_document_append_sequence_item(outdoc, values,
+				yaml_document_add_scalar(outdoc, NULL, (yaml_char_t *)set->texts[i],
+							-1, YAML_PLAIN_SCALAR_STYLE))
+			), "");
+	}
+
+	NB_die_if(
+		y_pair_insert(outdoc, reply, "set", set->name)
+		|| y_pair_insert_nf(outdoc, reply, "len", "%u", set->len)
+		|| y_pair_insert_obj(outdoc, reply, "values", values)
+		, "");
+	NB_die_if(!(
+		yaml_document_append_sequence_item(outdoc, outlist, reply)
+		), "");
+die:
+	return err_cnt;
+}
+
+/*	set_emit_all()
+ */
+int set_emit_all (yaml_document_t *outdoc, int outlist)
+{
+	int err_cnt = 0;
+
+	JS_LOOP(&set_JS,
+		NB_die_if(
+			set_emit(val, outdoc, outlist)
+			, "");
+	);
+
+die:
+	return err_cnt;
+}
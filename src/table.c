@@ -0,0 +1,439 @@
+/*	table.c
+ * (c) 2018 Sirio Balmelli
+ */
+
+#include <table.h>
+#include <value.h>
+#include <ndebug.h>
+#include <yamlutils.h>
+#include <nstring.h>
+#include <refcnt.h>
+#include <arpa/inet.h> /* inet_pton() */
+
+
+static Pvoid_t table_JS = NULL; /* (char *table_name) -> (struct table *table) */
+
+
+/*	table_prefixes_free()
+ */
+static void table_prefixes_free(Pvoid_t prefix_JQ)
+{
+	JL_LOOP(&prefix_JQ,
+		free(val);
+	);
+	int __attribute__((unused)) rc;
+	JLFA(rc, prefix_JQ);
+}
+
+/*	table_node_free()
+ */
+static void table_node_free(struct table_node *node)
+{
+	if (node <= TABLE_NODE_HIT)
+		return;
+	for (unsigned int i = 0; i < NLC_ARRAY_LEN(node->child); i++)
+		table_node_free(node->child[i]);
+	free(node);
+}
+
+
+/*	table_dir_insert()
+ * Insert prefix 'addr/bits' into the DIR-24-8 arrays of 'table'.
+ */
+static int table_dir_insert(struct table *table, const uint8_t *addr, unsigned int bits)
+{
+	int err_cnt = 0;
+	uint32_t hi = (uint32_t)addr[0] << 16 | (uint32_t)addr[1] << 8 | addr[2];
+
+	/* cover whole first-level entries */
+	if (bits <= TABLE_DIR_BITS) {
+		uint32_t n = 1U << (TABLE_DIR_BITS - bits);
+		hi &= ~(n - 1);
+		for (uint32_t i = 0; i < n; i++)
+			table->dir[hi + i] = TABLE_DIR_HIT;
+		return 0;
+	}
+
+	/* already covered by a shorter prefix */
+	uint16_t ent = table->dir[hi];
+	if (ent == TABLE_DIR_HIT)
+		return 0;
+
+	if (ent == TABLE_DIR_MISS) {
+		NB_die_if(table->group_cnt == TABLE_DIR_GROUP_MAX,
+			"more than %d prefixes longer than /%d",
+			TABLE_DIR_GROUP_MAX, TABLE_DIR_BITS);
+		size_t size = ((size_t)table->group_cnt + 1) << 8;
+		uint8_t *groups;
+		NB_die_if(!(
+			groups = realloc(table->groups, size)
+			), "fail alloc size %zu", size);
+		table->groups = groups;
+		memset(&groups[size - 256], 0, 256);
+		ent = table->group_cnt++ + 2;
+		table->dir[hi] = ent;
+	}
+
+	uint32_t n = 1U << (32 - bits);
+	memset(&table->groups[(size_t)(ent - 2) << 8 | (addr[3] & ~(n - 1))], 1, n);
+die:
+	return err_cnt;
+}
+
+/*	table_trie_insert()
+ * Insert prefix 'addr/bits' into the trie of 'table'.
+ */
+static int table_trie_insert(struct table *table, const uint8_t *addr, unsigned int bits)
+{
+	int err_cnt = 0;
+	struct table_node **slot = &table->root;
+
+	for (size_t i = 0; ; i++) {
+		/* prefix ends here: everything below is covered */
+		if (!bits) {
+			table_node_free(*slot);
+			*slot = TABLE_NODE_HIT;
+			break;
+		}
+		/* already covered by a shorter prefix */
+		if (*slot == TABLE_NODE_HIT)
+			break;
+		if (!*slot) {
+			NB_die_if(!(
+				*slot = calloc(1, sizeof(**slot))
+				), "fail alloc size %zu", sizeof(**slot));
+		}
+		if (bits >= 8) {
+			slot = &(*slot)->child[addr[i]];
+			bits -= 8;
+			continue;
+		}
+
+		/* prefix ends inside this Byte: expand to all children covered */
+		unsigned int n = 1U << (8 - bits);
+		unsigned int lo = addr[i] & ~(n - 1) & 0xff;
+		for (unsigned int j = lo; j < lo + n; j++) {
+			table_node_free((*slot)->child[j]);
+			(*slot)->child[j] = TABLE_NODE_HIT;
+		}
+		break;
+	}
+die:
+	return err_cnt;
+}
+
+/*	table_insert()
+ * Parse 'prefix' as 'address/bits' (or only 'address', meaning all bits)
+ * and insert it into 'table'.
+ */
+static int table_insert(struct table *table, const char *prefix)
+{
+	int err_cnt = 0;
+	char addr_txt[MAXLINELEN];
+	uint8_t addr[TABLE_LEN_MAX] = { 0 };
+	long bits = table->len * 8;
+
+	size_t len = strcspn(prefix, "/");
+	NB_die_if(len >= sizeof(addr_txt), "prefix '%s' too long", prefix);
+	memcpy(addr_txt, prefix, len);
+	addr_txt[len] = '\0';
+
+	if (prefix[len] == '/') {
+		char *end;
+		errno = 0;
+		bits = strtol(&prefix[len + 1], &end, 10);
+		NB_die_if(errno || *end || end == &prefix[len + 1],
+			"prefix '%s' length could not be parsed", prefix);
+	}
+	NB_die_if(bits < 0 || bits > table->len * 8,
+		"prefix '%s' length not in [0, %d]", prefix, table->len * 8);
+	/* value_parse() does not accept IPv6 with a trailing '::', as in '2001:db8::' */
+	if (table->len == 16) {
+		NB_die_if(inet_pton(AF_INET6, addr_txt, addr) != 1,
+			"prefix '%s' address could not be parsed", prefix);
+	} else {
+		NB_die_if(
+			value_parse(addr_txt, addr, table->len)
+			, "prefix '%s' address could not be parsed", prefix);
+	}
+
+	if (table->dir)
+		err_cnt = table_dir_insert(table, addr, bits);
+	else
+		err_cnt = table_trie_insert(table, addr, bits);
+die:
+	return err_cnt;
+}
+
+
+/*	table_free()
+ */
+void table_free(void *arg)
+{
+	if (!arg)
+		return;
+	struct table *table = arg;
+	NB_wrn_if(table->name != NULL,
+		"erase table %s", table->name);
+
+	NB_die_if(table->refcnt,
+		"table '%s' free with non-zero refcnt == leak", table->name);
+
+	/* _only_ remove from table_JS if _we_ are there: we may be a dup */
+	if (js_get(&table_JS, table->name) == table)
+		js_delete(&table_JS, table->name);
+
+	table_prefixes_free(table->prefix_JQ);
+	free(table->dir);
+	free(table->groups);
+	table_node_free(table->root);
+	free(table->name);
+	free(table);
+die:
+	return;
+}
+
+/*	table_free_all()
+ * Tables are referenced by rules, so are freed after them.
+ */
+void __attribute__((destructor(103))) table_free_all()
+{
+	JS_LOOP(&table_JS,
+		table_free(val);
+	);
+}
+
+/*	table_new()
+ * Create a new table of keys 'len' Bytes long from 'prefix_JQ',
+ * which it takes ownership of.
+ */
+struct table *table_new(const char *name, long len, Pvoid_t prefix_JQ)
+{
+	/* Create an object _first_ so that later failures can be passed
+	 * to _free() which will release 'prefix_JQ'.
+	 */
+	struct table *ret = NULL;
+	if (!(ret = calloc(1, sizeof(*ret)))) {
+		table_prefixes_free(prefix_JQ);
+		NB_die("fail alloc size %zu", sizeof(*ret));
+	}
+	ret->prefix_JQ = prefix_JQ;
+
+	NB_die_if(!name, "no name given for table");
+	errno = 0;
+	NB_die_if(!(
+		ret->name = nstralloc(name, MAXLINELEN, NULL)
+		), "string alloc fail");
+	NB_die_if(errno == E2BIG, "value truncated:\n%s", ret->name);
+
+	struct table *old = js_get(&table_JS, name);
+#ifdef XDPACKET_DISALLOW_CLOBBER
+	NB_die_if(old != NULL, "table '%s' already exists", name);
+#else
+	/* rules referencing a table rely on it not changing */
+	NB_die_if(old && old->refcnt, "table '%s' already exists and is in use", name);
+#endif
+
+	NB_die_if(len < 1 || len > TABLE_LEN_MAX,
+		"table '%s' len '%ld' not in [1, %d]", name, len, TABLE_LEN_MAX);
+	ret->len = len;
+
+	if (len == 4) {
+		NB_die_if(!(
+			ret->dir = calloc(1U << TABLE_DIR_BITS, sizeof(*ret->dir))
+			), "fail alloc size %zu", (1U << TABLE_DIR_BITS) * sizeof(*ret->dir));
+	}
+
+	JL_LOOP(&ret->prefix_JQ,
+		NB_die_if(
+			table_insert(ret, val)
+			, "table '%s'", name);
+	);
+
+	if (old) {
+		NB_wrn("table '%s' already exists: deleting", name);
+		table_free(old);
+	}
+	NB_die_if(
+		js_insert(&table_JS, ret->name, ret, true)
+		, "");
+	NB_inf("%s", ret->name);
+	return ret;
+
+die:
+	table_free(ret);
+	return NULL;
+}
+
+
+/*	table_release()
+ */
+void table_release(struct table *table)
+{
+	if (!table)
+		return;
+	refcnt_release(table);
+}
+
+/*	table_get()
+ * Increments refcount, don't call from inside this file.
+ */
+struct table *table_get(const char *name)
+{
+	struct table *ret = js_get(&table_JS, name);
+	if (ret)
+		refcnt_take(ret);
+	return ret;
+}
+
+
+/*	table_parse()
+ */
+int table_parse(enum parse_mode mode,
+		yaml_document_t *doc, yaml_node_t *mapping,
+		yaml_document_t *outdoc, int outlist)
+{
+	int err_cnt = 0;
+	struct table *table = NULL;
+
+	const char *name = "";
+	long len = 0;
+	Pvoid_t prefix_JQ = NULL;
+
+	/* {
+	 *   table: blocked		(scalar)
+	 *   len: 4			(scalar)
+	 *   prefixes:			(sequence)
+	 *     - 10.0.0.0/8		(scalar)
+	 * } # table			(mapping)
+	 */
+	Y_FOR_MAP(doc, mapping,
+		if (!strcmp("table", keyname)) {
+			name = txt;
+
+		} else if (!strcmp("len", keyname) || !strcmp("l", keyname)) {
+			errno = 0;
+			len = strtol(txt, NULL, 0);
+			NB_die_if(errno, "'%s': '%s' could not be parsed", keyname, txt);
+
+		} else if (!strcmp("prefixes", keyname)) {
+			if (type != YAML_SEQUENCE_NODE) {
+				NB_err("'prefixes' is not a sequence");
+				continue;
+			}
+			if (mode != PARSE_ADD) {
+				NB_err("'table' does not support parsing prefixes when not adding");
+				continue;
+			}
+			Y_FOR_SEQ(doc, seq,
+				if (type != YAML_SCALAR_NODE) {
+					NB_err("'prefixes' item not a scalar");
+					continue;
+				}
+				/* rely on enqueue() to test for a NULL datum */
+				NB_err_if(
+					jl_enqueue(&prefix_JQ, nstralloc(txt, MAXLINELEN, NULL))
+					, "");
+			);
+
+		} else {
+			NB_err("'table' does not implement '%s'", keyname);
+		}
+	);
+
+	/* process based on 'mode' */
+	switch (mode) {
+	case PARSE_ADD:
+	{
+		struct table *tmp = table_new(name, len, prefix_JQ);
+		prefix_JQ = NULL; /* consumed by table_new() */
+		NB_die_if(!(
+			table = tmp
+			), "could not create new table '%s'", name);
+		NB_die_if(
+			table_emit(table, outdoc, outlist)
+			, "");
+		break;
+	}
+
+	case PARSE_DEL:
+		NB_die_if(!(
+			table = js_get(&table_JS, name)
+			), "could not get table '%s'", name);
+		NB_die_if(table->refcnt, "table '%s' still in use", name);
+		NB_die_if(
+			table_emit(table, outdoc, outlist)
+			, "");
+		table_free(table);
+		break;
+
+	case PARSE_PRN:
+		/* if nothing is given, print all */
+		if (!strcmp("", name)) {
+			NB_die_if(
+				table_emit_all(outdoc, outlist)
+				, "");
+		/* otherwise, search for a literal match */
+		} else if ((table = js_get(&table_JS, name))) {
+			NB_die_if(
+				table_emit(table, outdoc, outlist)
+				, "");
+		}
+		break;
+
+	default:
+		NB_err("unknown mode %s", parse_mode_prn(mode));
+	};
+
+die:
+	table_prefixes_free(prefix_JQ);
+	return err_cnt;
+}
+
+/*	table_emit()
+ * Emit a table as a mapping under 'outlist' in 'outdoc'.
+ */
+int table_emit(struct table *table, yaml_document_t *outdoc, int outlist)
+{
+	/* allow internal/test parsing without an output doc */
+	if (!outdoc)
+		return 0;
+
+	int err_cnt = 0;
+	int reply = yaml_document_add_mapping(outdoc, NULL, YAML_BLOCK_MAPPING_STYLE);
+	int prefixes = yaml_document_add_sequence(outdoc, NULL, YAML_FLOW_SEQUENCE_STYLE);
+	JL_LOOP(&table->prefix_JQ,
+		NB_die_if(!(
+			yaml_document_append_sequence_item(outdoc, prefixes,
+				yaml_document_add_scalar(outdoc, NULL, (yaml_char_t *)val,
+							-1, YAML_PLAIN_SCALAR_STYLE))
+			), "");
+	);
+
+	NB_die_if(
+		y_pair_insert(outdoc, reply, "table", table->name)
+		|| y_pair_insert_nf(outdoc, reply, "len", "%u", table->len)
+		|| y_pair_insert_obj(outdoc, reply, "prefixes", prefixes)
+		, "");
+	NB_die_if(!(
+		yaml_document_append_sequence_item(outdoc, outlist, reply)
+		), "");
+die:
+	return err_cnt;
+}
+
+/*	table_emit_all()
+ */
+int table_emit_all (yaml_document_t *outdoc, int outlist)
+{
+	int err_cnt = 0;
+
+	JS_LOOP(&table_JS,
+		NB_die_if(
+			table_emit(val, outdoc, outlist)
+			, "");
+	);
+
+die:
+	return err_cnt;
+}
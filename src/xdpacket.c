@@ -172,14 +172,16 @@ int main(int argc, char **argv)
 	}
 	if (errno == 0x26) errno = 0;  /* weird getopt errno, pointedly ignore */
 
-	/* epoll loop */
+	/* epoll loop: wake up early only to kick tx rings left unsent */
 	while(!psg_kill_check()) {
 		NB_die_if((
-			eptk_pwait_exec(tk, -1, NULL)
+			eptk_pwait_exec(tk, iface_tx_retry(-1), NULL)
 			) < 0, "");
 	}
 
 die:
+	/* keep worker threads away from what is being freed, until they exit */
+	iface_fence();
 	process_free_all();
 	rule_free_all();
 	field_free_all();
@@ -188,5 +190,6 @@ die:
 	 * iface_free_all();
 	 */
 	eptk_free(tk);
+	iface_unfence();
 	return err_cnt;
 }
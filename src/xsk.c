@@ -0,0 +1,469 @@
+#include <xsk.h>
+#include <ndebug.h>
+#include <errno.h>
+#include <stddef.h>	/* offsetof() */
+#include <string.h>
+#include <unistd.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>	/* ETH_HLEN */
+#include <linux/if_link.h>	/* XDP_FLAGS_* */
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+
+/* The UMEM: a single area of frames shared by all XSKs.
+ * Allocated with the first XSK and released with the last one.
+ */
+static uint8_t *xsk_umem = NULL;
+static struct xsk *xsk_list = NULL;
+
+/* Addresses (offsets into 'xsk_umem') of frames owned by userland
+ * and not in use: a stack, so the most recently used frame is reused first.
+ */
+static uint64_t xsk_pool[XSK_FRAME_CNT];
+static uint32_t xsk_pool_cnt = 0;
+
+/* Frame being handled inside xsk_rx_burst().
+ * Set to NULL by xsk_tx_stage() when the frame is moved to a tx ring.
+ */
+static uint8_t *xsk_rx_cur = NULL;
+static uint64_t xsk_rx_cur_addr = 0;
+
+
+/*	xsk_bpf()
+ */
+static int xsk_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+
+/*	xsk_frame_put()
+ * Return a frame to the pool.
+ * In aligned mode any address inside a frame identifies it.
+ */
+NLC_INLINE void xsk_frame_put(uint64_t addr)
+{
+	xsk_pool[xsk_pool_cnt++] = addr & ~(uint64_t)(XSK_FRAME_SZ - 1);
+}
+
+
+/*	xsk_ring_map()
+ * mmap() a ring of XSK_RING_SZ entries of 'elem' Bytes at page offset 'pgoff'.
+ */
+static int xsk_ring_map(int fd, struct xsk_ring *ring,
+			const struct xdp_ring_offset *off, size_t elem, off_t pgoff)
+{
+	ring->map_len = off->desc + XSK_RING_SZ * elem;
+	ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (ring->map == MAP_FAILED) {
+		ring->map = NULL;
+		return 1;
+	}
+	ring->producer = (uint32_t *)((uint8_t *)ring->map + off->producer);
+	ring->consumer = (uint32_t *)((uint8_t *)ring->map + off->consumer);
+	ring->ring = (uint8_t *)ring->map + off->desc;
+	ring->size = XSK_RING_SZ;
+	ring->mask = XSK_RING_SZ - 1;
+	return 0;
+}
+
+/*	xsk_ring_unmap()
+ */
+static void xsk_ring_unmap(struct xsk_ring *ring)
+{
+	if (ring->map)
+		munmap(ring->map, ring->map_len);
+	ring->map = NULL;
+}
+
+
+/*	xsk_fill()
+ * Give the kernel as many free frames as the fill ring will take.
+ */
+static void xsk_fill(struct xsk *xsk)
+{
+	struct xsk_ring *fill = &xsk->fill;
+	uint64_t *ring = fill->ring;
+	uint32_t prod = *fill->producer;
+	uint32_t n = fill->size - (prod - __atomic_load_n(fill->consumer, __ATOMIC_ACQUIRE));
+	if (n > xsk_pool_cnt)
+		n = xsk_pool_cnt;
+	if (!n)
+		return;
+
+	for (uint32_t i = 0; i < n; i++)
+		ring[prod++ & fill->mask] = xsk_pool[--xsk_pool_cnt];
+	__atomic_store_n(fill->producer, prod, __ATOMIC_RELEASE);
+}
+
+/*	xsk_comp_drain()
+ * Return frames the kernel has finished sending to the pool.
+ */
+static void xsk_comp_drain(struct xsk *xsk)
+{
+	struct xsk_ring *comp = &xsk->comp;
+	uint64_t *ring = comp->ring;
+	uint32_t cons = *comp->consumer;
+	uint32_t prod = __atomic_load_n(comp->producer, __ATOMIC_ACQUIRE);
+	if (cons == prod)
+		return;
+
+	while (cons != prod)
+		xsk_frame_put(ring[cons++ & comp->mask]);
+	__atomic_store_n(comp->consumer, cons, __ATOMIC_RELEASE);
+}
+
+
+/*	xsk_prog_attach()
+ * Create an XSKMAP holding 'xsk', load an XDP program redirecting
+ * all packets on queue 0 into it, and attach the program to the interface.
+ * Packets on other queues are passed to the host network stack.
+ */
+static int xsk_prog_attach(struct xsk *xsk)
+{
+	int err_cnt = 0;
+	union bpf_attr attr;
+
+	memset(&attr, 0x0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(int);
+	attr.max_entries = 1;
+	NB_die_if((
+		xsk->map_fd = xsk_bpf(BPF_MAP_CREATE, &attr)
+		) < 0, "could not create XSKMAP for ifindex %d", xsk->ifindex);
+
+	uint32_t queue = 0;
+	memset(&attr, 0x0, sizeof(attr));
+	attr.map_fd = xsk->map_fd;
+	attr.key = (uintptr_t)&queue;
+	attr.value = (uintptr_t)&xsk->fd;
+	attr.flags = BPF_ANY;
+	NB_die_if(
+		xsk_bpf(BPF_MAP_UPDATE_ELEM, &attr)
+		, "could not insert XSK into XSKMAP");
+
+	/* return bpf_redirect_map(&xskmap, ctx->rx_queue_index, XDP_PASS); */
+	struct bpf_insn prog[] = {
+		{ .code = BPF_LDX | BPF_MEM | BPF_W,
+			.dst_reg = BPF_REG_2, .src_reg = BPF_REG_1,
+			.off = offsetof(struct xdp_md, rx_queue_index) },
+		{ .code = BPF_LD | BPF_DW | BPF_IMM,
+			.dst_reg = BPF_REG_1, .src_reg = BPF_PSEUDO_MAP_FD,
+			.imm = xsk->map_fd },
+		{ 0 },
+		{ .code = BPF_ALU64 | BPF_MOV | BPF_K,
+			.dst_reg = BPF_REG_3, .imm = XDP_PASS },
+		{ .code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map },
+		{ .code = BPF_JMP | BPF_EXIT }
+	};
+	memset(&attr, 0x0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uintptr_t)prog;
+	attr.insn_cnt = NLC_ARRAY_LEN(prog);
+	attr.license = (uintptr_t)"GPL";
+	attr.expected_attach_type = BPF_XDP;
+	NB_die_if((
+		xsk->prog_fd = xsk_bpf(BPF_PROG_LOAD, &attr)
+		) < 0, "could not load XDP program");
+
+	/* Native if the driver supports it, generic otherwise.
+	 * A link is detached when closed: nothing is left on the interface
+	 * if we exit without cleaning up.
+	 */
+	memset(&attr, 0x0, sizeof(attr));
+	attr.link_create.prog_fd = xsk->prog_fd;
+	attr.link_create.target_ifindex = xsk->ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	attr.link_create.flags = XDP_FLAGS_DRV_MODE;
+	xsk->native = true;
+	if ((xsk->link_fd = xsk_bpf(BPF_LINK_CREATE, &attr)) < 0) {
+		attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+		xsk->native = false;
+		NB_die_if((
+			xsk->link_fd = xsk_bpf(BPF_LINK_CREATE, &attr)
+			) < 0, "could not attach XDP program to ifindex %d", xsk->ifindex);
+	}
+
+die:
+	return err_cnt;
+}
+
+
+/*	xsk_free()
+ */
+void xsk_free(struct xsk *xsk)
+{
+	if (!xsk)
+		return;
+
+	for (struct xsk **pp = &xsk_list; *pp; pp = &(*pp)->next) {
+		if (*pp == xsk) {
+			*pp = xsk->next;
+			break;
+		}
+	}
+
+	/* detach program before closing the socket it redirects to */
+	if (xsk->link_fd != -1)
+		close(xsk->link_fd);
+	if (xsk->prog_fd != -1)
+		close(xsk->prog_fd);
+	if (xsk->map_fd != -1)
+		close(xsk->map_fd);
+	if (xsk->fd != -1)
+		close(xsk->fd);
+
+	/* Once the socket is closed the kernel no longer touches our rings:
+	 * reclaim frames still sitting in them.
+	 * Frames held by a zero-copy driver at close are only recovered
+	 * when the whole UMEM is released.
+	 */
+	if (xsk->fill.map) {
+		uint64_t *ring = xsk->fill.ring;
+		for (uint32_t i = *xsk->fill.consumer; i != *xsk->fill.producer; i++)
+			xsk_frame_put(ring[i & xsk->fill.mask]);
+	}
+	if (xsk->comp.map) {
+		uint64_t *ring = xsk->comp.ring;
+		for (uint32_t i = *xsk->comp.consumer; i != *xsk->comp.producer; i++)
+			xsk_frame_put(ring[i & xsk->comp.mask]);
+	}
+	if (xsk->rx.map) {
+		struct xdp_desc *ring = xsk->rx.ring;
+		for (uint32_t i = *xsk->rx.consumer; i != *xsk->rx.producer; i++)
+			xsk_frame_put(ring[i & xsk->rx.mask].addr);
+	}
+	if (xsk->tx.map) {
+		struct xdp_desc *ring = xsk->tx.ring;
+		for (uint32_t i = *xsk->tx.consumer; i != *xsk->tx.producer; i++)
+			xsk_frame_put(ring[i & xsk->tx.mask].addr);
+	}
+	xsk_ring_unmap(&xsk->fill);
+	xsk_ring_unmap(&xsk->comp);
+	xsk_ring_unmap(&xsk->rx);
+	xsk_ring_unmap(&xsk->tx);
+	free(xsk);
+
+	if (!xsk_list && xsk_umem) {
+		munmap(xsk_umem, (size_t)XSK_FRAME_CNT * XSK_FRAME_SZ);
+		xsk_umem = NULL;
+		xsk_pool_cnt = 0;
+	}
+}
+
+
+/*	xsk_new()
+ * Open an XSK on queue 0 of 'ifindex' with an rx ring if 'rx'
+ * and a tx ring if 'tx'.
+ * If 'rx', also attach the redirect program to the interface.
+ *
+ * The first XSK registers the UMEM and picks zero-copy if the driver
+ * supports it; all following XSKs share the UMEM and must use the same mode.
+ */
+struct xsk *xsk_new(int ifindex, int mtu, bool rx, bool tx)
+{
+	int err_cnt = 0;
+	struct xsk *ret = NULL;
+
+	NB_die_if(ETH_HLEN + mtu > XSK_FRAME_SZ - XDP_PACKET_HEADROOM,
+		"mtu %d too large for XSK frame size %d", mtu, XSK_FRAME_SZ);
+	NB_die_if(!(
+		ret = calloc(1, sizeof(*ret))
+		), "fail alloc size %zu", sizeof(*ret));
+	ret->ifindex = ifindex;
+	ret->map_fd = ret->prog_fd = ret->link_fd = -1;
+	NB_die_if((
+		ret->fd = socket(AF_XDP, SOCK_RAW, 0)
+		) < 0, "unable to open AF_XDP socket on ifindex %d", ifindex);
+
+	bool shared = xsk_list != NULL;
+	if (!xsk_umem) {
+		size_t len = (size_t)XSK_FRAME_CNT * XSK_FRAME_SZ;
+		void *umem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		NB_die_if(umem == MAP_FAILED, "fail mmap UMEM size %zu", len);
+		xsk_umem = umem;
+		for (xsk_pool_cnt = 0; xsk_pool_cnt < XSK_FRAME_CNT; xsk_pool_cnt++)
+			xsk_pool[xsk_pool_cnt] = (uint64_t)(XSK_FRAME_CNT - 1 - xsk_pool_cnt) * XSK_FRAME_SZ;
+	}
+	if (!shared) {
+		struct xdp_umem_reg reg = {
+			.addr = (uintptr_t)xsk_umem,
+			.len = (uint64_t)XSK_FRAME_CNT * XSK_FRAME_SZ,
+			.chunk_size = XSK_FRAME_SZ,
+			.headroom = 0
+		};
+		NB_die_if(
+			setsockopt(ret->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg))
+			, "could not register UMEM");
+	}
+
+	/* rings: every XSK has its own fill and completion rings */
+	int ring_sz = XSK_RING_SZ;
+	NB_die_if(
+		setsockopt(ret->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_sz, sizeof(ring_sz))
+		|| setsockopt(ret->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_sz, sizeof(ring_sz))
+		|| (rx && setsockopt(ret->fd, SOL_XDP, XDP_RX_RING, &ring_sz, sizeof(ring_sz)))
+		|| (tx && setsockopt(ret->fd, SOL_XDP, XDP_TX_RING, &ring_sz, sizeof(ring_sz)))
+		, "could not size XSK rings");
+
+	struct xdp_mmap_offsets off;
+	socklen_t optlen = sizeof(off);
+	NB_die_if(
+		getsockopt(ret->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen)
+		, "");
+	NB_die_if(
+		xsk_ring_map(ret->fd, &ret->fill, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING)
+		|| xsk_ring_map(ret->fd, &ret->comp, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING)
+		|| (rx && xsk_ring_map(ret->fd, &ret->rx, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING))
+		|| (tx && xsk_ring_map(ret->fd, &ret->tx, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING))
+		, "could not mmap XSK rings");
+	if (rx)
+		xsk_fill(ret);
+
+	/* bind: zero-copy if possible */
+	struct sockaddr_xdp sxdp = {
+		.sxdp_family = AF_XDP,
+		.sxdp_ifindex = ifindex,
+		.sxdp_queue_id = 0
+	};
+	if (shared) {
+		sxdp.sxdp_flags = XDP_SHARED_UMEM;
+		sxdp.sxdp_shared_umem_fd = xsk_list->fd;
+		NB_die_if(
+			bind(ret->fd, (struct sockaddr *)&sxdp, sizeof(sxdp))
+			, "could not bind XSK on ifindex %d: must support the same (copy|zerocopy) mode as the others",
+			ifindex);
+	} else {
+		sxdp.sxdp_flags = XDP_ZEROCOPY;
+		if (bind(ret->fd, (struct sockaddr *)&sxdp, sizeof(sxdp))) {
+			sxdp.sxdp_flags = XDP_COPY;
+			NB_die_if(
+				bind(ret->fd, (struct sockaddr *)&sxdp, sizeof(sxdp))
+				, "could not bind XSK on ifindex %d", ifindex);
+		}
+	}
+	struct xdp_options opts = { 0 };
+	optlen = sizeof(opts);
+	NB_die_if(
+		getsockopt(ret->fd, SOL_XDP, XDP_OPTIONS, &opts, &optlen)
+		, "");
+	ret->zerocopy = opts.flags & XDP_OPTIONS_ZEROCOPY;
+
+	if (rx) {
+		NB_die_if(
+			xsk_prog_attach(ret)
+			, "");
+	}
+
+	ret->next = xsk_list;
+	xsk_list = ret;
+	return ret;
+die:
+	xsk_free(ret);
+	return NULL;
+}
+
+
+/*	xsk_rx_burst()
+ * Hand up to 'max' received packets to 'handler', in place in the UMEM.
+ * Frames not moved to a tx ring by the handler are given back to the kernel.
+ * Returns number of packets handled.
+ */
+unsigned int xsk_rx_burst(struct xsk *xsk, unsigned int max,
+			void (*handler)(void *context, void *pkt, size_t len),
+			void *context)
+{
+	struct xsk_ring *rx = &xsk->rx;
+	struct xdp_desc *ring = rx->ring;
+	uint32_t cons = *rx->consumer;
+	uint32_t n = __atomic_load_n(rx->producer, __ATOMIC_ACQUIRE) - cons;
+	if (n > max)
+		n = max;
+
+	for (uint32_t i = 0; i < n; i++) {
+		struct xdp_desc desc = ring[cons++ & rx->mask];
+		xsk_rx_cur_addr = desc.addr;
+		xsk_rx_cur = xsk_umem + desc.addr;
+		if (handler)
+			handler(context, xsk_rx_cur, desc.len);
+		if (xsk_rx_cur)
+			xsk_frame_put(desc.addr);
+	}
+	xsk_rx_cur = NULL;
+	__atomic_store_n(rx->consumer, cons, __ATOMIC_RELEASE);
+
+	xsk_fill(xsk);
+	return n;
+}
+
+
+/*	xsk_tx_stage()
+ * Queue 'pkt' on the tx ring of 'xsk'; sent at the next xsk_tx_kick().
+ * If 'pkt' is the frame being handled by xsk_rx_burst() its descriptor
+ * is moved, otherwise 'pkt' is copied into a free frame.
+ * Returns 0 on success.
+ */
+int xsk_tx_stage(struct xsk *xsk, void *pkt, size_t len)
+{
+	struct xsk_ring *tx = &xsk->tx;
+	uint32_t prod = *tx->producer;
+	if (prod - __atomic_load_n(tx->consumer, __ATOMIC_ACQUIRE) == tx->size) {
+		xsk_tx_kick(xsk);
+		if (prod - __atomic_load_n(tx->consumer, __ATOMIC_ACQUIRE) == tx->size)
+			return 1;
+	}
+
+	uint64_t addr;
+	if (pkt == xsk_rx_cur) {
+		addr = xsk_rx_cur_addr;
+		xsk_rx_cur = NULL;
+	} else {
+		if (!xsk_pool_cnt)
+			xsk_comp_drain(xsk);
+		if (!xsk_pool_cnt || len > XSK_FRAME_SZ)
+			return 1;
+		addr = xsk_pool[--xsk_pool_cnt];
+		memcpy(xsk_umem + addr, pkt, len);
+	}
+
+	struct xdp_desc *desc = &((struct xdp_desc *)tx->ring)[prod & tx->mask];
+	desc->addr = addr;
+	desc->len = len;
+	desc->options = 0;
+	__atomic_store_n(tx->producer, prod + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/*	xsk_tx_kick()
+ * Have the kernel send everything on the tx ring of 'xsk',
+ * and reclaim frames it has finished sending.
+ * In copy mode the kernel sends a limited batch per call:
+ * call again for as long as it makes progress.
+ * Returns the number of descriptors the kernel has not yet taken
+ * off the tx ring, or -1 if it refused the kick.
+ */
+int xsk_tx_kick(struct xsk *xsk)
+{
+	struct xsk_ring *tx = &xsk->tx;
+	uint32_t cons = __atomic_load_n(tx->consumer, __ATOMIC_ACQUIRE);
+	while (cons != *tx->producer) {
+		if (sendto(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0
+			&& errno != EAGAIN && errno != EBUSY && errno != ENOBUFS)
+		{
+			NB_wrn("XSK tx kick failed on ifindex %d", xsk->ifindex);
+			xsk_comp_drain(xsk);
+			return -1;
+		}
+		uint32_t prev = cons;
+		cons = __atomic_load_n(tx->consumer, __ATOMIC_ACQUIRE);
+		if (cons == prev)
+			break;
+	}
+	xsk_comp_drain(xsk);
+	return *tx->producer - cons;
+}
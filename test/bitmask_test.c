@@ -0,0 +1,108 @@
+/*	bitmask_test.c
+ * Test that masked compares and merges give what a naive Byte loop gives,
+ * for every implementation and all lengths either side of a vector.
+ * (c) 2019 Sirio Balmelli
+ */
+
+#include <bitmask.h>
+#include <nonlibc.h>
+#include <ndebug.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef bool (*bitmask_differ_f)(const uint8_t *p, const uint8_t *value,
+				const uint8_t *mask, size_t len);
+typedef void (*bitmask_merge_f)(uint8_t *p, const uint8_t *value,
+				const uint8_t *mask, size_t len);
+
+struct impl {
+	const char		*name;
+	bitmask_differ_f	differ;
+	bitmask_merge_f		merge;
+	bool			supported;
+};
+
+
+#define BUF_LEN		128
+
+
+/*	check()
+ * Random field, mask and (masked) value of 'len' Bytes at random offsets;
+ * half the time the field is made to match.
+ */
+static int check(struct impl *impls, size_t impl_cnt, size_t len)
+{
+	int err_cnt = 0;
+	uint8_t p[BUF_LEN + 1], value[BUF_LEN + 1], mask[BUF_LEN + 1];
+	uint8_t ref_buf[BUF_LEN + 1], buf[BUF_LEN + 1];
+
+	for (unsigned int round = 0; round < 200; round++) {
+		size_t offt = random() % (BUF_LEN + 1 - len);
+		for (size_t i = 0; i < BUF_LEN; i++) {
+			p[i] = random();
+			/* sparse masks: most Bytes fully set, some partial or clear */
+			mask[i] = random() % 4 ? 0xff : random();
+			value[i] = random() & mask[i];
+			if (round % 2)
+				p[i] = (p[i] & ~mask[i]) | value[i];
+		}
+		/* a single differing bit anywhere */
+		if (round % 4 == 1 && len) {
+			size_t i = offt + random() % len;
+			if (mask[i])
+				p[i] ^= mask[i] & -mask[i];
+		}
+
+		bool ref = false;
+		for (size_t i = offt; i < offt + len; i++)
+			ref |= (p[i] & mask[i]) != value[i];
+		memcpy(ref_buf, p, sizeof(ref_buf));
+		for (size_t i = offt; i < offt + len; i++)
+			ref_buf[i] = (ref_buf[i] & ~mask[i]) | value[i];
+
+		for (unsigned int j = 0; j < impl_cnt; j++) {
+			if (!impls[j].supported)
+				continue;
+			bool differ = impls[j].differ(&p[offt], &value[offt], &mask[offt], len);
+			NB_die_if(differ != ref,
+				"%s: len %zu differ %d != reference %d",
+				impls[j].name, len, differ, ref);
+
+			memcpy(buf, p, sizeof(buf));
+			impls[j].merge(&buf[offt], &value[offt], &mask[offt], len);
+			NB_die_if(memcmp(buf, ref_buf, sizeof(buf)),
+				"%s: len %zu merge != reference", impls[j].name, len);
+		}
+	}
+
+die:
+	return err_cnt;
+}
+
+
+int main()
+{
+	int err_cnt = 0;
+
+	struct impl impls[] = {
+		{ "scalar", bitmask_differ_scalar, bitmask_merge_scalar, true },
+		{ "best", bitmask_differ, bitmask_merge, true },
+#if defined(__x86_64__) || defined(__i386__)
+		{ "sse2", bitmask_differ_sse2, bitmask_merge_sse2,
+			__builtin_cpu_supports("sse2") },
+		{ "avx2", bitmask_differ_avx2, bitmask_merge_avx2,
+			__builtin_cpu_supports("avx2") },
+#endif
+	};
+
+	srandom(1);
+	for (size_t len = 0; len <= BUF_LEN; len++) {
+		NB_die_if(
+			check(impls, NLC_ARRAY_LEN(impls), len)
+			, "");
+	}
+
+die:
+	return err_cnt;
+}
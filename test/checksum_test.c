@@ -0,0 +1,173 @@
+/*	checksum_test.c
+ * Test that every ones-complement sum implementation gives exactly
+ * the same checksum as the scalar reference;
+ * and that checksum_update() gives the same checksums as checksum(),
+ * also on frames received with an incomplete (CHECKSUM_PARTIAL) checksum.
+ * (c) 2019 Sirio Balmelli
+ */
+
+#include <checksums.h>
+#include <nonlibc.h>
+#include <ndebug.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef uint32_t (*ones_sum_f)(const void *blocks, size_t byte_count, uint32_t sum);
+
+struct impl {
+	const char	*name;
+	ones_sum_f	sum;
+	bool		supported;
+};
+
+
+/* larger than any frame, to exercise lane flushing in vector implementations */
+#define BUF_LEN (1 << 21)
+
+
+/*	check()
+ * Compare all 'impls' against the reference on 'len' bytes at 'buf',
+ * both in one go and chained in two parts split at 'split'.
+ * The reference is ones_sum_scalar(), which can only be trusted up to
+ * 64KiB (its 32-bit sum may wrap beyond that): past it, use ones_sum_u64()
+ * which has itself been checked against ones_sum_scalar() below that size.
+ */
+static int check(struct impl *impls, size_t impl_cnt,
+		const uint8_t *buf, size_t len, size_t split)
+{
+	int err_cnt = 0;
+	ones_sum_f ref_sum = len <= UINT16_MAX ? ones_sum_scalar : ones_sum_u64;
+	uint16_t ref = ones_final(ref_sum(buf, len, 0));
+	uint16_t ref_chain = ones_final(ref_sum(buf + split, len - split,
+					ref_sum(buf, split, 0)));
+
+	for (unsigned int i = 0; i < impl_cnt; i++) {
+		if (!impls[i].supported)
+			continue;
+		uint16_t res = ones_final(impls[i].sum(buf, len, 0));
+		NB_die_if(res != ref,
+			"%s: len %zu checksum 0x%04x != reference 0x%04x",
+			impls[i].name, len, res, ref);
+		res = ones_final(impls[i].sum(buf + split, len - split,
+					impls[i].sum(buf, split, 0)));
+		NB_die_if(res != ref_chain,
+			"%s: len %zu split %zu checksum 0x%04x != reference 0x%04x",
+			impls[i].name, len, split, res, ref_chain);
+	}
+die:
+	return err_cnt;
+}
+
+
+#define FRAME_LEN 58
+
+/* Ethernet, IPv4, UDP: checksums left zero */
+static const uint8_t frame_template[FRAME_LEN] = {
+	0x02, 0x00, 0x00, 0x00, 0x00, 0xaa, 0x02, 0x00,
+	0x00, 0x00, 0x00, 0xbb, 0x08, 0x00, 0x45, 0x00,
+	0x00, 0x2c, 0x12, 0x34, 0x00, 0x00, 0x40, 0x11,
+	0x00, 0x00, 0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00,
+	0x00, 0x02, 0x30, 0x39, 0x00, 0x50, 0x00, 0x18,
+	0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05,
+	0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d,
+	0x0e, 0x0f
+};
+#define FRAME_UDP_CHECK 40
+
+
+/*	check_update()
+ * Write 'n' Bytes of 'val' at 'offt' into a checksummed frame, journaled
+ * as op_write() does, and compare checksum_update() against checksum().
+ * If 'partial', the frame is first given the L4 checksum a kernel hands
+ * over with CHECKSUM_PARTIAL: only the pseudo-header sum, not complemented.
+ */
+static int check_update(size_t offt, const uint8_t *val, size_t n, bool partial)
+{
+	int err_cnt = 0;
+	uint8_t frame[FRAME_LEN], ref[FRAME_LEN];
+	memcpy(frame, frame_template, FRAME_LEN);
+	NB_die_if(checksum(frame, FRAME_LEN), "");
+
+	if (partial) {
+		const uint8_t pseudo[12] = {
+			0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+			0x00, 0x11, 0x00, 0x18
+		};
+		uint16_t check = ~ones_final(ones_sum_scalar(pseudo, sizeof(pseudo), 0));
+		memcpy(&frame[FRAME_UDP_CHECK], &check, sizeof(check));
+	}
+
+	checksum_log_reset();
+	size_t first = checksum_log_old(frame, FRAME_LEN, offt, n);
+	memcpy(&frame[offt], val, n);
+	checksum_log_new(frame, FRAME_LEN, first);
+
+	memcpy(ref, frame, FRAME_LEN);
+	NB_die_if(checksum(ref, FRAME_LEN), "");
+
+	checksum_log_rx(partial);
+	NB_die_if(checksum_update(frame, FRAME_LEN), "");
+	NB_die_if(memcmp(frame, ref, FRAME_LEN),
+		"offt %zu len %zu partial %d: checksums 0x%02x%02x 0x%02x%02x != reference 0x%02x%02x 0x%02x%02x",
+		offt, n, partial, frame[24], frame[25], frame[40], frame[41],
+		ref[24], ref[25], ref[40], ref[41]);
+die:
+	checksum_log_rx(false);
+	return err_cnt;
+}
+
+
+int main()
+{
+	int err_cnt = 0;
+	uint8_t *buf = NULL;
+
+	struct impl impls[] = {
+		{ "u64", ones_sum_u64, true },
+#if defined(__x86_64__) || defined(__i386__)
+		{ "sse2", ones_sum_sse2, __builtin_cpu_supports("sse2") },
+		{ "avx2", ones_sum_avx2, __builtin_cpu_supports("avx2") },
+#endif
+	};
+
+	/* extra byte so that every length can also be tested misaligned */
+	NB_die_if(!(
+		buf = malloc(BUF_LEN + 1)
+		), "fail alloc size %d", BUF_LEN + 1);
+
+	/* all-zero sums to zero, all-ones is the worst case for carries */
+	const uint8_t fills[] = { 0x00, 0xff };
+	for (unsigned int f = 0; f < NLC_ARRAY_LEN(fills); f++) {
+		memset(buf, fills[f], BUF_LEN + 1);
+		for (size_t len = 0; len < 300; len++)
+			NB_die_if(check(impls, NLC_ARRAY_LEN(impls), buf, len, len / 2), "");
+		NB_die_if(check(impls, NLC_ARRAY_LEN(impls), buf, UINT16_MAX, 9000), "");
+		NB_die_if(check(impls, NLC_ARRAY_LEN(impls), buf, BUF_LEN, 9000), "");
+	}
+
+	/* random data, every length up to a jumbo frame, aligned and not */
+	srandom(1);
+	for (size_t i = 0; i < BUF_LEN + 1; i++)
+		buf[i] = random();
+	for (size_t len = 0; len <= 9018; len++) {
+		size_t split = random() % (len + 1);
+		NB_die_if(check(impls, NLC_ARRAY_LEN(impls), buf, len, split), "");
+		NB_die_if(check(impls, NLC_ARRAY_LEN(impls), buf + 1, len, split), "");
+	}
+	NB_die_if(check(impls, NLC_ARRAY_LEN(impls), buf + 1, UINT16_MAX, 1), "");
+	NB_die_if(check(impls, NLC_ARRAY_LEN(impls), buf, BUF_LEN, 1), "");
+	NB_die_if(check(impls, NLC_ARRAY_LEN(impls), buf + 1, BUF_LEN, BUF_LEN - 3), "");
+
+	/* ip dst, udp dport, payload; incremental and not */
+	const uint8_t val[] = { 0x0a, 0x00, 0x00, 0x09 };
+	for (unsigned int partial = 0; partial < 2; partial++) {
+		NB_die_if(check_update(30, val, 4, partial), "");
+		NB_die_if(check_update(36, val + 2, 2, partial), "");
+		NB_die_if(check_update(45, val, 3, partial), "");
+	}
+
+die:
+	free(buf);
+	return err_cnt;
+}
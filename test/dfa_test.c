@@ -0,0 +1,120 @@
+/*	dfa_test.c
+ * Test that compiled regular expressions match exactly what the POSIX
+ * regex library matches, including expressions too large for a full DFA,
+ * and that invalid expressions are rejected.
+ * (c) 2019 Sirio Balmelli
+ */
+
+#include <dfa.h>
+#include <nonlibc.h>
+#include <ndebug.h>
+#include <stdlib.h>
+#include <string.h>
+#include <regex.h>
+
+
+#define BUF_LEN 512
+
+/* valid for both dfa_new() and regcomp(REG_EXTENDED) */
+static const char *patterns[] = {
+	"a",
+	"abc",
+	"a.c",
+	"^ab",
+	"cd$",
+	"^a.*d$",
+	"a|b|cc",
+	"(ab|ba)+c",
+	"a[bc]*d",
+	"[^ab]{3}",
+	"a{2,}b",
+	"(a|b){2,4}c?d",
+	"x?",
+	"^$",
+	"(a*)(b|c)d+",
+	"ab{0}c",
+	"[a-c]{5}d",
+	/* more DFA states than DFA_STATES_MAX: spills */
+	"(a|b)*a(a|b){13}",
+	"^(a|b|c)*a(a|b|c){12}$",
+};
+
+static const char *invalid[] = {
+	"*a",
+	"a**",
+	"(ab",
+	"ab)",
+	"[ab",
+	"a{3,2}",
+	"a^b",
+	"a$b",
+	"\\q",
+	"\\x4",
+	"[z-a]",
+	"a{1000}",
+};
+
+
+/*	check()
+ * Match random windows of random text over "abcd" against 'pattern'.
+ */
+static int check(const char *pattern)
+{
+	int err_cnt = 0;
+	struct dfa *dfa = NULL;
+	regex_t re;
+	bool re_ok = false;
+	char buf[BUF_LEN + 1];
+
+	NB_die_if(!(
+		dfa = dfa_new(pattern)
+		), "");
+	NB_die_if(regcomp(&re, pattern, REG_EXTENDED | REG_NOSUB),
+		"regcomp '%s'", pattern);
+	re_ok = true;
+
+	for (unsigned int round = 0; round < 2000; round++) {
+		size_t len = random() % (round < 1000 ? 16 : BUF_LEN);
+		unsigned int alpha = 2 + random() % 3;
+		for (size_t i = 0; i < len; i++)
+			buf[i] = 'a' + random() % alpha;
+		buf[len] = '\0';
+
+		bool ref = !regexec(&re, buf, 0, NULL, 0);
+		NB_die_if(dfa_match(dfa, (const uint8_t *)buf, len) != ref,
+			"'%s' on '%s': match != reference %d", pattern, buf, ref);
+	}
+
+die:
+	if (re_ok)
+		regfree(&re);
+	dfa_free(dfa);
+	return err_cnt;
+}
+
+
+int main()
+{
+	int err_cnt = 0;
+
+	srandom(1);
+	for (unsigned int i = 0; i < NLC_ARRAY_LEN(patterns); i++)
+		NB_die_if(check(patterns[i]), "");
+
+	/* escapes and classes POSIX ERE doesn't share */
+	struct dfa *dfa = dfa_new("\\x00\\d+[\\x01-\\x03\\]]\\.$");
+	NB_die_if(!dfa, "");
+	NB_die_if(!dfa_match(dfa, (const uint8_t *)"\x00" "42\x02.", 5), "");
+	NB_die_if(!dfa_match(dfa, (const uint8_t *)"z\x00" "7].", 5), "");
+	NB_die_if(dfa_match(dfa, (const uint8_t *)"\x00" "42\x04.", 5), "");
+	NB_die_if(dfa_match(dfa, (const uint8_t *)"\x00" "42\x02.z", 6), "");
+	dfa_free(dfa);
+
+	for (unsigned int i = 0; i < NLC_ARRAY_LEN(invalid); i++) {
+		dfa = dfa_new(invalid[i]);
+		NB_die_if(dfa, "invalid regex '%s' accepted", invalid[i]);
+	}
+
+die:
+	return err_cnt;
+}
@@ -48,15 +48,21 @@ struct field_test tests[] = {
 	},
 	/* show maximum positive values for all fields; prove hex is parsed correctly */
 	{
-		.yaml = "{ field: max positive, offt: 0x7fffffff, len: 0xffff, mask: 0xff}",
+		.yaml = "{ field: max positive, offt: 0x1ffffff, len: 0xffff, mask: 0xff}",
 		.name = "max positive",
-		.set = { .offt = INT32_MAX, .len = UINT16_MAX, .mask = UINT8_MAX }
+		.set = { .offt = FIELD_OFFT_MAX, .len = UINT16_MAX, .mask = UINT8_MAX }
 	},
 	/* show minimum non-zero values for all fields */
 	{
-		.yaml = "{ field: max negative, offt: -2147483646, len: 1, mask: 1}",
+		.yaml = "{ field: max negative, offt: -33554432, len: 1, mask: 1}",
 		.name = "max negative",
-		.set = { .offt = -2147483646, .len = 1, .mask = 1 }
+		.set = { .offt = FIELD_OFFT_MIN, .len = 1, .mask = 1 }
+	},
+	/* TCP/UDP destination port, wherever the transport header starts */
+	{
+		.yaml = "{ field: dport, anchor: l4, offt: 2, len: 2 }",
+		.name = "dport",
+		.set = { .offt = 2, .anchor = FIELD_ANCHOR_L4, .len = 2, .mask = 0xff }
 	}
 };
 
@@ -115,6 +121,9 @@ int test_field_parse(struct field_test *tst)
 		"naming broken '%s' != '%s'", fld->name, tst->name);
 	NB_die_if(fld->set.offt != tst->set.offt,
 		"offt mismatch: %d != %d", fld->set.offt, tst->set.offt);
+	NB_die_if(fld->set.anchor != tst->set.anchor,
+		"anchor mismatch: %s != %s",
+		field_anchor_prn(fld->set.anchor), field_anchor_prn(tst->set.anchor));
 	NB_die_if(fld->set.len != tst->set.len,
 		"len mismatch: %d != %d", fld->set.len, tst->set.len);
 	NB_die_if(fld->set.mask != tst->set.mask,
@@ -25,10 +25,40 @@ xdpk:\n\
   - field: ip dst\n\
     offt: 30\n\
     len: 4\n\
+  - field: ip addrs\n\
+    offt: 26\n\
+    len: 8\n\
   - field: dst mac multi\n\
     offt: 0\n\
     len: 1\n\
     mask: 0x10\n\
+  - field: payload\n\
+    offt: 12\n\
+    len: 1500\n\
+  - field: l3 ttl\n\
+    anchor: l3\n\
+    offt: 8\n\
+    len: 1\n\
+  - field: l4 dport\n\
+    anchor: l4\n\
+    offt: 2\n\
+    len: 2\n\
+  - field: vlan ip hlen\n\
+    offt: 18\n\
+    len: 1\n\
+    mask: 0x0f\n\
+  - field: vlan l4 dport\n\
+    offt: 2\n\
+    len: 2\n\
+    offt_from: {field: vlan ip hlen, mult: 4, add: 18}\n\
+  - field: ip src net\n\
+    offt: 26\n\
+    len: 4\n\
+    bitmask: 255.255.240.0\n\
+  - field: mac oui\n\
+    offt: 0\n\
+    len: 6\n\
+    bitmask: ff:ff:ff:00:00:00\n\
 ";
 
 
@@ -146,6 +176,279 @@ xdpk:\n\
 		.pkt_in = (uint8_t []){0x0a},
 		.pkt_len = 1,
 		.pkt_ex = (uint8_t []){0x1a}
+	},
+
+	{	/* 4-Byte kernels: match value->field, write field->field */
+		.yaml = "\
+xdpk:\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: \"ip src\"}\n\
+        src: {value: \"10.0.0.1\"}\n\
+    write:\n\
+      - dst: {field: \"ip dst\"}\n\
+        src: {field: \"ip src\"}\n\
+",
+		.pkt_in = (uint8_t []){
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x0a, 0x00, 0x00, 0x01, 0xc0, 0xa8,
+			0x01, 0x01},
+		.pkt_len = 34,
+		.pkt_ex = (const uint8_t []){
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00,
+			0x00, 0x01}
+	},
+
+	{	/* swap ip source and dest through a scratch register */
+		.yaml = "\
+xdpk:\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: \"ip src\"}\n\
+        src: {value: \"10.0.0.1\"}\n\
+    write:\n\
+      - dst: {scratch: \"isrc\"}\n\
+        src: {field: \"ip src\"}\n\
+      - dst: {field: \"ip src\"}\n\
+        src: {field: \"ip dst\"}\n\
+      - dst: {field: \"ip dst\"}\n\
+        src: {scratch: \"isrc\"}\n\
+",
+		.pkt_in = (uint8_t []){
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x0a, 0x00, 0x00, 0x01, 0xc0, 0xa8,
+			0x01, 0x01},
+		.pkt_len = 34,
+		.pkt_ex = (const uint8_t []){
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01, 0x0a, 0x00,
+			0x00, 0x01}
+	},
+
+	{	/* swap mac source and dest in one op */
+		.yaml = "\
+xdpk:\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: \"mac dst\"}\n\
+        src: {value: \"0a:00:27:00:01:02\"}\n\
+    write:\n\
+      - swap: [\"mac src\", \"mac dst\"]\n\
+",
+		.pkt_in = (uint8_t []){0x0a, 0x00, 0x27, 0x00, 0x01, 0x02,
+					0x01, 0x02, 0x03, 0x04, 0x05, 0x06},
+		.pkt_len = 12,
+		.pkt_ex = (uint8_t []){0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+					0x0a, 0x00, 0x27, 0x00, 0x01, 0x02}
+	},
+
+	{	/* match ip source against a prefix table */
+		.yaml = "\
+xdpk:\n\
+  - table: nets\n\
+    len: 4\n\
+    prefixes: [10.0.0.0/8, 192.168.1.0/28]\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: \"ip src\"}\n\
+        src: {table: \"nets\"}\n\
+    write:\n\
+      - dst: {field: \"ttl\"}\n\
+        src: {value: \"1\"}\n\
+",
+		.pkt_in = (uint8_t []){
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00,
+			0x00, 0x00, 0xc0, 0xa8, 0x01, 0x0f, 0x0a, 0x00,
+			0x00, 0x01},
+		.pkt_len = 34,
+		.pkt_ex = (uint8_t []){
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
+			0x00, 0x00, 0xc0, 0xa8, 0x01, 0x0f, 0x0a, 0x00,
+			0x00, 0x01}
+	},
+
+	{	/* match mac source against a set of values */
+		.yaml = "\
+xdpk:\n\
+  - set: macs\n\
+    len: 6\n\
+    values: [\"0a:00:27:00:00:01\", \"01:02:03:04:05:06\"]\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: \"mac src\"}\n\
+        src: {set: \"macs\"}\n\
+    write:\n\
+      - dst: {field: \"mac dst\"}\n\
+        src: {value: \"ff:ff:ff:ff:ff:ff\"}\n\
+",
+		.pkt_in = (uint8_t []){0x0a, 0x00, 0x27, 0x00, 0x01, 0x02,
+					0x01, 0x02, 0x03, 0x04, 0x05, 0x06},
+		.pkt_len = 12,
+		.pkt_ex = (uint8_t []){0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+					0x01, 0x02, 0x03, 0x04, 0x05, 0x06}
+	},
+
+	{	/* match ttl and ip source against ranges */
+		.yaml = "\
+xdpk:\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: \"ttl\"}\n\
+        src: {between: [2, 64]}\n\
+      - dst: {field: \"ip src\"}\n\
+        src: {ge: 192.168.1.0}\n\
+    write:\n\
+      - dst: {field: \"ttl\"}\n\
+        src: {value: \"1\"}\n\
+",
+		.pkt_in = (uint8_t []){
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00,
+			0x00, 0x00, 0xc0, 0xa8, 0x01, 0x0f, 0x0a, 0x00,
+			0x00, 0x01},
+		.pkt_len = 34,
+		.pkt_ex = (uint8_t []){
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
+			0x00, 0x00, 0xc0, 0xa8, 0x01, 0x0f, 0x0a, 0x00,
+			0x00, 0x01}
+	},
+
+	{	/* 8 Byte bounds above INT64_MAX, as op_emit_range() prints them */
+		.yaml = "\
+xdpk:\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: \"ip addrs\"}\n\
+        src: {between: [13835058055282163712, 18446744073709551614]}\n\
+    write:\n\
+      - dst: {field: \"ttl\"}\n\
+        src: {value: \"1\"}\n\
+",
+		.pkt_in = (uint8_t []){
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00,
+			0x00, 0x00, 0xc0, 0xa8, 0x01, 0x0f, 0x0a, 0x00,
+			0x00, 0x01},
+		.pkt_len = 34,
+		.pkt_ex = (uint8_t []){
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
+			0x00, 0x00, 0xc0, 0xa8, 0x01, 0x0f, 0x0a, 0x00,
+			0x00, 0x01}
+	},
+
+	{	/* search a payload window cut short by the end of packet */
+		.yaml = "\
+xdpk:\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: \"payload\"}\n\
+        src: {contains: [\"example\", \"host\"]}\n\
+    write:\n\
+      - dst: {field: \"mac dst\"}\n\
+        src: {value: \"ff:ff:ff:ff:ff:ff\"}\n\
+",
+		.pkt_in = (uint8_t []){0x0a, 0x00, 0x27, 0x00, 0x01, 0x02,
+					0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+					'x', 'h', 'o', 's', 't'},
+		.pkt_len = 17,
+		.pkt_ex = (uint8_t []){0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+					0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+					'x', 'h', 'o', 's', 't'}
+	},
+
+	{	/* match a regex against a payload window */
+		.yaml = "\
+xdpk:\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: \"payload\"}\n\
+        src: {regex: \"^x(h|g)[a-z]+t$\"}\n\
+    write:\n\
+      - dst: {field: \"mac dst\"}\n\
+        src: {value: \"ff:ff:ff:ff:ff:ff\"}\n\
+",
+		.pkt_in = (uint8_t []){0x0a, 0x00, 0x27, 0x00, 0x01, 0x02,
+					0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+					'x', 'h', 'o', 's', 't'},
+		.pkt_len = 17,
+		.pkt_ex = (uint8_t []){0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+					0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+					'x', 'h', 'o', 's', 't'}
+	},
+
+	{	/* anchored and computed fields behind a VLAN tag and IPv4 options */
+		.yaml = "\
+xdpk:\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: \"l4 dport\"}\n\
+        src: {value: \"80\"}\n\
+      - dst: {field: \"vlan l4 dport\"}\n\
+        src: {value: \"80\"}\n\
+    write:\n\
+      - dst: {field: \"l3 ttl\"}\n\
+        src: {value: \"1\"}\n\
+",
+		.pkt_in = (uint8_t []){
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x81, 0x00, 0x00, 0x05,
+			0x08, 0x00, 0x46, 0x00, 0x00, 0x2c, 0x00, 0x00,
+			0x00, 0x00, 0x40, 0x06, 0x00, 0x00, 0x0a, 0x00,
+			0x00, 0x01, 0x0a, 0x00, 0x00, 0x02, 0x01, 0x01,
+			0x01, 0x00, 0x30, 0x39, 0x00, 0x50},
+		.pkt_len = 46,
+		.pkt_ex = (uint8_t []){
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x81, 0x00, 0x00, 0x05,
+			0x08, 0x00, 0x46, 0x00, 0x00, 0x2c, 0x00, 0x00,
+			0x00, 0x00, 0x01, 0x06, 0x00, 0x00, 0x0a, 0x00,
+			0x00, 0x01, 0x0a, 0x00, 0x00, 0x02, 0x01, 0x01,
+			0x01, 0x00, 0x30, 0x39, 0x00, 0x50}
+	},
+
+	{	/* match and write fields under a bitmask */
+		.yaml = "\
+xdpk:\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: \"ip src net\"}\n\
+        src: {value: 192.168.0.0}\n\
+    write:\n\
+      - dst: {field: \"mac oui\"}\n\
+        src: {value: \"0a:0b:0c:ff:ff:ff\"}\n\
+",
+		.pkt_in = (uint8_t []){
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00,
+			0x00, 0x00, 0xc0, 0xa8, 0x01, 0x0f, 0x0a, 0x00,
+			0x00, 0x01},
+		.pkt_len = 34,
+		.pkt_ex = (uint8_t []){
+			0x0a, 0x0b, 0x0c, 0x00, 0x00, 0x07, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00,
+			0x00, 0x00, 0xc0, 0xa8, 0x01, 0x0f, 0x0a, 0x00,
+			0x00, 0x01}
 	}
 };
 
@@ -156,6 +459,7 @@ int main()
 {
 	int err_cnt = 0;
 	struct rule *rl = NULL;
+	uint8_t scratch[MEMREF_SCRATCH_LEN];
 
 	/* parse all fields only once */
 	NB_die_if(
@@ -173,18 +477,38 @@ int main()
 		rl = rule_get("rule");
 		NB_die_if(!rl, "");
 
+		/* as process_exec() does before matching */
+		field_anchors_parse(tc->pkt_in, tc->pkt_len);
+
+		/* the bounds guard of rout_set_match() and rout_set_exec() */
+		size_t match_plen = 0, write_plen = 0;
+		bool match_checked = false, write_checked = false;
+		JL_LOOP(&rl->match_JQ,
+			op_bound(&((struct op *)val)->set, &match_plen, &match_checked);
+		);
+		JL_LOOP(&rl->write_JQ,
+			op_bound(&((struct op *)val)->set, &write_plen, &write_checked);
+		);
+		NB_die_if(tc->pkt_len < match_plen || tc->pkt_len < write_plen,
+			"bounds guard %zu/%zu rejects packet of %zu",
+			match_plen, write_plen, tc->pkt_len);
+
 		/* all 'match' rules expected to test positive */
 		JL_LOOP(&rl->match_JQ,
 			struct op *op = val;
 			NB_die_if(
 				op_match(&op->set, tc->pkt_in, tc->pkt_len)
 				, "");
+			NB_die_if(!match_checked &&
+				op_match_unchecked(&op->set, tc->pkt_in, tc->pkt_len)
+				, "");
 		);
 		/* all 'write' rules expected to succeed */
 		JL_LOOP(&rl->write_JQ,
 			struct op *op = val;
-			NB_die_if(
-				op_write(&op->set, tc->pkt_in, tc->pkt_len)
+			NB_die_if(write_checked ?
+				op_write(&op->set, tc->pkt_in, tc->pkt_len, scratch)
+				: op_write_unchecked(&op->set, tc->pkt_in, tc->pkt_len, scratch)
 				, "");
 		);
 
@@ -0,0 +1,333 @@
+/*	program_test.c
+ * Test that compiled rules drop and merge what they should, and match and
+ * write exactly what running their ops one by one does.
+ * (c) 2019 Sirio Balmelli
+ */
+
+#include <rule.h>
+#include <program.h>
+#include <checksums.h>
+#include <parse2.h>
+
+/* expose internals of parse2.h just for this test */
+extern int parse(const unsigned char *buf, size_t buf_len, int outfd);
+
+
+const char *fields = "\
+xdpk:\n\
+  - field: any\n\
+  - field: mac dst\n\
+    offt: 0\n\
+    len: 6\n\
+  - field: mac src\n\
+    offt: 6\n\
+    len: 6\n\
+  - field: ethertype\n\
+    offt: 12\n\
+    len: 2\n\
+  - field: ip version\n\
+    offt: 14\n\
+    len: 1\n\
+  - field: ip dscp\n\
+    offt: 15\n\
+    len: 1\n\
+    mask: 0xfc\n\
+  - field: ip len\n\
+    offt: 16\n\
+    len: 2\n\
+  - field: ttl\n\
+    offt: 22\n\
+    len: 1\n\
+  - field: ip src\n\
+    offt: 26\n\
+    len: 4\n\
+  - field: ip dst\n\
+    offt: 30\n\
+    len: 4\n\
+  - field: l4 dport\n\
+    anchor: l4\n\
+    offt: 2\n\
+    len: 2\n\
+  - field: ip src net\n\
+    offt: 26\n\
+    len: 4\n\
+    bitmask: 255.255.255.248\n\
+  - field: ip dst net\n\
+    offt: 30\n\
+    len: 4\n\
+    bitmask: 255.255.0.248\n\
+";
+
+
+struct test {
+	const char	*yaml;
+	uint32_t	match_cnt; /* instructions left after passes */
+	uint32_t	write_cnt;
+	const uint8_t	*codes;	/* if given: code of each instruction */
+};
+
+struct test tests[] = {
+	{	/* nop, self-compare; adjacent matches; dead write, scratch folding,
+		 * adjacent writes
+		 */
+		.yaml = "\
+xdpk:\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: any}\n\
+        src: {field: any}\n\
+      - dst: {field: mac src}\n\
+        src: {value: 02:00:00:00:00:bb}\n\
+      - dst: {field: ip src}\n\
+        src: {field: ip src}\n\
+      - dst: {field: ethertype}\n\
+        src: {value: 0x0800}\n\
+      - dst: {field: mac dst}\n\
+        src: {value: 02:00:00:00:00:aa}\n\
+    write:\n\
+      - dst: {field: ttl}\n\
+        src: {value: 1}\n\
+      - dst: {field: ip dst, scratch: addr}\n\
+        src: {value: 10.0.0.1}\n\
+      - dst: {field: ttl}\n\
+        src: {value: 2}\n\
+      - dst: {field: ip src}\n\
+        src: {scratch: addr}\n\
+      - dst: {field: ip dst}\n\
+        src: {value: 10.0.0.2}\n\
+",
+		.match_cnt = 1,
+		.write_cnt = 2
+	},
+
+	{	/* anchored fields and lookups are left to their ops */
+		.yaml = "\
+xdpk:\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: l4 dport}\n\
+        src: {value: 80}\n\
+      - dst: {field: ttl}\n\
+        src: {between: [1, 64]}\n\
+    write:\n\
+      - swap: [mac src, mac dst]\n\
+      - dst: {field: ip dscp}\n\
+        src: {value: 0xb9}\n\
+      - dst: {field: l4 dport}\n\
+        src: {value: 8080}\n\
+",
+		.match_cnt = 2,
+		.write_cnt = 3
+	},
+
+	{	/* a masked field merges after an unmasked one, not before;
+		 * a write read before being overwritten stays
+		 */
+		.yaml = "\
+xdpk:\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: ip dscp}\n\
+        src: {value: 0x03}\n\
+      - dst: {field: ip version}\n\
+        src: {value: 0x45}\n\
+      - dst: {field: ip len}\n\
+        src: {value: 0x0032}\n\
+    write:\n\
+      - dst: {field: ttl}\n\
+        src: {value: 5}\n\
+      - dst: {field: ip dscp}\n\
+        src: {field: ttl}\n\
+      - dst: {field: ttl}\n\
+        src: {value: 6}\n\
+",
+		.match_cnt = 2,
+		.write_cnt = 3
+	},
+
+	{	/* a scratch register rewritten between reads */
+		.yaml = "\
+xdpk:\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: any}\n\
+        src: {field: any}\n\
+    write:\n\
+      - dst: {field: ip dst, scratch: addr}\n\
+        src: {value: 10.0.0.1}\n\
+      - dst: {field: ip src}\n\
+        src: {scratch: addr}\n\
+      - dst: {field: ip dst, scratch: addr}\n\
+        src: {value: 10.0.0.2}\n\
+      - dst: {field: ip dst}\n\
+        src: {scratch: addr}\n\
+",
+		.match_cnt = 0,
+		.write_cnt = 1
+	},
+
+	{	/* A bitmask over the last Byte only is a plain mask: inlined.
+		 * Any other is run by its op, the mask following the value.
+		 */
+		.yaml = "\
+xdpk:\n\
+  - rule: rule\n\
+    match:\n\
+      - dst: {field: ip dst net}\n\
+        src: {value: 10.0.77.7}\n\
+      - dst: {field: ip src net}\n\
+        src: {value: 10.0.0.6}\n\
+    write:\n\
+      - dst: {field: ip dst net}\n\
+        src: {value: 192.168.77.255}\n\
+      - dst: {field: ip src net}\n\
+        src: {value: 172.16.5.9}\n\
+",
+		.match_cnt = 2,
+		.write_cnt = 2,
+		.codes = (const uint8_t[]){ PROG_OP, PROG_MATCH_4, PROG_OP, PROG_WRITE_4 }
+	}
+};
+
+
+#define PKT_LEN 64
+
+/* matches all tests: IPv4/UDP to port 80 */
+static const uint8_t template[PKT_LEN] = {
+	0x02, 0x00, 0x00, 0x00, 0x00, 0xaa, 0x02, 0x00,
+	0x00, 0x00, 0x00, 0xbb, 0x08, 0x00, 0x45, 0x03,
+	0x00, 0x32, 0x00, 0x00, 0x00, 0x00, 0x40, 0x11,
+	0x00, 0x00, 0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00,
+	0x00, 0x02, 0x30, 0x39, 0x00, 0x50, 0x00, 0x1e,
+};
+
+
+/*	ref_match()
+ * Run the match ops of 'rl' one by one.
+ */
+static bool ref_match(struct rule *rl, const void *pkt, size_t plen)
+{
+	JL_LOOP(&rl->match_JQ,
+		if (op_match(&((struct op *)val)->set, pkt, plen))
+			return false;
+	);
+	return true;
+}
+
+/*	ref_exec()
+ */
+static bool ref_exec(struct rule *rl, void *pkt, size_t plen)
+{
+	uint8_t scratch[MEMREF_SCRATCH_LEN];
+	JL_LOOP(&rl->write_JQ,
+		if (op_write(&((struct op *)val)->set, pkt, plen, scratch))
+			return false;
+	);
+	return true;
+}
+
+
+/*	check_codes()
+ * Compare the code of each instruction in 'prog' against 'codes'.
+ */
+static int check_codes(struct program *prog, const uint8_t *codes)
+{
+	int err_cnt = 0;
+	const uint8_t *pc = prog->code;
+	for (uint32_t i = 0; i < prog->match_cnt + prog->write_cnt; i++) {
+		const struct prog_insn *in = (const void *)pc;
+		NB_die_if(in->code != codes[i],
+			"instruction %u: code %u != expected %u", i, in->code, codes[i]);
+		if (in->code == PROG_OP || in->code == PROG_OP_CHECKED)
+			pc += in->offt;
+		else
+			pc += sizeof(*in) + PROG_ALIGN(in->len);
+	}
+die:
+	return err_cnt;
+}
+
+
+/*	check()
+ * Compare 'prog' against the ops of 'rl' on the template packet,
+ * randomly altered and cut short.
+ */
+static int check(struct rule *rl, struct program *prog)
+{
+	int err_cnt = 0;
+	uint8_t pkt[PKT_LEN], ref[PKT_LEN];
+
+	for (unsigned int round = 0; round < 5000; round++) {
+		memcpy(pkt, template, PKT_LEN);
+		for (unsigned int i = random() % 3; i > 0; i--)
+			pkt[random() % 40] ^= 1 << (random() % 8);
+		size_t plen = random() % 4 ? PKT_LEN : random() % (PKT_LEN + 1);
+
+		/* as process_exec() does */
+		field_anchors_parse(pkt, plen);
+		bool match = program_match(prog, pkt, plen);
+		NB_die_if(match != ref_match(rl, pkt, plen),
+			"round %u plen %zu: match %d != reference", round, plen, match);
+		if (!match)
+			continue;
+
+		memcpy(ref, pkt, PKT_LEN);
+		checksum_log_reset();
+		bool done = program_exec(prog, pkt, plen);
+		checksum_log_reset();
+		NB_die_if(done != ref_exec(rl, ref, plen),
+			"round %u plen %zu: exec %d != reference", round, plen, done);
+		NB_die_if(done && memcmp(pkt, ref, PKT_LEN),
+			"round %u plen %zu: packet != reference", round, plen);
+	}
+
+die:
+	return err_cnt;
+}
+
+
+/*	main()
+ */
+int main()
+{
+	int err_cnt = 0;
+	struct rule *rl = NULL;
+	struct program *prog = NULL;
+
+	NB_die_if(
+		parse((const unsigned char *)fields, strlen(fields), fileno(stdout))
+		, "failed to parse YAML:\n%s", fields);
+
+	srandom(1);
+	for (unsigned int i = 0; i < NLC_ARRAY_LEN(tests); i++) {
+		struct test *tc = &tests[i];
+		NB_die_if(
+			parse((const unsigned char *)tc->yaml, strlen(tc->yaml), fileno(stdout))
+			, "failed to parse YAML:\n%s", tc->yaml);
+		NB_die_if(!(
+			rl = rule_get("rule")
+			), "");
+		NB_die_if(!(
+			prog = program_new(rl)
+			), "");
+
+		NB_die_if(prog->match_cnt != tc->match_cnt || prog->write_cnt != tc->write_cnt,
+			"test %u: %u match %u write instructions, expected %u %u", i,
+			prog->match_cnt, prog->write_cnt, tc->match_cnt, tc->write_cnt);
+		NB_die_if(tc->codes && check_codes(prog, tc->codes), "test %u", i);
+		NB_die_if(check(rl, prog), "test %u", i);
+
+		program_free(prog);
+		prog = NULL;
+		rule_release(rl);
+		rule_free(rl);
+		rl = NULL;
+	}
+
+die:
+	program_free(prog);
+	rule_release(rl);
+	rule_free(rl);
+	field_free_all();
+	return err_cnt;
+}
@@ -0,0 +1,124 @@
+/*	search_test.c
+ * Test that searches find exactly what a naive scan for each pattern finds,
+ * and that every prefilter implementation agrees with the scalar one.
+ * (c) 2019 Sirio Balmelli
+ */
+
+#include <search.h>
+#include <nonlibc.h>
+#include <ndebug.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef size_t (*search_skip_f)(const struct search *search, const uint8_t *p, size_t len);
+
+struct impl {
+	const char	*name;
+	search_skip_f	skip;
+	bool		supported;
+};
+
+
+#define PATTERN_MAX	16
+#define BUF_LEN		2048
+
+
+/*	naive_match()
+ */
+static bool naive_match(char pats[][PATTERN_MAX + 1], size_t pat_cnt,
+			const uint8_t *p, size_t len)
+{
+	for (size_t i = 0; i < pat_cnt; i++) {
+		size_t plen = strlen(pats[i]);
+		for (size_t j = 0; j + plen <= len; j++) {
+			if (!memcmp(&p[j], pats[i], plen))
+				return true;
+		}
+	}
+	return false;
+}
+
+
+/*	check()
+ * Compile 'pat_cnt' random patterns over an 'alpha' letter alphabet,
+ * then search random windows of a buffer over the same alphabet.
+ */
+static int check(struct impl *impls, size_t impl_cnt, size_t pat_cnt, unsigned int alpha)
+{
+	int err_cnt = 0;
+	int __attribute__((unused)) rc;
+	struct search *search = NULL;
+	Pvoid_t pattern_JQ = NULL;
+	char pats[64][PATTERN_MAX + 1];
+	uint8_t buf[BUF_LEN];
+
+	for (size_t i = 0; i < pat_cnt; i++) {
+		size_t plen = 1 + random() % (i % 4 ? PATTERN_MAX : 3);
+		for (size_t j = 0; j < plen; j++)
+			pats[i][j] = 'a' + random() % alpha;
+		pats[i][plen] = '\0';
+		NB_die_if(
+			jl_enqueue(&pattern_JQ, pats[i])
+			, "");
+	}
+	NB_die_if(!(
+		search = search_new(pattern_JQ)
+		), "");
+
+	for (unsigned int round = 0; round < 200; round++) {
+		/* sparse buffers exercise the prefilter, dense ones the automaton */
+		unsigned int fill = random() % 4 ? alpha * 8 : alpha;
+		for (size_t i = 0; i < BUF_LEN; i++)
+			buf[i] = 'a' + random() % fill;
+		size_t offt = random() % BUF_LEN;
+		size_t len = random() % (BUF_LEN - offt + 1);
+
+		bool ref = naive_match(pats, pat_cnt, &buf[offt], len);
+		NB_die_if(search_match(search, &buf[offt], len) != ref,
+			"%zu patterns alphabet %u: len %zu match != reference %d",
+			pat_cnt, alpha, len, ref);
+
+		size_t ref_skip = search_skip_scalar(search, &buf[offt], len);
+		for (unsigned int i = 0; i < impl_cnt; i++) {
+			if (!impls[i].supported || !search->pair_cnt)
+				continue;
+			size_t skip = impls[i].skip(search, &buf[offt], len);
+			NB_die_if(skip != ref_skip,
+				"%s: len %zu skip %zu != reference %zu",
+				impls[i].name, len, skip, ref_skip);
+		}
+	}
+
+die:
+	search_free(search);
+	JLFA(rc, pattern_JQ);
+	return err_cnt;
+}
+
+
+int main()
+{
+	int err_cnt = 0;
+
+	struct impl impls[] = {
+#if defined(__x86_64__) || defined(__i386__)
+		{ "sse2", search_skip_sse2, __builtin_cpu_supports("sse2") },
+		{ "avx2", search_skip_avx2, __builtin_cpu_supports("avx2") },
+#endif
+	};
+
+	/* few and many patterns: both sides of SEARCH_PAIRS_MAX */
+	srandom(1);
+	const size_t pat_cnts[] = { 1, 2, 5, 8, 20, 64 };
+	for (unsigned int i = 0; i < NLC_ARRAY_LEN(pat_cnts); i++) {
+		for (unsigned int alpha = 2; alpha <= 26; alpha += 8) {
+			NB_die_if(
+				check(impls, NLC_ARRAY_LEN(impls), pat_cnts[i], alpha)
+				, "");
+		}
+	}
+
+die:
+	return err_cnt;
+}